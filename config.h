@@ -5,6 +5,9 @@
    language is requested. */
 #define ENABLE_NLS 1
 
+/* Define to size efax buffers for small systems */
+/* #undef EFAX_LOWMEM */
+
 /* Define if the C++ fstream object has fstream::attach(int fd) funtion */
 /* #undef HAVE_ATTACH */
 
@@ -20,6 +23,9 @@
    */
 #define HAVE_DCGETTEXT 1
 
+/* Define to 1 if you have the `fopencookie' function. */
+#define HAVE_FOPENCOOKIE 1
+
 /* Define if the GNU gettext() function is already present or preinstalled. */
 #define HAVE_GETTEXT 1
 
@@ -86,6 +92,9 @@
 /* Define to 1 if you have the <X11/Xlib.h> header file. */
 #define HAVE_X11_XLIB_H 1
 
+/* Define to 1 if you have the <zlib.h> header file. */
+#define HAVE_ZLIB_H 1
+
 /* Name of package */
 #define PACKAGE "efax-gtk"
 
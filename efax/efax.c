@@ -53,6 +53,7 @@ const char *Usage =
   "  -i str  send modem command ATstr at start\n"
   "  -j str  send modem command ATstr after set fax mode\n"
   "  -k str  send modem command ATstr when done\n"
+  "  -K fil  read the encryption password from file fil\n"
   "  -l id   set local identification to id\n"
   "  -n      force line buffering of stdout instead of block buffering (necessary\n"
   "          if outputting UTF-8 to a terminal with translated text via NLS)\n"
@@ -95,6 +96,9 @@ const char *Usage =
 #include <glib/gunicode.h>
 #include <glib/gmem.h>
 #endif
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 #include"hc128.h"
 #include "efaxio.h"		/* EFAX */
 #include "efaxlib.h"
@@ -134,6 +138,7 @@ const char *Usage =
 #define DEFCAP 1,3,0,2,0,0,0,0	/* default local capabilities */
 #define DEFID "                    " /* default local ID */
 #define DEFPAT "%m%d%H%M%S" /* default received file name pattern */
+#define KEYFILE "/home/secfax/Desktop/file.txt" /* default password file */
 #define HDRSHFT 54	    /* shift header right 6.7mm into image area */
 #define HDRSPCE 20	    /* number of scan lines inserted before image */
 #define HDRSTRT  4	    /* scan line where header is placed on image */
@@ -746,6 +751,102 @@ int wrpage ( OFILE *f, int page )
 }
 
 
+/* Working buffers for a fax session.  They are carved out of one
+   block allocated before the session starts, so that the memory
+   used does not depend on the number of pages and little stack is
+   needed.  Each run-length buffer holds MAXRUNS runs, the most the
+   library functions may store (see efaxlib.h). */
+
+#define SESSCODES ( MAXCODES + 2*EOLBITS/8 + 1 )
+
+				/* received lines waiting to be written */
+#ifndef HAVE_PTHREAD_H
+#define RXLINES 1
+#else
+#ifdef EFAX_LOWMEM
+#define RXLINES 16
+#else
+#define RXLINES 64
+#endif
+#endif
+
+typedef struct sessbufstruct {
+  unsigned int *key ;		/* keystream, one word per run */
+  short *runs, *lastruns ;	/* current and saved scan line */
+  short *hruns, *orruns ;	/* header line and OR of two lines */
+  short *rxruns ;		/* RXLINES received lines */
+  uchar *codes ;		/* T.4 codes for one scan line */
+} SESSBUF ;
+
+SESSBUF sessbuf ;
+
+/* The encryption key, read once when efax starts so that it stays
+   the same for the whole session (see readkey()). */
+
+char passkey [ 16 ] ;
+
+/* Read the password in file fname and repeat it to fill the 16
+   bytes of key.  Returns 0 if OK, 2 on errors. */
+
+int readkey ( char *fname, char *key )
+{
+  char pass [ 50 ] ;
+  int i, n ;
+  FILE *fp ;
+
+  if ( ! ( fp = fopen ( fname, "rb" ) ) )
+    return msg ( "ES2can't open password file %s:", fname ) ;
+  n = fread ( pass, 1, sizeof(pass), fp ) ;
+  fclose ( fp ) ;
+
+  if ( n < 1 )
+    return msg ( "E2no password in file %s", fname ) ;
+
+  for ( i=0 ; i<16 ; i++ )
+    key [ i ] = pass [ i % n ] ;
+
+  return 0 ;
+}
+
+/* Allocate the session buffers.  Returns 0 if OK, 2 on errors. */
+
+int newSESSBUF ( SESSBUF *b )
+{
+  uchar *p ;
+
+  p = malloc ( MAXRUNS * ( sizeof(int) + ( 4 + RXLINES ) * sizeof(short) ) 
+	       + SESSCODES ) ;
+  if ( ! p ) 
+    return msg ( "E2 can't allocate session buffers" ) ;
+
+  b->key = (unsigned int*) p ;
+  b->runs = (short*) ( b->key + MAXRUNS ) ;
+  b->lastruns = b->runs + MAXRUNS ;
+  b->hruns = b->lastruns + MAXRUNS ;
+  b->orruns = b->hruns + MAXRUNS ;
+  b->rxruns = b->orruns + MAXRUNS ;
+  b->codes = (uchar*) ( b->rxruns + RXLINES * MAXRUNS ) ;
+
+  return 0 ;
+}
+
+
+/* OR scan line b of nb runs into *a of na runs using the session
+   buffer *c and swap *a and *c so *a holds the result. Returns
+   the number of runs in the result and sets *pels to its
+   width. */
+
+int sessor ( short **a, int na, short *b, int nb, short **c, int *pels )
+{
+  short *t = *a ;
+  int nr = runor ( *a, na, b, nb, *c, pels ) ;
+
+  *a = *c ;
+  *c = t ;
+  return nr ;
+}
+
+
 /* Send data for one page.  Figures out required padding and 196->98 lpi
    decimation based on local and session capabilitites, substitutes page
    numbers in header string and enables serial port flow control.  Inserts
@@ -759,12 +860,12 @@ int send_data ( TFILE *mf, IFILE *f, int page, int pages,
 {
   int done=0, err=0, noise=0, nr=0, lastnr=0, line, pixels ;
   int i, decimate, pwidth, minlen, dcecps, inheader, skip=0 ;
-  uchar buf [ MAXCODES + 2*EOLBITS/8 + 1 ], *p ;
-  short runs [ MAXRUNS ], lastruns [ MAXRUNS ] ,j;
+  uchar *buf = sessbuf.codes, *p ;
+  short *runs = sessbuf.runs, *lastruns = sessbuf.lastruns ;
+  short *orruns = sessbuf.orruns ;
   char headerbuf [ MAXLINELEN ] ;
   ENCODER e ;
- int s[MAXRUNS];
-char key[16];
+ unsigned int *s = sessbuf.key;
 /*for(i=0;i<16;i++)
 {
 key[i]=i;
@@ -829,11 +930,11 @@ printf("%x",s[i]);
 				/* generate and OR in header pixels */
     if ( line >= HDRSTRT && line < HDRSTRT + HDRCHRH ) {
       int hnr ;
-      short hruns [ MAXRUNS ] ;
+      short *hruns = sessbuf.hruns ;
       hnr = texttorun ( (uchar*) headerbuf, font, line-HDRSTRT, 
 		       HDRCHRW, HDRCHRH, HDRSHFT,
 		       hruns, 0 ) ;
-      nr = runor ( runs, nr, hruns, hnr, 0, &pixels ) ;
+      nr = sessor ( &runs, nr, hruns, hnr, &orruns, &pixels ) ;
     }
     
     inheader = line < HDRSTRT + HDRCHRH ;
@@ -844,7 +945,7 @@ printf("%x",s[i]);
    	lastnr = nr ;
    	continue ;		/* get next line */
       } else {			/* OR previous line into current line */
-   	nr = runor ( runs, nr, lastruns, lastnr, 0, &pixels ) ;
+   	nr = sessor ( &runs, nr, lastruns, lastnr, &orruns, &pixels ) ;
       }
     }
 
@@ -854,30 +955,7 @@ printf("%x",s[i]);
 	if ( pixels != pwidth ) nr = xpad ( runs, nr, pwidth - pixels ) ;
 				/* convert to MH coding */
 	
-       // size_t len = strlen(pass_str);
-   char pass_str[50];
-int i=0,len=0;
-FILE *fp;
-   fp = fopen("/home/secfax/Desktop/file.txt","rb");
-   while(1)
-   {
-      pass_str[len] = fgetc(fp);
-	len++;     
-	    if( feof(fp) )
-      {
-         break ;
-      }
-     
-     
-   }
-   fclose(fp);
-        
-        for(i=0;i<16;i++)
-	{
-	key[i]=pass_str[i%(len-1)];
-	}	
-
-	encrypt(key,nr,s);
+	encrypt(passkey,nr,s);
 
 	/*printf("\n\n Line %d Keystream is:\n\n",line);
 	for(i=0;i<nr;i++)
@@ -958,7 +1036,7 @@ int end_data ( TFILE *mf, cap session, int ppm, int *good )
   if ( message ) {
     msg ( message , 
 	  HDRSPCE, mf->lines-HDRSPCE, 
-	  mf->bytes-mf->pad, mf->pad, (int) dt, (mf->bytes*8)/dt ) ;
+	  mf->bytes-mf->pad, mf->pad, (int) dt, (mf->bytes*8)/(dt ? dt : 1) ) ;
     free ( message ) ;
   }
 
@@ -971,55 +1049,61 @@ int end_data ( TFILE *mf, cap session, int ppm, int *good )
 }
 
 
+/* Get the next data byte from the modem without fixing its bit
+   order (the decoder handles either order) and check it for the
+   start of a modem response.  Modem responses are not
+   bit-reversed so the raw bytes are checked.  Bytes are taken
+   from the span of unescaped bytes at ip..iq and tspan() is only
+   called when it is used up. */
+
+/* Translator: I am not sure what this means - I think
+   that the modem has given an unexpected response while
+   receiving date */
+
+#define GETMODEM \
+	if ( ip >= iq ) { \
+	  f->ip = ip ; \
+	  m = tspan ( f, TO_CHAR ) ; \
+	  ip = f->ip ; \
+	  iq = ip + ( m > 0 ? m : 0 ) ; \
+	} \
+	if ( ip < iq ) { \
+	  c = *ip++ ; \
+	  rd_state = ( rd_state & rd_allowed[c] ) ? \
+	    ( ( rd_state & rd_nexts[c] ) ? rd_state << 1 : rd_state ) : \
+	    RD_BEGIN ; \
+	  if ( rd_state == RD_END ) \
+	    msg ( "W+ %s", gettext ( "modem response in data" ) ) ; \
+	} else { \
+	  c = m ; \
+	}
+
 /* Read one scan line from fax device. If pointer pels is not
    null it is used to save pixel count.  Returns number of runs
    stored, EOF on RTC, or -2 on EOF, DLE-ETX or other error. */
 
 int readfaxruns ( TFILE *f, DECODER *d, short *runs, int *pels )
 {
-  int err=0, c=EOF, x, n ;
+  int err=0, c=EOF, x, n, m=EOF ;
   dtab *tab, *t ;
   short shift ;
-  short *p, *maxp, *q, len=0 ;
+  short *p, *maxp, len=0 ;
   uchar rd_state ;
+  uchar *ip, *iq ;
 
-  maxp = ( p = runs ) + MAXRUNS ;
+  maxp = runs + MAXRUNS ;
+  p = runs + d->invert ;
 
   x = d->x ; shift = d->shift ; tab = d->tab ; /* restore decoder state */
   rd_state = f->rd_state ;
+  ip = iq = f->ip ;
 
-  do {
-    do {
-      while ( shift < 0 ) { 
-	c = tgetd ( f, TO_CHAR ) ;
-	//if(c!=( (-2) && EOF && (f->ibitorder [ DLE ]) ))
-	//{c=c^0x43;}
-
-	rd_state = ( rd_state & rd_allowed[c] ) ?
-	  ( ( rd_state & rd_nexts[c] ) ? rd_state << 1 : rd_state ) : 
-	  RD_BEGIN ;
-
-	if ( rd_state == RD_END ) {
-
-	  /* Translator: I am not sure what this means - I think
-	     that the modem has given an unexpected response while
-	     receiving date */
-	  msg ( "W+ %s", gettext ( "modem response in data" ) ) ;
-	}
-
-	if ( c < 0 )  {
-	  x = ( x << 15 ) | 1 ; shift += 15 ;  /* EOL pad at EOF */
-	} else {
-	  x = ( x <<  8 ) | c ; shift +=  8 ; 
-	}
-      }
-      t = tab + ( ( x >> shift ) & 0x1ff ) ;
-      tab = t->next ;
-      shift -= t->bits ;
-    } while ( ! t->code ) ;
-    if ( p < maxp ) *p++ = t->code ;
-  } while ( t->code != -1 ) ;
+  if ( d->lsbfirst )
+    DECODELSB ( GETMODEM ) ;
+  else
+    DECODEMSB ( GETMODEM ) ;
 
+  f->ip = ip ;
   d->x = x ; d->shift = shift ; d->tab = tab ; /* save state */
   f->rd_state = rd_state ;
 
@@ -1028,15 +1112,7 @@ int readfaxruns ( TFILE *f, DECODER *d, short *runs, int *pels )
   /* combine make-up and terminating codes and remove +1 offset
      in run lengths */
 
-  n = p - runs - 1 ;
-  for ( p = q = runs ; n-- > 0 ; )
-    if ( *p > 64 && n-- > 0 ) {
-      len += *q++ = p[0] + p[1] - 2 ;
-      p+=2 ;
-    } else {
-      len += *q++ = *p++ - 1 ;
-    }
-  n = q - runs ;
+  n = joinruns ( runs, p - runs - d->invert - 1, &len, d->invert ) ;
   
   /* check for RTC and errors */
 
@@ -1053,54 +1129,52 @@ int readfaxruns ( TFILE *f, DECODER *d, short *runs, int *pels )
 }
 
 
-/* Receive data. Reads scan lines from modem and writes to output
-   file.  Checks for errors by comparing received line width and
-   session line width.  Check that the output file is still OK
-   and if not, send one CANcel character and wait for protocol to
-   complete. Returns 0 if OK, 1 on DLE-ETX without RTC, or 2 if
-   there was a file write error. */
+/* Received scan lines are written to the output file by a writer
+   thread so that a slow disk does not hold up reading the modem.
+   The decoder stores each line in the next free one of RXLINES
+   slots in the session buffer and the writer decrypts and writes
+   the slots in order.  Without threads, or if the writer can't be
+   started, each line is written as soon as it is queued. */
+
+typedef struct rxqueuestruct {
+  OFILE *f ;
+  short *runs ;			/* RXLINES slots of MAXRUNS runs */
+  int nr [ RXLINES ] ;		/* runs in each slot */
+  int head, tail ;		/* lines queued and lines written */
+  int done ;			/* no more lines will be queued */
+  int werr ;			/* output file write error */
+  int peak, waits ;		/* most lines queued, times found full */
+  int threaded ;
+#ifdef HAVE_PTHREAD_H
+  pthread_t tid ;
+  pthread_mutex_t lock ;
+  pthread_cond_t cond ;
+#endif
+} RXQUEUE ;
 
-int receive_data ( TFILE *mf, OFILE *f, cap session, int *nerr )
-{
-  int err=0, line, lines, nr, len,i ;
-  int pwidth = pagewidth [ session [ WD ] ] ;
-  short runs [ MAXRUNS ] ;
-  DECODER d ;
-  char *message ;
-  unsigned int s[MAXRUNS];
-  char key[16];
-  if ( ! f || ! f->f ) {
-    msg ( "E2 can't happen (writeline)" ) ;
-  } 
-  
-  newDECODER ( &d ) ;
+#ifdef HAVE_PTHREAD_H
+#define RXLOCK( q )   pthread_mutex_lock ( &(q)->lock )
+#define RXUNLOCK( q ) pthread_mutex_unlock ( &(q)->lock )
+#define RXWAIT( q )   pthread_cond_wait ( &(q)->cond, &(q)->lock )
+#define RXWAKE( q )   pthread_cond_signal ( &(q)->cond )
+#else
+#define RXLOCK( q )
+#define RXUNLOCK( q )
+#define RXWAIT( q )
+#define RXWAKE( q )
+#endif
 
-  lines=0 ; 
-  for ( line=0 ; ( nr = readfaxruns ( mf, &d, runs, &len ) ) >= 0 ; line++ ) {
-    if ( nr > 0 && len > 0 && line) { /* skip first line+EOL and RTC */
-
-char pass_str[50];
-int len1=0;
-FILE *fp;
-   fp = fopen("/home/secfax/Desktop/file.txt","rb");
-   while(1)
-   {
-      pass_str[len1] = fgetc(fp);
-	len1++;     
-	    if( feof(fp) )
-      {
-         break ;
-      }
-        
-   }
-   fclose(fp);
+/* Decrypt and write the line in slot i.  Returns 2 if the output
+   file has an error not reported before, otherwise 0. */
 
-	for(i=0;i<16;i++)
-	{
-	key[i]=pass_str[i%(len1-1)];
-	}	
-	
-	encrypt(key,nr,s);
+int rxwrite ( RXQUEUE *q, int i )
+{
+  OFILE *f = q->f ;
+  short *runs = q->runs + i * MAXRUNS ;
+  int nr = q->nr [ i ] ;
+  unsigned int *s = sessbuf.key;
+
+	encrypt(passkey,nr,s);
 
 	/*printf("\n\n Line %d Keystream is:\n\n",line);
 	for(i=0;i<nr;i++)
@@ -1117,15 +1191,162 @@ FILE *fp;
 	runs[i]=runs[i]^((unsigned char)s[i]);	
 	}
 		
-      writeline ( f, runs, nr, 1 ) ;
-      lines++ ;
+  writeline ( f, runs, nr, 1 ) ;
+
+  return ! q->werr && ferror ( f->f ) ? 
+    msg ( "ES2 %s", gettext ( "file write:" ) ) : 0 ;
+}
+
+#ifdef HAVE_PTHREAD_H
+void *rxwriter ( void *arg )
+{
+  RXQUEUE *q = arg ;
+  int i, err ;
+
+  RXLOCK ( q ) ;
+  while ( q->tail < q->head || ! q->done ) {
+    if ( q->tail == q->head ) {
+      RXWAIT ( q ) ;
+      continue ;
     }
-    if ( ferror ( f->f ) ) {
-      err = msg ( "ES2 %s", gettext ( "file write:" ) ) ;
+    i = q->tail % RXLINES ;
+    RXUNLOCK ( q ) ;
+    err = rxwrite ( q, i ) ;
+    RXLOCK ( q ) ;
+    if ( err ) q->werr = err ;
+    q->tail++ ;
+    RXWAKE ( q ) ;
+  }
+  RXUNLOCK ( q ) ;
+
+  return 0 ;
+}
+#endif
+
+void rxstart ( RXQUEUE *q, OFILE *f )
+{
+  q->f = f ;
+  q->runs = sessbuf.rxruns ;
+  q->head = q->tail = q->done = q->werr = 0 ;
+  q->peak = q->waits = 0 ;
+  q->threaded = 0 ;
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_init ( &q->lock, 0 ) ;
+  pthread_cond_init ( &q->cond, 0 ) ;
+  if ( pthread_create ( &q->tid, 0, rxwriter, q ) )
+    msg ( "W %s", gettext ( "can't start writer thread" ) ) ;
+  else
+    q->threaded = 1 ;
+#endif
+}
+
+/* Returns the slot for the next line, waiting until one is free.
+   Sets *werr if the output file has had an error. */
+
+short *rxslot ( RXQUEUE *q, int *werr )
+{
+  int i ;
+
+  RXLOCK ( q ) ;
+  if ( q->head - q->tail >= RXLINES ) {
+    q->waits++ ;
+    while ( q->head - q->tail >= RXLINES )
+      RXWAIT ( q ) ;
+  }
+  i = q->head % RXLINES ;
+  *werr = q->werr ;
+  RXUNLOCK ( q ) ;
+
+  return q->runs + i * MAXRUNS ;
+}
+
+/* Queue the line of nr runs stored in the current slot. */
+
+void rxput ( RXQUEUE *q, int nr )
+{
+  int err ;
+
+  q->nr [ q->head % RXLINES ] = nr ;
+
+  if ( ! q->threaded ) {
+    q->head++ ;
+    if ( ( err = rxwrite ( q, q->tail % RXLINES ) ) ) q->werr = err ;
+    q->tail++ ;
+    if ( q->peak < 1 ) q->peak = 1 ;
+    return ;
+  }
+
+  RXLOCK ( q ) ;
+  q->head++ ;
+  if ( q->head - q->tail > q->peak ) q->peak = q->head - q->tail ;
+  RXWAKE ( q ) ;
+  RXUNLOCK ( q ) ;
+}
+
+/* Wait for the writer to write all queued lines. */
+
+void rxend ( RXQUEUE *q )
+{
+#ifdef HAVE_PTHREAD_H
+  if ( q->threaded ) {
+    RXLOCK ( q ) ;
+    q->done = 1 ;
+    RXWAKE ( q ) ;
+    RXUNLOCK ( q ) ;
+    pthread_join ( q->tid, 0 ) ;
+  }
+  pthread_mutex_destroy ( &q->lock ) ;
+  pthread_cond_destroy ( &q->cond ) ;
+#endif
+}
+
+
+/* Receive data. Reads scan lines from modem and queues them to be
+   written to the output file.  Checks for errors by comparing
+   received line width and session line width.  Check that the
+   output file is still OK and if not, send one CANcel character
+   and wait for protocol to complete.  Reports in the session log
+   how full the receive ring and the queue of lines to be written
+   became.  Returns 0 if OK, 1 on DLE-ETX without RTC, or 2 if
+   there was a file write error. */
+
+int receive_data ( TFILE *mf, OFILE *f, cap session, int *nerr )
+{
+  int err=0, line, lines, nr, len, n, werr=0, cancelled=0 ;
+  int pwidth = pagewidth [ session [ WD ] ] ;
+  short *runs ;
+  DECODER d ;
+  RXQUEUE q ;
+  TRINGSTATS rs ;
+  char *message ;
+  if ( ! f || ! f->f ) {
+    msg ( "E2 can't happen (writeline)" ) ;
+  } 
+  
+  newDECODER ( &d, mf->ibitorder == normalbits, 0 ) ;
+
+  tringstart ( mf ) ;
+  rxstart ( &q, f ) ;
+
+  lines=0 ; 
+  for ( line=0 ; ; line++ ) {
+    runs = rxslot ( &q, &werr ) ;
+    if ( werr && ! cancelled ) {
+      err = werr ;
       tput ( mf, (uchar*) CAN_STR, 1 ) ;
       msg ("W %s", gettext ( "CAN: data reception cancelled" ) ) ;
+      cancelled = 1 ;
+    }
+    if ( ( nr = readfaxruns ( mf, &d, runs, &len ) ) < 0 )
+      break ;
+    if ( nr > 0 && len > 0 && line ) { /* skip first line+EOL and RTC */
+      rxput ( &q, nr ) ;
+      lines++ ;
     }
   }
+
+  rxend ( &q ) ;
+  if ( q.werr ) err = q.werr ;
   
   if ( *nerr ) {
     if ( *nerr > MAXERRPRT ) msg ("R-+ ....." ) ;
@@ -1134,11 +1355,34 @@ FILE *fp;
   }
 
   if ( nr == EOF ) { 
-    while ( tgetd ( mf, TO_CHAR ) >= 0 ) ; /* got RTC, wait for DLE-ETX */
+    while ( ( n = tspan ( mf, TO_CHAR ) ) >= 0 ) /* got RTC, wait for DLE-ETX */
+      mf->ip += n ;
   } else {
     err = 1 ;			/* DLE-ETX without RTC - should try again */
   }
 
+  tringstop ( mf, &rs ) ;
+
+  /* warn if a full ring held up the modem - a full write queue only
+     holds up the decoder, which the ring absorbs */
+
+  /* Translator: this must keep the formatting items in the same order in the translated string */
+  message = strdup2 ( rs.stalls ? "W- " : "I- ",
+		      gettext ( "receive ring peak %d%%, full %d times (%ld ms)" ) ) ;
+  if ( message ) {
+    if ( rs.size )
+      msg ( message, (int) ( 100.0 * rs.peak / rs.size ), rs.stalls, rs.stallms ) ;
+    free ( message ) ;
+  }
+
+  /* Translator: this must keep the formatting items in the same order in the translated string */
+  message = strdup2 ( "I- ", gettext ( "write queue peak %d of %d lines, full %d times" ) ) ;
+  if ( message ) {
+    if ( q.threaded )
+      msg ( message, q.peak, RXLINES, q.waits ) ;
+    free ( message ) ;
+  }
+
   /* Translator: this must have two "%d" formatting items in the translated string */
   message = strdup2 ( "I- ", gettext ( "received %d lines with %d errors" ) ) ;
   if ( message ) {
@@ -2672,7 +2916,7 @@ int main( int argc, char **argv)
 
   int nicmd[3]={0,0,0}, nlkfile=0, nverb=0 ;
 
-  char *faxfile = FAXFILE ;
+  char *faxfile = FAXFILE, *keyfile = KEYFILE ;
 
   int softaa=0, share=0, wait=0, reverse=1, ignerr=0, noretry=0, hwfc=0 ;
   int capsset=0 ;
@@ -2735,7 +2979,7 @@ int main( int argc, char **argv)
 
   while ( ! err && ! doneargs &&
 	 ( c = nextopt ( argc,argv,
-			"a:c:d:e:f:g:h:i:j:k:l:no:p:q:r:st:uv:wx:T" ) ) != -1 ) {
+			"a:c:d:e:f:g:h:i:j:k:K:l:no:p:q:r:st:uv:wx:T" ) ) != -1 ) {
 
     switch (c) {
     case 'a': 
@@ -2777,6 +3021,9 @@ int main( int argc, char **argv)
     case 'h': 
       header = nxtoptarg ; 
       break ;
+    case 'K': 
+      keyfile = nxtoptarg ; 
+      break ;
     case 'f': 
       fontname = nxtoptarg ; 
       break ;
@@ -2866,6 +3113,10 @@ int main( int argc, char **argv)
 
   readfont ( fontname, &font ) ;
 
+  if ( ! err ) err = newSESSBUF ( &sessbuf ) ;
+
+  if ( ! err && ! testing ) err = readkey ( keyfile, passkey ) ;
+
   if ( ! header ) {
     char tmp [ MAXLINELEN ] ;
     now = time ( 0 ) ;
@@ -0,0 +1,923 @@
+#define Version		  "efaxemu v 0.1"
+
+/*
+    efaxemu.c - Class 1 fax modem emulator
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+*/
+
+/*
+    efaxemu emulates two Class 1 fax modems connected by a phone
+    line so that the efax send and receive code can be run and
+    timed without modem hardware.  Each modem is a pseudo-terminal
+    whose slave device is given to efax with -d, for example:
+
+      efaxemu -c 1 /tmp/fax0 /tmp/fax1 &
+      efax -d /tmp/fax1 -r rx &
+      efax -d /tmp/fax0 -t 5551234 page.001
+
+    The emulated modems implement the commands efax uses: E, Q, V,
+    I, H, Z, S-registers and &-commands (accepted and ignored), D,
+    A, +FCLASS, +FTH/+FRH, +FTM/+FRM and +FTS/+FRS.  Data and HDLC
+    frames are carried at the bit rate of the modulation (or a
+    multiple of it, -x) with an optional one-way delay (-l) and
+    random bit errors (-e).  A transmitter whose DTE does not keep
+    its buffer filled sends zero bytes, as fill, and the underruns
+    are counted.  Statistics for each call are printed when it
+    ends.  Carrier training and answer tones take no time and HDLC
+    frames are passed on without the FCS bytes.
+*/
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE		/* for posix_openpt() and ptsname() */
+#endif
+
+#include <ctype.h>		/* ANSI C */
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <config.h>
+
+#include "efaxio.h"		/* EFAX */
+#include "efaxmsg.h"
+
+const char *Usage =
+  "Usage:\n"
+  "  %s [ option ]... [ link0 link1 ]\n"
+"Options (defaults):\n"
+  "  -c  n   exit after n calls (never)\n"
+  "  -e ber  bit error rate of the line, e.g. 1e-5 (0)\n"
+  "  -l  ms  one-way delay of the line in milliseconds (0)\n"
+  "  -m bps  highest bit rate the modems support (14400)\n"
+  "  -r  n   seed for the bit error generator (1)\n"
+  "  -v lvl  print messages of type in string lvl (ewi)\n"
+  "  -x  f   carry data f times faster than the bit rate, 0 for no limit (1)\n"
+  "Types of messages are:\n"
+  "  e  errors\n"
+  "  w  warnings\n"
+  "  i  call progress and statistics\n"
+  "  c  commands\n"
+  "  r  responses\n"
+  "The names of the modem devices are printed on standard output.  If\n"
+  "link0 and link1 are given they are made symbolic links to them.\n"
+  "" ;
+
+#define NPORT 2
+#define CMDLEN 256		/* longest command line */
+#define DCEBUF 4096		/* bytes of transmit data buffered */
+#define OUTBUF 65536		/* bytes buffered for the DTE */
+#define NEVENT (1<<17)		/* events in flight on each line direction */
+#define RINGTIME 6000		/* milliseconds between RINGs */
+#define NRING 10		/* RINGs before giving up */
+#define S7 60000		/* milliseconds to wait for a call to answer */
+#define UNDERRUN 10000		/* milliseconds of fill before giving up */
+#define TICK 10			/* milliseconds between line updates */
+#define QUIET 2000		/* idle milliseconds before exiting after -c calls */
+
+				/* what the modem is doing for its DTE */
+enum states { IDLE, DIALING, ANSWERING, HDLCTX, DATATX, HDLCRXWAIT,
+	      HDLCRX, DATARXWAIT, DATARX, SILENCETX, SILENCERX } ;
+
+				/* events carried on the line */
+enum linevents { CARRIER, BYTE, FRAME, DROP, HANGUP } ;
+
+typedef struct eventstruct {
+  long t ;			/* time at which it reaches the far end */
+  short type ;
+  short val ;			/* modulation, byte or frame error count */
+} EVENT ;
+
+typedef struct portstruct {
+  int fd ;			/* pty master */
+  int sfd ;			/* pty slave, kept open */
+  char *name ;			/* slave device */
+  char *link ;
+  int state ;
+  char cmd [ CMDLEN ] ;		/* command being received */
+  int ncmd ;
+  int echo ;
+  int fclass ;
+  uchar out [ OUTBUF ] ;	/* ring buffer of bytes to the DTE */
+  int outp, nout ;
+  uchar tx [ DCEBUF ] ;		/* ring buffer of data to transmit */
+  int txp, ntx ;
+  int dle ;			/* DTE sent DLE */
+  int etx ;			/* DTE sent DLE-ETX */
+  int mod ;			/* modulation transmitted or wanted */
+  long txstart, txbytes ;	/* for pacing transmission */
+  int started ;			/* data seen */
+  long starved ;		/* when the buffer ran dry, or 0 */
+  int frpos, frerr ;		/* byte and bit errors in HDLC frame */
+  int final ;			/* frame is the last on this carrier */
+  int heard ;			/* modulation being received, or 0 */
+  int skip ;			/* discard the rest of this carrier */
+  long until ;			/* end of wait or timeout */
+  long silent ;			/* time the received carrier dropped */
+  int rings ;
+  EVENT *ev ;			/* line events from the other port */
+  int evp, nev ;
+  long bytes, frames, badframes, underruns, fill, errors, lost ;
+} PORT ;
+
+PORT port [ NPORT ] ;
+
+int connected = 0 ;		/* ports are in a call */
+long callstart ;
+int calls = 0, maxcalls = 0 ;
+long latency = 0 ;
+double speed = 1, ber = 0 ;
+int maxbps = 14400 ;
+
+
+/* Milliseconds since the program started. */
+
+long now_ms ( void )
+{
+  static struct timeval start ;
+  struct timeval tv ;
+  gettimeofday ( &tv, 0 ) ;
+  if ( ! start.tv_sec ) start = tv ;
+  return ( tv.tv_sec - start.tv_sec ) * 1000L +
+    ( tv.tv_usec - start.tv_usec ) / 1000 ;
+}
+
+
+/* Bit rate of Class 1 modulation m (3 is V.21 HDLC) or 0 if
+   the modems don't support it. */
+
+int modbps ( int m )
+{
+  int bps ;
+  switch ( m ) {
+  case 3: return 300 ;
+  case 24: case 48: case 72: case 73: case 74: case 96: case 97:
+  case 98: case 121: case 122: case 145: case 146:
+    bps = m / 24 * 2400 ;
+    return bps <= maxbps ? bps : 0 ;
+  }
+  return 0 ;
+}
+
+
+/* Modulations that can talk to each other: the long and short
+   training forms of V.17 are the same modulation. */
+
+int samemod ( int a, int b )
+{
+  if ( a == 73 || a == 97 || a == 121 || a == 145 ) a++ ;
+  if ( b == 73 || b == 97 || b == 121 || b == 145 ) b++ ;
+  return a == b ;
+}
+
+
+/* Queue n bytes at p for the DTE of port p.  Bytes that don't
+   fit are dropped with a warning. */
+
+void put ( PORT *p, char *s, int n )
+{
+  for ( ; n > 0 ; n--, s++ ) {
+    if ( p->nout >= OUTBUF ) {
+      msg ( "W port %d: DTE buffer overflow", (int) ( p - port ) ) ;
+      return ;
+    }
+    p->out [ ( p->outp + p->nout++ ) % OUTBUF ] = *s ;
+  }
+}
+
+
+/* Send a result code to the DTE. */
+
+void respond ( PORT *p, char *s )
+{
+  msg ( "R port %d: %s", (int) ( p - port ), s ) ;
+  put ( p, "\r\n", 2 ) ;
+  put ( p, s, strlen ( s ) ) ;
+  put ( p, "\r\n", 2 ) ;
+}
+
+
+/* Add an event to the line towards port p. */
+
+void sendev ( PORT *p, int type, int val )
+{
+  EVENT *e ;
+  if ( p->nev >= NEVENT ) {
+    port [ 1 - ( p - port ) ].lost++ ;
+    return ;
+  }
+  e = p->ev + ( p->evp + p->nev++ ) % NEVENT ;
+  e->t = now_ms ( ) + latency ;
+  e->type = type ;
+  e->val = val ;
+}
+
+
+/* Flip bits of byte c at the line's bit error rate.  Returns the
+   byte and adds the number of errors to *nerr. */
+
+int noise ( int c, long *nerr )
+{
+  int i ;
+  if ( ber > 0 )
+    for ( i=0 ; i<8 ; i++ )
+      if ( drand48 ( ) < ber ) {
+	c ^= 1 << i ;
+	(*nerr)++ ;
+      }
+  return c ;
+}
+
+
+/* Print statistics for the call and reset them. */
+
+void callstats ( void )
+{
+  int i ;
+  double secs = ( now_ms ( ) - callstart ) / 1000.0 ;
+  msg ( "I call ended after %.1f s", secs ) ;
+  for ( i=0 ; i<NPORT ; i++ ) {
+    PORT *p = port + i ;
+    msg ( "I port %d sent %ld bytes (%.0f bps), %ld frames (%ld bad), "
+	  "%ld underruns (%ld fill bytes), %ld bit errors, %ld events lost",
+	  i, p->bytes, secs > 0 ? p->bytes * 8 / secs : 0.0, p->frames,
+	  p->badframes, p->underruns, p->fill, p->errors, p->lost ) ;
+    p->bytes = p->frames = p->badframes = p->underruns = p->fill =
+      p->errors = p->lost = 0 ;
+  }
+}
+
+
+/* End the call, if any, from port p. */
+
+void hangup ( PORT *p )
+{
+  p->nev = 0 ;
+  p->heard = p->skip = 0 ;
+  if ( connected ) {
+    sendev ( port + ( 1 - ( p - port ) ), HANGUP, 0 ) ;
+    connected = 0 ;
+    callstats ( ) ;
+    calls++ ;
+  }
+}
+
+
+/* Start sending a carrier of modulation mod and tell the DTE to
+   send data. */
+
+void starttx ( PORT *p, int mod )
+{
+  p->mod = mod ;
+  p->state = mod == 3 ? HDLCTX : DATATX ;
+  p->txstart = now_ms ( ) ;
+  p->txbytes = 0 ;
+  p->ntx = p->dle = p->etx = 0 ;
+  p->started = p->starved = 0 ;
+  p->frpos = p->frerr = p->final = 0 ;
+  sendev ( port + ( 1 - ( p - port ) ), CARRIER, mod ) ;
+  respond ( p, "CONNECT" ) ;
+}
+
+
+/* Connect the call: the answering modem sends HDLC frames and the
+   calling modem waits for them. */
+
+void startcall ( PORT *caller, PORT *answerer )
+{
+  connected = 1 ;
+  callstart = now_ms ( ) ;
+  msg ( "I port %d called port %d", (int) ( caller - port ),
+	(int) ( answerer - port ) ) ;
+  caller->nev = answerer->nev = 0 ;
+  caller->heard = answerer->heard = 0 ;
+  caller->skip = answerer->skip = 0 ;
+  caller->state = HDLCRXWAIT ;
+  caller->mod = 3 ;
+  starttx ( answerer, 3 ) ;
+}
+
+
+/* Execute a Class 1 (+F) command.  Returns the result code or 0
+   if the command returns one later. */
+
+char *fcmd ( PORT *p, char *s )
+{
+  static char buf [ 80 ] ;
+  int i, n, m, ms [] = { 24, 48, 72, 73, 74, 96, 97, 98, 121, 122, 145, 146 } ;
+
+  if ( ! strncmp ( s, "CLASS", 5 ) ) {
+    s += 5 ;
+    if ( ! strcmp ( s, "=?" ) ) {
+      respond ( p, "0,1" ) ;
+    } else if ( ! strcmp ( s, "?" ) ) {
+      sprintf ( buf, "%d", p->fclass ) ;
+      respond ( p, buf ) ;
+    } else if ( ! strcmp ( s, "=0" ) || ! strcmp ( s, "=1" ) ) {
+      p->fclass = s[1] - '0' ;
+    } else {
+      return "ERROR" ;
+    }
+    return "OK" ;
+  }
+
+  if ( strlen ( s ) < 4 || ( s[0] != 'T' && s[0] != 'R' ) ||
+       ! strchr ( "HMS", s[1] ) || s[2] != '=' )
+    return "ERROR" ;
+
+  if ( ! strcmp ( s+3, "?" ) ) {
+    if ( s[1] == 'H' ) {
+      strcpy ( buf, "3" ) ;
+    } else if ( s[1] == 'M' ) {
+      for ( *buf = 0, i=0 ; i < (int) ( sizeof(ms)/sizeof(*ms) ) ; i++ )
+	if ( modbps ( ms[i] ) )
+	  sprintf ( buf + strlen ( buf ), *buf ? ",%d" : "%d", ms[i] ) ;
+    } else {
+      strcpy ( buf, "0-255" ) ;
+    }
+    respond ( p, buf ) ;
+    return "OK" ;
+  }
+
+  n = atoi ( s+3 ) ;
+
+  if ( s[1] == 'S' ) {		/* silence */
+    p->until = n * 10 ;
+    if ( s[0] == 'T' ) {
+      p->until += now_ms ( ) ;
+      p->state = SILENCETX ;
+    } else {
+      p->silent = now_ms ( ) ;
+      p->state = SILENCERX ;
+    }
+    return 0 ;
+  }
+
+  m = s[1] == 'H' ? 3 : n ;
+  if ( ( s[1] == 'H' && n != 3 ) || ! modbps ( m ) || p->fclass != 1 )
+    return "ERROR" ;
+  if ( ! connected )
+    return "NO CARRIER" ;
+
+  if ( s[0] == 'T' ) {
+    starttx ( p, m ) ;
+  } else {
+    p->mod = m ;
+    p->state = m == 3 ? HDLCRXWAIT : DATARXWAIT ;
+  }
+
+  return 0 ;
+}
+
+
+/* Execute an AT command line.  Responds with a result code unless
+   the command (D, A or +F) finishes later. */
+
+void atcmd ( PORT *p, char *s )
+{
+  char *r = "OK", buf [ 80 ] ;
+  PORT *q = port + ( 1 - ( p - port ) ) ;
+  int n ;
+
+  msg ( "C port %d: %s", (int) ( p - port ), s ) ;
+
+  if ( p->echo ) {
+    put ( p, s, strlen ( s ) ) ;
+    put ( p, "\r", 1 ) ;
+  }
+
+  while ( *s && ( toupper ( (uchar) s[0] ) != 'A' ||
+		  toupper ( (uchar) s[1] ) != 'T' ) )
+    s++ ;			/* skip escapes and line noise */
+
+  if ( ! *s ) return ;
+
+  for ( s += 2 ; *s && r ; ) {
+    switch ( toupper ( (uchar) *s++ ) ) {
+    case ' ':
+      break ;
+    case 'E':
+      p->echo = strtol ( s, &s, 10 ) ;
+      break ;
+    case 'I':
+      n = strtol ( s, &s, 10 ) ;
+      sprintf ( buf, n == 3 ? Version : "%d", n ) ;
+      respond ( p, buf ) ;
+      break ;
+    case 'H':
+      strtol ( s, &s, 10 ) ;
+      hangup ( p ) ;
+      break ;
+    case 'Z':
+      strtol ( s, &s, 10 ) ;
+      hangup ( p ) ;
+      p->echo = 1 ;
+      p->fclass = 0 ;
+      break ;
+    case 'S':
+      strtol ( s, &s, 10 ) ;
+      if ( *s == '?' ) {
+	s++ ;
+	respond ( p, "000" ) ;
+      } else if ( *s == '=' ) {
+	strtol ( s+1, &s, 10 ) ;
+      }
+      break ;
+    case '&':
+      if ( *s ) s++ ;
+      strtol ( s, &s, 10 ) ;
+      break ;
+    case 'B': case 'L': case 'M': case 'O': case 'Q': case 'V': case 'X':
+      strtol ( s, &s, 10 ) ;
+      break ;
+    case 'D':
+      if ( strchr ( s, ';' ) ) {
+	r = "OK" ;
+      } else if ( connected || q->state == DIALING ) {
+	r = "BUSY" ;
+      } else if ( q->state == ANSWERING ) {
+	startcall ( p, q ) ;
+	r = 0 ;
+      } else {
+	p->state = DIALING ;
+	p->rings = 0 ;
+	p->until = now_ms ( ) ;
+	r = 0 ;
+      }
+      s += strlen ( s ) ;
+      break ;
+    case 'A':
+      if ( connected ) {
+	r = "ERROR" ;
+      } else if ( q->state == DIALING ) {
+	startcall ( q, p ) ;
+	r = 0 ;
+      } else {
+	p->state = ANSWERING ;
+	p->until = now_ms ( ) + S7 ;
+	r = 0 ;
+      }
+      break ;
+    case '+':
+      if ( toupper ( (uchar) *s ) == 'F' ) {
+	for ( n=0 ; s[n] ; n++ ) s[n] = toupper ( (uchar) s[n] ) ;
+	r = fcmd ( p, s+1 ) ;
+      } else {
+	r = "ERROR" ;
+      }
+      s += strlen ( s ) ;
+      break ;
+    default:
+      r = "ERROR" ;
+      break ;
+    }
+  }
+
+  if ( r ) respond ( p, r ) ;
+}
+
+
+/* Take bytes from the DTE of port p: command characters, data to
+   transmit (removing DLE escapes) or characters that abort
+   reception. */
+
+void dterx ( PORT *p, uchar *buf, int n )
+{
+  int c ;
+
+  for ( ; n > 0 ; n--, buf++ ) {
+    c = *buf ;
+    switch ( p->state ) {
+
+    case HDLCTX:
+    case DATATX:
+      if ( p->etx ) {
+	break ;
+      } else if ( p->dle ) {
+	p->dle = 0 ;
+	if ( c == ETX ) {
+	  p->etx = 1 ;
+	  break ;
+	} else if ( c == SUB ) {
+	  p->tx [ ( p->txp + p->ntx++ ) % DCEBUF ] = DLE ;
+	  c = DLE ;
+	} else if ( c != DLE ) {
+	  break ;
+	}
+      } else if ( c == DLE ) {
+	p->dle = 1 ;
+	break ;
+      }
+      p->tx [ ( p->txp + p->ntx++ ) % DCEBUF ] = c ;
+      p->started = 1 ;
+      break ;
+
+    case HDLCRXWAIT:		/* any character aborts */
+    case DATARXWAIT:
+    case HDLCRX:
+    case DATARX:
+      if ( p->state == HDLCRX || p->state == DATARX ) {
+	put ( p, DLE_ETX, 2 ) ;
+	p->skip = 1 ;
+      }
+      p->state = IDLE ;
+      respond ( p, "OK" ) ;
+      break ;
+
+    default:			/* command mode */
+      if ( c == '\r' ) {
+	p->cmd [ p->ncmd ] = 0 ;
+	if ( p->ncmd ) atcmd ( p, p->cmd ) ;
+	p->ncmd = 0 ;
+      } else if ( c == '\n' || c == CAN || c == DLE || c == ETX ) {
+	;
+      } else if ( c == BS ) {
+	if ( p->ncmd ) p->ncmd-- ;
+      } else if ( p->ncmd < CMDLEN-1 ) {
+	p->cmd [ p->ncmd++ ] = c ;
+      }
+      break ;
+    }
+  }
+}
+
+
+/* Transmit what the line can carry from port p's buffer.  Sends
+   fill when the buffer runs dry during a page and ends frames and
+   carriers after DLE-ETX. */
+
+void transmit ( PORT *p, long now )
+{
+  PORT *q = port + ( 1 - ( p - port ) ) ;
+  long allowed ;
+  int c, d ;
+
+  if ( p->state != HDLCTX && p->state != DATATX ) return ;
+
+  allowed = speed > 0 ?
+    (long) ( ( now - p->txstart ) * modbps ( p->mod ) * speed / 8000 ) :
+    p->txbytes + p->ntx + 1 ;
+
+  while ( p->txbytes < allowed ) {
+
+    if ( p->ntx > 0 ) {		/* data */
+      c = p->tx [ p->txp ] ;
+      p->txp = ( p->txp + 1 ) % DCEBUF ;
+      p->ntx-- ;
+      if ( p->state == HDLCTX && p->frpos++ == 1 )
+	p->final = c & 0x10 ;	/* control field P/F bit */
+      if ( ( d = noise ( c, &p->errors ) ) != c ) p->frerr++ ;
+      sendev ( q, BYTE, d ) ;
+      p->bytes++ ;
+      p->txbytes++ ;
+      p->starved = 0 ;
+
+    } else if ( p->etx ) {	/* end of frame or data */
+      if ( p->state == HDLCTX ) {
+	sendev ( q, FRAME, p->frerr ) ;
+	p->frames++ ;
+	if ( p->frerr ) p->badframes++ ;
+	if ( p->final ) {
+	  sendev ( q, DROP, 0 ) ;
+	  p->state = IDLE ;
+	  respond ( p, "OK" ) ;
+	} else {
+	  p->etx = p->dle = 0 ;
+	  p->frpos = p->frerr = p->final = 0 ;
+	  respond ( p, "CONNECT" ) ;
+	}
+      } else {
+	sendev ( q, DROP, 0 ) ;
+	p->state = IDLE ;
+	respond ( p, "OK" ) ;
+      }
+      break ;
+
+    } else if ( p->state == DATATX && p->started && speed > 0 ) {
+      if ( ! p->starved ) {
+	p->starved = now ;
+	p->underruns++ ;
+      } else if ( now - p->starved > UNDERRUN ) {
+	msg ( "W port %d: no data for %d s, dropping carrier",
+	      (int) ( p - port ), UNDERRUN / 1000 ) ;
+	sendev ( q, DROP, 0 ) ;
+	p->state = IDLE ;
+	respond ( p, "ERROR" ) ;
+	break ;
+      }
+      sendev ( q, BYTE, 0 ) ;	/* underrun: send fill */
+      p->fill++ ;
+      p->txbytes++ ;
+
+    } else {			/* idle: flags or training */
+      p->txbytes = allowed ;
+    }
+  }
+}
+
+
+/* Take events that have arrived on the line to port p and act on
+   them according to what the DTE asked for. */
+
+void receive ( PORT *p, long now )
+{
+  EVENT *e ;
+  uchar c ;
+
+  while ( p->nev > 0 && ( e = p->ev + p->evp )->t <= now ) {
+
+    if ( e->type == HANGUP ) {
+      p->heard = 0 ;
+      if ( p->state != IDLE ) {
+	if ( p->state == HDLCRX || p->state == DATARX ) put ( p, DLE_ETX, 2 ) ;
+	p->state = IDLE ;
+	respond ( p, "NO CARRIER" ) ;
+      }
+    } else if ( e->type == CARRIER ) {
+      p->heard = e->val ;
+      p->skip = 0 ;
+    } else if ( e->type == DROP ) {
+      p->heard = 0 ;
+      p->silent = e->t ;
+    }
+
+    switch ( p->state ) {
+
+    case HDLCRXWAIT:
+    case DATARXWAIT:
+      if ( ! p->heard || p->skip ) break ;
+      if ( samemod ( p->heard, p->mod ) ) {
+	p->state = p->mod == 3 ? HDLCRX : DATARX ;
+	respond ( p, "CONNECT" ) ;
+      } else {
+	p->state = IDLE ;
+	p->skip = 1 ;		/* the DTE misses this carrier */
+	respond ( p, "+FCERROR" ) ;
+      }
+      if ( e->type == CARRIER ) break ;
+      continue ;		/* handle the event in the new state */
+
+    case HDLCRX:
+    case DATARX:
+      if ( p->nout > OUTBUF - 16 ) return ; /* wait for the DTE */
+      if ( e->type == BYTE ) {
+	c = e->val ;
+	if ( c == DLE ) put ( p, (char*) &c, 1 ) ;
+	put ( p, (char*) &c, 1 ) ;
+      } else if ( e->type == FRAME ) {
+	put ( p, DLE_ETX, 2 ) ;
+	p->state = IDLE ;
+	respond ( p, e->val ? "ERROR" : "OK" ) ;
+      } else if ( e->type == DROP ) {
+	put ( p, DLE_ETX, 2 ) ;
+	p->state = IDLE ;
+	respond ( p, "NO CARRIER" ) ;
+      }
+      break ;
+
+    case SILENCERX:		/* the far end has started sending */
+      if ( e->type == CARRIER ) {
+	p->state = IDLE ;
+	respond ( p, "OK" ) ;
+	return ;
+      }
+      break ;
+
+    case IDLE:			/* keep data until the DTE asks for it */
+    case SILENCETX:
+      if ( e->type != HANGUP && ! p->skip ) return ;
+      break ;
+
+    default:			/* not listening */
+      break ;
+    }
+
+    p->evp = ( p->evp + 1 ) % NEVENT ;
+    p->nev-- ;
+  }
+}
+
+
+/* Update the timers of port p. */
+
+void timers ( PORT *p, long now )
+{
+  PORT *q = port + ( 1 - ( p - port ) ) ;
+
+  switch ( p->state ) {
+  case DIALING:
+    if ( now >= p->until ) {
+      if ( p->rings++ >= NRING ) {
+	p->state = IDLE ;
+	respond ( p, "NO ANSWER" ) ;
+      } else {
+	respond ( q, "RING" ) ;
+	p->until = now + RINGTIME ;
+      }
+    }
+    break ;
+  case ANSWERING:
+    if ( now >= p->until ) {
+      p->state = IDLE ;
+      respond ( p, "NO CARRIER" ) ;
+    }
+    break ;
+  case SILENCETX:
+    if ( now >= p->until ) {
+      p->state = IDLE ;
+      respond ( p, "OK" ) ;
+    }
+    break ;
+  case SILENCERX:
+    if ( p->heard )
+      p->silent = now ;
+    else if ( now - p->silent >= p->until ) {
+      p->state = IDLE ;
+      respond ( p, "OK" ) ;
+    }
+    break ;
+  }
+}
+
+
+/* Open a pty for port p.  Returns 0 or 2 on errors. */
+
+int openport ( PORT *p )
+{
+  int err=0 ;
+  struct termios t ;
+
+  if ( ( p->fd = posix_openpt ( O_RDWR | O_NOCTTY ) ) < 0 ||
+       grantpt ( p->fd ) || unlockpt ( p->fd ) ||
+       ! ( p->name = ptsname ( p->fd ) ) ||
+       ! ( p->name = strdup ( p->name ) ) )
+    return msg ( "ES2can't open pseudo-terminal:" ) ;
+
+  /* hold the slave open so the master doesn't see hangups
+     between efax runs, and make it raw so nothing is echoed */
+
+  if ( ( p->sfd = open ( p->name, O_RDWR | O_NOCTTY ) ) < 0 ||
+       tcgetattr ( p->sfd, &t ) )
+    return msg ( "ES2can't open %s:", p->name ) ;
+  cfmakeraw ( &t ) ;
+  tcsetattr ( p->sfd, TCSANOW, &t ) ;
+
+  fcntl ( p->fd, F_SETFL, fcntl ( p->fd, F_GETFL ) | O_NONBLOCK ) ;
+
+  if ( ! ( p->ev = malloc ( NEVENT * sizeof ( EVENT ) ) ) )
+    err = msg ( "E2 out of memory" ) ;
+
+  p->echo = 1 ;
+
+  if ( ! err && p->link ) {
+    unlink ( p->link ) ;
+    if ( symlink ( p->name, p->link ) )
+      err = msg ( "ES2can't link %s to %s:", p->link, p->name ) ;
+  }
+
+  return err ;
+}
+
+
+int done = 0 ;
+
+void onsig ( int sig )
+{
+  done = 1 ;
+}
+
+
+int main ( int argc, char **argv )
+{
+  int err=0, i, n, c, busy ;
+  struct pollfd fds [ NPORT ] ;
+  uchar buf [ DCEBUF ] ;
+  long now, active ;
+  PORT *p ;
+
+  argv0 = argv[0] ;
+  verb[0] = "ewi" ;
+  srand48 ( 1 ) ;
+
+  while ( ! err && ( c = nextopt ( argc, argv, "c:e:l:m:r:v:x:" ) ) != -1 ) {
+    switch ( c ) {
+    case 'c':
+      maxcalls = atoi ( nxtoptarg ) ;
+      break ;
+    case 'e':
+      ber = atof ( nxtoptarg ) ;
+      break ;
+    case 'l':
+      latency = atol ( nxtoptarg ) ;
+      break ;
+    case 'm':
+      maxbps = atoi ( nxtoptarg ) ;
+      break ;
+    case 'r':
+      srand48 ( atol ( nxtoptarg ) ) ;
+      break ;
+    case 'v':
+      verb[0] = nxtoptarg ;
+      break ;
+    case 'x':
+      speed = atof ( nxtoptarg ) ;
+      break ;
+    default:
+      fprintf ( stderr, Usage, argv0 ) ;
+      err = 2 ;
+      break ;
+    }
+  }
+
+  if ( ! err && argc - nxtoptind != 0 && argc - nxtoptind != NPORT ) {
+    fprintf ( stderr, Usage, argv0 ) ;
+    err = 2 ;
+  }
+
+  for ( i=0 ; ! err && i<NPORT ; i++ ) {
+    if ( argc - nxtoptind == NPORT ) port[i].link = argv [ nxtoptind + i ] ;
+    err = openport ( port + i ) ;
+    if ( ! err ) printf ( "%s\n", port[i].name ) ;
+  }
+  fflush ( stdout ) ;
+
+  signal ( SIGINT, onsig ) ;
+  signal ( SIGTERM, onsig ) ;
+  signal ( SIGHUP, onsig ) ;
+
+  /* after the last call, wait for the DTEs to finish hanging up */
+
+  for ( active = now = now_ms ( ) ;
+	! err && ! done && ( ! maxcalls || calls < maxcalls ||
+			     now - active < QUIET ) ; ) {
+
+    for ( busy=0, i=0 ; i<NPORT ; i++ ) {
+      p = port + i ;
+      fds[i].fd = p->fd ;
+      fds[i].events = p->nout ? POLLOUT : 0 ;
+      if ( ( p->state != HDLCTX && p->state != DATATX ) ||
+	   ( ! p->etx && p->ntx < DCEBUF - 1 ) )
+	fds[i].events |= POLLIN ;
+      if ( p->state != IDLE || p->nev ) busy = 1 ;
+    }
+
+    n = poll ( fds, NPORT, busy ? TICK : 1000 ) ;
+    if ( n < 0 ) {
+      if ( errno != EINTR ) err = msg ( "ES2poll failed:" ) ;
+      continue ;
+    }
+
+    now = now_ms ( ) ;
+
+    for ( i=0 ; i<NPORT ; i++ ) {
+      p = port + i ;
+
+      if ( fds[i].revents & POLLIN ) {
+	n = ( p->state == HDLCTX || p->state == DATATX ) ?
+	  DCEBUF - 1 - p->ntx : DCEBUF ;
+	if ( ( n = read ( p->fd, buf, n ) ) > 0 ) {
+	  dterx ( p, buf, n ) ;
+	  active = now ;
+	}
+      }
+
+      transmit ( p, now ) ;
+      receive ( p, now ) ;
+      timers ( p, now ) ;
+
+      while ( p->nout > 0 ) {
+	n = p->outp + p->nout > OUTBUF ? OUTBUF - p->outp : p->nout ;
+	if ( ( n = write ( p->fd, p->out + p->outp, n ) ) <= 0 ) break ;
+	p->outp = ( p->outp + n ) % OUTBUF ;
+	p->nout -= n ;
+      }
+    }
+  }
+
+  if ( connected ) callstats ( ) ;
+
+  for ( i=0 ; i<NPORT ; i++ )
+    if ( port[i].link ) unlink ( port[i].link ) ;
+
+  return err ;
+}
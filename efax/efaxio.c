@@ -107,35 +107,66 @@ char *tgets( TFILE *f, char *s, int len, int t )
 }
 
 
+/* Copy n bytes from p to q, translating them through the bit order
+   table.  Reversing the bits of each byte is done a word at a time
+   by swapping adjacent bits, bit pairs and nybbles. */
+
+static void sendbits ( uchar *q, uchar *p, int n, uchar *order )
+{
+  unsigned long w, m1 = ~0UL/3, m2 = ~0UL/5, m4 = ~0UL/17 ;
+
+  if ( order == normalbits )
+    for ( ; n >= (int) sizeof(w) ; n -= sizeof(w) ) {
+      memcpy ( &w, p, sizeof(w) ) ;
+      w = ( w >> 1 & m1 ) | ( w & m1 ) << 1 ;
+      w = ( w >> 2 & m2 ) | ( w & m2 ) << 2 ;
+      w = ( w >> 4 & m4 ) | ( w & m4 ) << 4 ;
+      memcpy ( q, &w, sizeof(w) ) ;
+      p += sizeof(w) ;
+      q += sizeof(w) ;
+    }
+
+  while ( n-- > 0 ) *q++ = order [ *p++ ] ;
+}
+
+
 /* Send bytes to the modem, doing bit-reversal and escaping DLEs.
-   Returns 0 or 2 on errors. */
+   The bytes are translated a span at a time up to the next byte
+   that becomes a DLE (both bit order tables are their own inverse)
+   and written OBUFSIZE bytes at a time, or MINWRITE bytes at a time
+   when doing virtual flow control.  Returns 0 or 2 on errors. */
 
 int sendbuf ( TFILE *f, uchar *p, int n, int dcecps )
 {
-  int err=0, c, over ;
+  int err=0, over, m ;
   uchar *order = f->obitorder ;
-  uchar buf [ MINWRITE+1 ] ;
-  int i ;
+  uchar buf [ OBUFSIZE ], *q, *dle, *end = p + n ;
+  int size = vfc && dcecps > 0 ? MINWRITE : OBUFSIZE ;
 
-  for ( i=0 ; ! err && n > 0 ; n-- ) {
-    c  = order [ *p++ ] ;
-    if ( c == DLE ) buf[i++] = DLE ;
-    buf[i++] = c ;
-    if ( i >= MINWRITE || n == 1 ) {
+  while ( ! err && p < end ) {
 
-      /* ``virtual'' flow control */
+    /* leave room to escape the last byte */
 
-      if ( vfc && dcecps > 0 ) {
-	over = f->bytes - ( proc_ms ( ) - f->mstart ) * dcecps / 1000 
-	  - MAXDCEBUF ;
-	if ( over > 0 ) msleep ( over * 1000 / dcecps ) ;
-      }
+    for ( q = buf ; p < end && q < buf + size - 1 ; ) {
+      m = buf + size - 1 - q ;
+      if ( end - p < m ) m = end - p ;
+      if ( ( dle = memchr ( p, order [ DLE ], m ) ) ) m = dle - p + 1 ;
+      sendbits ( q, p, m, order ) ;
+      p += m ;
+      q += m ;
+      if ( dle ) *q++ = DLE ;
+    }
 
-      if ( tput ( f, buf, i ) < 0 )
-	err = msg ( "ES2 %s", gettext ( "fax device write error:" ) ) ;
+    /* ``virtual'' flow control */
 
-      i = 0 ;
+    if ( vfc && dcecps > 0 ) {
+      over = f->bytes - ( proc_ms ( ) - f->mstart ) * dcecps / 1000 
+	- MAXDCEBUF ;
+      if ( over > 0 ) msleep ( over * 1000 / dcecps ) ;
     }
+
+    if ( tput ( f, buf, q - buf ) < 0 )
+      err = msg ( "ES2 %s", gettext ( "fax device write error:" ) ) ;
   }
 
   return err ;
@@ -3,7 +3,12 @@
 		     Copyright 1995 Ed Casas
 */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE		/* for fopencookie() */
+#endif
+
 #include <ctype.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -19,10 +24,34 @@
 #include <glib/gmem.h>
 #endif
 
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
+#ifdef HAVE_ZLIB_H
+#include <zlib.h>
+#endif
+
 #ifndef SEEK_SET
 #define SEEK_SET 0
 #endif
 
+/* Call fun() the first time this statement is executed.  Used to
+   build shared lookup tables; with threads other callers wait
+   until the tables are complete. */
+
+#ifdef HAVE_PTHREAD_H
+#define ONCE( fun ) { static pthread_once_t once = PTHREAD_ONCE_INIT ; \
+                      pthread_once ( &once, fun ) ; }
+#else
+#define ONCE( fun ) { static int once = 0 ; \
+                      if ( ! once ) { fun () ; once = 1 ; } }
+#endif
+
 #define DEFXRES 204.145		/* fax x and y resolution in dpi */
 #define DEFYRES 195.58
 
@@ -195,6 +224,174 @@ int xscale ( short *p, int nr, int xs )
   return outlen ;
 }
 
+/* Resample scan lines by area filtering.  Each output pixel
+   covers a span of input pixels and lines taken from phase
+   tables set up once per page, and is black if at least half of
+   the pixels it covers are black.  Halving the resolution thus
+   ORs pairs of pixels or lines and keeps thin strokes that
+   xscale() and line deletion drop.  Enlarging takes the input
+   pixel nearest the centre of each output pixel.  The small
+   offset keeps exact phases (e.g. 2:1) exact despite rounding
+   of the scale factors.  Only the columns under black runs are
+   visited, so white space costs nothing. */
+
+#define SPANSTART( c, f ) \
+  ( (f) > 1 ? (int) ( ( (c) + 0.5 ) / (f) + 1e-3 ) : (int) ( (c) / (f) + 1e-3 ) )
+#define SPANEND( c, f ) \
+  ( (f) > 1 ? SPANSTART( c, f ) + 1 : (int) ( ( (c) + 1 ) / (f) + 1e-3 ) )
+
+/* Set up s to scale by fx horizontally and fy vertically.
+   Returns 0 or 2 if out of memory. */
+
+int newSCALER ( SCALER *s, double fx, double fy )
+{
+  int c, x, n = MAXRUNS - 2, nx = MAXBITS * 8 ;
+
+  memset ( s, 0, sizeof(SCALER) ) ;
+  s->fx = fx ;
+  s->fy = fy ;
+
+  if ( fx <= 0 || fy <= 0 ) 
+    return msg ( "E2 can't happen (newSCALER)" ) ;
+
+  if ( ! ( s->x0 = malloc ( n * sizeof(int) ) ) ||
+       ! ( s->x1 = malloc ( n * sizeof(int) ) ) ||
+       ! ( s->ic = malloc ( ( nx + 1 ) * sizeof(int) ) ) ||
+       ! ( s->acc = calloc ( n, sizeof(int) ) ) ||
+       ! ( s->seg = malloc ( 2 * MAXRUNS * sizeof(int) ) ) ||
+       ! ( s->tmp = malloc ( 2 * MAXRUNS * sizeof(int) ) ) ) {
+    freeSCALER ( s ) ;
+    return msg ( "E2 out of memory for scaling" ) ;
+  }
+
+  for ( c=0 ; c < n && ( s->x0 [ c ] = SPANSTART ( c, fx ) ) < nx ; c++ ) 
+    s->x1 [ c ] = SPANEND ( c, fx ) ;
+  s->nc = c ;
+
+  for ( c=0, x=0 ; x <= nx ; x++ ) {
+    while ( c < s->nc && s->x1 [ c ] <= x ) c++ ;
+    s->ic [ x ] = c ;
+  }
+
+  return 0 ;
+}
+
+
+/* Add input line `runs' of nr runs and *pels pixels.  When the
+   line completes the span of one or more output lines, replaces
+   runs by the output line, sets *pels to its width and *no to the
+   number of times it is repeated; otherwise sets *no to 0.
+   Returns the number of runs. */
+
+int scaleline ( SCALER *s, short *runs, int nr, int *pels, int *no )
+{
+  int c, c0, k, x=0, a, e, blk, len, area ;
+  int *acc = s->acc, *x0 = s->x0, *x1 = s->x1, *seg = s->seg, *t = s->tmp ;
+  int ow, nt=0, i, j ;
+
+  ow = *pels * s->fx + 0.5 ;
+  if ( ow > s->nc ) ow = s->nc ;
+  if ( ow > s->ow ) s->ow = ow ;
+
+  /* add the black pixels of each black run to the columns it
+     covers, merging the columns into the sorted intervals in seg */
+
+  for ( i=0, k=0 ; k < nr ; k++ ) {
+    a = x ;
+    x += runs [ k ] ;
+    if ( ! ( k & 1 ) || x <= a || a >= MAXBITS * 8 ) continue ;
+    e = x < MAXBITS * 8 ? x : MAXBITS * 8 ;
+    for ( c = c0 = s->ic [ a ] ; c < ow && x0 [ c ] < e ; c++ )
+      acc [ c ] += ( e < x1 [ c ] ? e : x1 [ c ] ) - ( a > x0 [ c ] ? a : x0 [ c ] ) ;
+    if ( c <= c0 ) continue ;
+    for ( ; i < s->nseg && seg [ 2*i ] < c0 ; i++ ) {
+      if ( nt && seg [ 2*i ] <= t [ 2*nt-1 ] ) {
+	if ( seg [ 2*i+1 ] > t [ 2*nt-1 ] ) t [ 2*nt-1 ] = seg [ 2*i+1 ] ;
+      } else {
+	t [ 2*nt ] = seg [ 2*i ] ; t [ 2*nt+1 ] = seg [ 2*i+1 ] ; nt++ ;
+      }
+    }
+    if ( nt && c0 <= t [ 2*nt-1 ] ) {
+      if ( c > t [ 2*nt-1 ] ) t [ 2*nt-1 ] = c ;
+    } else {
+      t [ 2*nt ] = c0 ; t [ 2*nt+1 ] = c ; nt++ ;
+    }
+  }
+  for ( ; i < s->nseg ; i++ ) {
+    if ( nt && seg [ 2*i ] <= t [ 2*nt-1 ] ) {
+      if ( seg [ 2*i+1 ] > t [ 2*nt-1 ] ) t [ 2*nt-1 ] = seg [ 2*i+1 ] ;
+    } else {
+      t [ 2*nt ] = seg [ 2*i ] ; t [ 2*nt+1 ] = seg [ 2*i+1 ] ; nt++ ;
+    }
+  }
+  s->tmp = seg ;
+  s->seg = seg = t ;
+  s->nseg = nt ;
+
+  s->na++ ;
+  s->i++ ;
+
+  /* output lines whose span ends with this input line */
+
+  for ( *no = 0 ; SPANEND ( s->r, s->fy ) <= s->i ; s->r++ ) 
+    ++*no ;
+
+  if ( ! *no ) 
+    return nr ;
+
+  nr = 0 ;
+  len = 0 ;
+  blk = 0 ;
+  x = 0 ;
+  for ( i=0 ; i < s->nseg ; i++ ) {
+    if ( blk ) {
+      runs [ nr++ ] = len ;
+      len = 0 ;
+      blk = 0 ;
+    }
+    len += seg [ 2*i ] - x ;
+    for ( c = seg [ 2*i ], j = seg [ 2*i+1 ] ; c < j ; c++ ) {
+      area = ( x1 [ c ] - x0 [ c ] ) * s->na ;
+      if ( ( 2 * acc [ c ] >= area ) != blk ) {
+	runs [ nr++ ] = len ;
+	len = 0 ;
+	blk ^= 1 ;
+      }
+      acc [ c ] = 0 ;
+      len++ ;
+    }
+    x = j ;
+  }
+  if ( blk && s->ow > x ) {
+    runs [ nr++ ] = len ;
+    len = 0 ;
+  }
+  len += s->ow - x ;
+  runs [ nr++ ] = len ;
+
+  *pels = s->ow ;
+  s->ow = 0 ;
+  s->na = 0 ;
+  s->nseg = 0 ;
+
+  return nr ;
+}
+
+
+/* Release the tables of s. */
+
+void freeSCALER ( SCALER *s )
+{
+  free ( s->x0 ) ;
+  free ( s->x1 ) ;
+  free ( s->ic ) ;
+  free ( s->acc ) ;
+  free ( s->seg ) ;
+  free ( s->tmp ) ;
+  memset ( s, 0, sizeof(SCALER) ) ;
+}
+
+
 /* Invert a run-length buffer by prepending or removing a
    zero-length initial run. */
 
@@ -243,23 +440,29 @@ uchar byteruns [ 1408 + 1 ] =
    "3212032111032210323031130311210311111031112031220312110313103140"
    "4404310421104220411204111104121041305305210511105120620611071080" ;
 
+/* Pointers to the list of runs for each byte. */
+
+uchar *rltab [ 256 ] ;
+
+void initrltab ( void )
+{
+  int i = 0 ;
+  uchar *p ;
+  for ( rltab[ 0 ] = p = byteruns ; *p ; p++ )
+    if ( ! ( *p -= '0' ) && i < 255 ) 
+      rltab [ ++i ] = p+1 ;
+}
+
 /* Convert byte-aligned bit-mapped n-byte scan line into array of run
    lengths.  Run length array must have *more* than 8*n elements.  First
    run is white.  Returns number of runs coded.  */
 
 int bittorun ( uchar *bits, int n, short *runs )
 {
-  static uchar init=0, *rltab [ 256 ] ;
   register uchar *p, c, lastc = 0x00 ;
   short *runs0 = runs ;
 
-  if ( ! init ) {		/* initialize pointer and run tables */
-    int i = 0 ;
-    for ( rltab[ 0 ] = p = byteruns ; *p ; p++ )
-      if ( ! ( *p -= '0' ) && i < 255 ) 
-	rltab [ ++i ] = p+1 ;
-    init = 1 ;
-  }
+  ONCE ( initrltab ) ;
 
   *runs = 0 ;
   for ( ; n > 0 ; n-- ) {
@@ -333,7 +536,10 @@ int runor ( short *a, int na, short *b, int nb, short *c, int *pels )
       lb = b [ ib ] ;
     }
 
-  if ( c == tmp ) for ( ia=0 ; ia <= ic ; ia++ ) np += a[ia] = c[ia] ;
+  if ( c == tmp ) 
+    for ( ia=0 ; ia <= ic ; ia++ ) np += a[ia] = c[ia] ;
+  else
+    for ( ia=0 ; ia <= ic ; ia++ ) np += c[ia] ;
 
   if ( pels ) *pels = np ;
 
@@ -365,82 +571,104 @@ int pbmdim ( IFILE *f )
 }
 
 
-/* Append nb bits from in[from] to bit-mapped scan line buffer
-   where `from' is a bit (not byte) index.  Bits in bytes are
-   ordered from MS to LS bit. Initialize before each scan line by
-   calling with nb=0 and in pointing to output buffer.  Flush
-   after each scan line by calling with nb=0 and in=NULL. */
+/* Store row `line' of character c of font `font' as runs,
+   starting with a (possibly empty) white run.  Returns the number
+   of runs. */
+
+static int glyphrow ( faxfont *font, int line, int c, uchar *runs )
+{
+  uchar *in = font->buf + 256/8 * font->w * line ;
+  int i, bit, from = font->offset [ c ], colour = 0, nr = 0 ;
+
+  runs [ 0 ] = 0 ;
+  for ( i = from ; i < from + font->w ; i++ ) {
+    bit = ( in [ i >> 3 ] >> ( 7 - ( i & 7 ) ) ) & 1 ;
+    if ( bit != colour ) {
+      colour = bit ;
+      runs [ ++nr ] = 0 ;
+    }
+    runs [ nr ]++ ;
+  }
+
+  return nr + 1 ;
+}
 
-#define putbits( c, b ) { x = ( x << (b) ) | (c) ; shift += (b) ; \
-          if ( shift >= 0 ) { *out++ = x >> shift ; shift -= 8 ; } }
+/* Convert each row of each glyph of font `font' to runs, once,
+   so that text can be set by joining runs instead of copying
+   bits.  The runs of row `line' of character c are
+   runs[runidx[k]] to runs[runidx[k+1]-1] where k=line*256+c.
+   Returns 0 or 2 if out of memory. */
 
-void copybits ( uchar *in, int from, short nb )
+static int fontruns ( faxfont *font )
 {
-  uchar *f ;
-  short bits ;
-  static uchar *out ;
-  static short x, shift ;
-  static unsigned char right [ 9 ] = { 
-    0x00, 0x01, 0x03, 0x07, 0x0f, 0x1f, 0x3f, 0x7f, 0xff } ;
-  
-  if ( ! nb ) {				/* reset for new scan line */
-    if ( in ) out = in ;		   
-    else putbits ( 0, -shift ) ;	/* or flush bit buffer */
-    x = 0 ;
-    shift = -8 ;
-  } else {
-    f = in + ( from >> 3 ) ;
-    bits = 8 - ( from & 7 ) ;
+  int k, n = 0 ;
+  uchar tmp [ MAXFONTW + 1 ] ;
 
-    if ( nb >= bits ) {
-      putbits ( *f++ & right [ bits ], bits ) ;
-      nb -= bits ;
-    } else {
-      putbits ( ( *f >> ( bits - nb ) ) & right [ bits ], nb ) ;
-      nb = 0 ;
-    } 
+  for ( k = 0 ; k < 256 * font->h ; k++ )
+    n += glyphrow ( font, k / 256, k % 256, tmp ) ;
+
+  font->runidx = malloc ( ( 256 * font->h + 1 ) * sizeof(int) ) ;
+  font->runs = malloc ( n ) ;
 
-    while ( nb >= 8 ) { putbits ( *f++, 8 ) ; nb -= 8 ; }
+  if ( ! font->runidx || ! font->runs ) {
+    free ( font->runidx ) ;
+    free ( font->runs ) ;
+    font->runidx = 0 ;
+    font->runs = 0 ;
+    return msg ( "E2 out of memory for font" ) ;
+  }
 
-    if ( nb > 0 ) putbits ( *f >> ( 8 - nb ), nb );
+  for ( k = n = 0 ; k < 256 * font->h ; k++ ) {
+    font->runidx [ k ] = n ;
+    n += glyphrow ( font, k / 256, k % 256, font->runs + n ) ;
   }
-}   
+  font->runidx [ k ] = n ;
 
+  return 0 ;
+}
 
-/* Generate scan line 'line' of string 'txt' using font `font'
-   and store the runs in 'runs'.  The font is scaled so it
-   appears to have cells of width w and height h.  lmargin pixels
-   of white space are added at the left margin. Sets 'pels' to
-   line width if not null.  Returns number of runs coded. */
 
-int texttorun ( uchar *txt, faxfont *font, short line, 
-	       int w, int h, int lmargin,
-	       short *runs, int *ppels )
+/* Generate scan line 'line' of the first n characters of 'txt'
+   using font `font' and store the runs in 'runs'.  Tabs are
+   expanded to multiples of 8 characters.  The font is scaled so
+   it appears to have cells of width w and height h.  lmargin
+   pixels of white space are added at the left margin. Sets
+   'pels' to line width if not null.  Returns number of runs
+   coded. */
+
+static int textruns ( uchar *txt, int n, faxfont *font, short line, 
+		      int w, int h, int lmargin,
+		      short *runs, int *ppels )
 {
-  uchar *in, out [ MAXLINELEN * MAXFONTW / 8 + 1 ] ;
-  int i, nc = 0, cw, nr, pels ;
+  uchar *p, *end ;
+  int i, c, nc = 0, nr = 1, col, pels ;
 
   line = ( line * font->h + h/2 ) / h ;
-
-  cw = font->w ;
   if ( line >= font->h ) line = font->h - 1 ;
-  in = font->buf + 256/8 * cw * line ;
-
-  copybits ( out, 0, 0 ) ;
-  for ( i=0 ; txt[i] && i < MAXLINELEN ; i++ ) {
-    copybits ( in, font->offset [ txt[i] ], cw ) ;
-    nc++ ;
-    while ( ( txt[i] == HT ) && ( nc & 7 ) ) { /* tab */
-      copybits ( in, font->offset [ ' ' ], cw ) ;
+
+  if ( ! font->runidx ) n = 0 ;
+  if ( n > MAXLINELEN ) n = MAXLINELEN ;
+
+  runs [ 0 ] = 0 ;
+  for ( i=0 ; i < n && nr < MAXRUNS - 8 * ( font->w + 1 ) ; i++ ) {
+    c = txt [ i ] ;
+    do {
+      p = font->runs + font->runidx [ line * 256 + c ] ;
+      end = font->runs + font->runidx [ line * 256 + c + 1 ] ;
+      for ( col = 0 ; p < end ; p++, col ^= 1 )
+	if ( *p ) {
+	  if ( ( ( nr - 1 ) & 1 ) == col )
+	    runs [ nr - 1 ] += *p ;	/* continues the last run */
+	  else
+	    runs [ nr++ ] = *p ;
+	}
       nc++ ;
-    }
+      c = ' ' ;
+    } while ( ( txt[i] == HT ) && ( nc & 7 ) ) ; /* tab */
   }
-  copybits ( 0, 0, 0 ) ;
 
-  nr = bittorun ( out, ( nc*cw + 7 )/8, runs ) ;
-  
   if ( font->w == w )
-    pels = nc*cw ;
+    pels = nc * font->w ;
   else    
     pels = xscale ( runs, nr, ( w * 256 ) / font->w ) ;
   
@@ -451,6 +679,32 @@ int texttorun ( uchar *txt, faxfont *font, short line,
   return nr ;
 }
 
+int texttorun ( uchar *txt, faxfont *font, short line, 
+	       int w, int h, int lmargin,
+	       short *runs, int *ppels )
+{
+  return textruns ( txt, strlen ( (char*) txt ), font, line, w, h, lmargin,
+		    runs, ppels ) ;
+}
+
+
+/* Return the number of characters of 'txt', up to the end of the
+   line, that fit in a row of ncols character cells with tabs
+   expanded.  At least one character is taken unless the line is
+   empty. */
+
+static int textwrap ( uchar *txt, int ncols )
+{
+  int i, nc = 0 ;
+
+  for ( i=0 ; txt[i] && txt[i] != '\n' && i < MAXLINELEN ; i++ ) {
+    nc += ( txt[i] == HT ) ? 8 - ( nc & 7 ) : 1 ;
+    if ( nc > ncols && i > 0 ) break ;
+  }
+
+  return i ;
+}
+
 		/* Image File Input Functions */
 
 
@@ -494,43 +748,66 @@ void logifnames ( IFILE *f, char *s )
 }
 
 
+/* Combine make-up and terminating codes in the n+1 decoder
+   outputs in runs (the last being the EOL) and remove the +1
+   offset in run lengths.  If invert is set the outputs start at
+   runs+1 and the colours are swapped by starting the line with a
+   zero-length white run, or by dropping the initial run if it is
+   zero-length.  Saves the line width in len.  Returns the number
+   of runs. */
+
+int joinruns ( short *runs, int n, short *len, int invert )
+{
+  short *p, *q ;
+
+  *len = 0 ;
+  p = q = runs ;
+  if ( invert && n > 0 ) {
+    if ( *++p == 1 ) {
+      p++ ;
+      n-- ;
+    } else {
+      *q++ = 0 ;
+    }
+  }
+  while ( n-- > 0 )
+    if ( *p > 64 && n-- > 0 ) {
+      *len += *q++ = p[0] + p[1] - 2 ;
+      p+=2 ;
+    } else {
+      *len += *q++ = *p++ - 1 ;
+    }
+
+  return q - runs ;
+}
+
+
 /* Read run lengths for one scan line from T.4-coded IFILE f into buffer
    runs.  If pointer pels is not null it is used to save pixel count.
    Returns number of runs stored, EOF on RTC, or -2 on EOF or other
    error. */
 
+#define GETFILE if ( ( c = fgetc ( f->f ) ) == EOF ) npad++
+
 int readruns ( IFILE *f, short *runs, int *pels )
 {
   int err=0, c=EOF, n ;
   register int x ;
   dtab *tab, *t ;
   short shift ;
-  short *p, *maxp, *q, len=0, npad=0 ;
+  short *p, *maxp, len=0, npad=0 ;
   DECODER *d ;
-  uchar reverse=f->page->revbits ;
 
-  maxp = ( p = runs ) + MAXRUNS ;
   d = &f->d ;
+  maxp = runs + MAXRUNS ;
+  p = runs + d->invert ;
 
   x = d->x ; shift = d->shift ; tab = d->tab ; /* restore decoder state */
 
-  do {
-    do {
-      while ( shift < 0 ) { 
-	if ( ( c = fgetc ( f->f ) ) == EOF )  {
-	  x = ( x << 15 ) | 1 ; shift += 15 ;  /* EOL pad at EOF */
-	  npad++ ;
-	} else {
-	  if ( reverse ) c = normalbits [ c & 0xff ] ;
-	  x = ( x <<  8 ) | c ; shift +=  8 ; 
-	}
-      }
-      t = tab + ( ( x >> shift ) & 0x1ff ) ;
-      tab = t->next ;
-      shift -= t->bits ;
-    } while ( ! t->code ) ;
-    if ( p < maxp ) *p++ = t->code ;
-  } while ( t->code != -1 ) ;
+  if ( d->lsbfirst )
+    DECODELSB ( GETFILE ) ;
+  else
+    DECODEMSB ( GETFILE ) ;
 
   d->x = x ; d->shift = shift ; d->tab = tab ; /* save state */
 
@@ -538,18 +815,7 @@ int readruns ( IFILE *f, short *runs, int *pels )
 
   if ( p >= maxp ) msg ( "W run length buffer overflow" ) ;
 
-  /* combine make-up and terminating codes and remove +1 offset
-     in run lengths */
-
-  n = p - runs - 1 ;
-  for ( p = q = runs ; n-- > 0 ; )
-    if ( *p > 64 && n-- > 0 ) {
-      len += *q++ = p[0] + p[1] - 2 ;
-      p+=2 ;
-    } else {
-      len += *q++ = *p++ - 1 ;
-    }
-  n = q - runs ;
+  n = joinruns ( runs, p - runs - d->invert - 1, &len, d->invert ) ;
   
   /* check for RTC and errors */
 
@@ -572,6 +838,98 @@ int readruns ( IFILE *f, short *runs, int *pels )
 }
 
 
+/* As readruns() but decodes from the bytes between *pp and end
+   and advances *pp.  The end of the buffer acts as an EOL so the
+   last line need not be terminated.  Returns number of runs
+   stored, EOF on RTC, or -2 if the buffer was exhausted before
+   any pixels were decoded and without completing an RTC.  Only uses the caller's state so may
+   be called from several threads at once. */
+
+#define GETBUF if ( in < end ) c = *in++ ; else { c = -1 ; npad++ ; }
+
+int bufruns ( DECODER *d, uchar **pp, uchar *end, short *runs, int *pels )
+{
+  int err=0, c=0, n, npad=0 ;
+  register int x ;
+  dtab *tab, *t ;
+  short shift ;
+  short *p, *maxp, len=0 ;
+  uchar *in = *pp ;
+
+  maxp = runs + MAXRUNS ;
+  p = runs + d->invert ;
+
+  x = d->x ; shift = d->shift ; tab = d->tab ; /* restore decoder state */
+
+  if ( d->lsbfirst )
+    DECODELSB ( GETBUF ) ;
+  else
+    DECODEMSB ( GETBUF ) ;
+
+  d->x = x ; d->shift = shift ; d->tab = tab ; /* save state */
+  *pp = in ;
+
+  n = joinruns ( runs, p - runs - d->invert - 1, &len, d->invert ) ;
+
+  if ( len )
+    d->eolcnt = 0 ;
+  else
+    if ( ++(d->eolcnt) >= RTCEOL ) err = EOF ;
+
+  if ( npad && ! len && err != EOF ) err = -2 ;	/* RTC may end the data */
+
+  if ( pels ) *pels = len ;
+  
+  return err ? err : n ;
+}
+
+
+/* Append a scan line of nr runs and width pels to arena a,
+   growing it as required.  Returns 0 or 2 if out of memory. */
+
+int arenaline ( RUNARENA *a, short *runs, int nr, int pels )
+{
+  void *p ;
+
+  if ( a->nlines + 1 >= a->maxlines ) {
+    int n = a->maxlines ? 2 * a->maxlines : 256 ;
+    if ( ! ( p = realloc ( a->start, n * sizeof(int) ) ) ) return 2 ;
+    a->start = p ;
+    if ( ! ( p = realloc ( a->pels, n * sizeof(int) ) ) ) return 2 ;
+    a->pels = p ;
+    a->maxlines = n ;
+  }
+
+  if ( a->nruns + nr > a->maxruns ) {
+    int n = a->maxruns ? 2 * a->maxruns : 16 * MAXRUNS ;
+    while ( n < a->nruns + nr ) n *= 2 ;
+    if ( ! ( p = realloc ( a->runs, n * sizeof(short) ) ) ) return 2 ;
+    a->runs = p ;
+    a->maxruns = n ;
+  }
+
+  memcpy ( a->runs + a->nruns, runs, nr * sizeof(short) ) ;
+  a->start [ a->nlines ] = a->nruns ;
+  a->pels [ a->nlines ] = pels ;
+  a->nlines++ ;
+  a->nruns += nr ;
+  a->start [ a->nlines ] = a->nruns ;
+
+  return 0 ;
+}
+
+
+/* Release the memory used by arena a. */
+
+void freearena ( RUNARENA *a )
+{
+  free ( a->runs ) ;
+  free ( a->start ) ;
+  free ( a->pels ) ;
+  memset ( a, 0, sizeof(RUNARENA) ) ;
+}
+
+
 /* Read a PCX compressed bit-map */
 
 int readpcx ( char *p, int len, IFILE *f )
@@ -605,6 +963,152 @@ int readpcx ( char *p, int len, IFILE *f )
   return err ;
 }
 
+/* Count off a scan line of a multi-strip uncompressed TIFF page,
+   seeking to the start of the next strip when all lines of the
+   current one have been read.  Returns 0 if OK, 1 if there are no
+   more strips or 2 on errors. */
+
+int rawstrip ( IFILE *f )
+{
+  int err=0 ;
+
+  if ( f->striplines <= 0 ) {
+    if ( ++f->strip >= f->page->nstrips ) {
+      err = 1 ;
+    } else if ( fseek ( f->f, f->page->stripoff [ f->strip ], SEEK_SET ) ) {
+      err = msg ( "ES2 seek to TIFF strip failed" ) ;
+    } else {
+      f->striplines = f->page->rowsperstrip ;
+    }
+  }
+
+  f->striplines-- ;
+
+  return err ;
+}
+
+
+/* Copy the next scan line of a fax page from its decoded strips
+   or segments.  Returns number of runs or EOF at end of page. */
+
+int arenaruns ( IFILE *f, short *runs, int *pels )
+{
+  RUNARENA *a ;
+  int nr ;
+
+  while ( f->strip < f->narena && 
+	  f->line >= f->arena [ f->strip ].nlines ) {
+    f->strip++ ;
+    f->line = 0 ;
+  }
+
+  if ( f->strip >= f->narena )
+    return EOF ;
+
+  a = f->arena + f->strip ;
+  nr = a->start [ f->line + 1 ] - a->start [ f->line ] ;
+  memcpy ( runs, a->runs + a->start [ f->line ], nr * sizeof(short) ) ;
+  if ( pels ) *pels = a->pels [ f->line ] ;
+  f->line++ ;
+
+  return nr ;
+}
+
+
+/* Grey-scale scan lines are converted to black and white either
+   by an adaptive threshold or by Floyd-Steinberg error diffusion
+   (dithering).  The threshold for each pel is a fraction of the
+   average brightness of a window about 1/8 inch wide centred on
+   it, averaged with the windows of the lines above.  This keeps
+   text legible on shaded or unevenly lit scans.  Dithering is
+   better for photographs.  */
+
+#define MAXGREYW (MAXRUNS-8)	/* widest grey-scale image */
+#define GREYMAXR 64		/* largest threshold window half-width */
+#define GREYPAD (2*GREYMAXR+2)	/* line buffer padding for window */
+#define GREYBIAS 12		/* black if this % darker than average */
+#define GREYBLACK 64		/* always black below this brightness */
+
+/* Convert the grey-scale scan line in f->grey to a bit map of
+   (w+7)/8 bytes in bits using method f->greymode.  The samples in
+   f->grey are overwritten.  Returns the number of bytes. */
+
+int greytobit ( IFILE *f, uchar *bits )
+{
+  int x, w = f->page->w, nb = ( w + 7 ) / 8 ;
+  uchar *g = f->grey, *map = f->greymap, *k ;
+  int *buf = f->greybuf ;
+
+  if ( f->greymode == G_DITHER ) {
+
+    /* errors are in 1/16 brightness units; the buffers for the
+       current and next lines alternate */
+
+    int *e = buf + ( f->lines & 1 ) * ( w + 2 ) ;
+    int *n = buf + ( ~f->lines & 1 ) * ( w + 2 ) ;
+    int v, d ;
+
+    for ( x=0 ; x<w ; x++ ) {
+      v = ( map [ g[x] ] << 4 ) + e [ x+1 ] ;
+      g[x] = v < 128*16 ;
+      d = g[x] ? v : v - 255*16 ;
+      e [ x+2 ] += ( d * 7 ) >> 4 ;
+      n [ x ]   += ( d * 3 ) >> 4 ;
+      n [ x+1 ] += ( d * 5 ) >> 4 ;
+      n [ x+2 ] += d >> 4 ;
+    }
+    memset ( e, 0, ( w + 2 ) * sizeof(int) ) ;
+
+  } else {
+
+    /* b is the line of brightness values padded by r pels
+       replicated from each edge, s its running sum and a the
+       vertically averaged window sums */
+
+    int r = f->page->xres / 16, nw, *b, *s, *a ;
+    int first = f->lines == f->page->h ;
+
+    if ( r < 1 ) r = 1 ;
+    if ( r > GREYMAXR ) r = GREYMAXR ;
+    nw = 2*r + 1 ;
+
+    b = buf ;
+    s = b + w + GREYPAD ;
+    a = s + w + GREYPAD ;
+
+    for ( x=0 ; x<w ; x++ )
+      b [ x+r ] = map [ g[x] ] ;
+    for ( x=0 ; x<r ; x++ ) {
+      b [ x ] = b [ r ] ;
+      b [ w+r+x ] = b [ w+r-1 ] ;
+    }
+
+    s[0] = 0 ;
+    for ( x=0 ; x < w + 2*r ; x++ )
+      s [ x+1 ] = s [ x ] + b [ x ] ;
+
+    for ( x=0 ; x<w ; x++ )
+      a[x] = first ? s [ x+nw ] - s [ x ] : 
+	( a[x] + s [ x+nw ] - s [ x ] ) >> 1 ;
+
+    /* no dependencies between pels: gcc vectorizes this */
+
+    for ( x=0 ; x<w ; x++ )
+      g[x] = ( b [ x+r ] * nw * 100 < a[x] * ( 100 - GREYBIAS ) ) | 
+	( b [ x+r ] < GREYBLACK ) ;
+  }
+
+  /* pack one pel per byte (1=black) into bits; f->grey has 8
+     bytes of zero (white) padding */
+
+  for ( x=0, k=g ; x<nb ; x++, k+=8 )
+    bits[x] = k[0] << 7 | k[1] << 6 | k[2] << 5 | k[3] << 4 | 
+      k[4] << 3 | k[5] << 2 | k[6] << 1 | k[7] ;
+
+  return nb ;
+}
+
+
 /* Read a scan line from the current page of IFILE f.  Stores
    number of runs in runs and line width in pels if not null.
    Pages ends at EOF. Text pages also end if a complete text line
@@ -613,18 +1117,23 @@ int readpcx ( char *p, int len, IFILE *f )
    read. Fax pages also end at RTC. Returns number of runs stored
    or EOF at end of page. */
 
+int coverruns ( IFILE *f, short *runs, int *pels ) ;
+
 int readline ( IFILE *f, short *runs, int *pels )
 {
-  int nr = 0, nb ;
+  int nr = 0, nb, i ;
   uchar bits [ MAXBITS ] ;
 
   if ( f->lines != 0 ) {	/* -1 allowed as well */
     switch ( f->page->format ) {
 
     case P_TEXT :
-      if ( f->txtlines <= 0 ) {	/* need another text line */
-	if ( fgets ( f->text, MAXLINELEN, f->f ) ) {
-	  f->txtlines = f->charh ;
+      if ( f->txtlines <= 0 ) {	/* need another row of text */
+	f->txtpos += f->txtn ;
+	if ( f->text [ f->txtpos ] && f->text [ f->txtpos ] != '\n' ) {
+	  ;			/* rest of a wrapped line */
+	} else if ( fgets ( f->text, MAXLINELEN, f->f ) ) {
+	  f->txtpos = 0 ;
 	  if ( strchr ( f->text, FF ) ) {
 	    f->lines = 0 ;	/* no more lines in this page */
 	    nr = EOF ;		/* don't return any */
@@ -632,18 +1141,25 @@ int readline ( IFILE *f, short *runs, int *pels )
 	} else {
 	  nr = EOF ;
 	}
+	if ( nr != EOF ) {
+	  f->txtn = textwrap ( (uchar*) f->text + f->txtpos, 
+			       ( f->page->w - f->lmargin ) / f->charw ) ;
+	  f->txtlines = f->charh ;
+	}
       }
       if ( nr != EOF ) {
-	nr = texttorun ( (uchar*) f->text, f->font, f->charh - f->txtlines, 
-			f->charw, f->charh, f->lmargin,
-			runs, pels ) ;
+	nr = textruns ( (uchar*) f->text + f->txtpos, f->txtn, f->font, 
+		       f->charh - f->txtlines, f->charw, f->charh, f->lmargin,
+		       runs, pels ) ;
 	f->txtlines-- ;
       } 
       break ;
 
     case P_RAW:
     case P_PBM:
-      if ( fread ( bits, 1, f->page->w/8, f->f ) != f->page->w/8 ) {
+      if ( f->page->nstrips > 1 && rawstrip ( f ) ) {
+	nr = EOF ;
+      } else if ( fread ( bits, 1, f->page->w/8, f->f ) != f->page->w/8 ) {
 	nr = EOF ;
       } else {
 	nr = bittorun ( bits, f->page->w/8, runs ) ;
@@ -652,9 +1168,45 @@ int readline ( IFILE *f, short *runs, int *pels )
       break ;
 
     case P_FAX:
-      nr = readruns ( f, runs, pels ) ;
+      if ( f->arena )
+	nr = arenaruns ( f, runs, pels ) ;
+      else
+	nr = readruns ( f, runs, pels ) ;
       break ;
       
+    case P_GREY:
+      nb = ( f->page->w + 7 ) / 8 ;
+      if ( f->page->nstrips > 1 && rawstrip ( f ) ) {
+	nr = EOF ;
+      } else if ( fread ( f->grey, 1, f->page->w, f->f ) != f->page->w ) {
+	nr = EOF ;
+      } else {
+	greytobit ( f, bits ) ;
+	nr = bittorun ( bits, nb, runs ) ;
+	if ( pels ) *pels = nb * 8 ;
+      }
+      break ;
+
+    case P_PDF:
+      nb = ( f->page->w + 7 ) / 8 ;
+      if ( f->pixpos + nb > f->pixlen ) {
+	nr = EOF ;
+      } else {
+	memcpy ( bits, f->pixels + f->pixpos, nb ) ;
+	f->pixpos += nb ;
+	if ( f->page->black_is_zero )
+	  for ( i=0 ; i<nb ; i++ ) bits[i] = ~bits[i] ;
+	if ( f->page->w % 8 )	/* clear padding */
+	  bits [ nb-1 ] &= 0xff << ( 8 - f->page->w % 8 ) ;
+	nr = bittorun ( bits, nb, runs ) ;
+	if ( pels ) *pels = nb * 8 ;
+      }
+      break ;
+
+    case P_COVER:
+      nr = coverruns ( f, runs, pels ) ;
+      break ;
+
     case P_PCX:
       nb = ( ( f->page->w + 15 ) / 16 ) * 2 ;	/* round up */
       if ( readpcx ( (char*) bits, nb, f ) != 0 ) {
@@ -670,16 +1222,115 @@ int readline ( IFILE *f, short *runs, int *pels )
     nr = EOF ;
   }
   
-  if ( nr >= 0 && f->page->black_is_zero ) { /* invert */
+  if ( nr >= 0 && f->page->black_is_zero && f->page->format != P_FAX &&
+       f->page->format != P_GREY && f->page->format != P_PDF ) { /* invert */
     nr = xinvert ( runs, nr ) ;
   }
 
   if ( nr >= 0 && f->lines > 0 ) f->lines-- ;
+  if ( nr >= 0 ) f->lineno++ ;
   
   return nr ;
 }
 
 
+/* Check that an EOL code ends at bit `bit' of the strip of the
+   current page of IFILE f, where the line index says a line starts.
+   Leaves f positioned after the byte holding that bit and sets *c
+   to that byte, or to 0 if the bit starts a byte.  Returns 0 if OK
+   or EOF if there is no EOL there or the data can't be read. */
+
+int indexeol ( IFILE *f, long bit, int *c )
+{
+  PAGE *p = f->page ;
+  long i, n ;
+  int x ;
+
+  *c = 0 ;
+  if ( bit < EOLBITS || 
+       fseek ( f->f, p->offset + ( bit - EOLBITS ) / 8, SEEK_SET ) )
+    return EOF ;
+
+  for ( i = ( bit - EOLBITS ) / 8 ; i < ( bit + 7 ) / 8 ; i++ ) {
+    if ( ( *c = fgetc ( f->f ) ) == EOF ) 
+      return EOF ;
+    x = p->revbits ? normalbits [ *c ] : *c ;
+    for ( n = i * 8 ; n < i * 8 + 8 ; n++ )	/* 11 zeros and a one */
+      if ( n >= bit - EOLBITS && n < bit && 
+	   ( x >> ( 7 - n % 8 ) & 1 ) != ( n == bit - 1 ) )
+	return EOF ;
+  }
+
+  if ( ! ( bit % 8 ) ) *c = 0 ;
+
+  return 0 ;
+}
+
+
+/* Position the current page of IFILE f so that the next
+   readline() returns scan line `line' (0 is the first).  Fax pages
+   that have been decoded (see fax_strips()) are positioned
+   directly and others are decoded from the nearest indexed line
+   (see LINEINDEX) if they have an index.  Other pages are read
+   from the current line, or from the start if `line' has already
+   been read.  Returns 0 if OK, EOF (and no more lines will be
+   read) if the page has fewer lines or 2 on errors. */
+
+int seekline ( IFILE *f, int line )
+{
+  int err=0, k, c ;
+  long bit, where ;
+  short runs [ MAXRUNS ] ;
+  PAGE *p = f->page ;
+
+  if ( line < 0 ) line = 0 ;
+
+  if ( f->arena ) {
+    f->strip = 0 ;
+    f->line = line ;
+    while ( f->strip < f->narena && 
+	    f->line >= f->arena [ f->strip ].nlines ) 
+      f->line -= f->arena [ f->strip++ ].nlines ;
+    f->lineno = line ;
+    if ( f->strip >= f->narena ) 
+      f->lines = 0 ;
+    return f->lines ? 0 : EOF ;
+  }
+
+  if ( p->format == P_FAX && p->lineidx && 
+       ( k = line / p->linestep ) > 0 ) {
+    if ( k >= p->nlineidx ) k = p->nlineidx - 1 ;
+    if ( k * p->linestep > f->lineno || line < f->lineno ) {
+      bit = p->lineidx [ k ] ;
+      if ( ( where = ftell ( f->f ) ) < 0 )
+	return msg ( "ES2 can't read file position:" ) ;
+      if ( indexeol ( f, bit, &c ) ) {	/* decode from here instead */
+	msg ( "W bad TIFF line index entry for line %d ignored", 
+	      k * p->linestep ) ;
+	if ( fseek ( f->f, where, SEEK_SET ) )
+	  return msg ( "ES2 seek failed" ) ;
+      } else {
+	newDECODER ( &f->d, p->revbits, p->black_is_zero ) ;
+	if ( bit % 8 ) 
+	  skipbits ( &f->d, c, bit % 8 ) ;
+	f->lineno = k * p->linestep ;
+      }
+    }
+  }
+
+  if ( line < f->lineno )
+    err = nextipage ( f, 0 ) ;
+
+  while ( ! err && f->lineno < line )
+    if ( readline ( f, runs, 0 ) < 0 ) {
+      f->lines = 0 ;		/* don't read past the end */
+      err = EOF ;
+    }
+
+  return err ;
+}
+
+
 /* Deduce the file type by scanning buffer p of n bytes. */
    
 int getformat ( uchar *p, int n )
@@ -701,7 +1352,19 @@ int getformat ( uchar *p, int n )
     format = I_PBM ;
   }
 
-  if ( ! format && n >= 128 && p[0] == 0x0a && 
+  if ( ! format && ! strncmp ( (char*) p, "P5", 2 ) ) {
+    format = I_PGM ;
+  }
+
+  if ( ! format && ! strncmp ( (char*) p, "%PDF", 4 ) ) {
+    format = I_PDF ;
+  }
+
+  if ( ! format && ! strncmp ( (char*) p, "%efax-cover", 11 ) ) {
+    format = I_COVER ;
+  }
+
+  if ( ! format && n >= 128 && p[0] == 0x0a && 
        strchr ("\02\03\05", p[1] ) && p[2] <= 1 ) {
     if ( p[65] != 1 ) {
       msg ( "E can't read colour PCX" ) ;
@@ -746,6 +1409,7 @@ void page_init ( PAGE *p, char *fn )
 {
   p->fname = fn ;
   p->offset = 0 ;
+  p->length = 0 ;
   p->w = DEFWIDTH ;
   p->h = DEFHEIGHT ;
   p->xres = DEFXRES ;
@@ -753,6 +1417,39 @@ void page_init ( PAGE *p, char *fn )
   p->format = P_FAX ;
   p->revbits = 0 ;
   p->black_is_zero = 0 ;
+  p->maxval = 255 ;
+  p->nstrips = 1 ;
+  p->rowsperstrip = 0 ;
+  p->stripoff = 0 ;
+  p->stripbytes = 0 ;
+  p->linestep = 0 ;
+  p->lineidx = 0 ;
+  p->nlineidx = 0 ;
+  p->cover = 0 ;
+  p->field = 0 ;
+  p->nfield = 0 ;
+}
+
+/* Release the strip tables and line index of a page that could
+   not be scanned (freeIFILE() only releases those of pages up to
+   lastpage). */
+
+static void dropcover ( struct coverstruct *c ) ;
+
+void freepage ( PAGE *p )
+{
+  free ( p->stripoff ) ;
+  free ( p->stripbytes ) ;
+  free ( p->lineidx ) ;
+  p->stripoff = p->stripbytes = 0 ;
+  p->lineidx = 0 ;
+  p->nlineidx = 0 ;
+  dropcover ( p->cover ) ;
+  p->cover = 0 ;
+  while ( p->nfield > 0 )
+    free ( p->field [ --p->nfield ].text ) ;
+  free ( p->field ) ;
+  p->field = 0 ;
 }
 
 void page_report ( PAGE *p, int fmt, int n )
@@ -797,6 +1494,7 @@ char *tagname ( int tag )
   { 296, "resolution units(2=in,3=cm)" },
   { 297, "page number" },
   { 327, "clean fax(0=clean/1=regen/2=errors)" },
+  { TIFFLINEINDEX, "efax line index" },
   {0,0} },
   *p ;
   
@@ -837,6 +1535,55 @@ int fread4 ( unsigned long *p, IFILE *f )
 }
 
 
+/* Read an array of count SHORT (type 3) or LONG (type 4) values
+   of a TIFF tag into a new heap array.  tv is the offset to the
+   values; if they fit in the directory entry they are taken from
+   the shorts a and b or from tv itself.  Returns the array or NULL
+   on errors. */
+
+long *tiff_array ( IFILE *f, int type, unsigned long count, 
+		  unsigned long tv, unsigned short a, unsigned short b )
+{
+  int err=0 ;
+  unsigned long i, v ;
+  unsigned short sv ;
+  long *vals, where=0 ;
+
+  if ( ( type != 3 && type != 4 ) || ! count || 
+       ! ( vals = malloc ( count * sizeof(long) ) ) )
+    return 0 ;
+
+  if ( type == 3 && count <= 2 ) {
+    vals [ 0 ] = a ;
+    if ( count > 1 ) vals [ 1 ] = b ;
+  } else if ( type == 4 && count == 1 ) {
+    vals [ 0 ] = tv ;
+  } else if ( ( where = ftell ( f->f ) ) < 0 ) {
+    err = 1 ;
+  } else {
+    err = fseek ( f->f, tv, SEEK_SET ) ;
+    for ( i=0 ; ! err && i < count ; i++ ) {
+      if ( type == 3 ) {
+	err = fread2 ( &sv, f ) ;
+	vals [ i ] = sv ;
+      } else {
+	err = fread4 ( &v, f ) ;
+	vals [ i ] = v ;
+      }
+    }
+    if ( fseek ( f->f, where, SEEK_SET ) ) /* even after errors */
+      err = 1 ;
+  }
+
+  if ( err ) {
+    free ( vals ) ;
+    vals = 0 ;
+  }
+
+  return vals ;
+}
+
+
 /* Read a TIFF directory at current file offset, save image
    format information and seek to next directory if any.  Returns
    0 if OK, 2 on errors. */
@@ -844,8 +1591,8 @@ int fread4 ( unsigned long *p, IFILE *f )
 int tiff_next ( IFILE *f )
 {
   int err=0 ;
-  unsigned short ntag, tag, type ;
-  unsigned long count, tv ;
+  unsigned short ntag, tag, type, a=0, b=0 ;
+  unsigned long count, tv, nbytes=0, bps=1 ;
   double ftv ;
 
   msg ( "F+ TIFF directory at %ld", ftell ( f->f ) ) ;
@@ -863,7 +1610,6 @@ int tiff_next ( IFILE *f )
     err = err || fread4 ( &count, f ) ;
 
     if ( type == 3 ) {		      /* left-aligned short */
-      unsigned short a, b ;
       err = err || fread2 ( &a, f ) ;
       err = err || fread2 ( &b, f ) ;
       tv = a ;
@@ -906,6 +1652,9 @@ int tiff_next ( IFILE *f )
     case 257 :			/* height */
       f->page->h = tv ;
       break ;
+    case 258 :			/* bits/sample */
+      bps = count == 1 ? tv : 0 ;
+      break ;
     case 259 :			/* compression: 1=none, 3=G3 */
       if ( tv == 1 ) {
 	f->page->format = P_RAW ;
@@ -921,11 +1670,27 @@ int tiff_next ( IFILE *f )
     case 266 :			/* fill order */
       f->page->revbits = ( tv == 2 ? 1 : 0 ) ;
       break ;
-    case 273 :			/* data offset */
-      if ( count != 1 )
-	err = msg ( "E2can't read multi-strip TIFF files" ) ;
-      else
+    case 273 :			/* data offset(s) */
+      if ( count == 1 ) {
 	f->page->offset = tv ;
+      } else if ( ! ( f->page->stripoff = 
+		      tiff_array ( f, type, count, tv, a, b ) ) ) {
+	err = msg ( "E2can't read TIFF strip offsets" ) ;
+      } else {
+	f->page->nstrips = count ;
+	f->page->offset = f->page->stripoff [ 0 ] ;
+      }
+      break ;
+    case 278 :			/* rows per strip */
+      f->page->rowsperstrip = tv ;
+      break ;
+    case 279 :			/* strip byte counts */
+      if ( count > 1 && ! ( f->page->stripbytes = 
+			    tiff_array ( f, type, count, tv, a, b ) ) )
+	err = msg ( "E2can't read TIFF strip byte counts" ) ;
+      if ( count == 1 )
+	f->page->length = tv ;
+      nbytes = count ;
       break ;
     case 282 :			/* x resolution */
       f->page->xres = ftv ;
@@ -945,6 +1710,15 @@ int tiff_next ( IFILE *f )
 	f->page->yres *= 2.54 ;
       }
       break ;
+    case TIFFLINEINDEX :	/* line interval & offsets */
+      if ( type == 4 && count > 1 && 
+	   ( f->page->lineidx = tiff_array ( f, type, count, tv, a, b ) ) ) {
+	f->page->linestep = f->page->lineidx [ 0 ] ;
+	f->page->nlineidx = count - 1 ;
+	memmove ( f->page->lineidx, f->page->lineidx + 1, 
+		  ( count - 1 ) * sizeof(long) ) ;
+      }
+      break ;
     }
 
   } /* end of tag reading loop */
@@ -954,6 +1728,41 @@ int tiff_next ( IFILE *f )
     msg ( "W missing TIFF compression format, set to raw" ) ;
     f->page->format = P_RAW ;
   }
+
+  if ( ! err && bps == 8 ) {
+    if ( f->page->format != P_RAW ) 
+      err = msg ( "E2can only read uncompressed grey-scale TIFF" ) ;
+    else if ( f->page->w > MAXGREYW )
+      err = msg ( "E2grey-scale TIFF too wide (%d pels)", f->page->w ) ;
+    else
+      f->page->format = P_GREY ;
+  } else if ( ! err && bps != 1 ) {
+    err = msg ( "E2can only read 1- or 8-bit grey-scale TIFF" ) ;
+  }
+
+  if ( ! err && f->page->nstrips > 1 ) {
+    if ( ! f->page->stripbytes || nbytes != f->page->nstrips )
+      err = msg ( "E2 missing or bad TIFF strip byte counts" ) ;
+    else
+      msg ( "F+ , %d strips", f->page->nstrips ) ;
+  }
+
+  if ( f->page->lineidx ) {
+    PAGE *p = f->page ;
+    int i ;
+    for ( i=1 ; i < p->nlineidx && p->lineidx [ i ] > p->lineidx [ i-1 ] ; 
+	  i++ ) ;
+    if ( p->format != P_FAX || p->nstrips > 1 || p->linestep < 1 || 
+	 i < p->nlineidx || p->lineidx [ 0 ] < 0 || 
+	 ( p->length && p->lineidx [ i-1 ] >= p->length * 8 ) ) {
+      msg ( "W bad TIFF line index ignored" ) ;
+      free ( p->lineidx ) ;
+      p->lineidx = 0 ;
+      p->nlineidx = 0 ;
+    } else {
+      msg ( "F+ , %d lines indexed", p->nlineidx ) ;
+    }
+  }
   
   if ( ! err ) {
 
@@ -1000,7 +1809,8 @@ int tiff_first ( IFILE *f )
 
 int text_next ( IFILE *f )
 {
-  int err = 0, i, nc ;
+  int err = 0, i, n = 0, nc ;
+  long line = 0 ;
   char buf [ MAXLINELEN ] ;
 
   f->page->offset = ftell ( f->f ) ;
@@ -1008,10 +1818,21 @@ int text_next ( IFILE *f )
 
   nc = ( f->page->w - f->lmargin ) / f->charw ;
 
-  if ( nc > MAXLINELEN ) 
-    nc = MAXLINELEN ;
+  /* count rows as readline() wraps them; a page may end part way
+     through a long line */
+
+  buf [ 0 ] = 0 ;
+  for ( i = 0 ; i < f->pglines ; i++ ) {
+    if ( ! buf [ n ] || buf [ n ] == '\n' ) {
+      line = ftell ( f->f ) ;
+      if ( ! fgets ( buf, MAXLINELEN, f->f ) ) break ;
+      n = 0 ;
+    }
+    n += textwrap ( (uchar*) buf + n, nc ) ;
+  }
 
-  for ( i = 0 ; i < f->pglines && fgets ( buf, nc, f->f ) ; i++ ) ;
+  if ( buf [ n ] && buf [ n ] != '\n' )
+    fseek ( f->f, line + n, SEEK_SET ) ;
 
   f->next = ! feof(f->f) ? ftell ( f->f ) : 0 ;
 
@@ -1021,14 +1842,19 @@ int text_next ( IFILE *f )
 }
 
 
-int text_first ( IFILE *f )
+faxfont defaultfont ;
+
+void initdefaultfont ( void )
 {
-  static faxfont defaultfont ;
+  readfont ( 0, &defaultfont ) ;
+}
 
+int text_first ( IFILE *f )
+{
   if ( ! f->font ) {
     /* use default font scaled 2X, 1 inch margin, 66 lines/page */
+    ONCE ( initdefaultfont ) ;
     f->font = &defaultfont ;
-    readfont ( 0, f->font ) ; 
     if ( ! f->charw ) f->charw = 2 * f->font->w ;
     if ( ! f->charh ) f->charh = 2 * f->font->h ;
     if ( ! f->lmargin ) f->lmargin = 204 ;
@@ -1044,6 +1870,343 @@ int text_first ( IFILE *f )
 }
 
 
+/* File handling for cover pages.  A cover page file is text
+   starting with the line "%efax-cover", followed by lines
+
+     template FILE
+     field X,Y,W,H[UNITS] TEXT
+
+   The template, an image in any format efaxlib reads (with a
+   relative name taken from the cover page file's directory), is
+   drawn under the fields; without one the page is blank.  TEXT is
+   set in the text font, H high, in the box with its top left
+   corner X,Y from the top left of the page and width W, and is
+   clipped to the box.  UNITS are in (the default), cm, mm or pt.
+   In TEXT, %P is replaced by the number of pages in the input
+   files, or by the IFILE's npages if that is set, and %% by %.
+   Blank lines and lines starting with # are ignored.
+
+   Templates are decoded once and kept while any page uses them,
+   and for use by later pages while the file is unchanged, so a
+   program which converts many cover pages (e.g. efix in server
+   mode) only sets the text of each. */
+
+typedef struct coverstruct {
+  char *fname ;			/* template file */
+  time_t mtime ;		/* its modification time... */
+  off_t size ;			/* ...and size when decoded */
+  int w, h ;			/* image size */
+  float xres, yres ;		/* and resolution */
+  RUNARENA a ;			/* decoded scan lines */
+  int refs ;			/* pages using the template */
+  int stale ;			/* the file has changed since */
+  struct coverstruct *next ;
+} COVER ;
+
+static COVER *covers ;		/* templates decoded so far */
+
+#ifdef HAVE_PTHREAD_H
+static pthread_mutex_t coverlock = PTHREAD_MUTEX_INITIALIZER ;
+#define LOCKCOVERS() pthread_mutex_lock ( &coverlock )
+#define UNLOCKCOVERS() pthread_mutex_unlock ( &coverlock )
+#else
+#define LOCKCOVERS()
+#define UNLOCKCOVERS()
+#endif
+
+/* Free templates that have changed and are no longer used.  Must
+   be called with the template list locked. */
+
+static void sweepcovers ( void )
+{
+  COVER **pc, *c ;
+
+  for ( pc = &covers ; ( c = *pc ) ; )
+    if ( c->stale && ! c->refs ) {
+      *pc = c->next ;
+      freearena ( &c->a ) ;
+      free ( c->fname ) ;
+      free ( c ) ;
+    } else {
+      pc = &c->next ;
+    }
+}
+
+/* Decode the first page of image file fname into a new template.
+   Returns the template or null on errors. */
+
+static COVER *readcover ( char *fname, struct stat *st )
+{
+  int err=0, n, nr, pels ;
+  char *fnames [ 2 ] = { 0, 0 } ;
+  uchar buf [ 128 ] ;
+  short runs [ MAXRUNS ] ;
+  FILE *fp ;
+  COVER *c ;
+  IFILE t ;
+
+  /* a template can't be a cover page */
+
+  if ( ! ( fp = fopen ( fname, "rb" ) ) ) {
+    msg ( "ES2 can't open cover page template %s:", fname ) ;
+    return 0 ;
+  }
+  n = fread ( buf, 1, sizeof(buf), fp ) ;
+  fclose ( fp ) ;
+  if ( getformat ( buf, n ) == I_COVER ) {
+    msg ( "E2 cover page template %s is a cover page", fname ) ;
+    return 0 ;
+  }
+
+  if ( ! ( c = calloc ( 1, sizeof(COVER) ) ) || 
+       ! ( c->fname = strdup ( fname ) ) ) {
+    free ( c ) ;
+    msg ( "E2 out of memory for cover page" ) ;
+    return 0 ;
+  }
+  c->mtime = st->st_mtime ;
+  c->size = st->st_size ;
+
+  fnames [ 0 ] = fname ;
+  if ( newIFILE ( &t, fnames ) || nextipage ( &t, 0 ) ) {
+    err = msg ( "E2 can't read cover page template %s", fname ) ;
+  } else {
+    c->w = t.page->w ;
+    c->h = t.page->h ;
+    c->xres = t.page->xres ;
+    c->yres = t.page->yres ;
+    while ( ! err && ( nr = readline ( &t, runs, &pels ) ) >= 0 )
+      if ( arenaline ( &c->a, runs, nr, pels ) )
+	err = msg ( "E2 out of memory for cover page" ) ;
+  }
+  freeIFILE ( &t ) ;
+
+  if ( err ) {
+    freearena ( &c->a ) ;
+    free ( c->fname ) ;
+    free ( c ) ;
+    return 0 ;
+  }
+
+  msg ( "F decoded cover page template %s (%d lines)", fname, c->a.nlines ) ;
+
+  return c ;
+}
+
+/* Get the template for image file fname, decoding it if it hasn't
+   been decoded or has changed since.  Returns the template or null
+   on errors.  Release it with dropcover(). */
+
+static COVER *getcover ( char *fname )
+{
+  COVER *c ;
+  struct stat st ;
+
+  if ( stat ( fname, &st ) ) {
+    msg ( "ES2 can't open cover page template %s:", fname ) ;
+    return 0 ;
+  }
+
+  LOCKCOVERS() ;
+
+  for ( c = covers ; c ; c = c->next )
+    if ( ! c->stale && ! strcmp ( c->fname, fname ) ) {
+      if ( c->mtime == st.st_mtime && c->size == st.st_size ) break ;
+      c->stale = 1 ;
+    }
+
+  if ( ! c && ( c = readcover ( fname, &st ) ) ) {
+    c->next = covers ;
+    covers = c ;
+  }
+  
+  if ( c ) c->refs++ ;
+  sweepcovers () ;
+
+  UNLOCKCOVERS() ;
+
+  return c ;
+}
+
+static void dropcover ( COVER *c )
+{
+  if ( c ) {
+    LOCKCOVERS() ;
+    c->refs-- ;
+    sweepcovers () ;
+    UNLOCKCOVERS() ;
+  }
+}
+
+/* Parse "X,Y,W,H[UNITS]" at s into field fld.  Returns the number
+   of characters read, including following spaces, or 0 on
+   errors. */
+
+static int coverbox ( char *s, COVERFIELD *fld )
+{
+  int i, n, nc = 0 ;
+  static char *unitstr[] = { "in", "cm", "mm", "pt", 0 } ;
+  static float unitval[] = { 1.0, 2.54, 25.4, 72.0 } ;
+  
+  if ( sscanf ( s, "%f,%f,%f,%f%n", 
+		&fld->x, &fld->y, &fld->w, &fld->h, &nc ) < 4 )
+    return 0 ;
+
+  if ( s [ nc ] && ! isspace ( s [ nc ] ) ) {
+    for ( n = nc ; s [ n ] && ! isspace ( s [ n ] ) ; n++ ) ;
+    for ( i = 0 ; unitstr [ i ] && ( strlen ( unitstr [ i ] ) != n - nc ||
+				   strncmp ( unitstr [ i ], s + nc, n - nc ) ) ;
+	  i++ ) ;
+    if ( ! unitstr [ i ] ) return 0 ;
+    fld->x /= unitval [ i ] ;
+    fld->y /= unitval [ i ] ;
+    fld->w /= unitval [ i ] ;
+    fld->h /= unitval [ i ] ;
+    nc = n ;
+  }
+
+  while ( isspace ( s [ nc ] ) ) nc++ ;
+
+  return nc ;
+}
+
+int cover_first ( IFILE *f )
+{
+  int err=0, n, len ;
+  char buf [ MAXLINELEN ], *p, *q, *fname ;
+  COVERFIELD *fld ;
+  PAGE *pg = f->page ;
+
+  pg->format = P_COVER ;
+  f->next = 0 ;
+
+  ONCE ( initdefaultfont ) ;
+
+  fseek ( f->f, 0, SEEK_SET ) ;
+  fgets ( buf, sizeof(buf), f->f ) ; /* "%efax-cover" */
+
+  while ( ! err && fgets ( buf, sizeof(buf), f->f ) ) {
+    
+    buf [ strcspn ( buf, "\r\n" ) ] = 0 ;
+    for ( p = buf ; isspace ( *p ) ; p++ ) ;
+    if ( ! *p || *p == '#' ) continue ;
+    for ( q = p ; *q && ! isspace ( *q ) ; q++ ) ;
+    if ( *q ) *q++ = 0 ;
+    while ( isspace ( *q ) ) q++ ;
+
+    if ( ! strcmp ( p, "template" ) && *q && ! pg->cover ) {
+
+      /* relative names are relative to the cover page file */
+      len = *q != '/' && ( p = strrchr ( pg->fname, '/' ) ) ? 
+	p - pg->fname + 1 : 0 ;
+      if ( ! ( fname = malloc ( len + strlen ( q ) + 1 ) ) ) {
+	err = msg ( "E2 out of memory for cover page" ) ;
+      } else {
+	memcpy ( fname, pg->fname, len ) ;
+	strcpy ( fname + len, q ) ;
+	if ( ! ( pg->cover = getcover ( fname ) ) ) {
+	  err = 2 ;
+	} else {
+	  pg->w = pg->cover->w ;
+	  pg->h = pg->cover->h ;
+	  pg->xres = pg->cover->xres ;
+	  pg->yres = pg->cover->yres ;
+	}
+	free ( fname ) ;
+      }
+
+    } else if ( ! strcmp ( p, "field" ) ) {
+
+      if ( ! ( fld = realloc ( pg->field, 
+			       ( pg->nfield + 1 ) * sizeof(COVERFIELD) ) ) ) {
+	err = msg ( "E2 out of memory for cover page" ) ;
+      } else {
+	pg->field = fld ;
+	fld += pg->nfield ;
+	if ( ! ( n = coverbox ( q, fld ) ) ) {
+	  err = msg ( "E2 bad cover page field box in \"%s\"", q ) ;
+	} else if ( ! ( fld->text = strdup ( q + n ) ) ) {
+	  err = msg ( "E2 out of memory for cover page" ) ;
+	} else {
+	  pg->nfield++ ;
+	}
+      }
+
+    } else {
+      err = msg ( "E2 bad cover page line \"%s %s\"", p, q ) ;
+    }
+  }
+
+  if ( ! err && ferror ( f->f ) )
+    err = msg ( "ES2 can't read cover page file:" ) ;
+
+  return err ;
+}
+
+#define cover_next 0
+#define cover_reset 0
+
+
+/* Make scan line f->lineno of a cover page: the template's line
+   with the text of any fields on this line OR-ed in.  Returns
+   number of runs or EOF at end of page. */
+
+int coverruns ( IFILE *f, short *runs, int *pels )
+{
+  int i, n, nr, fnr, fpels, tpels, y, h, right ;
+  char *p, text [ MAXLINELEN ] ;
+  short fruns [ MAXRUNS ] ;
+  COVER *c = f->page->cover ;
+  COVERFIELD *fld ;
+  faxfont *font = f->font ? f->font : &defaultfont ;
+  float xres = f->page->xres, yres = f->page->yres ;
+
+  if ( f->lineno >= f->page->h )
+    return EOF ;
+
+  if ( c && f->lineno < c->a.nlines ) {
+    nr = c->a.start [ f->lineno + 1 ] - c->a.start [ f->lineno ] ;
+    memcpy ( runs, c->a.runs + c->a.start [ f->lineno ], nr * sizeof(short) ) ;
+    fpels = c->a.pels [ f->lineno ] ;
+  } else {
+    runs [ 0 ] = fpels = f->page->w ;
+    nr = 1 ;
+  }
+
+  for ( fld = f->page->field, i = 0 ; i < f->page->nfield ; i++, fld++ ) {
+
+    y = f->lineno - fld->y * yres ;
+    h = fld->h * yres + 0.5 ;
+    if ( y < 0 || y >= h ) continue ;
+
+    for ( n = 0, p = fld->text ; *p && n < MAXLINELEN - 12 ; p++ ) 
+      if ( *p == '%' && p[1] == 'P' ) {
+	n += sprintf ( text + n, "%d", f->npages ? f->npages :
+		       (int) ( f->lastpage - f->pages + 1 ) ) ;
+	p++ ;
+      } else {
+	text [ n++ ] = *p ;
+	if ( *p == '%' && p[1] == '%' ) p++ ;
+      }
+
+    /* cell width keeps the font's shape at this resolution */
+    fnr = textruns ( (uchar*) text, n, font, y,
+		     ( fld->h * font->w * xres ) / font->h + 0.5, h, 
+		     fld->x * xres + 0.5, fruns, &tpels ) ;
+
+    right = ( fld->x + fld->w ) * xres + 0.5 ;	/* clip to the box */
+    if ( tpels > right )
+      fnr = xpad ( fruns, fnr, right - tpels ) ;
+
+    nr = runor ( runs, nr, fruns, fnr, 0, &fpels ) ;
+  }
+
+  if ( pels ) *pels = fpels ;
+
+  return nr ;
+}
+
+
 /* File handling for PBM files */
 
 int pbm_first ( IFILE *f )
@@ -1070,6 +2233,36 @@ int pbm_first ( IFILE *f )
 #define pbm_next 0
 
 
+/* File handling for PGM files */
+
+int pgm_first ( IFILE *f )
+{
+  int err=0 ;
+
+  fseek ( f->f, 2, SEEK_SET ) ;
+
+  if ( ! ( f->page->w = pbmdim ( f ) ) || ! ( f->page->h = pbmdim ( f ) ) ||
+       ! ( f->page->maxval = pbmdim ( f ) ) ) {
+    err = msg ( "E2 EOF or 0 dimension in PGM header" ) ;
+  } else if ( f->page->maxval > 255 ) {
+    err = msg ( "E2 can't read 16-bit PGM" ) ;
+  } else if ( f->page->w > MAXGREYW ) {
+    err = msg ( "E2 PGM too wide (%d pels)", f->page->w ) ;
+  } else {
+    msg ( "F read %dx%d PGM header", f->page->w, f->page->h ) ;
+  }
+
+  f->page->offset = ftell ( f->f ) ;
+  f->page->format = P_GREY ;
+  f->page->black_is_zero = 1 ;
+  f->next = 0 ;
+
+  return err ;
+}
+
+#define pgm_next 0
+
+
 /* File handling for FAX files */
 
 #define fax_first 0
@@ -1156,85 +2349,1465 @@ int dcx_first ( IFILE *f )
 }
 
 
-#define raw_reset 0
-#define raw_first 0
-#define raw_next 0
+/* File handling for PDF files.  Only files in which each page
+   is a single bi-level image, such as those written by scanners,
+   fax programs and efix, can be read.  The cross-reference table
+   or stream is used to find the page tree and the image of each
+   page.  1-D (K=0) CCITT data is then read like the data in a
+   TIFF/G3 file and Flate-compressed or uncompressed bit maps are
+   decoded into memory when the page is opened.  Other PDF files
+   have to be rasterized first (e.g. by Ghostscript). */
 
+#define PDFMAXDEPTH 32		/* deepest page tree or xref chain */
 
-/* input file state reset for different compression methods */
+typedef struct pdfdocstruct {
+  char *buf ;			/* the file, null-terminated */
+  long len ;			/* file length */
+  long nobj ;			/* cross-reference entries */
+  long *off ;			/* object offset or object stream number */
+  long *idx ;			/* index in object stream or -1 */
+  char **stm ;			/* decoded object streams */
+  PAGE *pages ;			/* the pages found */
+  int npages, maxpages ;	/* pages found & allocated */
+} PDFDOC ;
 
-#define pcx_reset 0
-#define pbm_reset 0
+#define PDFDELIM(c) ( (c) && strchr ( "()<>[]{}/%", (c) ) )
 
-int text_reset ( IFILE *f )
+/* Skip white space and comments.  Returns pointer to the next
+   token. */
+
+char *pdfws ( char *p )
 {
-  int err=0 ;
+  for ( ;; ) {
+    while ( isspace ( (uchar) *p ) ) p++ ;
+    if ( *p != '%' ) return p ;
+    while ( *p && *p != '\n' && *p != '\r' ) p++ ;
+  }
+}
 
-  f->lines = ( ( f->pglines * f->charh ) / f->charh ) * f->charh ;
-  f->txtlines = 0 ;
-  f->page->yres = f->lines > 1078 ? 196 : 98 ; /* BOGUS */
+/* Skip one token or (for strings, arrays and dictionaries)
+   object.  References are skipped as three tokens.  Returns
+   pointer to the following character. */
 
-  return err ;
+char *pdfskip ( char *p )
+{
+  int n = 0 ;
+
+  p = pdfws ( p ) ;
+
+  switch ( *p ) {
+  case 0 :
+    break ;
+  case '(' :
+    for ( p++ ; *p && ( *p != ')' || n ) ; p++ ) {
+      if ( *p == '\\' && p[1] ) p++ ;
+      else if ( *p == '(' ) n++ ;
+      else if ( *p == ')' ) n-- ;
+    }
+    if ( *p ) p++ ;
+    break ;
+  case '<' :
+    if ( p[1] == '<' ) {
+      for ( p = pdfws ( p+2 ) ; *p && ! ( p[0] == '>' && p[1] == '>' ) ; 
+	    p = pdfws ( p ) ) 
+	p = pdfskip ( p ) ;
+      if ( *p ) p += 2 ;
+    } else {
+      while ( *p && *p != '>' ) p++ ;
+      if ( *p ) p++ ;
+    }
+    break ;
+  case '[' :
+    for ( p = pdfws ( p+1 ) ; *p && *p != ']' ; p = pdfws ( p ) )
+      p = pdfskip ( p ) ;
+    if ( *p ) p++ ;
+    break ;
+  case ')' : case '>' : case ']' : case '{' : case '}' :
+    p++ ;
+    break ;
+  default :			/* names, numbers and keywords */
+    for ( p++ ; *p && ! isspace ( (uchar) *p ) && ! PDFDELIM ( *p ) ; p++ ) ;
+    break ;
+  }
+
+  return p ;
 }
 
-int fax_reset ( IFILE *f )
+/* Skip a value, which may be an indirect reference. */
+
+char *pdfskipval ( char *p )
 {
-  int pels ;
-  short runs [ MAXRUNS ] ;
-  
-  newDECODER ( &f->d ) ;
-  if ( readruns ( f, runs, &pels ) < 0 || pels ) /* skip first EOL */
-    msg ( "W first line has %d pixels: probably not fax data", pels ) ;
-  f->lines = -1 ;
+  char *q = pdfskip ( p ), *r ;
+
+  p = pdfws ( p ) ;
+  if ( isdigit ( (uchar) *p ) ) {
+    r = pdfws ( q ) ;
+    if ( isdigit ( (uchar) *r ) ) {
+      r = pdfws ( pdfskip ( r ) ) ;
+      if ( r[0] == 'R' && ( ! r[1] || isspace ( (uchar) r[1] ) || 
+			    PDFDELIM ( r[1] ) ) )
+	q = r + 1 ;
+    }
+  }
+  return q ;
+}
 
-  return 0 ;
+/* Return true if the token at p is the keyword or name s. */
+
+int pdfis ( char *p, char *s )
+{
+  int n = strlen ( s ) ;
+  p = pdfws ( p ) ;
+  return ! strncmp ( p, s, n ) && ( ! p[n] || isspace ( (uchar) p[n] ) || 
+				    PDFDELIM ( p[n] ) ) ;
 }
 
+/* Read an integer.  Returns 0 if the token at p is not an
+   integer. */
 
-/* Skip to start of same (dp=0) or next (dp=1) page image.
-   Returns 0 if OK, 1 if no more pages, 2 on errors. */
+int pdfint ( char *p, long *v )
+{
+  char *e ;
+  p = pdfws ( p ) ;
+  if ( ! isdigit ( (uchar) *p ) && *p != '-' && *p != '+' ) return 0 ;
+  *v = strtol ( p, &e, 10 ) ;
+  return e > p && *e != '.' ;
+}
 
-int nextipage ( IFILE *f, int dp )
+char *pdfobject ( PDFDOC *d, long n ) ;
+
+/* Resolve value v if it is an indirect reference.  Returns
+   pointer to the value or null if there is none. */
+
+char *pdfderef ( PDFDOC *d, char *v )
 {
-  int err=0 ;
-  char *message ;
+  long n ;
+  char *q ;
+
+  if ( ! v ) return 0 ;
+  v = pdfws ( v ) ;
+  q = pdfskipval ( v ) ;
+  if ( pdfint ( v, &n ) && q > pdfskip ( v ) )
+    return pdfobject ( d, n ) ;
+  return v ;
+}
 
-#ifdef ENABLE_NLS
-  gsize written = 0 ;
-  char *conv_fname ;
-#endif
+/* Find the value of key (e.g. "/Type") in the dictionary at p.
+   Indirect values are resolved.  Returns pointer to the value or
+   null if there is no dictionary or no such key. */
 
-  int ( *reset [NPFORMATS] ) ( IFILE * ) = {
-    raw_reset, fax_reset, pbm_reset, text_reset, pcx_reset
-  }, (*pf)(IFILE*) ;
+char *pdfkey ( PDFDOC *d, char *p, char *key )
+{
+  int n = strlen ( key ) ;
+  char *q ;
 
-  /* close current file if any and set to NULL */
+  if ( ! p ) return 0 ;
+  p = pdfws ( p ) ;
+  if ( p[0] != '<' || p[1] != '<' ) return 0 ;
 
-  if ( f->f ) {
-    fclose ( f->f ) ;
-    f->f = 0 ;
+  for ( p = pdfws ( p+2 ) ; *p == '/' ; p = pdfws ( pdfskipval ( q ) ) ) {
+    q = pdfskip ( p ) ;
+    if ( q - p == n && ! strncmp ( p, key, n ) )
+      return pdfderef ( d, q ) ;
   }
 
-  /*  if requested, point to next page and check if done */
+  return 0 ;
+}
 
-  if ( dp ) {
-    f->page++ ;
-  }
-  
-  if ( f->page > f->lastpage ) {
-    err = 1 ;
+/* Get an integer value from dictionary p.  Returns the value or
+   def if there is no such key. */
+
+long pdfkeyint ( PDFDOC *d, char *p, char *key, long def )
+{
+  long n ;
+  char *v = pdfkey ( d, p, key ) ;
+  return v && pdfint ( v, &n ) ? n : def ;
+}
+
+/* If v is a one-element array return pointer to the element. */
+
+char *pdfunwrap ( PDFDOC *d, char *v )
+{
+  char *q ;
+  if ( v && *( v = pdfws ( v ) ) == '[' ) {
+    q = pdfws ( pdfskipval ( v+1 ) ) ;
+    v = *q == ']' ? pdfderef ( d, v+1 ) : 0 ;
   }
+  return v ;
+}
 
-  /* open the file and seek to start of image data */
+/* Return true if the value of key in dictionary p is the name
+   or keyword s (or a one-element array holding it). */
 
-  if ( ! err ) {
-    f->f = fopen ( f->page->fname, (f->page->format == P_TEXT) ? "r" : "rb" ) ;
-    if ( ! f->f ) {
-      message = strdup2 ( "ES2 ", gettext ( "can't open file %s:" ) ) ;
-      if ( message ) {
-#ifdef ENABLE_NLS
-	if ( use_utf8 && !g_utf8_validate ( f->page->fname, -1, NULL ) ) {
-	  conv_fname = g_filename_to_utf8 ( f->page->fname, -1, NULL, &written, NULL ) ;
+int pdfname ( PDFDOC *d, char *p, char *key, char *s )
+{
+  char *v = pdfunwrap ( d, pdfkey ( d, p, key ) ) ;
+  return v && pdfis ( v, s ) ;
+}
+
+/* Find the data of the stream object at p.  Returns pointer to
+   the data and its length in len or null on errors. */
+
+uchar *pdfstream ( PDFDOC *d, char *p, long *len )
+{
+  char *q ;
+
+  if ( ! p || ( *len = pdfkeyint ( d, p, "/Length", -1 ) ) < 0 ) return 0 ;
+
+  q = pdfws ( pdfskip ( p ) ) ;
+  if ( ! pdfis ( q, "stream" ) ) return 0 ;
+  q += 6 ;
+  if ( *q == '\r' ) q++ ;
+  if ( *q == '\n' ) q++ ;
+
+  if ( q + *len > d->buf + d->len ) return 0 ;
+
+  return (uchar*) q ;
+}
+
+#ifdef HAVE_ZLIB_H
+
+/* Inflate n bytes of Flate (zlib) data.  Returns a buffer
+   (null-terminated, free with free()) with the data and its
+   length in len or null on errors. */
+
+uchar *pdfinflate ( uchar *in, long n, long *len )
+{
+  z_stream z ;
+  uchar *out=0, *p ;
+  long size = 4 * n + 1024 ;
+  int zerr ;
+
+  memset ( &z, 0, sizeof(z) ) ;
+  if ( inflateInit ( &z ) != Z_OK ) return 0 ;
+
+  z.next_in = in ;
+  z.avail_in = n ;
+  do {
+    if ( ! ( p = realloc ( out, size + 1 ) ) ) {
+      zerr = Z_MEM_ERROR ;
+      break ;
+    }
+    out = p ;
+    z.next_out = out + z.total_out ;
+    z.avail_out = size - z.total_out ;
+    zerr = inflate ( &z, Z_NO_FLUSH ) ;
+    size *= 2 ;
+  } while ( zerr == Z_OK ) ;
+
+  inflateEnd ( &z ) ;
+
+  /* accept truncated data */
+  if ( zerr != Z_STREAM_END && ( zerr != Z_BUF_ERROR || ! z.total_out ) ) {
+    free ( out ) ;
+    return 0 ;
+  }
+
+  out [ *len = z.total_out ] = 0 ;
+  return out ;
+}
+
+#endif
+
+/* Undo a PNG predictor (pred >= 10) applied to n bytes of rows
+   of columns samples of bpc bits and colors components.  The
+   data is decoded in place.  Returns the decoded length or -1 if
+   the predictor is not supported. */
+
+long pdfunpredict ( uchar *buf, long n, int pred, int colors, int bpc, 
+		    int columns )
+{
+  int bpp = ( colors * bpc + 7 ) / 8, a, b, c, pa, pb, pc, v, type ;
+  long i, row = ( (long) colors * bpc * columns + 7 ) / 8 ;
+  uchar *in, *out, *prev ;
+
+  if ( pred < 10 ) 
+    return pred == 1 ? n : -1 ;
+
+  for ( in = out = buf ; in + row + 1 <= buf + n ; in += row + 1 ) {
+    prev = out > buf ? out - row : 0 ;
+    type = *in ;		/* may be overwritten by output */
+    for ( i=0 ; i<row ; i++ ) {
+      a = i >= bpp ? out [ i-bpp ] : 0 ;
+      b = prev ? prev [ i ] : 0 ;
+      c = prev && i >= bpp ? prev [ i-bpp ] : 0 ;
+      switch ( type ) {
+      case 0 : v = 0 ; break ;
+      case 1 : v = a ; break ;
+      case 2 : v = b ; break ;
+      case 3 : v = ( a + b ) / 2 ; break ;
+      case 4 :
+	pa = abs ( b - c ) ; pb = abs ( a - c ) ; pc = abs ( a + b - 2*c ) ;
+	v = pa <= pb && pa <= pc ? a : pb <= pc ? b : c ;
+	break ;
+      default : return -1 ;
+      }
+      out [ i ] = in [ i+1 ] + v ;
+    }
+    out += row ;
+  }
+
+  return out - buf ;
+}
+
+/* Decode the Flate-compressed stream object at p (an object or
+   cross-reference stream).  Returns a buffer (free with free())
+   with the data and its length in len or null on errors. */
+
+uchar *pdfdecode ( PDFDOC *d, char *p, long *len )
+{
+  uchar *data, *out=0 ;
+  char *parms ;
+  long n ;
+
+  if ( ! ( data = pdfstream ( d, p, &n ) ) ) {
+    msg ( "W bad PDF stream" ) ;
+  } else if ( ! pdfname ( d, p, "/Filter", "/FlateDecode" ) ) {
+    msg ( "W can't decode PDF stream" ) ;
+  } else {
+#ifdef HAVE_ZLIB_H
+    parms = pdfunwrap ( d, pdfkey ( d, p, "/DecodeParms" ) ) ;
+    if ( ! ( out = pdfinflate ( data, n, len ) ) ) {
+      msg ( "W bad Flate data in PDF stream" ) ;
+    } else if ( ( *len = pdfunpredict ( out, *len, 
+		   pdfkeyint ( d, parms, "/Predictor", 1 ), 
+		   pdfkeyint ( d, parms, "/Colors", 1 ), 
+		   pdfkeyint ( d, parms, "/BitsPerComponent", 8 ), 
+		   pdfkeyint ( d, parms, "/Columns", 1 ) ) ) < 0 ) {
+      msg ( "W unsupported PDF stream predictor" ) ;
+      free ( out ) ;
+      out = 0 ;
+    } else {
+      out [ *len ] = 0 ;
+    }
+#else
+    msg ( "W can't decode PDF stream (no zlib)" ) ;
+#endif
+  }
+
+  return out ;
+}
+
+/* Find object n.  Returns pointer to its value or null if there
+   is no such object. */
+
+char *pdfobject ( PDFDOC *d, long n )
+{
+  char *p = 0, *q ;
+  long s, i, first, len, v ;
+
+  if ( n < 0 || n >= d->nobj || ! d->off [ n ] ) {
+    p = 0 ;
+  } else if ( d->idx [ n ] < 0 ) {	/* "n g obj" in the file */
+    if ( d->off [ n ] < d->len ) {
+      p = d->buf + d->off [ n ] ;
+      if ( pdfint ( p, &v ) && v == n && 
+	   pdfint ( p = pdfskip ( p ), &v ) && 
+	   pdfis ( p = pdfskip ( p ), "obj" ) )
+	p = pdfws ( pdfskip ( p ) ) ;
+      else
+	p = 0 ;
+    }
+  } else {			/* in an object stream */
+    s = d->off [ n ] ;
+    if ( s < d->nobj && d->idx [ s ] < 0 && ! d->stm [ s ] ) {
+      d->stm [ s ] = (char*) pdfdecode ( d, pdfobject ( d, s ), &len ) ;
+    }
+    if ( s < d->nobj && ( q = d->stm [ s ] ) ) {
+      first = pdfkeyint ( d, pdfobject ( d, s ), "/First", 0 ) ;
+      for ( i = 0 ; i < d->idx [ n ] && *q ; i++ )
+	q = pdfskip ( pdfskip ( q ) ) ;
+      if ( pdfint ( q, &v ) && v == n && pdfint ( pdfskip ( q ), &v ) &&
+	   first >= 0 && v >= 0 && first + v < (long) strlen ( d->stm [ s ] ) )
+	p = pdfws ( d->stm [ s ] + first + v ) ;
+    }
+  }
+
+  return p ;
+}
+
+/* Add a cross-reference entry unless there is one from a later
+   update.  Returns 0 or 2 if out of memory. */
+
+int pdfsetobj ( PDFDOC *d, long n, long off, long idx )
+{
+  long i, m ;
+  void *p ;
+
+  if ( n < 0 || n > 8 * d->len ) return 0 ; /* bogus */
+
+  if ( n >= d->nobj ) {
+    m = n + 1 > 2 * d->nobj ? n + 1 : 2 * d->nobj ;
+    if ( ! ( p = realloc ( d->off, m * sizeof(long) ) ) ) return 2 ;
+    d->off = p ;
+    if ( ! ( p = realloc ( d->idx, m * sizeof(long) ) ) ) return 2 ;
+    d->idx = p ;
+    if ( ! ( p = realloc ( d->stm, m * sizeof(char*) ) ) ) return 2 ;
+    d->stm = p ;
+    for ( i = d->nobj ; i < m ; i++ ) {
+      d->off [ i ] = 0 ;
+      d->idx [ i ] = -1 ;
+      d->stm [ i ] = 0 ;
+    }
+    d->nobj = m ;
+  }
+
+  if ( ! d->off [ n ] && off > 0 ) {
+    d->off [ n ] = off ;
+    d->idx [ n ] = idx ;
+  }
+
+  return 0 ;
+}
+
+/* Read the cross-reference table or stream at offset off and
+   the earlier ones it refers to.  Returns pointer to the trailer
+   dictionary or null on errors. */
+
+char *pdfxref ( PDFDOC *d, long off, int depth )
+{
+  char *p, *trailer=0 ;
+  long start, count, i, v, t, f2, f3, w[3], len ;
+  uchar *x=0, *q ;
+  int j, err=0 ;
+
+  if ( off <= 0 || off >= d->len || depth > PDFMAXDEPTH ) 
+    return 0 ;
+
+  p = d->buf + off ;
+
+  if ( pdfis ( p, "xref" ) ) {		/* cross-reference table */
+
+    for ( p = pdfskip ( p ) ; ! err && pdfint ( p, &start ) ; ) {
+      if ( ! pdfint ( p = pdfskip ( p ), &count ) ) break ;
+      for ( p = pdfskip ( p ), i = 0 ; ! err && i < count ; i++ ) {
+	if ( ! pdfint ( p, &v ) ) break ;
+	p = pdfskip ( pdfskip ( p ) ) ;	/* skip generation */
+	p = pdfws ( p ) ;
+	if ( *p == 'n' ) err = pdfsetobj ( d, start + i, v, -1 ) ;
+	else pdfsetobj ( d, start + i, 0, -1 ) ;
+	p = pdfskip ( p ) ;
+      }
+    }
+    if ( pdfis ( p, "trailer" ) ) 
+      trailer = pdfws ( pdfskip ( p ) ) ;
+
+    /* hybrid files also have a cross-reference stream */
+    if ( trailer && ( v = pdfkeyint ( d, trailer, "/XRefStm", 0 ) ) )
+      pdfxref ( d, v, depth+1 ) ;
+
+  } else if ( pdfint ( p, &v ) && pdfint ( p = pdfskip ( p ), &t ) && 
+	      pdfis ( p = pdfskip ( p ), "obj" ) ) { /* cross-ref stream */
+
+    trailer = pdfws ( pdfskip ( p ) ) ;
+    p = pdfkey ( d, trailer, "/W" ) ;
+    for ( j = 0 ; j < 3 ; j++ ) {
+      w[j] = -1 ;
+      if ( p && ( p = pdfws ( j ? p : p+1 ) ) && pdfint ( p, &w[j] ) )
+	p = pdfskip ( p ) ;
+    }
+    if ( ! pdfname ( d, trailer, "/Type", "/XRef" ) ||
+	 w[0] < 0 || w[1] < 0 || w[2] < 0 || w[0] > 4 || w[1] > 4 || 
+	 w[2] > 4 || ! ( x = pdfdecode ( d, trailer, &len ) ) ) {
+      trailer = 0 ;
+    } else {
+      p = pdfkey ( d, trailer, "/Index" ) ;
+      if ( p && *p == '[' ) p = pdfws ( p+1 ) ;
+      else p = 0 ;
+      q = x ;
+      do {
+	if ( ! p ) {
+	  start = 0 ;
+	  count = pdfkeyint ( d, trailer, "/Size", 0 ) ;
+	} else if ( ! pdfint ( p, &start ) || 
+		    ! pdfint ( p = pdfskip ( p ), &count ) ) {
+	  break ;
+	} else {
+	  p = pdfws ( pdfskip ( p ) ) ;
+	}
+	for ( i = 0 ; ! err && i < count && 
+		q + w[0] + w[1] + w[2] <= x + len ; i++ ) {
+	  for ( t = w[0] ? 0 : 1, j = 0 ; j < w[0] ; j++ ) t = t << 8 | *q++ ;
+	  for ( f2 = 0, j = 0 ; j < w[1] ; j++ ) f2 = f2 << 8 | *q++ ;
+	  for ( f3 = 0, j = 0 ; j < w[2] ; j++ ) f3 = f3 << 8 | *q++ ;
+	  if ( t == 1 ) err = pdfsetobj ( d, start + i, f2, -1 ) ;
+	  else if ( t == 2 ) err = pdfsetobj ( d, start + i, f2, f3 ) ;
+	  else pdfsetobj ( d, start + i, 0, -1 ) ;
+	}
+      } while ( ! err && p && *p != ']' && *p ) ;
+      free ( x ) ;
+    }
+  }
+
+  if ( err ) {
+    msg ( "E2 out of memory reading PDF cross-reference" ) ;
+    trailer = 0 ;
+  }
+
+  if ( trailer && ( v = pdfkeyint ( d, trailer, "/Prev", 0 ) ) )
+    pdfxref ( d, v, depth+1 ) ;
+
+  return trailer ;
+}
+
+/* Add a page for the page object p with inherited resources res
+   and media box mbox.  Returns 0 or 2 if the page is not a single
+   image that can be read. */
+
+int pdfpage ( PDFDOC *d, char *p, char *res, char *mbox, char *fname )
+{
+  int err=0, n=0, inv ;
+  char *xobj, *img=0, *v, *parms ;
+  long w, h, len ;
+  uchar *data=0 ;
+  double box [ 4 ] ;
+  PAGE *pg ;
+  void *q ;
+
+  if ( d->npages >= d->maxpages ) {
+    d->maxpages = d->maxpages ? 2 * d->maxpages : 16 ;
+    if ( ! ( q = realloc ( d->pages, d->maxpages * sizeof(PAGE) ) ) )
+      return msg ( "E2 out of memory reading PDF pages" ) ;
+    d->pages = q ;
+  }
+  pg = d->pages + d->npages ;
+  page_init ( pg, fname ) ;
+
+  /* the page must have no text and exactly one image */
+
+  if ( pdfkey ( d, res, "/Font" ) )
+    return msg ( "E2 PDF page %d has text", d->npages + 1 ) ;
+
+  if ( ( xobj = pdfkey ( d, res, "/XObject" ) ) && xobj[0] == '<' ) 
+    for ( v = pdfws ( xobj+2 ) ; *v == '/' ; n++ ) {
+      img = pdfderef ( d, v = pdfskip ( v ) ) ;
+      v = pdfws ( pdfskipval ( v ) ) ;
+    }
+
+  if ( n != 1 || ! pdfname ( d, img, "/Subtype", "/Image" ) )
+    return msg ( "E2 PDF page %d is not a single image", d->npages + 1 ) ;
+
+  w = pdfkeyint ( d, img, "/Width", 0 ) ;
+  h = pdfkeyint ( d, img, "/Height", 0 ) ;
+  inv = ( v = pdfkey ( d, img, "/Decode" ) ) && *v == '[' && 
+    pdfis ( v+1, "1" ) ;
+  parms = pdfunwrap ( d, pdfkey ( d, img, "/DecodeParms" ) ) ;
+
+  if ( w <= 0 || h <= 0 || w > MAXRUNS - 8 ) {
+    err = msg ( "E2 bad PDF image size (%ldx%ld)", w, h ) ;
+  } else if ( ! pdfname ( d, img, "/ImageMask", "true" ) && 
+	      ( pdfkeyint ( d, img, "/BitsPerComponent", 0 ) != 1 ||
+		! pdfname ( d, img, "/ColorSpace", "/DeviceGray" ) ) ) {
+    err = msg ( "E2 PDF image on page %d is not black and white", 
+		d->npages + 1 ) ;
+  } else if ( ! ( data = pdfstream ( d, img, &len ) ) ) {
+    err = msg ( "E2 bad PDF image stream" ) ;
+  } else if ( pdfname ( d, img, "/Filter", "/CCITTFaxDecode" ) ) {
+
+    /* decoded as fax data: the same sense as fax data unless
+       BlackIs1 or Decode invert it.  The decoder needs EOLs. */
+
+    if ( pdfkeyint ( d, parms, "/K", 0 ) != 0 )
+      err = msg ( "E2 can't read 2-D coded image in PDF" ) ;
+    else if ( pdfkeyint ( d, parms, "/Columns", 1728 ) != w )
+      err = msg ( "E2 PDF image width and Columns differ" ) ;
+    else if ( len < 2 || data[0] || ( data[1] & 0xe0 ) )
+      err = msg ( "E2 can't read PDF fax image without EOLs" ) ;
+    else {
+      pg->format = P_FAX ;
+      pg->black_is_zero = pdfname ( d, parms, "/BlackIs1", "true" ) ^ inv ;
+    }
+
+  } else if ( pdfkey ( d, img, "/Filter" ) && 
+	      ! pdfname ( d, img, "/Filter", "/FlateDecode" ) ) {
+    err = msg ( "E2 can't read PDF image filter" ) ;
+  } else {
+
+    /* bit map: 0 is black unless Decode inverts it */
+
+    pg->format = P_PDF ;
+    pg->deflate = pdfkey ( d, img, "/Filter" ) != 0 ;
+    pg->predictor = pdfkeyint ( d, parms, "/Predictor", 1 ) ;
+    pg->black_is_zero = ! inv ;
+#ifndef HAVE_ZLIB_H
+    if ( pg->deflate )
+      err = msg ( "E2 can't read compressed PDF image (no zlib)" ) ;
+#endif
+    if ( pg->predictor != 1 && 
+	 ( pg->predictor < 10 || pdfkeyint ( d, parms, "/Columns", 1 ) != w ||
+	   pdfkeyint ( d, parms, "/Colors", 1 ) != 1 || 
+	   pdfkeyint ( d, parms, "/BitsPerComponent", 8 ) != 1 ) )
+      err = msg ( "E2 can't read PDF image predictor" ) ;
+  }
+
+  if ( ! err ) {
+    pg->offset = (char*) data - d->buf ;
+    pg->length = len ;
+    pg->w = w ;
+    pg->h = h ;
+
+    /* the image fills the page */
+
+    if ( ( v = mbox ) && *v++ == '[' ) {
+      for ( n = 0 ; n < 4 && *( v = pdfws ( v ) ) && *v != ']' ; n++ ) {
+	box [ n ] = atof ( v ) ;
+	v = pdfskip ( v ) ;
+      }
+      if ( n == 4 && box[2] - box[0] > 0 && box[3] - box[1] > 0 ) {
+	pg->xres = w * 72.0 / ( box[2] - box[0] ) ;
+	pg->yres = h * 72.0 / ( box[3] - box[1] ) ;
+      }
+    }
+
+    d->npages++ ;
+  }
+
+  return err ;
+}
+
+/* Add the pages of the page tree node p.  Resources and media
+   box are inherited from res and mbox.  Returns 0 or 2 on
+   errors. */
+
+int pdfpages ( PDFDOC *d, char *p, char *res, char *mbox, char *fname,
+	       int depth )
+{
+  int err=0 ;
+  char *v, *kids ;
+
+  if ( ! p || depth > PDFMAXDEPTH )
+    return msg ( "E2 bad PDF page tree" ) ;
+
+  if ( ( v = pdfkey ( d, p, "/Resources" ) ) ) res = v ;
+  if ( ( v = pdfkey ( d, p, "/MediaBox" ) ) ) mbox = v ;
+
+  if ( pdfname ( d, p, "/Type", "/Pages" ) ) {
+    if ( ! ( kids = pdfkey ( d, p, "/Kids" ) ) || *kids != '[' )
+      return msg ( "E2 bad PDF page tree" ) ;
+    for ( v = pdfws ( kids+1 ) ; ! err && *v && *v != ']' ; 
+	  v = pdfws ( pdfskipval ( v ) ) )
+      err = pdfpages ( d, pdfderef ( d, v ), res, mbox, fname, depth+1 ) ;
+  } else {
+    err = pdfpage ( d, p, res, mbox, fname ) ;
+  }
+
+  return err ;
+}
+
+/* Release the memory used by PDF document d. */
+
+void pdffree ( PDFDOC *d )
+{
+  long i ;
+  if ( d ) {
+    for ( i=0 ; i < d->nobj ; i++ )
+      free ( d->stm [ i ] ) ;
+    free ( d->stm ) ;
+    free ( d->off ) ;
+    free ( d->idx ) ;
+    free ( d->pages ) ;
+    free ( d->buf ) ;
+    free ( d ) ;
+  }
+}
+
+int pdf_next ( IFILE *f )
+{
+  PDFDOC *d = f->pdf ;
+  int i = f->next ;
+
+  *f->page = d->pages [ i ] ;
+
+  if ( ++i < d->npages ) {
+    f->next = i ;
+  } else {
+    f->next = 0 ;
+    pdffree ( d ) ;
+    f->pdf = 0 ;
+  }
+
+  return 0 ;
+}
+
+int pdf_first ( IFILE *f )
+{
+  int err=0 ;
+  PDFDOC *d ;
+  char *p, *trailer ;
+  long off ;
+
+  if ( ! ( d = f->pdf = calloc ( 1, sizeof(PDFDOC) ) ) )
+    return msg ( "E2 out of memory reading PDF file" ) ;
+
+  /* read the file */
+
+  if ( fseek ( f->f, 0, SEEK_END ) || ( d->len = ftell ( f->f ) ) < 0 || 
+       fseek ( f->f, 0, SEEK_SET ) ) {
+    err = msg ( "ES2 can't get size of PDF file" ) ;
+  } else if ( ! ( d->buf = malloc ( d->len + 1 ) ) ) {
+    err = msg ( "E2 out of memory reading PDF file" ) ;
+  } else if ( fread ( d->buf, 1, d->len, f->f ) != d->len ) {
+    err = msg ( "ES2 can't read PDF file" ) ;
+  } else {
+    d->buf [ d->len ] = 0 ;
+  }
+
+  /* find the last cross-reference section and the page tree */
+
+  if ( ! err && d->len < 9 )	/* too short to hold startxref */
+    err = msg ( "E2 can't read PDF cross-reference" ) ;
+
+  if ( ! err ) {
+    for ( p = d->buf + d->len - 9 ; p > d->buf && 
+	    ( p > d->buf + d->len - 1024 ) && strncmp ( p, "startxref", 9 ) ;
+	  p-- ) ;
+    if ( strncmp ( p, "startxref", 9 ) || ! pdfint ( p+9, &off ) ||
+	 ! ( trailer = pdfxref ( d, off, 0 ) ) ) 
+      err = msg ( "E2 can't read PDF cross-reference" ) ;
+    else
+      err = pdfpages ( d, pdfkey ( d, pdfkey ( d, trailer, "/Root" ), 
+				  "/Pages" ), 0, 0, f->page->fname, 0 ) ;
+  }
+
+  if ( ! err && ! d->npages )
+    err = msg ( "E2 no pages in PDF file" ) ;
+
+  if ( err ) {
+    pdffree ( d ) ;
+    f->pdf = 0 ;
+    f->next = 0 ;
+    return err ;
+  }
+
+  msg ( "F read %d-page PDF file", d->npages ) ;
+
+  f->next = 0 ;
+  return pdf_next ( f ) ;
+}
+
+
+#define raw_first 0
+#define raw_next 0
+
+
+/* input file state reset for different compression methods */
+
+#define pcx_reset 0
+#define pbm_reset 0
+
+int text_reset ( IFILE *f )
+{
+  int err=0 ;
+
+  f->lines = ( ( f->pglines * f->charh ) / f->charh ) * f->charh ;
+  f->txtlines = 0 ;
+  f->txtpos = f->txtn = 0 ;
+  f->text [ 0 ] = 0 ;
+  f->page->yres = f->lines > 1078 ? 196 : 98 ; /* BOGUS */
+
+  return err ;
+}
+
+int raw_reset ( IFILE *f )
+{
+  f->strip = 0 ;
+  f->striplines = f->page->rowsperstrip > 0 ? 
+    f->page->rowsperstrip : f->page->h ;
+  return 0 ;
+}
+
+
+/* Grey-scale pages need the line buffers used by greytobit(),
+   cleared for each page, and a table mapping samples to
+   brightness. */
+
+int grey_reset ( IFILE *f )
+{
+  int err=0, i, v, w = f->page->w ;
+
+  if ( w > f->greyw ) {
+    free ( f->grey ) ;
+    free ( f->greybuf ) ;
+    f->grey = malloc ( w + 8 ) ;
+    f->greybuf = malloc ( 3 * ( w + GREYPAD ) * sizeof(int) ) ;
+    if ( f->grey && f->greybuf ) {
+      f->greyw = w ;
+    } else {
+      f->greyw = 0 ;
+      err = msg ( "E2 out of memory for grey-scale buffers" ) ;
+    }
+  }
+
+  if ( ! err ) {
+    memset ( f->grey, 0, w + 8 ) ;
+    memset ( f->greybuf, 0, 3 * ( w + GREYPAD ) * sizeof(int) ) ;
+    for ( i=0 ; i<256 ; i++ ) {
+      v = i < f->page->maxval ? i * 255 / f->page->maxval : 255 ;
+      f->greymap [ i ] = f->page->black_is_zero ? v : 255 - v ;
+    }
+    err = raw_reset ( f ) ;
+  }
+
+  return err ;
+}
+
+
+/* PDF bit maps are read and decoded when the page is opened. */
+
+int pdf_reset ( IFILE *f )
+{
+  int err=0 ;
+  long n = f->page->length ;
+  uchar *data ;
+
+  free ( f->pixels ) ;
+  f->pixels = 0 ;
+  f->pixpos = f->pixlen = 0 ;
+
+  if ( ! ( data = malloc ( n + 1 ) ) ) {
+    err = msg ( "E2 out of memory reading PDF image" ) ;
+  } else if ( fread ( data, 1, n, f->f ) != n ) {
+    err = msg ( "ES2 can't read PDF image" ) ;
+  } else if ( ! f->page->deflate ) {
+    f->pixels = data ;
+    f->pixlen = n ;
+    data = 0 ;
+  } else {
+#ifdef HAVE_ZLIB_H
+    if ( ! ( f->pixels = pdfinflate ( data, n, &f->pixlen ) ) )
+      err = msg ( "E2 bad Flate data in PDF image" ) ;
+    else if ( ( f->pixlen = pdfunpredict ( f->pixels, f->pixlen, 
+					   f->page->predictor, 1, 1, 
+					   f->page->w ) ) < 0 ) {
+      err = msg ( "E2 bad PDF image predictor" ) ;
+      free ( f->pixels ) ;
+      f->pixels = 0 ;
+      f->pixlen = 0 ;
+    }
+#endif
+  }
+
+  free ( data ) ;
+
+  return err ;
+}
+
+
+/* G3 pages that are coded in independent parts are decoded when
+   the page is opened: multi-strip TIFF pages by strip and large
+   single-strip pages in segments that start after EOL codes.  The
+   parts are decoded concurrently, each into its own arena, by up
+   to MAXSTRIPTHREADS threads. */
+
+typedef struct jobstruct {
+  void ( *fun ) ( void *arg, int i ) ;	/* decodes part i */
+  void *arg ;
+  int n ;			/* number of parts */
+  int next ;			/* next part to decode */
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_t lock ;
+#endif
+} JOB ;
+
+void *jobworker ( void *arg )
+{
+  JOB *j = arg ;
+  int i ;
+
+  while ( 1 ) {
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_lock ( &j->lock ) ;
+#endif
+    i = j->next++ ;
+#ifdef HAVE_PTHREAD_H
+    pthread_mutex_unlock ( &j->lock ) ;
+#endif
+    if ( i >= j->n ) break ;
+    j->fun ( j->arg, i ) ;
+  }
+
+  return 0 ;
+}
+
+/* Returns the number of threads worth using to decode a page. */
+
+int maxthreads ( void )
+{
+#ifdef HAVE_PTHREAD_H
+  long ncpu = sysconf ( _SC_NPROCESSORS_ONLN ) ;
+  return ncpu < 1 ? 1 : ncpu > MAXSTRIPTHREADS ? MAXSTRIPTHREADS : ncpu ;
+#else
+  return 1 ;
+#endif
+}
+
+/* Call fun(arg,i) for i from 0 to n-1 using up to maxthreads()
+   threads.  Returns the number of threads used. */
+
+int runjob ( void ( *fun ) ( void *, int ), void *arg, int n )
+{
+  int nt=1 ;
+  JOB j ;
+#ifdef HAVE_PTHREAD_H
+  pthread_t tid [ MAXSTRIPTHREADS ] ;
+  int i ;
+#endif
+
+  j.fun = fun ;
+  j.arg = arg ;
+  j.n = n ;
+  j.next = 0 ;
+
+#ifdef HAVE_PTHREAD_H
+  nt = maxthreads ( ) ;
+  if ( nt > n ) nt = n ;
+  pthread_mutex_init ( &j.lock, 0 ) ;
+  for ( i=1 ; i < nt ; i++ )
+    if ( pthread_create ( &tid [ i ], 0, jobworker, &j ) ) 
+      break ;
+  nt = i ;
+#endif
+  jobworker ( &j ) ;
+#ifdef HAVE_PTHREAD_H
+  for ( i=1 ; i < nt ; i++ )
+    pthread_join ( tid [ i ], 0 ) ;
+  pthread_mutex_destroy ( &j.lock ) ;
+#endif
+
+  return nt ;
+}
+
+typedef struct stripjobstruct {
+  PAGE *page ;
+  uchar **data ;		/* coded data of each strip */
+  RUNARENA *arena ;		/* decoded lines of each strip */
+} STRIPJOB ;
+
+/* Decode strip i of a page into its arena.  Lines with no pixels
+   (EOLs before the first line and in the RTC) are dropped. */
+
+void decodestrip ( void *arg, int i )
+{
+  STRIPJOB *j = arg ;
+  PAGE *p = j->page ;
+  RUNARENA *a = j->arena + i ;
+  DECODER d ;
+  short runs [ MAXRUNS ] ;
+  uchar *in = j->data [ i ], *end = j->data [ i ] + p->stripbytes [ i ] ;
+  int nr, pels ;
+
+  newDECODER ( &d, p->revbits, p->black_is_zero ) ;
+
+  while ( ! a->err && 
+	  ( p->rowsperstrip <= 0 || a->nlines < p->rowsperstrip ) &&
+	  ( nr = bufruns ( &d, &in, end, runs, &pels ) ) >= 0 )
+    if ( pels ) 
+      a->err = arenaline ( a, runs, nr, pels ) ;
+}
+
+/* Read all strips of the current page and decode them into
+   f->arena.  Returns 0 if OK, 2 on errors. */
+
+int fax_strips ( IFILE *f )
+{
+  int err=0, i, nt, n = f->page->nstrips ;
+  STRIPJOB j ;
+
+  j.page = f->page ;
+  j.data = calloc ( n, sizeof(uchar*) ) ;
+  j.arena = f->arena = calloc ( n, sizeof(RUNARENA) ) ;
+  f->narena = n ;
+
+  if ( ! j.data || ! j.arena )
+    err = msg ( "E2 out of memory for %d TIFF strips", n ) ;
+
+  for ( i=0 ; ! err && i < n ; i++ ) {
+    if ( ! ( j.data [ i ] = malloc ( f->page->stripbytes [ i ] + 1 ) ) )
+      err = msg ( "E2 out of memory for TIFF strip" ) ;
+    else if ( fseek ( f->f, f->page->stripoff [ i ], SEEK_SET ) ||
+	      fread ( j.data [ i ], 1, f->page->stripbytes [ i ], f->f ) != 
+	      f->page->stripbytes [ i ] )
+      err = msg ( "ES2 can't read TIFF strip %d:", i ) ;
+  }
+
+  if ( ! err ) {
+    nt = runjob ( decodestrip, &j, n ) ;
+    for ( i=0 ; i < n ; i++ )
+      if ( j.arena [ i ].err ) 
+	err = msg ( "E2 out of memory decoding TIFF strip %d", i ) ;
+    msg ( "F decoded %d strips using %d thread(s)", n, nt ) ;
+  }
+
+  if ( j.data ) {
+    for ( i=0 ; i < n ; i++ )
+      free ( j.data [ i ] ) ;
+    free ( j.data ) ;
+  }
+
+  f->strip = 0 ;
+  f->line = 0 ;
+
+  return err ;
+}
+
+/* Single-strip pages of at least 2*SEGBYTES bytes are split into
+   up to two segments per thread.  Each segment after the first
+   starts just after an EOL code, where the decoder state does not
+   depend on the data before it.  The EOLs are found by a search
+   of the coded bytes near the nominal segment boundaries. */
+
+#ifndef EFAX_LOWMEM
+
+#define SEGBYTES 8192		/* least coded bytes per segment */
+
+typedef struct segjobstruct {
+  PAGE *page ;
+  uchar *data ;			/* coded data of the page */
+  long *start ;			/* first bit of each segment & end */
+  int nseg ;			/* number of segments */
+  RUNARENA *arena ;		/* decoded lines of each segment */
+  uchar *ended ;		/* how decoding of each segment ended */
+} SEGJOB ;
+
+enum segends { SEGOK=0, SEGLOST=1, SEGRTC=2 } ;
+
+/* Return the position in bits, counted in fill order from data,
+   just after the first EOL code (11 or more 0 bits then a 1) that
+   starts at or after byte i of the n bytes at data, or -1 if there
+   is none.  Zero bytes, which make up most of an EOL and any fill
+   before it, need no bit tests. */
+
+long findeol ( uchar *data, long n, long i, int lsbfirst )
+{
+  int z=0, b, c ;
+
+  for ( ; i < n ; i++ ) {
+    if ( ! ( c = data [ i ] ) ) {
+      z += 8 ;
+      continue ;
+    }
+    if ( lsbfirst ) c = normalbits [ c ] ;
+    for ( b=7 ; b >= 0 ; b-- )
+      if ( c & ( 1 << b ) ) {
+	if ( z >= EOLBITS - 1 ) return i * 8 + 8 - b ;
+	z = 0 ;
+      } else {
+	z++ ;
+      }
+  }
+
+  return -1 ;
+}
+
+/* Decode segment i of a page into its arena.  All lines are kept,
+   including empty ones, so that fax_segments() can apply the same
+   first-line and RTC handling as readruns().  Decoding stops at the
+   start of the next segment, at the end of the data or at an RTC
+   within the segment.  The segment is marked as lost if a line
+   ends past the start of the next segment (errors in the data
+   hid the EOL there) or if the data ends first. */
+
+void decodeseg ( void *arg, int i )
+{
+  SEGJOB *j = arg ;
+  RUNARENA *a = j->arena + i ;
+  DECODER d ;
+  short runs [ MAXRUNS ] ;
+  long pos = j->start [ i ], next = j->start [ i+1 ] ;
+  uchar *in = j->data + pos / 8, *end = j->data + ( j->start [ j->nseg ] / 8 ) ;
+  int nr=0, pels ;
+
+  newDECODER ( &d, j->page->revbits, j->page->black_is_zero ) ;
+
+  if ( pos % 8 )		/* starts within a byte */
+    skipbits ( &d, *in++, pos % 8 ) ;
+
+  while ( ! a->err && pos < next ) {
+    nr = bufruns ( &d, &in, end, runs, &pels ) ;
+    if ( nr == EOF )		/* keep the last RTC EOL */
+      a->err = arenaline ( a, runs, 0, 0 ) ;
+    if ( nr < 0 ) break ;
+    a->err = arenaline ( a, runs, nr, pels ) ;
+    pos = ( in - j->data ) * 8 - ( d.shift + 9 ) ;
+  }
+
+  if ( nr == EOF ) 
+    j->ended [ i ] = SEGRTC ;
+  else if ( nr == -2 ? i < j->nseg - 1 : pos > next ) 
+    j->ended [ i ] = SEGLOST ;
+}
+
+/* Read the len bytes of the current single-strip page and decode
+   them in segments into f->arena, ending the page at RTC as
+   readruns() would.  Returns 0 if OK, 2 on errors or 1 if the page
+   is too small, there is only one processor, the page could not be
+   split or has no RTC, and it must be decoded by readruns(). */
+
+int fax_segments ( IFILE *f, long len )
+{
+  int err=0, i, k, m, nt, eolcnt=0, cut=0 ;
+  long s ;
+  RUNARENA *a ;
+  SEGJOB j ;
+
+  if ( ( m = maxthreads ( ) ) < 2 ) return 1 ;
+  m *= 2 ;
+  if ( m > len / SEGBYTES ) m = len / SEGBYTES ;
+  if ( m < 2 ) return 1 ;
+
+  memset ( &j, 0, sizeof(j) ) ;
+  j.page = f->page ;
+  j.data = malloc ( len ) ;
+  j.start = malloc ( ( m + 1 ) * sizeof(long) ) ;
+  j.ended = calloc ( m, 1 ) ;
+
+  if ( ! j.data || ! j.start || ! j.ended ) {
+    err = msg ( "E2 out of memory for fax page" ) ;
+  } else if ( fread ( j.data, 1, len, f->f ) != len ) {
+    err = msg ( "ES2 can't read fax page:" ) ;
+  } else {
+    j.start [ j.nseg++ ] = 0 ;
+    for ( i=1 ; i < m ; i++ )
+      if ( ( s = findeol ( j.data, len, i * len / m, f->page->revbits ) ) > 
+	   j.start [ j.nseg - 1 ] )
+	j.start [ j.nseg++ ] = s ;
+    j.start [ j.nseg ] = len * 8 ;
+    if ( j.nseg < 2 ) err = 1 ;
+  }
+
+  if ( ! err && ! ( j.arena = calloc ( j.nseg, sizeof(RUNARENA) ) ) )
+    err = msg ( "E2 out of memory for fax page" ) ;
+
+  if ( ! err ) {
+    nt = runjob ( decodeseg, &j, j.nseg ) ;
+    for ( i=0 ; ! err && i < j.nseg ; i++ ) {
+      if ( j.arena [ i ].err ) {
+	err = msg ( "E2 out of memory decoding fax page" ) ;
+      } else if ( j.ended [ i ] == SEGLOST ) {
+	msg ( "F fax data errors at segment %d, decoding sequentially", i+1 ) ;
+	err = 1 ;
+      } else if ( j.ended [ i ] == SEGRTC ) {
+	break ;			/* later segments follow the RTC */
+      }
+    }
+    if ( ! err )
+      msg ( "F decoded %d segments using %d thread(s)", j.nseg, nt ) ;
+  }
+
+  if ( ! err ) {
+
+    /* end the page at RTC */
+
+    for ( i=0 ; i < j.nseg ; i++ ) {
+      a = j.arena + i ;
+      for ( k=0 ; ! cut && k < a->nlines ; k++ )
+	if ( a->pels [ k ] ) 
+	  eolcnt = 0 ;
+	else if ( ++eolcnt >= RTCEOL ) 
+	  break ;
+      if ( cut || k < a->nlines ) {
+	a->nlines = k ;
+	cut = 1 ;
+      }
+    }
+
+    /* without RTC the data was cut short: readruns() keeps the
+       partial last line and warns */
+
+    if ( ! cut ) {
+      msg ( "F fax data ends without RTC, decoding sequentially" ) ;
+      err = 1 ;
+    }
+  }
+
+  if ( ! err ) {
+
+    /* skip the first line */
+
+    a = j.arena ;
+    if ( ! a->nlines || a->pels [ 0 ] )
+      msg ( "W first line has %d pixels: probably not fax data", 
+	    a->nlines ? a->pels [ 0 ] : 0 ) ;
+    if ( a->nlines > 0 ) {
+      memmove ( a->start, a->start + 1, a->nlines * sizeof(int) ) ;
+      memmove ( a->pels, a->pels + 1, ( a->nlines - 1 ) * sizeof(int) ) ;
+      a->nlines-- ;
+    }
+
+    f->arena = j.arena ;
+    f->narena = j.nseg ;
+    f->strip = 0 ;
+    f->line = 0 ;
+    j.arena = 0 ;
+  }
+
+  if ( j.arena ) {
+    for ( i=0 ; i < j.nseg ; i++ )
+      freearena ( j.arena + i ) ;
+    free ( j.arena ) ;
+  }
+  free ( j.data ) ;
+  free ( j.start ) ;
+  free ( j.ended ) ;
+
+  if ( err == 1 && fseek ( f->f, f->page->offset, SEEK_SET ) )
+    err = msg ( "ES2 seek failed" ) ;
+
+  return err ;
+}
+
+#endif
+
+int fax_reset ( IFILE *f )
+{
+  int pels ;
+  short runs [ MAXRUNS ] ;
+#ifndef EFAX_LOWMEM
+  int err ;
+  long len = f->page->length ;
+  struct stat st ;
+#endif
+  
+  newDECODER ( &f->d, f->page->revbits, f->page->black_is_zero ) ;
+  f->lines = -1 ;
+
+  if ( f->page->nstrips > 1 )
+    return fax_strips ( f ) ;
+
+#ifndef EFAX_LOWMEM
+  if ( ! len && ! fstat ( fileno ( f->f ), &st ) && S_ISREG ( st.st_mode ) )
+    len = st.st_size - f->page->offset ;
+  if ( len >= 2 * SEGBYTES && ( err = fax_segments ( f, len ) ) != 1 )
+    return err ;
+#endif
+
+  if ( readruns ( f, runs, &pels ) < 0 || pels ) /* skip first EOL */
+    msg ( "W first line has %d pixels: probably not fax data", pels ) ;
+
+  return 0 ;
+}
+
+
+/* Standard input, named "-", is copied to an anonymous spool file
+   as it is needed, so that its pages can be scanned, seeked and
+   converted while the rest is still arriving from a pipe.  Each
+   stream opened on it reads the spool from its own position;
+   reads past the data received so far wait for more input. */
+
+#ifdef HAVE_FOPENCOOKIE
+
+typedef struct spoolstruct {
+  FILE *f ;			/* standard input read so far */
+  long len ;			/* bytes in f */
+  int eof ;			/* end of input or error */
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_t lock ;
+#endif
+} SPOOL ;
+
+SPOOL stdinspool = { 0, 0, 0 
+#ifdef HAVE_PTHREAD_H
+		     , PTHREAD_MUTEX_INITIALIZER 
+#endif
+} ;
+
+#ifdef HAVE_PTHREAD_H
+#define SPOOLLOCK( s )   pthread_mutex_lock ( &(s)->lock )
+#define SPOOLUNLOCK( s ) pthread_mutex_unlock ( &(s)->lock )
+#else
+#define SPOOLLOCK( s )
+#define SPOOLUNLOCK( s )
+#endif
+
+/* Append the next block of standard input to the spool.  Called
+   with the spool locked.  Sets s->eof at end of input and on
+   errors. */
+
+void spoolmore ( SPOOL *s )
+{
+  char buf [ 16384 ] ;
+  ssize_t n ;
+
+  do n = read ( 0, buf, sizeof(buf) ) ; while ( n < 0 && errno == EINTR ) ;
+
+  if ( n <= 0 ) {
+    if ( n < 0 ) msg ( "ES2 can't read standard input:" ) ;
+    s->eof = 1 ;
+  } else if ( fseek ( s->f, s->len, SEEK_SET ) || 
+	      fwrite ( buf, 1, n, s->f ) != n ) {
+    msg ( "ES2 can't spool standard input:" ) ;
+    s->eof = 1 ;
+  } else {
+    s->len += n ;
+  }
+}
+
+ssize_t spoolread ( void *cookie, char *buf, size_t size )
+{
+  long *pos = cookie ;
+  ssize_t n = -1 ;
+  SPOOL *s = &stdinspool ;
+
+  SPOOLLOCK ( s ) ;
+  while ( *pos >= s->len && ! s->eof )
+    spoolmore ( s ) ;
+  if ( *pos >= s->len ) {
+    n = 0 ;
+  } else {
+    if ( size > s->len - *pos ) size = s->len - *pos ;
+    if ( ! fseek ( s->f, *pos, SEEK_SET ) && 
+	 ( n = fread ( buf, 1, size, s->f ) ) > 0 )
+      *pos += n ;
+    else
+      n = -1 ;
+  }
+  SPOOLUNLOCK ( s ) ;
+
+  return n ;
+}
+
+int spoolseek ( void *cookie, off64_t *off, int whence )
+{
+  long *pos = cookie, to ;
+  SPOOL *s = &stdinspool ;
+
+  switch ( whence ) {
+  case SEEK_SET: 
+    to = *off ; 
+    break ;
+  case SEEK_CUR: 
+    to = *pos + *off ; 
+    break ;
+  case SEEK_END:		/* have to wait for all of it */
+    SPOOLLOCK ( s ) ;
+    while ( ! s->eof ) spoolmore ( s ) ;
+    to = s->len + *off ;
+    SPOOLUNLOCK ( s ) ;
+    break ;
+  default:
+    to = -1 ;
+  }
+
+  if ( to < 0 ) {
+    errno = EINVAL ;
+    return -1 ;
+  }
+
+  *pos = *off = to ;
+  return 0 ;
+}
+
+int spoolclose ( void *cookie )
+{
+  free ( cookie ) ;
+  return 0 ;
+}
+
+#endif
+
+
+/* Open an input file: as fopen() but the name "-" opens a new
+   stream reading standard input from the start.  Returns the
+   stream or NULL with errno set. */
+
+FILE *ifopen ( char *fname, char *mode )
+{
+#ifdef HAVE_FOPENCOOKIE
+  static cookie_io_functions_t spoolfuns = 
+    { spoolread, 0, spoolseek, spoolclose } ;
+  FILE *f = 0 ;
+  long *pos ;
+  SPOOL *s = &stdinspool ;
+
+  if ( strcmp ( fname, "-" ) )
+    return fopen ( fname, mode ) ;
+
+  SPOOLLOCK ( s ) ;
+  if ( ! s->f && ! ( s->f = tmpfile() ) ) 
+    s->eof = 1 ;
+  SPOOLUNLOCK ( s ) ;
+
+  if ( s->f && ( pos = calloc ( 1, sizeof(long) ) ) && 
+       ! ( f = fopencookie ( pos, "r", spoolfuns ) ) )
+    free ( pos ) ;
+
+  return f ;
+#else
+  if ( ! strcmp ( fname, "-" ) ) {
+    errno = ENOSYS ;
+    return 0 ;
+  }
+  return fopen ( fname, mode ) ;
+#endif
+}
+
+
+/* Close the current page: its file and any decoded data. */
+
+void closeipage ( IFILE *f )
+{
+  if ( f->f ) {
+    fclose ( f->f ) ;
+    f->f = 0 ;
+  }
+
+  if ( f->arena ) {
+    int i ;
+    for ( i=0 ; i < f->narena ; i++ )
+      freearena ( f->arena + i ) ;
+    free ( f->arena ) ;
+    f->arena = 0 ;
+  }
+
+  if ( f->pixels ) {
+    free ( f->pixels ) ;
+    f->pixels = 0 ;
+  }
+}
+
+
+/* Skip to start of same (dp=0) or next (dp=1) page image.
+   Returns 0 if OK, 1 if no more pages, 2 on errors. */
+
+int nextipage ( IFILE *f, int dp )
+{
+  int err=0 ;
+  char *message ;
+
+#ifdef ENABLE_NLS
+  gsize written = 0 ;
+  char *conv_fname ;
+#endif
+
+  int ( *reset [NPFORMATS] ) ( IFILE * ) = {
+    raw_reset, fax_reset, pbm_reset, text_reset, pcx_reset, grey_reset,
+    pdf_reset, cover_reset
+  }, (*pf)(IFILE*) ;
+
+  /* close current file and release decoded data if any */
+
+  closeipage ( f ) ;
+
+  /*  if requested, point to next page and check if done */
+
+  if ( dp ) {
+    f->page++ ;
+  }
+  
+  if ( f->page > f->lastpage ) {
+    err = 1 ;
+  }
+
+  /* open the file and seek to start of image data */
+
+  if ( ! err ) {
+    f->f = ifopen ( f->page->fname, (f->page->format == P_TEXT) ? "r" : "rb" ) ;
+    if ( ! f->f ) {
+      message = strdup2 ( "ES2 ", gettext ( "can't open file %s:" ) ) ;
+      if ( message ) {
+#ifdef ENABLE_NLS
+	if ( use_utf8 && !g_utf8_validate ( f->page->fname, -1, NULL ) ) {
+	  conv_fname = g_filename_to_utf8 ( f->page->fname, -1, NULL, &written, NULL ) ;
 	  if ( conv_fname ) {
 	    err = msg ( message, conv_fname ) ;
 	    g_free ( conv_fname ) ;
@@ -1256,6 +3829,7 @@ int nextipage ( IFILE *f, int dp )
   /* default initializations */
 
   f->lines = f->page->h ;
+  f->lineno = 0 ;
 
   /* coding-specific initializations for this page */
   
@@ -1276,9 +3850,87 @@ int lastpage ( IFILE *f )
   return f->page >= f->lastpage ;
 }
 
+
+/* Make `to' a copy of the scanned input file `from' that is
+   positioned at page number `page' (0 is the first page).  The
+   copy has its own file pointer and buffers so several pages can
+   be read concurrently; call nextipage(to,0) to open the page
+   and closeIFILE(to) when done.  The page data is copied so the
+   copy may change it.  Returns 0 if OK, 1 if there is no such
+   page. */
+
+int dupIFILE ( IFILE *to, IFILE *from, int page )
+{
+  if ( page < 0 || from->pages + page > from->lastpage ) 
+    return 1 ;
+
+  *to = *from ;
+  to->page = to->pages + page ;
+  to->lastpage = to->pages + ( from->lastpage - from->pages ) ;
+  to->f = 0 ;
+  to->arena = 0 ;
+  to->grey = 0 ;
+  to->greybuf = 0 ;
+  to->greyw = 0 ;
+  to->pdf = 0 ;
+  to->pixels = 0 ;
+  to->scan = 0 ;
+
+  return 0 ;
+}
+
+
+/* Close an input file and release its buffers. */
+
+void closeIFILE ( IFILE *f )
+{
+  closeipage ( f ) ;
+  free ( f->grey ) ;
+  free ( f->greybuf ) ;
+  f->grey = 0 ;
+  f->greybuf = 0 ;
+  f->greyw = 0 ;
+}
+
+/* Release the page data of an input file scanned by newIFILE().
+   The file can't be read again. */
+
+void freeIFILE ( IFILE *f )
+{
+  PAGE *p ;
+
+  closeIFILE ( f ) ;
+  if ( f->scan ) {
+    fclose ( f->scan ) ;
+    f->scan = 0 ;
+  }
+  if ( f->pdf ) {
+    pdffree ( f->pdf ) ;
+    f->pdf = 0 ;
+  }
+  if ( f->lastpage )
+    for ( p = f->pages ; p <= f->lastpage ; p++ ) 
+      freepage ( p ) ;
+}
+
 #define dfax_first 0
 #define dfax_next 0
 
+/* Functions to scan the first and following pages of a file of
+   each input format. */
+
+int ( *firstpage [NIFORMATS] ) ( IFILE * ) = {
+  auto_first, pbm_first, fax_first, text_first, tiff_first, 
+  dfax_first, pcx_first, raw_first, dcx_first, pgm_first, pdf_first,
+  cover_first
+} ;
+
+int ( *nextpage [NIFORMATS] ) ( IFILE * ) = {
+  auto_next, pbm_next, fax_next, text_next, tiff_next, 
+  dfax_next, pcx_next, raw_next, dcx_next, pgm_next, pdf_next,
+  cover_next
+} ;
+
 /* Initialize an input (IFILE) structure.  This structure
    collects the data about images to be processed to allow a
    simple interface for functions that need to read image files.
@@ -1289,6 +3941,11 @@ int lastpage ( IFILE *f )
    The page pointer index is initialized so that the first call
    to nextipage with dp=1 actually opens the first file.
 
+   If f->stream is set and the last file is standard input ("-")
+   only its first page is scanned, so that it can be converted
+   before the rest of the input arrives.  Call scanipage() for
+   each following page.
+
 */
 
 
@@ -1304,24 +3961,22 @@ int newIFILE ( IFILE *f, char **fnames )
   gsize written = 0 ;
   char *conv_fname ;
 #endif
-  
-  int ( *first [NIFORMATS] ) ( IFILE * ) = {
-    auto_first, pbm_first, fax_first, text_first, tiff_first, 
-    dfax_first, pcx_first, raw_first, dcx_first
-  } ;
-
-  int ( *next [NIFORMATS] ) ( IFILE * ) = {
-    auto_next, pbm_next, fax_next, text_next, tiff_next, 
-    dfax_next, pcx_next, raw_next, dcx_next
-  } ;
 
+  f->lastpage = 0 ;		/* for freeIFILE() */
+  f->scan = 0 ;
   f->page = f->pages ;
+  f->arena = 0 ;
+  f->grey = 0 ;
+  f->greybuf = 0 ;
+  f->greyw = 0 ;
+  f->pdf = 0 ;
+  f->pixels = 0 ;
 
   /* get info for all pages in all files */
 
   for ( p=fnames ; ! err && *p ; p++ ) {
 
-    if ( ! ( f->f = fopen ( *p, "rb" ) ) ) {
+    if ( ! ( f->f = ifopen ( *p, "rb" ) ) ) {
       message = strdup2 ( "ES2 ", gettext ( "can't open file %s:" ) ) ;
       if ( message ) {
 #ifdef ENABLE_NLS
@@ -1412,9 +4067,11 @@ int newIFILE ( IFILE *f, char **fnames )
 
       page_init ( f->page, *p ) ;
 
-      if ( ( fun = i ? next[fformat] : first[fformat] ) )
+      if ( ( fun = i ? nextpage[fformat] : firstpage[fformat] ) )
 	err = (*fun)(f) ;
 
+      if ( err ) freepage ( f->page ) ;
+
       if ( ! err ) {
 
 	page_report ( f->page, fformat, f->page - f->pages + 1 ) ;
@@ -1426,6 +4083,14 @@ int newIFILE ( IFILE *f, char **fnames )
       }
 
       if ( ! f->next ) break ;
+
+      if ( ! err && f->stream && ! p[1] && ! strcmp ( *p, "-" ) && 
+	   nextpage[fformat] ) {
+	f->scan = f->f ;	/* scan the rest as it arrives */
+	f->scanformat = fformat ;
+	f->f = 0 ;
+	break ;
+      }
     }
 
     if ( f->f ) {
@@ -1441,13 +4106,57 @@ int newIFILE ( IFILE *f, char **fnames )
   
   if ( ! normalbits[1] ) initbittab() ;	/* bit-reverse table initialization */
 
+  return err ;
+}
+
+
+/* Scan the next page of standard input if it is the last file of
+   input file f (see newIFILE()), waiting for the page to arrive.
+   Returns 0 if a page was added, 1 if there are no more pages or
+   2 on errors. */
+
+int scanipage ( IFILE *f )
+{
+  int err=0 ;
+  PAGE *page = f->page ;
+  FILE *fp = f->f ;
+
+  if ( ! f->scan ) 
+    return 1 ;
+
+  if ( f->lastpage + 1 >= f->pages + MAXPAGE ) {
+    err = msg ( "E2 too many pages (max is %d)", MAXPAGE ) ;
+  } else {
+    f->page = f->lastpage + 1 ;
+    f->f = f->scan ;
+    page_init ( f->page, f->lastpage->fname ) ;
+    if ( ! ( err = (*nextpage[f->scanformat])(f) ) ) {
+      page_report ( f->page, f->scanformat, f->page - f->pages + 1 ) ;
+      f->lastpage++ ;
+    } else {
+      freepage ( f->page ) ;
+    }
+  }
+
+  if ( err || ! f->next ) {
+    fclose ( f->scan ) ;
+    f->scan = 0 ;
+  }
+
+  f->page = page ;
+  f->f = fp ;
+
   return err ;
 }
 
 		/* Image File Output Functions */
 
-/* Strings and function to write a bit map in HP-PCL format. The only
-   compression is removal of trailing zeroes.  Margins and resolution are
+/* Strings and functions to write a bit map in HP-PCL format.
+   Each row is sent using whichever of compression mode 2 (TIFF
+   PackBits) and mode 3 (delta row, which codes the bytes that
+   differ from the previous or `seed' row) is shorter, after
+   removal of trailing zeroes.  Both modes are understood by
+   LaserJets from the LaserJet III on.  Margins and resolution are
    set before first write.  */
 
 char *PCLBEGIN =
@@ -1462,11 +4171,90 @@ char *PCLEND =
 	 "\014" 		/* form feed */
 	 "\033E" ;		/* Printer reset. */
 
+/* Code n bytes of buf into out using PackBits: runs of 2 to 128
+   equal bytes as the byte preceded by 1-count and other bytes as
+   literals of up to 128 bytes preceded by count-1.  Returns the
+   number of bytes written. */
+
+int packbits ( uchar *buf, int n, uchar *out )
+{
+  int i=0, k ;
+  uchar *p = out ;
+
+  while ( i < n ) {
+    for ( k=1 ; i+k < n && k < 128 && buf [ i+k ] == buf [ i ] ; k++ ) ;
+    if ( k > 1 ) {
+      *p++ = 257 - k ;
+      *p++ = buf [ i ] ;
+    } else {			/* literal up to a run of 3 */
+      for ( ; i+k < n && k < 128 && 
+	      ! ( i+k+2 < n && buf [ i+k ] == buf [ i+k+1 ] && 
+		  buf [ i+k ] == buf [ i+k+2 ] ) ; k++ ) ;
+      *p++ = k - 1 ;
+      memcpy ( p, buf + i, k ) ;
+      p += k ;
+    }
+    i += k ;
+  }
+
+  return p - out ;
+}
+
+/* Code the n bytes of row as changes to the nseed bytes of seed
+   (both padded with zeroes) using PCL delta row compression.  Each
+   group of up to 8 changed bytes is preceded by a byte holding
+   count-1 (3 bits) and the offset (5 bits) from the end of the
+   previous group, with offset 31 followed by further bytes to
+   add, up to one below 255.  Returns the number of bytes
+   written. */
+
+#define PCLBYTE( b, n, i ) ( (i) < (n) ? (b) [ i ] : 0 )
+
+int deltarow ( uchar *row, int n, uchar *seed, int nseed, uchar *out )
+{
+  int i=0, k, off, last=0, m = n > nseed ? n : nseed ;
+  uchar *p = out ;
+
+  while ( i < m ) {
+    if ( PCLBYTE ( row, n, i ) == PCLBYTE ( seed, nseed, i ) ) {
+      i++ ;
+      continue ;
+    }
+    for ( k=1 ; k < 8 && i+k < m && 
+	    PCLBYTE ( row, n, i+k ) != PCLBYTE ( seed, nseed, i+k ) ; k++ ) ;
+    off = i - last ;
+    *p++ = ( k - 1 ) << 5 | ( off < 31 ? off : 31 ) ;
+    if ( off >= 31 ) {
+      for ( off -= 31 ; off >= 255 ; off -= 255 ) *p++ = 255 ;
+      *p++ = off ;
+    }
+    for ( last = i + k ; i < last ; i++ ) 
+      *p++ = PCLBYTE ( row, n, i ) ;
+  }
+
+  return p - out ;
+}
+
 void pclwrite ( OFILE *f, unsigned char *buf, int n )
 {
+  int n2, n3, mode ;
+  uchar p2 [ MAXBITS + MAXBITS / 128 + 1 ], p3 [ 3 * MAXBITS ] ;
+
   while ( n > 0 && buf [ n-1 ] == 0 ) n-- ; 
-  fprintf( f->f, "\033*b%dW", n ) ;
-  fwrite ( buf, n, 1, f->f ) ;
+
+  n2 = packbits ( buf, n, p2 ) ;
+  n3 = deltarow ( buf, n, f->pclseed, f->pclseedlen, p3 ) ;
+  mode = n3 < n2 || ( n3 == n2 && f->pclmode == 3 ) ? 3 : 2 ;
+
+  if ( mode != f->pclmode ) 
+    fprintf ( f->f, "\033*b%dM", f->pclmode = mode ) ;
+  fprintf( f->f, "\033*b%dW", mode == 2 ? n2 : n3 ) ;
+  fwrite ( mode == 2 ? p2 : p3, mode == 2 ? n2 : n3, 1, f->f ) ;
+
+  memcpy ( f->pclseed, buf, n ) ;
+  if ( f->pclseedlen > n ) 
+    memset ( f->pclseed + n, 0, f->pclseedlen - n ) ;
+  f->pclseedlen = n ;
 }
 
 
@@ -1479,33 +4267,22 @@ void pclwrite ( OFILE *f, unsigned char *buf, int n )
 
 void pgmwrite ( OFILE *f, uchar *buf, int n )
 {
-  static uchar gval [ MAXBITS * 8 / 4 ] ;
-  static int init=0, lines=0 ;
-  static uchar hbits [ 256 ], lbits [ 256 ] ;
-  static int nybblecnt [ 16 ] = { 0,1,1,2, 1,2,2,3, 1,2,2,3, 2,3,3,4 } ;
-  static uchar corr [ 17 ] = { 255, 239, 223, 207, 191, 175, 159, 143, 127, 
+  static const uchar nybblecnt [ 16 ] = 
+    { 0,1,1,2, 1,2,2,3, 1,2,2,3, 2,3,3,4 } ;
+  static const uchar corr [ 17 ] = { 255, 239, 223, 207, 191, 175, 159, 143, 127, 
 				111,  95,  79,  63,  47,  31,  15,   0 } ;
   int m ;
   uchar *p, *q ; 
 
-  if ( ! init ) {	    /*  build table of bit counts in each nybble */
-    short i ;
-    for ( i=0 ; i<256 ; i++ ) {
-	hbits [ i ] = nybblecnt [ i >> 4 & 0x0f ] ;
-	lbits [ i ] = nybblecnt [ i & 0x0f ] ;
-      }
-    init = 1 ;
-  }
-
-  for ( m=n, p=gval, q=buf ; m-- > 0 ; q++ ) {
-    *p++ += hbits [ *q ] ;
-    *p++ += lbits [ *q ] ;
+  for ( m=n, p=f->pgmval, q=buf ; m-- > 0 ; q++ ) {
+    *p++ += nybblecnt [ *q >> 4 ] ;
+    *p++ += nybblecnt [ *q & 0x0f ] ;
   }
   
-  if ( ( lines++ & 0x03 ) == 0x03 ) {
-    for ( p=gval, m=2*n ; m-- > 0 ; p++ ) *p = corr [ *p ] ;
-    fwrite ( gval,  1, 2*n, f->f ) ;
-    memset ( gval,  0, 2*n ) ;
+  if ( ( f->pgmlines++ & 0x03 ) == 0x03 ) {
+    for ( p=f->pgmval, m=2*n ; m-- > 0 ; p++ ) *p = corr [ *p ] ;
+    fwrite ( f->pgmval,  1, 2*n, f->f ) ;
+    memset ( f->pgmval,  0, 2*n ) ;
   }
 }
 
@@ -1618,14 +4395,14 @@ void psinit ( OFILE *f, int newfile, int page, int w, int h, int n )
 }
 
 
-char nhexout = 0, hexchars [ 16 ] = "0123456789abcdef" ;
+char hexchars [ 16 ] = "0123456789abcdef" ;
 
-#define hexputc( f, c ) ( \
-        putc ( hexchars [ (c) >>   4 ], f ), \
-        putc ( hexchars [ (c) & 0x0f ], f ), \
-        ( ( ( nhexout++ & 31 ) == 31 ) ? putc ( '\n', f ) : 0 ) )
+#define hexputc( o, c ) ( \
+        putc ( hexchars [ (c) >>   4 ], (o)->f ), \
+        putc ( hexchars [ (c) & 0x0f ], (o)->f ), \
+        ( ( ( (o)->nhexout++ & 31 ) == 31 ) ? putc ( '\n', (o)->f ) : 0 ) )
 
-void hexputs ( FILE *f, uchar *p, int n )
+void hexputs ( OFILE *f, uchar *p, int n )
 {
   uchar c ;
   if ( n > 0 ) {
@@ -1643,7 +4420,7 @@ void hexputs ( FILE *f, uchar *p, int n )
 void pswrite ( OFILE *f, unsigned char *buf, int n )
 {
   int i, j, l ;
-  static unsigned char last [ MAXBITS ] ;
+  uchar *last = f ? f->pslast : 0 ;
   
   l=i=0 ;
 
@@ -1654,7 +4431,7 @@ void pswrite ( OFILE *f, unsigned char *buf, int n )
 
   for ( j=0 ; j<n && buf[j]==last[j] && f->pslines ; j++ ) ;
   if ( j == n ) {		/* repeat line */
-    hexputc ( f->f, 0 ) ;
+    hexputc ( f, 0 ) ;
     l=i=n ;
   }
 
@@ -1662,20 +4439,20 @@ void pswrite ( OFILE *f, unsigned char *buf, int n )
 
     for ( j=i ; j<n && buf[j]==last[j] && j-i<127 && f->pslines ; j++ ) ;
     if ( j-i > 2 ) {		/* skip */
-      hexputs ( f->f, buf+l, i-l ) ;
-      hexputc ( f->f, j-i + 127 ) ; 
+      hexputs ( f, buf+l, i-l ) ;
+      hexputc ( f, j-i + 127 ) ; 
       l=i=j ;
     } else {
       for ( j=i ; j<n && buf[j]==buf[i] && j-i<255 ; j++ ) ;
       if ( j-i > 4 ) {		/* run */
-	hexputs ( f->f, buf+l, i-l ) ;
-	hexputc ( f->f, 255 ) ; 
-	hexputc ( f->f, j-i ) ; 
-	hexputc ( f->f, buf[i] ^ 0xff ) ;
+	hexputs ( f, buf+l, i-l ) ;
+	hexputc ( f, 255 ) ; 
+	hexputc ( f, j-i ) ; 
+	hexputc ( f, buf[i] ^ 0xff ) ;
 	l=i=j ;
       } else {
 	if ( i-l >= 127 ) {	/* maximum data length */
-	  hexputs ( f->f, buf+l, i-l ) ;
+	  hexputs ( f, buf+l, i-l ) ;
 	  l=i ;
 	} else {		/* data */
 	  i++ ;
@@ -1684,7 +4461,7 @@ void pswrite ( OFILE *f, unsigned char *buf, int n )
     }
 
   }
-  hexputs ( f->f, buf+l, i-l ) ;
+  hexputs ( f, buf+l, i-l ) ;
 
   if ( n >= 0 ) 
     memcpy ( last, buf, n ) ;
@@ -1693,6 +4470,274 @@ void pswrite ( OFILE *f, unsigned char *buf, int n )
 }
 
 
+/* PostScript Level 2 output embeds the G3-coded image, ASCII85
+   encoded, in the file and decodes it with the CCITTFaxDecode
+   filter.  No bit map is generated and fax pages can be copied
+   without being decoded.  The data for each page follows the
+   faximage procedure and ends with the ASCII85 EOD marker (~>);
+   anything the image operator leaves unread is discarded by
+   flushfile.  */
+
+const char PS2BEGIN [] =	/* start of file */
+  "%%!PS-Adobe-3.0 \n"
+  "%%%%Creator: efax (Copyright 1995 Ed Casas) \n"
+  "%%%%Title: efix output\n"
+  "%%%%LanguageLevel: 2 \n"
+  "%%%%Pages: (atend) \n"
+  "%%%%BoundingBox: 0 0 %d %d \n"
+  "%%%%EndComments \n"
+  "%%%%BeginProlog \n"
+  "/faxdict 3 dict def \n"
+  "/faximage { %% w h => - \n"
+  "  faxdict begin \n"
+  "  /h exch def /w exch def \n"
+  "  /src currentfile /ASCII85Decode filter def \n"
+  "  << /ImageType 1 /Width w /Height h /BitsPerComponent 1 \n"
+  "     /Decode [ 0 1 ] /ImageMatrix [ w 0 0 h neg 0 h ] \n"
+  "     /DataSource src << /K 0 /Columns w /Rows h >> /CCITTFaxDecode filter \n"
+  "  >> image \n"
+  "  src flushfile \n"
+  "  end \n"
+  "} bind def \n"
+  "%%%%EndProlog \n" ;
+
+const char PS2PAGE [] =		/* start of page */
+  "%%%%Page: %d %d \n"
+  "gsave \n"
+  "%f %f translate \n"
+  "%f %f scale \n"
+  "%d %d faximage \n" ;
+
+void ps2init ( OFILE *f, int newfile, int page )
+{
+  float ptw, pth ;
+
+  ptw = f->w/f->xres * 72.0 ;		   /* convert to points */
+  pth = f->h/f->yres * 72.0 ;
+
+  if ( newfile )
+    fprintf ( f->f, PS2BEGIN, (int) ptw, (int) pth ) ;
+
+  fprintf ( f->f, PS2PAGE, 
+	  page, page,				 /* page number */
+	  0.0, 0.0,				 /* shift */
+	  ptw, pth,				 /* scaling */
+	  f->w, f->h ) ;			 /* image size */
+
+  f->pslines = 0 ;
+  f->lastpageno = page ;
+  f->na85 = f->a85col = 0 ;
+}
+
+
+/* Write n bytes as ASCII85 to PS2 file f.  Up to 3 bytes are held
+   in f->a85 until the next call or a85end(). */
+
+void a85write ( OFILE *f, uchar *p, int n )
+{
+  unsigned long v ;
+  char c [ 5 ] ;
+  int i ;
+
+  while ( n-- > 0 ) {
+
+    f->a85 [ f->na85++ ] = *p++ ;
+    if ( f->na85 < 4 ) continue ;
+
+    v = (unsigned long) f->a85[0] << 24 | f->a85[1] << 16 | 
+      f->a85[2] << 8 | f->a85[3] ;
+    f->na85 = 0 ;
+
+    if ( ! v ) {
+      putc ( 'z', f->f ) ;
+      f->a85col++ ;
+    } else {
+      for ( i=4 ; i>=0 ; i-- ) {
+	c [ i ] = '!' + v % 85 ;
+	v /= 85 ;
+      }
+      fwrite ( c, 1, 5, f->f ) ;
+      f->a85col += 5 ;
+    }
+
+    if ( f->a85col >= 72 ) {
+      putc ( '\n', f->f ) ;
+      f->a85col = 0 ;
+    }
+  }
+}
+
+/* Write any remaining bytes and the end-of-data marker. */
+
+void a85end ( OFILE *f )
+{
+  unsigned long v ;
+  char c [ 5 ] ;
+  int i, n = f->na85 ;
+
+  if ( n > 0 ) {
+    for ( i=n ; i<4 ; i++ ) f->a85 [ i ] = 0 ;
+    v = (unsigned long) f->a85[0] << 24 | f->a85[1] << 16 | 
+      f->a85[2] << 8 | f->a85[3] ;
+    for ( i=4 ; i>=0 ; i-- ) {
+      c [ i ] = '!' + v % 85 ;
+      v /= 85 ;
+    }
+    fwrite ( c, 1, n+1, f->f ) ;
+  }
+
+  fprintf ( f->f, "~>\n" ) ;
+  f->na85 = f->a85col = 0 ;
+}
+
+
+/* PDF output is written sequentially so it can go to a pipe.
+   Objects 1 and 2 (the catalog and page tree) are written at the
+   end of the file, followed by the cross-reference table.  Each
+   page uses four objects: the page, its content stream, the image
+   (with the G3 data as a CCITTFaxDecode stream) and the image
+   stream length, which is only known after the data is written. */
+
+#define PDFPAGEOBJS 4
+
+/* Write formatted text to PDF file f, counting the bytes. */
+
+void pdfprintf ( OFILE *f, const char *fmt, ... )
+{
+  va_list ap ;
+  int n ;
+
+  va_start ( ap, fmt ) ;
+  n = vfprintf ( f->f, fmt, ap ) ;
+  va_end ( ap ) ;
+
+  if ( n > 0 ) f->pdfpos += n ;
+}
+
+void pdfwrite ( OFILE *f, uchar *p, int n )
+{
+  f->pdfpos += fwrite ( p, 1, n, f->f ) ;
+}
+
+/* Start object number obj at the current file offset. */
+
+void pdfobj ( OFILE *f, int obj )
+{
+  long *p ;
+
+  if ( obj >= f->maxpdfobj ) {
+    int n = f->maxpdfobj ? 2 * f->maxpdfobj : 64 ;
+    while ( n <= obj ) n *= 2 ;
+    if ( ! ( p = realloc ( f->pdfobj, n * sizeof(long) ) ) ) {
+      msg ( "E2 out of memory for PDF objects" ) ;
+      return ;
+    }
+    memset ( p + f->maxpdfobj, 0, ( n - f->maxpdfobj ) * sizeof(long) ) ;
+    f->pdfobj = p ;
+    f->maxpdfobj = n ;
+  }
+
+  f->pdfobj [ obj ] = f->pdfpos ;
+  if ( obj >= f->npdfobj ) f->npdfobj = obj + 1 ;
+
+  pdfprintf ( f, "%d 0 obj\n", obj ) ;
+}
+
+/* Begin page `page' of PDF file f, writing the file header first
+   if newfile is set.  The image data follows. */
+
+void pdfinit ( OFILE *f, int newfile, int page )
+{
+  float ptw, pth ;
+  char content [ 128 ] ;
+  int obj ;
+
+  if ( newfile ) {
+    f->pdfpos = 0 ;
+    f->npdfobj = 3 ;
+    f->pdfpages = 0 ;
+    pdfprintf ( f, "%%PDF-1.4\n%%\342\343\317\323\n" ) ;
+  }
+
+  ptw = f->w/f->xres * 72.0 ;		   /* convert to points */
+  pth = f->h/f->yres * 72.0 ;
+
+  obj = f->npdfobj ;
+
+  pdfobj ( f, obj ) ;
+  pdfprintf ( f, "<< /Type /Page /Parent 2 0 R "
+	      "/MediaBox [ 0 0 %.2f %.2f ] "
+	      "/Resources << /XObject << /Im%d %d 0 R >> >> "
+	      "/Contents %d 0 R >>\nendobj\n", 
+	      ptw, pth, page, obj+2, obj+1 ) ;
+
+  sprintf ( content, "q %.2f 0 0 %.2f 0 0 cm /Im%d Do Q\n", 
+	    ptw, pth, page ) ;
+  pdfobj ( f, obj+1 ) ;
+  pdfprintf ( f, "<< /Length %d >>\nstream\n%sendstream\nendobj\n",
+	      (int) strlen ( content ), content ) ;
+
+  pdfobj ( f, obj+2 ) ;
+  pdfprintf ( f, "<< /Type /XObject /Subtype /Image "
+	      "/Width %d /Height %d /ColorSpace /DeviceGray "
+	      "/BitsPerComponent 1 /Filter /CCITTFaxDecode "
+	      "/DecodeParms << /K 0 /Columns %d /Rows %d >> "
+	      "/Length %d 0 R >>\nstream\n", 
+	      f->w, f->h, f->w, f->h, obj+3 ) ;
+
+  f->pdfstream = f->pdfpos ;
+  f->pdfpages++ ;
+  f->pslines = 0 ;
+  f->lastpageno = page ;
+}
+
+/* End the image data of the current page. */
+
+void pdfend ( OFILE *f )
+{
+  long len ;
+  int obj = f->npdfobj - 1 ;
+
+  len = f->pdfpos - f->pdfstream ;
+  pdfprintf ( f, "\nendstream\nendobj\n" ) ;
+  pdfobj ( f, obj+1 ) ;
+  pdfprintf ( f, "%ld\nendobj\n", len ) ;
+}
+
+/* Write the page tree, catalog, cross-reference table and trailer
+   of PDF file f after its last page. */
+
+void pdftrailer ( OFILE *f )
+{
+  long xref ;
+  int i ;
+
+  pdfobj ( f, 2 ) ;
+  pdfprintf ( f, "<< /Type /Pages /Count %d /Kids [", f->pdfpages ) ;
+  for ( i=0 ; i < f->pdfpages ; i++ )
+    pdfprintf ( f, "%s%d 0 R", i % 8 ? " " : "\n", 3 + i*PDFPAGEOBJS ) ;
+  pdfprintf ( f, " ] >>\nendobj\n" ) ;
+
+  pdfobj ( f, 1 ) ;
+  pdfprintf ( f, "<< /Type /Catalog /Pages 2 0 R >>\nendobj\n" ) ;
+
+  xref = f->pdfpos ;
+  pdfprintf ( f, "xref\n0 %d\n0000000000 65535 f \n", f->npdfobj ) ;
+  for ( i=1 ; i < f->npdfobj ; i++ )
+    pdfprintf ( f, "%010ld 00000 n \n", f->pdfobj [ i ] ) ;
+  pdfprintf ( f, "trailer\n<< /Size %d /Root 1 0 R >>\n"
+	      "startxref\n%ld\n%%%%EOF\n", f->npdfobj, xref ) ;
+}
+
+/* Returns true if all pages go to one PDF file: the output file
+   name pattern, if any, has no page number escape. */
+
+int pdfonefile ( OFILE *f )
+{
+  return f->format == O_PDF && ( ! f->fname || ! strchr ( f->fname, '%' ) ) ;
+}
+
+
 /* Write 2- and 4-byte integers to an image output file.  Return
    as for fwrite. */
 
@@ -1740,7 +4785,7 @@ int wtag ( OFILE *f, int lng, short tag, short type, long count, long offset )
 
 int tiffinit ( OFILE *f )
 {
-  int err=0, compr=1 ;
+  int err=0, compr=1, ntags = NTAGS + ( f->format == O_TIFF_FAX ) ;
   long tdoff, doff ;
 
   fseek ( f->f, 0, SEEK_SET ) ;
@@ -1755,11 +4800,11 @@ int tiffinit ( OFILE *f )
 
   /* 8 ==> directory */
 
-  fwrite2 ( NTAGS, f ) ;
+  fwrite2 ( ntags, f ) ;
 
   /* figure out offsets within file and compression code */
 
-  tdoff = 8 + 2 + NTAGS*12 + 4 ;     /* offset to directory data */
+  tdoff = 8 + 2 + ntags*12 + 4 ;     /* offset to directory data */
   doff = tdoff + NRATIO*8 ;	     /* offset to image data */
 
   switch ( f->format ) {
@@ -1791,6 +4836,10 @@ int tiffinit ( OFILE *f )
 
   wtag( f, 0, 296, 3, 1, 2 ) ;	      /* resolution units(2=in,3=cm) short */
   wtag( f, 0, 327, 3, 1, 0 ) ;	      /* clean fax(0=clean) short */
+
+  if ( f->format == O_TIFF_FAX )      /* line index long (see LINEINDEX) */
+    wtag( f, 1, TIFFLINEINDEX, 4, f->nlineidx + 1, 
+	  f->nlineidx ? f->lineidxoff : LINEINDEX ) ;
   
   fwrite4 ( 0, f ) ;		      /* offset to next dir (no more) */
 
@@ -1906,88 +4955,159 @@ void  pcxwrite ( OFILE *of, uchar *p, int nb )
 }
 
 
-/* Begin/end output pages.  If not starting first page (0), terminate
-   previous page.  If output filename pattern is defined, [re-]opens that
-   file.  If not terminating last page (page==EOF), writes file header.
-   Returns 0 or 2 on errors. */
+/* End the current output page: write its trailer and flush the
+   output so a program reading a pipe gets the whole page without
+   waiting for the next one.  The file trailer, if any, is written
+   by nextopage().  Returns 0 or 2 on errors. */
 
-int nextopage ( OFILE *f, int page )
+int endopage ( OFILE *f )
 {
   int err = 0 ;
   int i, nb=0 ;
   uchar *p, codes [ ( RTCEOL * EOLBITS ) / 8 + 3 ] ;
-  char *message ;
-  
-#ifdef ENABLE_NLS
-  gsize written = 0 ;
-  char *conv_cfname ;
-#endif
 
-  if ( f->f ) { /* terminate previous page */
+  if ( ! f->f || f->pageend ) 
+    return 0 ;
+
+  f->pageend = 1 ;
+
+  switch ( f->format ) {
+  case O_PBM:
+    break ;
+  case O_PGM:
+    break ;
+  case O_FAX:
+  case O_TIFF_FAX:
+    for ( p = codes, i=0 ; i<RTCEOL ; i++ ) 
+      p = putcode ( &f->e, EOLCODE, EOLBITS, p ) ;
+    nb = putcode ( &f->e, 0, 0, p ) - codes ;
+    fwrite ( codes, 1, nb, f->f ) ;
+    f->bytes += nb ;
+    if ( f->format == O_TIFF_FAX ) {
+      if ( ( f->lineidxoff = ftell ( f->f ) ) < 0 ) 
+	f->nlineidx = 0 ;
+      if ( f->nlineidx && f->lineidxoff % 2 ) { /* word-align index */
+	fputc ( 0, f->f ) ;
+	f->lineidxoff++ ;
+      }
+      if ( f->nlineidx ) 
+	fwrite4 ( LINEINDEX, f ) ;
+      for ( i=0 ; i < f->nlineidx ; i++ ) 
+	fwrite4 ( f->lineidx [ i ], f ) ;
+      tiffinit ( f ) ;
+    }
+    break ;
+  case O_TIFF_RAW:
+    tiffinit(f) ;		/* rewind & update TIFF header */
+    break ;
+  case O_PCL:
+    fprintf ( f->f, PCLEND ) ;
+    break ;
+  case O_PS:
+    fprintf ( f->f, PSPAGEEND ) ;
+    break ;
+  case O_PS2:
+    for ( p = codes, i=0 ; i<RTCEOL ; i++ ) 
+      p = putcode ( &f->e, EOLCODE, EOLBITS, p ) ;
+    nb = putcode ( &f->e, 0, 0, p ) - codes ;
+    a85write ( f, codes, nb ) ;
+    a85end ( f ) ;
+    fprintf ( f->f, PSPAGEEND ) ;
+    break ;
+  case O_PDF:
+    for ( p = codes, i=0 ; i<RTCEOL ; i++ ) 
+      p = putcode ( &f->e, EOLCODE, EOLBITS, p ) ;
+    nb = putcode ( &f->e, 0, 0, p ) - codes ;
+    pdfwrite ( f, codes, nb ) ;
+    pdfend ( f ) ;
+    break ;
+  case O_PCX:
+  case O_PCX_RAW:
+    fseek ( f->f, 0, SEEK_SET ) ;
+    pcxinit ( f ) ;
+    break ;
+  }
 
+  if ( fflush ( f->f ) || ferror ( f->f ) ) {
+    err = msg ("ES2output error:" ) ;
+  } else {
+    msg ( "F+ wrote %s as %dx%d pixel %.fx%.f dpi %s page", 
+	 f->cfname, f->w, f->h, f->xres, f->yres, 
+	 oformatname [f->format] ) ;
+    
     switch ( f->format ) {
-    case O_PBM:
-      break ;
-    case O_PGM:
-      break ;
-    case O_FAX:
-    case O_TIFF_FAX:
-      for ( p = codes, i=0 ; i<RTCEOL ; i++ ) 
-	p = putcode ( &f->e, EOLCODE, EOLBITS, p ) ;
-      nb = putcode ( &f->e, 0, 0, p ) - codes ;
-      fwrite ( codes, 1, nb, f->f ) ;
-      f->bytes += nb ;
-      if ( f->format == O_TIFF_FAX ) tiffinit ( f ) ;
+    case O_PS: 
+    case O_PS2: 
+    case O_PDF: 
+      msg ( "F  (%d lines)", f->pslines ) ;
       break ;
     case O_TIFF_RAW:
-      tiffinit(f) ;		/* rewind & update TIFF header */
-      break ;
-    case O_PCL:
-      fprintf ( f->f, PCLEND ) ;
-      break ;
-    case O_PS:
-      fprintf ( f->f, PSPAGEEND ) ;
-      if ( f->fname || page<0 ) fprintf ( f->f, PSEND, f->lastpageno ) ;
+    case O_TIFF_FAX:
+      msg ( "F  (%d bytes)", f->bytes ) ;
       break ;
-    case O_PCX:
-    case O_PCX_RAW:
-      fseek ( f->f, 0, SEEK_SET ) ;
-      pcxinit ( f ) ;
+    default:
+      msg ( "F " ) ;
       break ;
     }
 
-    if ( ferror ( f->f ) ) {
-      err = msg ("ES2output error:" ) ;
-    } else {
-      msg ( "F+ wrote %s as %dx%d pixel %.fx%.f dpi %s page", 
-  	   f->cfname, f->w, f->h, f->xres, f->yres, 
-	   oformatname [f->format] ) ;
-      
+  }
+
+  return err ;
+}
+
+
+/* Begin/end output pages.  If not starting first page (0), terminate
+   previous page (if endopage() hasn't) and, if this is the last page
+   or each page has its own file, write the file trailer.  If output
+   filename pattern is defined, [re-]opens that file.  If not
+   terminating last page (page==EOF), writes file header.  Returns 0
+   or 2 on errors. */
+
+int nextopage ( OFILE *f, int page )
+{
+  int err = 0 ;
+  int nb=0 ;
+  uchar *p, codes [ EOLBITS / 8 + 3 ] ;
+  char *message ;
+  
+#ifdef ENABLE_NLS
+  gsize written = 0 ;
+  char *conv_cfname ;
+#endif
+
+  if ( f->f ) { /* terminate previous page and file */
+
+    err = endopage ( f ) ;
+
+    if ( ! err ) {
       switch ( f->format ) {
-      case O_PS: 
-  	msg ( "F  (%d lines)", f->pslines ) ;
-	break ;
-      case O_TIFF_RAW:
-      case O_TIFF_FAX:
-  	msg ( "F  (%d bytes)", f->bytes ) ;
+      case O_PS:
+      case O_PS2:
+	if ( f->fname || page<0 ) fprintf ( f->f, PSEND, f->lastpageno ) ;
 	break ;
-      default:
-  	msg ( "F " ) ;
+      case O_PDF:
+	if ( ! pdfonefile ( f ) || page<0 ) pdftrailer ( f ) ;
 	break ;
       }
-
+      if ( fflush ( f->f ) || ferror ( f->f ) ) 
+	err = msg ("ES2output error:" ) ;
     }
 
   }
 
   if ( ! err && page >= 0 ) {	/* open new file */
-    if ( f->fname ) {
+    if ( f->f && pdfonefile ( f ) ) {
+      /* keep adding pages to the same file */
+    } else if ( f->fname ) {
       sprintf ( f->cfname, f->fname, page+1, page+1, page+1 ) ;
 
       if ( ! f->f )
-	f->f = fopen ( f->cfname, ( f->format == O_PS ) ? "w" : "wb+" ) ;
+	f->f = fopen ( f->cfname, ( f->format == O_PS || f->format == O_PS2 ) ? 
+		       "w" : "wb+" ) ;
       else
-	f->f = freopen ( f->cfname, ( f->format == O_PS ) ? "w" : "wb+", f->f ) ;
+	f->f = freopen ( f->cfname, ( f->format == O_PS || 
+				      f->format == O_PS2 ) ? "w" : "wb+", 
+			 f->f ) ;
 
       if ( ! f->f ) {
 	message = strdup2 ( "ES2 ", gettext ( "can't open output file %s:" ) ) ;
@@ -2009,14 +5129,16 @@ int nextopage ( OFILE *f, int page )
 	}
       }
     } else {
-      f->f = stdout ;
-      strcpy ( f->cfname, "standard output" ) ;
+      f->f = f->out ;
+      strcpy ( f->cfname, f->out == stdout ? "standard output" : 
+	       "output stream" ) ;
     }
   }
 
   /* start new page */
 
   if ( ! err && page >= 0 ) {
+    f->pageend = 0 ;
     switch ( f->format ) {
     case  O_PBM:
       fprintf ( f->f, "P4 %d %d\n", f->w, f->h ) ;
@@ -2036,10 +5158,22 @@ int nextopage ( OFILE *f, int page )
       break ;
     case O_PCL:
       fprintf ( f->f, PCLBEGIN, (int) f->xres ) ;
+      f->pclmode = 0 ;		/* reset, and raster start zeroes */
+      f->pclseedlen = 0 ;	/* the seed row */
       break ;
     case O_PS:
       psinit ( f, ( f->fname || page==0 ), page+1, f->w, f->h, f->w/8 ) ;
       break ;
+    case O_PS2:
+      ps2init ( f, ( f->fname || page==0 ), page+1 ) ;
+      p = putcode ( &f->e, EOLCODE, EOLBITS, codes ) ;
+      a85write ( f, codes, p - codes ) ;
+      break ;
+    case O_PDF:
+      pdfinit ( f, ( ! pdfonefile ( f ) || page==0 ), page+1 ) ;
+      p = putcode ( &f->e, EOLCODE, EOLBITS, codes ) ;
+      pdfwrite ( f, codes, p - codes ) ;
+      break ;
     case O_PCX:
     case O_PCX_RAW:
       fseek ( f->f, 0, SEEK_SET ) ;
@@ -2056,10 +5190,12 @@ int nextopage ( OFILE *f, int page )
   switch ( f->format ) {
   case O_FAX:
   case O_TIFF_FAX:
+  case O_TIFF_RAW:
   case O_PCX:
   case O_PCX_RAW:
     f->h = 0 ;
     f->bytes = nb ;
+    f->nlineidx = 0 ;
     break ;
   }
 
@@ -2067,6 +5203,30 @@ int nextopage ( OFILE *f, int page )
 }
 
 
+/* Add the position of the next scan line of a TIFF/G3 page to
+   its line index if the line is to be indexed.  If memory runs
+   out the index stops at the last line indexed. */
+
+void indexline ( OFILE *f )
+{
+  long *p ;
+  int n ;
+
+  if ( f->h % LINEINDEX || f->h / LINEINDEX != f->nlineidx ) 
+    return ;
+
+  if ( f->nlineidx >= f->maxlineidx ) {
+    n = f->maxlineidx ? 2 * f->maxlineidx : 64 ;
+    if ( ! ( p = realloc ( f->lineidx, n * sizeof(long) ) ) ) 
+      return ;
+    f->lineidx = p ;
+    f->maxlineidx = n ;
+  }
+
+  f->lineidx [ f->nlineidx++ ] = f->bytes * 8L + f->e.shift + 8 ;
+}
+
+
 /* Output scan line of nr runs no times to output file f. */
 
 void writeline ( OFILE *f, short *runs, int nr, int no )
@@ -2106,11 +5266,24 @@ void writeline ( OFILE *f, short *runs, int nr, int no )
       break ;
     case O_TIFF_FAX:
     case O_FAX:
+      if ( f->format == O_TIFF_FAX ) indexline ( f ) ;
       p = runtocode ( &f->e, runs, nr, buf ) ;
       p = putcode ( &f->e, EOLCODE, EOLBITS, p ) ;
       nb = p - buf ;
       fwrite ( buf, 1, nb, f->f ) ;
       break ;
+    case O_PS2:
+      p = runtocode ( &f->e, runs, nr, buf ) ;
+      p = putcode ( &f->e, EOLCODE, EOLBITS, p ) ;
+      a85write ( f, buf, p - buf ) ;
+      f->pslines++ ;
+      break ;
+    case O_PDF:
+      p = runtocode ( &f->e, runs, nr, buf ) ;
+      p = putcode ( &f->e, EOLCODE, EOLBITS, p ) ;
+      pdfwrite ( f, buf, p - buf ) ;
+      f->pslines++ ;
+      break ;
     case O_PCL:
       pclwrite ( f, buf, nb ) ;
       break ;
@@ -2140,23 +5313,136 @@ void writeline ( OFILE *f, short *runs, int nr, int no )
 }
 
 
-/* Initialize new output file. If fname is NULL, stdout will be used for
-   all images. */
+/* Returns true if the coded data of the current page of IFILE f
+   can be copied unchanged to an output page of format `format'
+   and w by h pixels: single-strip G3 data of known length with
+   white coded as zero. */
+
+int passthrough ( IFILE *f, int format, int w, int h )
+{
+  PAGE *p = f->page ;
+
+  return ( format == O_PS2 || format == O_PDF ) && 
+    p->format == P_FAX && p->length > 0 && p->nstrips == 1 && 
+    ! p->black_is_zero && p->w == w && p->h == h ;
+}
+
+
+/* Copy the coded data of the current page of IFILE f to the
+   current page of OFILE o without decoding it.  Only valid if
+   passthrough() is true.  Returns 0 or 2 on errors. */
+
+int copypage ( IFILE *f, OFILE *o )
+{
+  int err=0, i, nb, z, first=1 ;
+  long n = f->page->length ;
+  uchar buf [ IFILEBUFSIZE ], eol [ 4 ] ;
+
+  if ( fseek ( f->f, f->page->offset, SEEK_SET ) )
+    err = msg ( "ES2 seek failed" ) ;
+
+  while ( ! err && n > 0 ) {
+    nb = fread ( buf, 1, n < IFILEBUFSIZE ? n : IFILEBUFSIZE, f->f ) ;
+    if ( nb <= 0 ) {
+      err = msg ( "ES2 can't read fax data:" ) ;
+    } else {
+      if ( f->page->revbits )
+	for ( i=0 ; i<nb ; i++ ) buf [ i ] = normalbits [ buf [ i ] ] ;
+
+      /* nextopage() started the page with an EOL whose last bits
+	 are still in the encoder.  If the data starts with its own
+	 EOL (11 or more zeros and a one) drop them, leaving the
+	 zeros already written as fill.  Otherwise flush them (the
+	 fill goes before the EOL).  Either way the copied data
+	 starts on a byte boundary and so does the RTC added by
+	 endopage(). */
+
+      if ( first ) {
+	first = 0 ;
+	for ( z=0 ; z < nb*8 && ! ( buf [ z/8 ] & 0x80 >> z%8 ) ; z++ ) ;
+	if ( z >= 11 && z < nb*8 ) {
+	  newENCODER ( &o->e ) ;
+	} else {
+	  i = putcode ( &o->e, 0, 0, eol ) - eol ;
+	  switch ( o->format ) {
+	  case O_PS2:
+	    a85write ( o, eol, i ) ;
+	    break ;
+	  case O_PDF:
+	    pdfwrite ( o, eol, i ) ;
+	    break ;
+	  }
+	}
+      }
+
+      switch ( o->format ) {
+      case O_PS2:
+	a85write ( o, buf, nb ) ;
+	break ;
+      case O_PDF:
+	pdfwrite ( o, buf, nb ) ;
+	break ;
+      }
+      n -= nb ;
+    }
+  }
+
+  o->pslines = f->page->h ;
+  f->lines = 0 ;
+
+  return err ;
+}
+
+
+/* Initialize new output file. If fname is NULL, stdout (or the
+   stream f->out is later set to) will be used for all images. */
 
 void newOFILE ( OFILE *f, int format, char *fname, 
 	       float xres, float yres, int w, int h )
 {
   f->f = 0 ;
+  f->out = stdout ;
   f->format = format ;
+  f->pageend = 0 ;
   f->fname = fname ;
   f->xres = xres ;
   f->yres = yres ;
   f->w = w ;
   f->h = h ;
   f->bytes = 0 ;
+  f->pdfobj = 0 ;
+  f->npdfobj = f->maxpdfobj = f->pdfpages = 0 ;
+  f->pgmlines = 0 ;
+  memset ( f->pgmval, 0, sizeof(f->pgmval) ) ;
+  f->nhexout = 0 ;
+  f->lineidx = 0 ;
+  f->nlineidx = f->maxlineidx = 0 ;
   newENCODER ( &f->e ) ;
 }
 
+
+/* Close an output file after its last page (nextopage(f,EOF))
+   and release its buffers.  The f->out stream is flushed but not
+   closed.  Returns 0 or 2 on errors. */
+
+int closeOFILE ( OFILE *f )
+{
+  int err=0 ;
+
+  if ( f->f && ( f->f == f->out ? fflush ( f->f ) : fclose ( f->f ) ) )
+    err = msg ( "ES2output error:" ) ;
+
+  f->f = 0 ;
+  free ( f->pdfobj ) ;
+  f->pdfobj = 0 ;
+  f->npdfobj = f->maxpdfobj = 0 ;
+  free ( f->lineidx ) ;
+  f->lineidx = 0 ;
+  f->nlineidx = f->maxlineidx = 0 ;
+
+  return err ;
+}
+
 /* Read a bitmap to use as a font and fill in the font data.  If
    the file name is null, empty, or there are errors, the font is
    initialized to the built-in font. Returns 0 if OK, 2 on
@@ -2230,6 +5516,8 @@ int readfont ( char *fname, faxfont *font )
     for ( i=0 ; i<256 ; i++ ) font->offset[i] = i*font->w ;
   }
 
+  if ( fontruns ( font ) ) err = 2 ;
+
   return err ;
 }
 
@@ -2270,10 +5558,16 @@ void initbittab ( void )
    For undefined codewords, one bit is skipped and decoding continues at
    the white code table. */
 
-/* the lookup tables for each colour and the fill lookup table */
+/* the lookup tables for each colour and the fill lookup table, and
+   the same tables indexed by bit-reversed codes for decoding
+   LSB-first data (see DECODELSB) */
 
 dtab tw1 [ 512 ], tw2 [ 512 ], tb1 [ 512 ], tb2 [ 512 ], fill [ 512 ] ;
-char tabinit=0 ;
+dtab rtw1 [ 512 ], rtw2 [ 512 ], rtb1 [ 512 ], rtb2 [ 512 ], rfill [ 512 ] ;
+
+#define NDTABS 5
+dtab *dtabs [ NDTABS ] = { tw1, tw2, tb1, tb2, fill } ;
+dtab *rdtabs [ NDTABS ] = { rtw1, rtw2, rtb1, rtb2, rfill } ;
 
 /* Add code cword shifted left by shift to decoding table tab. */
 
@@ -2308,47 +5602,75 @@ void init1dtab ( t4tab *p0, dtab *t1, dtab *t2, dtab *ot )
 }
 
 
-/* Initialize a T.4 decoder.   */
+/* Build the decoding tables. */
 
-void newDECODER ( DECODER *d )
+void initdtabs ( void )
 {
-  int i ;
-
-  if ( ! tabinit ) {
+  int i, j, k, r ;
 
-    /* undefined codes */
+  /* undefined codes */
 
-    addcode ( tw1,  0, 9, 0, 1, tw1 ) ;
-    addcode ( tw2,  0, 9, 0, 1, tw1 ) ;
-    addcode ( tb1,  0, 9, 0, 1, tw1 ) ;
-    addcode ( tb2,  0, 9, 0, 1, tw1 ) ;
-    addcode ( fill, 0, 9, 0, 1, tw1 ) ;
+  addcode ( tw1,  0, 9, 0, 1, tw1 ) ;
+  addcode ( tw2,  0, 9, 0, 1, tw1 ) ;
+  addcode ( tb1,  0, 9, 0, 1, tw1 ) ;
+  addcode ( tb2,  0, 9, 0, 1, tw1 ) ;
+  addcode ( fill, 0, 9, 0, 1, tw1 ) ;
   
-    /* fill and EOL */
+  /* fill and EOL */
 
-    addcode ( tw1, 0, 0, 0, 4, tw2 ) ;
-    addcode ( tw2, 0, 2, 0, 7, fill ) ;
-    addcode ( tb1, 0, 0, 0, 4, tb2 ) ;
-    addcode ( tb2, 0, 2, 0, 7, fill ) ;
+  addcode ( tw1, 0, 0, 0, 4, tw2 ) ;
+  addcode ( tw2, 0, 2, 0, 7, fill ) ;
+  addcode ( tb1, 0, 0, 0, 4, tb2 ) ;
+  addcode ( tb2, 0, 2, 0, 7, fill ) ;
 
-    addcode ( fill, 0, 0, 0, 9, fill ) ;
-    for ( i=0 ; i<=8 ; i++ )
-      addcode ( fill, 1, i, -1, 9-i, tw1 ) ;
+  addcode ( fill, 0, 0, 0, 9, fill ) ;
+  for ( i=0 ; i<=8 ; i++ )
+    addcode ( fill, 1, i, -1, 9-i, tw1 ) ;
 
-    /* white and black runs */
+  /* white and black runs */
     
-    init1dtab ( wtab, tw1, tw2, tb1 ) ;
-    init1dtab ( btab, tb1, tb2, tw1 ) ;
-
-    tabinit=1 ;
+  init1dtab ( wtab, tw1, tw2, tb1 ) ;
+  init1dtab ( btab, tb1, tb2, tw1 ) ;
+
+  /* bit-reversed copies */
+
+  for ( i=0 ; i<512 ; i++ ) {
+    for ( r=0, j=0 ; j<9 ; j++ )
+      if ( i & ( 1 << j ) ) r |= 256 >> j ;
+    for ( k=0 ; k<NDTABS ; k++ ) {
+      rdtabs [ k ] [ r ] = dtabs [ k ] [ i ] ;
+      for ( j=0 ; j<NDTABS ; j++ ) 
+	if ( dtabs [ k ] [ i ].next == dtabs [ j ] ) 
+	  rdtabs [ k ] [ r ].next = rdtabs [ j ] ;
+    }
   }
+}
+
+/* Initialize a T.4 decoder for data with the given fill order
+   that stores lines with colours swapped if invert is set.  */
+
+void newDECODER ( DECODER *d, int lsbfirst, int invert )
+{
+  ONCE ( initdtabs ) ;
 
   /* initialize decoder to starting state */
 
   d->x = 0 ;
   d->shift = -9 ;
-  d->tab = tw1 ;
+  d->tab = lsbfirst ? rtw1 : tw1 ;
   d->eolcnt = 0 ;
+  d->lsbfirst = lsbfirst ? 1 : 0 ;
+  d->invert = invert ? 1 : 0 ;
+}
+
+/* Start decoding with input byte c, of which the first n bits (in
+   fill order) are skipped.  Used to start after an EOL that ends
+   within a byte. */
+
+void skipbits ( DECODER *d, int c, int n )
+{
+  d->x = d->lsbfirst ? c >> n : c ;
+  d->shift = 8 - n - 9 ;
 }
 
       /* T.4 coding table and default font for efax/efix */
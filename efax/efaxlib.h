@@ -3,6 +3,8 @@
 
 #include <stdio.h>
 
+#include <config.h>		/* for EFAX_LOWMEM */
+
 #define EFAX_PATH_MAX 1024
 
 		/*  T.4 fax encoding/decoding */
@@ -21,9 +23,16 @@
    32-pel-wide characters allows up to 256 characters per line.  Converted
    to T.4 codes, each pair of runs takes up to 25 bits to code.  MAXCODES
    must also be at least the maximum minimum line length (1200 cps*40 ms ~=
-   48 bytes).  */
-
+   48 bytes).  A low-memory build (configure --enable-lowmem) sets
+   MAXRUNS just above the longest encodeable run instead, which is
+   still enough for the widest T.4 line but limits text and other
+   input images to about 2600 pels.  */
+
+#ifdef EFAX_LOWMEM
+#define MAXRUNS 2688
+#else
 #define MAXRUNS 8192
+#endif
 #define MAXBITS (MAXRUNS/8+1)
 #define MAXCODES (MAXRUNS*25/8/2+1)
 
@@ -53,6 +62,8 @@ typedef struct fontstruct {
   int h, w ;
   uchar buf [ MAXFONTBUF ] ;
   short offset [ 256 ] ;
+  int *runidx ;			/* start of runs for each glyph row */
+  uchar *runs ;			/* glyph rows as runs, starting white */
 } faxfont ;
 
 extern uchar stdfont [ ] ; /* compressed bit map for built-in font */
@@ -80,27 +91,35 @@ extern short short256 ;
 
 /* input, output and page file formats */
 
-#define NIFORMATS 9
-#define NOFORMATS 14
-#define NPFORMATS 5
+#define NIFORMATS 12
+#define NOFORMATS 16
+#define NPFORMATS 8
 
 enum iformats { I_AUTO=0, I_PBM=1, I_FAX=2, I_TEXT=3, I_TIFF=4,
-		I_DFAX=5, I_PCX=6, I_RAW=7, I_DCX=8 } ;
+		I_DFAX=5, I_PCX=6, I_RAW=7, I_DCX=8, I_PGM=9, I_PDF=10,
+		I_COVER=11 } ;
 
 #define IFORMATS { "AUTO", "PBM", "FAX", "TEXT", "TIFF", \
-		"DFAX", "PCX", "RAW", "DCX" } ;
+		"DFAX", "PCX", "RAW", "DCX", "PGM", "PDF", "COVER" } ;
 
 enum oformats { O_AUTO=0, O_PBM=1, O_FAX=2, O_PCL=3, O_PS=4, 
 		O_PGM=5, O_TEXT=6, O_TIFF_FAX=7, O_TIFF_RAW=8, O_DFAX=9, 
-		O_TIFF=10, O_PCX=11, O_PCX_RAW=12, O_DCX=13 } ;
+		O_TIFF=10, O_PCX=11, O_PCX_RAW=12, O_DCX=13, O_PS2=14,
+		O_PDF=15 } ;
 
 #define OFORMATS { "AUTO", "PBM", "FAX", "PCL", "PS", \
 		"PGM", "TEXT", "TIFF", "TIFF", "DFAX", \
-		  "TIFF", "PCX", "PCX", "DCX" } 
+		  "TIFF", "PCX", "PCX", "DCX", "PS", "PDF" } 
+
+enum pformats { P_RAW=0, P_FAX=1, P_PBM=2, P_TEXT=3, P_PCX=4, 
+		P_GREY=5, P_PDF=6, P_COVER=7 } ;
+
+#define PFORMATS { "RAW", "FAX", "PBM", "TEXT", "PCX", "GREY", "PDF", \
+		"COVER" }
 
-enum pformats { P_RAW=0, P_FAX=1, P_PBM=2, P_TEXT=3, P_PCX=4 } ;
+/* methods of converting grey-scale images to black and white */
 
-#define PFORMATS { "RAW", "FAX", "PBM", "TEXT", "PCX" }
+enum greymodes { G_THRESHOLD=0, G_DITHER=1 } ;
 
 
 extern char *iformatname [ NIFORMATS ] ;
@@ -112,24 +131,126 @@ typedef struct decoderstruct {
   short shift ;				 /* number of unused bits - 9 */
   dtab *tab ;				 /* current decoding table */
   int eolcnt ;				 /* EOL count for detecting RTC */
+  uchar lsbfirst ;			 /* fill order is LS to MS bit */
+  uchar invert ;			 /* white is coded as black */
 } DECODER ;
 
-void newDECODER ( DECODER *d ) ;
+void newDECODER ( DECODER *d, int lsbfirst, int invert ) ;
+void   skipbits ( DECODER *d, int c, int n ) ;
+int joinruns ( short *runs, int n, short *len, int invert ) ;
+
+/* Decoding loops for one scan line, one for each fill order, which
+   store the decoder outputs (run length + 1 or -1 for EOL) at p
+   until maxp.  They use the variables x, shift, tab, t, c, p and
+   maxp of the function they are used in.  GET must set c to the
+   next input byte, or to a negative value at the end of the input,
+   where EOL padding is decoded instead.  MSB-first bits are
+   shifted in at the low end of x and decoded from the high end;
+   LSB-first bits are added at the high end and decoded from the
+   low end, using tables indexed by bit-reversed codes.  Neither
+   reverses input bytes. */
+
+#define DECODEMSB(GET) \
+  do { \
+    do { \
+      while ( shift < 0 ) { \
+	GET ; \
+	if ( c < 0 ) { \
+	  x = ( x << 15 ) | 1 ; shift += 15 ; /* EOL pad at end */ \
+	} else { \
+	  x = ( x <<  8 ) | c ; shift +=  8 ; \
+	} \
+      } \
+      t = tab + ( ( x >> shift ) & 0x1ff ) ; \
+      tab = t->next ; \
+      shift -= t->bits ; \
+    } while ( ! t->code ) ; \
+    if ( p < maxp ) *p++ = t->code ; \
+  } while ( t->code != -1 )
+
+#define DECODELSB(GET) \
+  do { \
+    do { \
+      while ( shift < 0 ) { \
+	GET ; \
+	if ( c < 0 ) { \
+	  x |= 0x4000L << ( shift + 9 ) ; shift += 15 ; \
+	} else { \
+	  x |= (long) c << ( shift + 9 ) ; shift +=  8 ; \
+	} \
+      } \
+      t = tab + ( x & 0x1ff ) ; \
+      tab = t->next ; \
+      x >>= t->bits ; \
+      shift -= t->bits ; \
+    } while ( ! t->code ) ; \
+    if ( p < maxp ) *p++ = t->code ; \
+  } while ( t->code != -1 )
+
+/* TIFF/G3 pages written by efax and efix index the start of
+   every LINEINDEX'th scan line in private TIFF tag TIFFLINEINDEX
+   so that they can be decoded from any line (see seekline()).
+   The tag holds the interval followed by the offsets, in bits
+   from the start of the strip, of lines 0, LINEINDEX,
+   2*LINEINDEX, etc. */
+
+#define LINEINDEX 64
+#define TIFFLINEINDEX 65400
 
 #define IFILEBUFSIZE 512
 
 #define MAXPAGE 360		/* number of A4 pages in a 100m roll */
 
+/* A text field of a cover page: a box, in inches from the top
+   left corner of the page, in which the text is set. */
+
+typedef struct coverfieldstruct {
+  float x, y, w, h ;		/* position and size of the box */
+  char *text ;			/* text; %P is the number of pages */
+} COVERFIELD ;
+
 typedef struct PAGEstruct {	/* page data */
   char *fname ;			/* file name */
   long offset ;			/* location of data within file */
+  long length ;			/* bytes of coded data, 0 if unknown */
   int w, h ;			/* pel and line counts */
   float xres, yres ;		/* x and y resolution, dpi */
   uchar format ;		/* image coding */
   uchar revbits ;		/* fill order is LS to MS bit */
   uchar black_is_zero ;		/* black is encoded as zero */
+  int maxval ;			/* GREY: sample value for white/black */
+  uchar deflate ;		/* PDF: bit map is Flate compressed */
+  int predictor ;		/* PDF: Flate predictor (1=none) */
+  int nstrips ;			/* TIFF: number of strips */
+  int rowsperstrip ;		/* TIFF: scan lines per strip (0=all) */
+  long *stripoff ;		/* TIFF: strip offsets if nstrips > 1 */
+  long *stripbytes ;		/* TIFF: strip byte counts if nstrips > 1 */
+  int linestep ;		/* TIFF: lines between indexed lines */
+  long *lineidx ;		/* TIFF: bit offsets of indexed lines */
+  int nlineidx ;		/* TIFF: number of indexed lines */
+  struct coverstruct *cover ;	/* COVER: cached template, if any */
+  COVERFIELD *field ;		/* COVER: text fields */
+  int nfield ;			/* COVER: number of text fields */
 } PAGE ;
 
+/* Decoded scan lines of one strip or segment of a page.  Lines
+   are stored back-to-back in `runs'; line i starts at
+   runs[start[i]] and has start[i+1]-start[i] runs. */
+
+#define MAXSTRIPTHREADS 16	/* most threads used to decode a page */
+
+typedef struct runarenastruct {
+  short *runs ;			/* run lengths of all lines */
+  int *start ;			/* index of first run of each line */
+  int *pels ;			/* width of each line */
+  int nlines, maxlines ;	/* lines stored & allocated */
+  int nruns, maxruns ;		/* runs stored & allocated */
+  int err ;			/* decoding error, if any */
+} RUNARENA ;
+
+int  arenaline ( RUNARENA *a, short *runs, int nr, int pels ) ;
+void freearena ( RUNARENA *a ) ;
+
 typedef struct ifilestruct {	/* input image file  */
 
   /* data for each pages */
@@ -143,24 +264,53 @@ typedef struct ifilestruct {	/* input image file  */
 
   FILE *f ;			/* current file pointer */
   int lines ;			/* scan lines remaining in page */
+  int lineno ;			/* next scan line to be read */
 
   uchar bigend ;		/* TIFF: big-endian byte order */
 
   DECODER d ;			/* FAX: T.4 decoder state */
 
+  int strip ;			/* TIFF: current strip */
+  int striplines ;		/* TIFF: lines left in current strip */
+  RUNARENA *arena ;		/* FAX: decoded strips of current page */
+  int narena ;			/* FAX: number of arenas */
+  int line ;			/* FAX: next line in current strip arena */
+
+  int greymode ;		/* GREY: conversion to black & white */
+  uchar *grey ;			/* GREY: current scan line samples */
+  int *greybuf ;		/* GREY: threshold/error line buffers */
+  int greyw ;			/* GREY: width greybuf allocated for */
+  uchar greymap [ 256 ] ;	/* GREY: sample to brightness (0-255) */
+
+  int stream ;			/* STREAM: scan stdin as pages arrive */
+  FILE *scan ;			/* STREAM: stdin being scanned for pages */
+  int scanformat ;		/* STREAM: its file format */
+
+  struct pdfdocstruct *pdf ;	/* PDF: document (while scanning only) */
+  uchar *pixels ;		/* PDF: decoded bit map of current page */
+  long pixpos, pixlen ;		/* PDF: next row and bit map size */
+
   faxfont *font ;		/* TEXT: font to use */
   int pglines ;			/* TEXT: text lines per page */
   char text [ MAXLINELEN ] ;	/* TEXT: current string */
   int txtlines ;		/* TEXT: scan lines left in text l. */
+  int txtpos, txtn ;		/* TEXT: start and length of this row */
   int charw, charh, lmargin ;	/* TEXT: desired char w, h & margin */
 
+  int npages ;			/* COVER: pages for %P, 0 to count them */
+
 } IFILE ;
 
 int    newIFILE ( IFILE *f, char **fname ) ;
 void logifnames ( IFILE *f, char *s ) ;
+int scanipage ( IFILE *f ) ;
 int nextipage ( IFILE *f, int dp ) ;
 int lastpage ( IFILE *f ) ;
+int dupIFILE ( IFILE *to, IFILE *from, int page ) ;
+void closeIFILE ( IFILE *f ) ;
+void freeIFILE ( IFILE *f ) ;
 int     readline ( IFILE *f, short *runs, int *pels ) ;
+int     seekline ( IFILE *f, int line ) ;
 
 			    /* Image Output */
 
@@ -173,13 +323,31 @@ void newENCODER ( ENCODER *e ) ;
 
 typedef struct ofilestruct {		 /* input image file state  */
   FILE *f ;				 /* file pointer */
+  FILE *out ;				 /* stream used if no name (stdout) */
   int format ;				 /* file format */
+  int pageend ;				 /* page trailer written */
   char *fname ;			         /* file name pattern */
   float xres, yres ;			 /* x and y resolution, dpi */
   int w, h ;			         /* width & height, pixels */
   int lastpageno ;			 /* PS: last page number this file */
   int pslines ;			         /* PS: scan lines written to file */
+  uchar pslast [ MAXBITS ] ;		 /* PS: previous scan line */
+  uchar pclseed [ MAXBITS ] ;		 /* PCL: previous row (seed row) */
+  int pclseedlen, pclmode ;		 /* PCL: its length & compression */
+  int nhexout ;				 /* PS: hex bytes written */
+  uchar pgmval [ MAXBITS * 8 / 4 ] ;	 /* PGM: sums of current 4 lines */
+  int pgmlines ;			 /* PGM: scan lines written */
   int bytes ;			         /* TIFF: data bytes written */
+  long *lineidx ;			 /* TIFF: line index of page */
+  int nlineidx, maxlineidx ;		 /* TIFF: lines indexed/allocated */
+  long lineidxoff ;			 /* TIFF: file offset of line index */
+  uchar a85 [ 4 ] ;			 /* PS2: bytes not yet encoded */
+  int na85, a85col ;			 /* PS2: # of bytes & output column */
+  long pdfpos ;				 /* PDF: bytes written to file */
+  long pdfstream ;			 /* PDF: offset of image data */
+  long *pdfobj ;			 /* PDF: offsets of objects */
+  int npdfobj, maxpdfobj ;		 /* PDF: objects written/allocated */
+  int pdfpages ;			 /* PDF: pages in this file */
   ENCODER e ;				 /* T.4 encoder state */
   char cfname [ EFAX_PATH_MAX + 1 ] ;	 /* current file name */
 } OFILE ;
@@ -187,8 +355,13 @@ typedef struct ofilestruct {		 /* input image file state  */
 void  newOFILE ( OFILE *f, int format, char *fname, 
 		float xres, float yres, int w, int h ) ;
 int  nextopage ( OFILE *f, int page ) ;
+int   endopage ( OFILE *f ) ;
+int closeOFILE ( OFILE *f ) ;
 void writeline ( OFILE *f, short *runs, int nr, int no ) ;
 
+int passthrough ( IFILE *f, int format, int w, int h ) ;
+int copypage ( IFILE *f, OFILE *o ) ;
+
 			/*  Scan Line Processing */
 
 uchar   *putcode ( ENCODER *e, short code , short bits , uchar *buf ) ;
@@ -203,6 +376,23 @@ int   xpad ( short *runs, int nr, int pad ) ;
 int xscale ( short *runs, int nr, int xs ) ;
 int xshift ( short *runs, int nr, int s ) ;
 
+typedef struct scalerstruct {	/* area-filter resampling state */
+  double fx, fy ;		/* scale factors */
+  int *x0, *x1 ;		/* input pixels covered by each column */
+  int nc ;			/* columns in phase table */
+  int *ic ;			/* first column covering each input pixel */
+  int *acc ;			/* black pixels covered, each column */
+  int *seg, *tmp ;		/* columns with black pixels, as intervals */
+  int nseg ;
+  int ow ;			/* widest output line accumulated */
+  int na ;			/* input lines accumulated */
+  int r, i ;			/* next output line & input lines read */
+} SCALER ;
+
+int   newSCALER ( SCALER *s, double fx, double fy ) ;
+int   scaleline ( SCALER *s, short *runs, int nr, int *pels, int *no ) ;
+void freeSCALER ( SCALER *s ) ;
+
 int runor ( short *a, int na, short *b, int nb, short *c, int *pels ) ;
 
 /* Bit reversal lookup tables (note that the `normalbits' array
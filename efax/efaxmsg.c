@@ -14,6 +14,10 @@
 #include <glib/gmem.h>
 #endif
 
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
 #include "efaxmsg.h"
 
 #define MAXTSTAMP 80		/* maximum length of a time stamp */
@@ -131,6 +135,24 @@ char *cname ( uchar c )
 
 enum  msgflags { E=0x01, W=0x02, S=0x04, NOFLSH=0x08, NOLF=0x10 } ;
 
+/* Messages may come from several threads (efix converts pages
+   concurrently) so msg() holds a lock while it writes.  The lock
+   is recursive because efax also calls msg() from its signal
+   handler. */
+
+#ifdef HAVE_PTHREAD_H
+pthread_mutex_t msglock ;
+
+void initmsglock ( void )
+{
+  pthread_mutexattr_t attr ;
+  pthread_mutexattr_init ( &attr ) ;
+  pthread_mutexattr_settype ( &attr, PTHREAD_MUTEX_RECURSIVE ) ;
+  pthread_mutex_init ( &msglock, &attr ) ;
+  pthread_mutexattr_destroy ( &attr ) ;
+}
+#endif
+
 int msg ( char *fmt, ... ) 
 { 
   static int init=0 ;
@@ -148,6 +170,15 @@ int msg ( char *fmt, ... )
 #endif
 
   va_list ap ;
+
+#ifdef HAVE_PTHREAD_H
+  static pthread_once_t lockinit = PTHREAD_ONCE_INIT ;
+  int errnum = errno ;		/* for S flag */
+  pthread_once ( &lockinit, initmsglock ) ;
+  pthread_mutex_lock ( &msglock ) ;
+  errno = errnum ;
+#endif
+
   va_start ( ap, fmt ) ;
 
   if ( ! init ) {
@@ -241,21 +272,27 @@ int msg ( char *fmt, ... )
   }
   
   va_end ( ap ) ;
+
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_unlock ( &msglock ) ;
+#endif
   
   return err ;
 }
 
 
-/* Simple (one option per argument) version of getopt(3). */
+/* Simple (one option per argument) version of getopt(3).  As for
+   getopt(3), a lone "-" (standard input) ends the options. */
 
 int nextopt( int argc, char **argv, char *args )
 {
   char *a, *p ;
 
-  if ( nxtoptind >= argc || *(a = argv[nxtoptind]) != '-' ) return -1 ;
+  if ( nxtoptind >= argc || *(a = argv[nxtoptind]) != '-' || ! *(a+1) ) 
+    return -1 ;
   nxtoptind++ ;
 
-  if ( ! *(a+1) || ( ( p = strchr ( args, *(a+1) ) ) == 0 ) )
+  if ( ( p = strchr ( args, *(a+1) ) ) == 0 )
     return msg ( "Eunknown option (%s)", a ), '?' ; 
 
   if ( *(p+1) != ':' ) nxtoptarg = 0 ;
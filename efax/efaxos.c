@@ -5,6 +5,7 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdio.h>
 #include <string.h>
@@ -22,6 +23,11 @@
 #include "efaxmsg.h"
 #include "efaxos.h"
 
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#include <stdlib.h>
+#endif
+
 #ifdef USE_TERMIO
 #include <termio.h>
 #include <sys/ioctl.h>
@@ -93,25 +99,20 @@ void msleep ( int t )
 int tdata ( TFILE *f, int t )
 {
   int n, err=0 ;
-  fd_set fds ;
-
-  struct timeval timeout ;
+  struct pollfd fds ;
 
   if ( f->fd < 0 ) msg ( "Ecan't happen (faxdata)" ) ;
 
-  timeout.tv_sec  = t / 10 ; 
-  timeout.tv_usec = ( t % 10 ) * 100000 ;
-
-  FD_ZERO ( &fds ) ;
-  FD_SET ( f->fd, &fds ) ;
+  fds.fd = f->fd ;
+  fds.events = POLLIN ;
 
   do { 
-    n = select ( f->fd + 1, &fds, 0, 0, t<0 ? 0 : &timeout ) ;
+    n = poll ( &fds, 1, t<0 ? -1 : t * 100 ) ;
     if ( n < 0 ) {
       if ( errno == EINTR ) {
-	msg ( "W0  select() interrupted in tdata()" ) ;
+	msg ( "W0  poll() interrupted in tdata()" ) ;
       } else {
-	err = msg ( "ES2 select() failed in tdata():" ) ;
+	err = msg ( "ES2 poll() failed in tdata():" ) ;
       }
     }
   } while ( n < 0 && ! err ) ;
@@ -120,14 +121,270 @@ int tdata ( TFILE *f, int t )
 }
 
 
-/* tundrflw is called only by the tgetc() macro when the buffer
-   is empty.  t is maximum idle time before giving up. Returns
-   number of characters read or EOF on timeout or errors.  */
+#ifdef HAVE_PTHREAD_H
+
+/* The receive ring.  Only the reader thread advances head and
+   only the thread reading the TFILE advances tail, so data is
+   passed without locking; the mutex and condition variable are
+   used only to wait for data or for space.  head and tail count
+   bytes and are taken modulo TRINGSIZE. */
+
+typedef struct tringstruct {
+  uchar buf [ TRINGSIZE ] ;
+  volatile unsigned head, tail ;
+  volatile int stop ;		/* set by tringstop() */
+  volatile int done ;		/* the reader has ended */
+  volatile int full ;		/* the reader is waiting for space */
+  int fd ;
+  int wake [ 2 ] ;		/* pipe to interrupt the reader's poll() */
+  TRINGSTATS stats ;
+  pthread_t tid ;
+  pthread_mutex_t lock ;
+  pthread_cond_t cond ;
+} TRING ;
+
+static void tringwake ( TRING *r )
+{
+  pthread_mutex_lock ( &r->lock ) ;
+  pthread_cond_broadcast ( &r->cond ) ;
+  pthread_mutex_unlock ( &r->lock ) ;
+}
+
+static void tringfree ( TFILE *f )
+{
+  pthread_mutex_destroy ( &f->ring->lock ) ;
+  pthread_cond_destroy ( &f->ring->cond ) ;
+  free ( f->ring ) ;
+  f->ring = 0 ;
+}
+
+/* The reader thread.  Copies whatever the fax device has into the
+   ring until stopped or the device reads fail. */
+
+static void *tringreader ( void *arg )
+{
+  TRING *r = arg ;
+  struct pollfd fds [ 2 ] ;
+  struct timeval t0, t1 ;
+  unsigned head, used, n ;
+  int m ;
+#ifdef SCHED_FIFO
+  struct sched_param sp ;
+
+  /* keep ahead of the decoder if allowed to (usually only root is) */
+
+  sp.sched_priority = sched_get_priority_min ( SCHED_FIFO ) ;
+  pthread_setschedparam ( pthread_self ( ), SCHED_FIFO, &sp ) ;
+#endif
+
+  fds[0].fd = r->fd ;
+  fds[0].events = POLLIN ;
+  fds[1].fd = r->wake[0] ;
+  fds[1].events = POLLIN ;
+
+  while ( ! r->stop ) {
+
+    head = r->head ;
+    used = head - r->tail ;
+
+    if ( used >= TRINGSIZE ) {	/* full: wait for space, not drop data */
+      r->stats.stalls++ ;
+      gettimeofday ( &t0, 0 ) ;
+      pthread_mutex_lock ( &r->lock ) ;
+      r->full = 1 ;
+      __sync_synchronize ( ) ;
+      while ( r->head - r->tail >= TRINGSIZE && ! r->stop )
+	pthread_cond_wait ( &r->cond, &r->lock ) ;
+      r->full = 0 ;
+      pthread_mutex_unlock ( &r->lock ) ;
+      gettimeofday ( &t1, 0 ) ;
+      r->stats.stallms += ( t1.tv_sec - t0.tv_sec ) * 1000 + 
+	( t1.tv_usec - t0.tv_usec ) / 1000 ;
+      continue ;
+    }
+
+    if ( poll ( fds, 2, -1 ) < 0 ) {
+      if ( errno == EINTR ) continue ;
+      msg ( "ES2 poll() failed in tringreader():" ) ;
+      break ;
+    }
+    if ( fds[1].revents ) continue ;
+
+    n = TRINGSIZE - used ;	/* read into contiguous space only */
+    if ( n > TRINGSIZE - head % TRINGSIZE ) n = TRINGSIZE - head % TRINGSIZE ;
+
+    if ( ( m = read ( r->fd, r->buf + head % TRINGSIZE, n ) ) <= 0 ) {
+      if ( m < 0 && errno == EINTR ) continue ;
+      if ( m < 0 ) msg ( "ES2fax device read:" ) ;
+      break ;
+    }
+
+    __sync_synchronize ( ) ;	/* data before head */
+    r->head = head + m ;
+    if ( used + m > (unsigned) r->stats.peak ) r->stats.peak = used + m ;
+    tringwake ( r ) ;
+  }
+
+  pthread_mutex_lock ( &r->lock ) ;
+  r->done = 1 ;
+  pthread_cond_broadcast ( &r->cond ) ;
+  pthread_mutex_unlock ( &r->lock ) ;
+
+  return 0 ;
+}
+
+/* Copy up to IBUFSIZE bytes from the ring to the input buffer,
+   waiting t tenths of a second (forever if t is negative) for
+   data.  Returns the number of bytes copied, EOF on timeout or if
+   the reader has ended, or 0 if the ring had been stopped and is
+   now empty, in which case it is freed and the caller should read
+   the device itself. */
+
+static int tringread ( TFILE *f, int t )
+{
+  TRING *r = f->ring ;
+  unsigned tail = r->tail, n, m ;
+  struct timeval now ;
+  struct timespec until ;
+
+  if ( ! ( n = r->head - tail ) ) {
+
+    if ( r->stop ) {
+      tringfree ( f ) ;
+      return 0 ;
+    }
+
+    if ( t >= 0 ) {
+      gettimeofday ( &now, 0 ) ;
+      until.tv_sec = now.tv_sec + t / 10 ;
+      until.tv_nsec = now.tv_usec * 1000L + ( t % 10 ) * 100000000L ;
+      if ( until.tv_nsec >= 1000000000L ) {
+	until.tv_sec++ ;
+	until.tv_nsec -= 1000000000L ;
+      }
+    }
+
+    pthread_mutex_lock ( &r->lock ) ;
+    while ( ! ( n = r->head - tail ) && ! r->done )
+      if ( t < 0 )
+	pthread_cond_wait ( &r->cond, &r->lock ) ;
+      else
+	if ( pthread_cond_timedwait ( &r->cond, &r->lock, &until ) == ETIMEDOUT )
+	  break ;
+    pthread_mutex_unlock ( &r->lock ) ;
+
+    if ( ! n ) return EOF ;
+  }
+
+  __sync_synchronize ( ) ;	/* head before data */
+
+  if ( n > IBUFSIZE ) n = IBUFSIZE ;
+  m = TRINGSIZE - tail % TRINGSIZE ;
+  if ( m > n ) m = n ;
+  memcpy ( f->ibuf, r->buf + tail % TRINGSIZE, m ) ;
+  memcpy ( f->ibuf + m, r->buf, n - m ) ;
+
+  __sync_synchronize ( ) ;	/* data before tail */
+  r->tail = tail + n ;
+  __sync_synchronize ( ) ;	/* tail before full */
+  if ( r->full ) tringwake ( r ) ;
+
+  f->iq = ( f->ip = f->ibuf ) + n ;
+
+  return n ;
+}
+
+#endif
+
+
+/* Start a thread that reads the fax device into a receive ring
+   for tundrflw().  If a stopped ring still holds data the same
+   ring is used again so the data stays in order.  Returns 0 if
+   OK or 1 if the device will be read directly. */
+
+int tringstart ( TFILE *f )
+{
+#ifdef HAVE_PTHREAD_H
+  TRING *r = f->ring ;
+
+  if ( ! r ) {
+    if ( ! ( r = malloc ( sizeof ( TRING ) ) ) ) {
+      msg ( "W can't allocate receive ring" ) ;
+      return 1 ;
+    }
+    r->head = r->tail = 0 ;
+    pthread_mutex_init ( &r->lock, 0 ) ;
+    pthread_cond_init ( &r->cond, 0 ) ;
+    f->ring = r ;
+  }
+
+  r->stop = r->done = r->full = 0 ;
+  r->fd = f->fd ;
+  memset ( &r->stats, 0, sizeof ( r->stats ) ) ;
+  r->stats.size = TRINGSIZE ;
+
+  if ( pipe ( r->wake ) ) {
+    msg ( "WS can't make receive ring pipe:" ) ;
+  } else {
+    if ( ! pthread_create ( &r->tid, 0, tringreader, r ) )
+      return 0 ;
+    msg ( "W can't start receive ring reader" ) ;
+    close ( r->wake[0] ) ;
+    close ( r->wake[1] ) ;
+  }
+
+  r->stop = r->done = 1 ;
+  if ( r->head == r->tail ) tringfree ( f ) ;
+#endif
+  return 1 ;
+}
+
+
+/* Stop the receive ring reader and return its statistics in *s
+   (all zero if there was no reader).  Any data left in the ring
+   is still read by tundrflw() before it reads the device. */
+
+void tringstop ( TFILE *f, TRINGSTATS *s )
+{
+#ifdef HAVE_PTHREAD_H
+  TRING *r = f->ring ;
+#endif
+
+  memset ( s, 0, sizeof ( *s ) ) ;
+
+#ifdef HAVE_PTHREAD_H
+  if ( ! r || r->stop ) return ;
+
+  r->stop = 1 ;
+  if ( write ( r->wake[1], "", 1 ) < 0 )
+    msg ( "ES2 can't stop receive ring reader:" ) ;
+  tringwake ( r ) ;
+  pthread_join ( r->tid, 0 ) ;
+  close ( r->wake[0] ) ;
+  close ( r->wake[1] ) ;
+
+  *s = r->stats ;
+
+  if ( r->head == r->tail ) tringfree ( f ) ;
+#endif
+}
+
+
+/* tundrflw is called only by the tgetc() macro and tspan() when
+   the buffer is empty.  t is maximum idle time before giving up.
+   Reads as much as is waiting, up to IBUFSIZE bytes, from the
+   receive ring if there is one.  Returns number of characters
+   read or EOF on timeout or errors.  */
 
 int tundrflw ( TFILE *f, int t )
 { 
   int n ;
 
+#ifdef HAVE_PTHREAD_H
+  if ( f->ring && ( n = tringread ( f, t ) ) != 0 )
+    return n ;
+#endif
+
   n = tdata ( f, t ) ;
 
   if ( n > 0 )
@@ -140,27 +397,61 @@ int tundrflw ( TFILE *f, int t )
 } 
 
 
-/* tgetd returns the next data character after removing DLE
-   escapes, DLE-ETX terminators and fixing bit order. Evaluates
-   to the next character, EOF on error/timeout, or -2 on DLE-ETX.  */
+/* tspan returns the number of data bytes starting at f->ip that
+   can be used without removing DLE escapes, removing the escape
+   sequence at f->ip first if there is one.  The caller takes
+   bytes by advancing f->ip and must take at least one before
+   calling tspan again.  The bit order is not fixed.  Returns EOF
+   on error/timeout or -2 on DLE-ETX. */
 
-int tgetd ( TFILE *f, int t )
+int tspan ( TFILE *f, int t )
+{
+  int c ;
+  uchar *dle ;
+
+  if ( f->ip >= f->iq && tundrflw ( f, t ) == EOF )
+    return EOF ;
+
+  if ( *f->ip == DLE ) {	/* escape sequence */
+    f->ip++ ;
+    if ( ( c = tgetc ( f, t ) ) == EOF )
+      return EOF ;
+    if ( c == ETX )
+      return -2 ;
+
+    /* leave the unescaped byte where the second byte was */
+
+    *--f->ip = c == DLE || c == SUB ? DLE :
+      msg ( "W0invalid escape sequence (DLE-%s) in data", cname(c) ) ;
+    return 1 ;
+  }
+
+  dle = memchr ( f->ip, DLE, f->iq - f->ip ) ;
+
+  return ( dle ? dle : f->iq ) - f->ip ;
+}
+
+
+/* tgetr returns the next data character after removing DLE
+   escapes and DLE-ETX terminators but without fixing the bit
+   order.  Evaluates to the next character, EOF on error/timeout,
+   or -2 on DLE-ETX.  */
+
+int tgetr ( TFILE *f, int t )
 { 
   int c ;
 
   if ( ( c = tgetc(f,t) ) < 0 )
     c = EOF ;
   else
-    if ( c != DLE )
-      c = f->ibitorder[c] ;
-    else {			/* escape sequence */
+    if ( c == DLE ) {		/* escape sequence */
       c = tgetc(f,t) ;
       
       if ( c == ETX )
 	c = -2 ;
       else
 	if ( c == DLE || c == SUB )
-	  c = f->ibitorder [ DLE ] ;
+	  c = DLE ;
 	else
 	  c = msg ( "W0invalid escape sequence (DLE-%s) in data", cname(c) ) ;
     }
@@ -168,6 +459,15 @@ int tgetd ( TFILE *f, int t )
   return c ;
 }
 
+/* tgetd is like tgetr but also fixes the bit order. */
+
+int tgetd ( TFILE *f, int t )
+{ 
+  int c = tgetr ( f, t ) ;
+
+  return c < 0 ? c : f->ibitorder [ c ] ;
+}
+
 /* Write buffer to modem.  Returns 0 or EOF on error. */
 
 int tput ( TFILE *f, uchar *p, int n )
@@ -300,6 +600,7 @@ void tinit ( TFILE *f, int fd, int reverse, int hwfc )
   f->ibitorder = reverse ? reversebits : normalbits ;
   f->fd = fd ;
   f->hwfc = hwfc ;
+  f->ring = 0 ;
   if ( ! normalbits[1] ) initbittab () ;
 }
 
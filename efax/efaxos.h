@@ -31,9 +31,15 @@ typedef enum ttymodes		/* serial port modes:  */
    do non-blocking reads/writes with C stream i/o [UNIX select()
    gives the status of the file, not the stream buffer].*/
 
-#define IBUFSIZE 1024	    /* read up to this many bytes at a time from fax */
+#define IBUFSIZE 16384	    /* read up to this many bytes at a time from fax */
 #define OBUFSIZE 1024	    /* maximum bytes to write at a time to fax */
 
+#ifdef EFAX_LOWMEM
+#define TRINGSIZE 65536	    /* bytes held by the receive ring (power of 2) */
+#else
+#define TRINGSIZE 262144
+#endif
+
 typedef struct tfilestruct {
   int fd ;
   unsigned char *ip, *iq ;
@@ -44,8 +50,23 @@ typedef struct tfilestruct {
   time_t start ;
   long mstart ;
   int rd_state ;
+  struct tringstruct *ring ;	/* receive ring or null (see tringstart) */
 } TFILE ;
 
+/* While a page is received a reader thread drains the fax device
+   into a ring of TRINGSIZE bytes that tundrflw() reads from.  The
+   reader waits for space rather than dropping data when the ring
+   is full; tringstop() returns how often it had to. */
+
+typedef struct tringstatsstruct {
+  int size, peak ;		/* ring size and most bytes held */
+  int stalls ;			/* times the reader found it full */
+  long stallms ;		/* milliseconds spent waiting for space */
+} TRINGSTATS ;
+
+int tringstart ( TFILE *f ) ;
+void tringstop ( TFILE *f, TRINGSTATS *s ) ;
+
 /* tgetc() is a macro like getc().  It evaluates to the next
    character from the fax device or EOF after idle time t. */
 
@@ -53,7 +74,9 @@ typedef struct tfilestruct {
 		    *(unsigned char*)(f)->ip++ )
 
 int tundrflw ( TFILE *f, int t ) ;
+int tgetr ( TFILE *f, int t ) ;
 int tgetd ( TFILE *f, int t ) ;
+int tspan ( TFILE *f, int t ) ;
 int tput ( TFILE *f, unsigned char *p, int n ) ;
 int tdata ( TFILE *f, int t ) ;
 void tinit ( TFILE *f, int fd, int reverse, int hwfc ) ;
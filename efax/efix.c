@@ -46,16 +46,20 @@ const char *Usage =
   "     fax     fax (\"Group3\") 1-D coded image\n"
   "     text    text\n"
   "     pbm     raw PBM (portable bit map)\n"
+  "     pgm     raw PGM (portable grey map), 8-bit\n"
   "     tiffg3  TIFF, Group 3 fax compression\n"
-  "     tiffraw TIFF, no compression\n"
+  "     tiffraw TIFF, no compression (mono or 8-bit grey)\n"
   "     pcx     mono PCX\n"
   "     dcx     mono DCX\n"
-  "  -o  f   output format (tiffg3):\n"
+  "     pdf     PDF with one fax or bit-map image per page\n"
+  "  -o  f   output format (tiffg3), or f:file to also write file:\n"
   "     fax     fax (\"Group3\") 1-D coded image\n"
   "     pbm     Portable Bit Map\n"
   "     pgm     Portable Gray Map (decimated by 4)\n"
   "     pcl     HP-PCL (e.g. HP LaserJet)\n"
   "     ps      Postscript (e.g. Apple Laserwriter)\n"
+  "     ps2     Postscript Level 2, embedded fax data\n"
+  "     pdf     PDF, embedded fax data (one file unless -n has %%d)\n"
   "     tiffg3  TIFF, Group 3 fax compression\n"
   "     tiffraw TIFF, no compression\n"
   "     pcx     mono PCX\n"
@@ -63,6 +67,8 @@ const char *Usage =
   "  -n pat  printf() pattern for output file name (ofile)\n"
   "  -f fnt  use PBM font file fnt for text (built-in)\n"
   "  -l  n   lines per text page (66)\n"
+  "  -g  m   grey-scale to black & white by threshold or dither (threshold)\n"
+  "  -q  m   scale by sample (nearest pixel) or filter (area) (sample)\n"
   "  -v lvl  print messages of type in string lvl (ewi)\n"
   "  -s XxY  scale input by X and Y (Y optional) (1x1)\n"
   "  -r XxY  resolution of output is X by Y (dpi, Y optional) (204x196)\n"
@@ -70,8 +76,13 @@ const char *Usage =
   "  -p WxH  pad/truncate output to width W by height H (215x297mm)\n"
   "  -d R,D  displace output right R, down D (opposite if -ve) (0,0)\n"
   "  -O f    overlay file f (none)\n"
+  "  -P lst  convert only the pages in list lst, e.g. 1-3,5,9- (all)\n"
+  "  -c  n   number of pages given by %%P in cover pages (pages read)\n"
   "  -M      ignore other options and base64 (MIME) encode stdin to stdout\n"
+  "  -S sock serve conversion requests on Unix socket sock (- for stdin)\n"
   "\n"
+  "A file name of - reads standard input, converting pages as they arrive.\n"
+  "Each -o f:file writes another output from the same conversion.\n"
   "Add 'in', 'cm', 'mm', or 'pt' to -p and -d arguments (default in[ches]).\n" 
   "Default output size and resolution is same as input (if known).\n" 
   ;
@@ -86,6 +97,19 @@ const char *Usage =
 #include "efaxlib.h"
 #include "efaxmsg.h"
 
+#include <errno.h>		/* Unix */
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <config.h>
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+
 #ifndef INT_MAX
 #define INT_MAX 32767
 #endif
@@ -93,11 +117,15 @@ const char *Usage =
 /* Allowed input and output formats. *** MUST match enum *** */
 
 char *iformatstr[] = { " 3text", " 1pbm", " 2fax", " 4tiffg3", " 4tiffraw", 
-		       " 6pcx", " 6pcxraw", " 8dcx", 0 } ;
+		       " 6pcx", " 6pcxraw", " 8dcx", " 9pgm", "10pdf", "11cover", 0 } ;
 
 char *oformatstr[] = { " 1pbm" , " 2fax", " 3pcl", " 4ps",  " 5pgm", 
 		       " 7tiffg3", " 8tiffraw", 
-		       "11pcx", "12pcxraw", "13dcx", 0 } ;
+		       "11pcx", "12pcxraw", "13dcx", "14ps2", "15pdf", 0 } ;
+
+char *greystr[] = { " 0threshold", " 1dither", 0 } ;
+
+char *scalestr[] = { " 0sample", " 1filter", 0 } ;
 
 /* Look up a string in a NULL-delimited table where the first
    character of each string is the digit to return if the rest of
@@ -164,6 +192,43 @@ int getxy ( char *arg, float *x, float *y, int dim )
 }
 
 
+/* Set sel[i] if page i+1 (of MAXPAGE) is in the list arg of
+   page numbers and ranges separated by commas, e.g. "1-3,5,9-".
+   Returns 0 or 2 on errors. */
+
+int getpages ( char *arg, char *sel )
+{
+  int i, from, to, n ;
+  char *p = arg ;
+
+  memset ( sel, 0, MAXPAGE ) ;
+
+  while ( *p ) {
+    if ( sscanf ( p, "%d%n", &from, &n ) != 1 || from < 1 ) 
+      return msg ( "E2bad page list (%s)", arg ) ;
+    p += n ;
+    to = from ;
+    if ( *p == '-' ) {
+      p++ ;
+      if ( ! *p || *p == ',' ) 
+	to = MAXPAGE ;
+      else if ( sscanf ( p, "%d%n", &to, &n ) != 1 || to < from ) 
+	return msg ( "E2bad page range in (%s)", arg ) ;
+      else
+	p += n ;
+    }
+    if ( *p == ',' ) 
+      p++ ;
+    else if ( *p ) 
+      return msg ( "E2bad page list (%s)", arg ) ;
+    for ( i = from ; i <= to && i <= MAXPAGE ; i++ ) 
+      sel [ i-1 ] = 1 ;
+  }
+
+  return 0 ;
+}
+
+
 /* Copy stdin to stdout while applying base64 (RFC 1521)
    encoding.  This encoding must be applied after the file is
    complete since some output formats (e.g. TIFF) require seeking
@@ -224,14 +289,619 @@ int base64encode ( void )
 }
 
 
-int main( int argc, char **argv)
+/* Pages are converted (decoded, overlaid and scaled) into
+   arenas of output scan lines by convertpage().  Up to
+   MAXPAGETHREADS threads convert pages concurrently, at most two
+   pages per thread ahead of the output, while the main thread
+   writes the converted pages to the output file in order.  Each
+   further output (-o f:file) is written from the same pages by
+   its own thread and a page is released when every output has
+   written it. */
+
+#define MAXPAGETHREADS 16	/* most threads used to convert pages */
+#define MAXSINKS 8		/* most outputs */
+
+typedef struct pagejobstruct {	/* one page */
+  int done ;			/* conversion complete */
+  int end ;			/* page can't be opened: no more pages */
+  int err ;			/* conversion error */
+  int copy ;			/* outputs (bits) copying coded data */
+  int nout ;			/* outputs that have written the page */
+  int ipage ;			/* input page number */
+  int w, h ;			/* output size, pixels */
+  int hpgm ;			/* height rounded for PGM, lines converted */
+  float xres, yres ;		/* output resolution, dpi */
+  RUNARENA out ;		/* output lines, pels is the repeat count */
+} PAGEJOB ;
+
+typedef struct sinkstruct {	/* one output */
+  OFILE o ;
+  struct convstruct *c ;
+  int pages ;			/* pages written */
+  int err ;			/* write error */
+  int thread ;			/* written by its own thread */
+#ifdef HAVE_PTHREAD_H
+  pthread_t tid ;
+#endif
+} SINK ;
+
+typedef struct convstruct {	/* conversion of all pages */
+  IFILE *ifile ;		/* scanned input files */
+  char *sel ;			/* input pages selected (-P) */
+  RUNARENA *ov ;		/* decoded overlay or null if none */
+  SINK *sink ;			/* outputs */
+  int nsink ;
+  int oformats ;		/* output formats (bits) */
+  float xsc, ysc, xsh, ysh ;	/* scale and shift */
+  int filter ;			/* scale by area filtering (-q) */
+  float axres, ayres, axsz, aysz ; /* requested output res'n & size */
+  float ainxres, ainyres ;	/* requested input res'n */
+  float dxres, dyres, dxsz, dysz ; /* default output res'n & size */
+  PAGEJOB *job ;		/* conversion of each page */
+  int npages ;			/* number of pages to write */
+  int last ;			/* no more pages will be added */
+  int next ;			/* next page to convert */
+  int written ;			/* pages written to all outputs */
+  int ahead ;			/* most pages converted but not written */
+  int stop ;			/* stop converting and writing */
+#ifdef HAVE_PTHREAD_H
+  pthread_mutex_t lock ;
+  pthread_cond_t cond ;		/* page converted or written */
+#endif
+} CONV ;
+
+#ifdef HAVE_PTHREAD_H
+#define LOCK( c )   pthread_mutex_lock ( &(c)->lock )
+#define UNLOCK( c ) pthread_mutex_unlock ( &(c)->lock )
+#define WAIT( c )   pthread_cond_wait ( &(c)->cond, &(c)->lock )
+#define WAKE( c )   pthread_cond_broadcast ( &(c)->cond )
+#else
+#define LOCK( c )
+#define UNLOCK( c )
+#define WAIT( c )
+#define WAKE( c )
+#endif
+
+
+/* Set up `to' to read page ipage of the input.  The input may be
+   being scanned for more pages by morepages().  Returns 0 or 1
+   if there is no such page. */
+
+int dupinput ( CONV *c, IFILE *to, int ipage )
 {
-  int err=0, done=0, i, c ;
-  int nr, pels, ovnr, ovpels, no ;	/* run/pixel/repeat counts */
+  int end ;
+
+  LOCK ( c ) ;
+  end = dupIFILE ( to, c->ifile, ipage ) ;
+  UNLOCK ( c ) ;
+
+  return end ;
+}
+
+
+/* Add a scan line to be output `no' times to the page. Returns 0
+   or 2 if out of memory. */
+
+int putline ( PAGEJOB *j, short *runs, int nr, int no )
+{
+  if ( no > 0 && arenaline ( &j->out, runs, nr, no ) )
+    return msg ( "E2 out of memory converting page" ) ;
+  return 0 ;
+}
+
+
+/* Convert page number `page' of the input file as for conversion
+   c.  Sets the bits of j->copy for outputs that can copy the
+   page's coded data instead, and only decodes it if some other
+   output needs it. */
+
+void convertpage ( CONV *c, int page, PAGEJOB *j )
+{
+  int err=0, i ;
+  int nr, pels, no ;			/* run/pixel/repeat counts */
+  int ovline=0, ovno=0, ovnr ;		/* overlay line, repeats used & runs */
   int linesout ;
-  int page, ilines, olines ;		/* page & line counts */
-  int xs, ys, w, h, ixsh, iysh ;	/* integer scale, size & shift */
-  short runs [ MAXRUNS ] , ovruns [ MAXRUNS ] ;
+  int ilines, olines ;			/* line counts */
+  int xs, ys, w, h, hpgm, ixsh, iysh ;	/* integer scale, size & shift */
+  short runs [ MAXRUNS ] ;
+  float xres, yres, xsz, ysz ;		/* values used */
+  double fx, fy ;			/* exact scale */
+  IFILE ifile ;
+  SCALER scaler, *sc=0 ;
+  RUNARENA *ov = c->ov ;
+
+  if ( dupinput ( c, &ifile, j->ipage ) ) {
+    j->end = 1 ;
+    return ;
+  }
+
+  if ( nextipage ( &ifile, 0 ) ) { 
+    closeIFILE ( &ifile ) ;
+    j->end = 1 ;
+    return ;
+  }
+
+  /* set output size and resolution equal to input if none specified */
+
+  if ( c->ainxres > 0 ) ifile.page->xres = c->ainxres ;
+  if ( c->ainyres > 0 ) ifile.page->yres = c->ainyres ;
+
+  if ( ifile.page->xres <= 0 ) ifile.page->xres = c->dxres ;
+  if ( ifile.page->yres <= 0 ) ifile.page->yres = c->dyres ;
+
+  xres = c->axres > 0 ? c->axres : ifile.page->xres ;
+  yres = c->ayres > 0 ? c->ayres : ifile.page->yres ;
+
+  xsz = c->axsz > 0 ? c->axsz : ( ifile.page->w > 0 ? 
+				  ifile.page->w / ifile.page->xres : c->dxsz ) ;
+  ysz = c->aysz > 0 ? c->aysz : ( ifile.page->h > 0 ? 
+				  ifile.page->h / ifile.page->yres : c->dysz ) ;
+
+
+  w = xsz * xres + 0.5 ;	      /* output dimensions in pixels */
+  h = ysz * yres + 0.5 ;
+    
+  ixsh = c->xsh * xres ;	      /* x/y shifts in pixels/lines */
+  iysh = c->ysh * yres ;
+    
+  if ( ( w & 7 ) != 0 )		/* just about everything requires... */
+    msg ("Iimage width rounded to %d pixels", 
+	 w = ( w + 7 ) & ~7 ) ;
+    
+  hpgm = h ;
+  if ( c->oformats & 1 << O_PGM && h & 3 ) /* PGM x4 decimation requires... */
+    msg ("I PGM image height rounded up to %d lines", 
+	 hpgm = ( h + 3 ) & ~3 ) ;
+    
+  if ( w <= 0 || h <= 0 || xres < 0 || yres < 0 )
+    err = msg ( "E2negative/zero scaling/size/resolution" ) ;
+    
+  if ( c->oformats & 1 << O_PCL &&	/* check for strange PCL resolutions */
+       ( xres != yres || ( xres != 300 && xres != 150 && xres != 75 ) ) )
+    msg ( "Wstrange PCL resolution (%.0fx%.0f)", xres, yres ) ;
+    
+  if ( w > MAXBITS*8 )		/* make sure output will fit... */
+    err = msg( "E2requested output width too large (%d pixels)", w ) ;
+    
+  j->w = w ; 
+  j->h = h ; 
+  j->hpgm = hpgm ;
+  j->xres = xres ; 
+  j->yres = yres ;
+
+  /* scale according to input file resolution */
+
+  fx = (double) c->xsc * xres / ifile.page->xres ;
+  fy = (double) c->ysc * yres / ifile.page->yres ;
+
+  xs = 256 * fx + 0.5 ;
+  ys = 256 * fy + 0.5 ;
+
+  if ( xs <= 0 || ys <= 0 )
+    err = msg ( "E2negative/zero scaling" ) ;
+
+  if ( ! err && c->filter && ( xs != 256 || ys != 256 ) && 
+       ! ( err = newSCALER ( &scaler, fx, fy ) ) )
+    sc = &scaler ;
+
+  if ( err ) {
+    closeIFILE ( &ifile ) ;
+    j->err = err ;
+    return ;
+  }
+
+  linesout=0 ;
+
+  /* copy fax data unchanged to outputs that embed it */
+
+  if ( xs == 256 && ys == 256 && ! ixsh && ! iysh && ! ov )
+    for ( i=0 ; i < c->nsink ; i++ )
+      if ( passthrough ( &ifile, c->sink [ i ].o.format, w, h ) ) 
+	j->copy |= 1 << i ;
+
+  if ( j->copy == ( 1 << c->nsink ) - 1 ) {
+    closeIFILE ( &ifile ) ;
+    return ;
+  }
+
+  /* y-shift */
+
+  if ( iysh > 0 ) {
+    err = putline ( j, ( ( *runs = w ), runs ), 1, iysh ) ;
+    linesout += iysh ;
+  } else if ( iysh < 0 ) {
+    seekline ( &ifile, -iysh ) ;
+  }    
+
+  /* copy input to output */
+    
+  olines = ilines = 0 ; 
+    
+  while ( ! err && linesout < hpgm ) {
+
+    if ( ! ifile.lines || ( nr = readline ( &ifile, runs, &pels ) ) < 0 ) {
+      break ;
+    } else {
+      ilines++ ;
+    }
+
+    if ( ov && ovline < ov->nlines ) {
+      if ( ( ovnr = ov->start [ ovline+1 ] - ov->start [ ovline ] ) > 0 )
+	nr = runor ( runs, nr, ov->runs + ov->start [ ovline ], ovnr, 0, 
+		     &pels ) ; 
+      if ( ++ovno >= ov->pels [ ovline ] ) {
+	ovline++ ;
+	ovno = 0 ;
+      }
+    }
+
+    /* x-scale, x-shift & x-pad input line and y-scale by
+       deleting/duplicating lines or by filtering */
+    
+    if ( sc ) {
+      nr = scaleline ( sc, runs, nr, &pels, &no ) ;
+      if ( ! no ) continue ;
+    } else {
+      pels = ( xs == 256 ) ? pels : xscale ( runs, nr, xs ) ;
+      no = ( ( ilines * ys ) >> 8 ) - olines ;
+    }
+    pels += ( ixsh == 0 ) ?   0  : xshift ( runs, nr, ixsh ) ;
+    nr    = ( pels == w ) ?  nr  : xpad   ( runs, nr, w - pels ) ;
+
+    if ( linesout + no > hpgm ) no = hpgm - linesout ;
+    olines += no ;
+
+    err = putline ( j, runs, nr, no ) ;
+    linesout += no ;
+  }
+
+  /* y-pad */
+
+  if ( ! err && linesout < hpgm )
+    err = putline ( j, ( ( *runs = w ), runs ), 1, hpgm - linesout ) ;
+    
+  if ( ! err && ferror ( ifile.f ) ) err = msg ( "ES2input error:" ) ;
+
+  if ( sc ) freeSCALER ( sc ) ;
+  closeIFILE ( &ifile ) ;
+
+  j->err = err ;
+}
+
+
+/* Convert pages until all have been started or conversion is
+   stopped.  Runs in each page conversion thread. */
+
+void *pageworker ( void *arg )
+{
+  CONV *c = arg ;
+  int i ;
+
+  LOCK ( c ) ;
+  while ( 1 ) {
+    while ( ! c->stop && c->next < c->npages && 
+	    c->next >= c->written + c->ahead )
+      WAIT ( c ) ;
+    if ( c->stop || c->next >= c->npages ) break ;
+    i = c->next++ ;
+    UNLOCK ( c ) ;
+    convertpage ( c, i, c->job + i ) ;
+    LOCK ( c ) ;
+    c->job [ i ].done = 1 ;
+    WAKE ( c ) ;
+  }
+  UNLOCK ( c ) ;
+
+  return 0 ;
+}
+
+
+/* Wait until page number `page' has been converted.  Converts
+   the page in this thread if no other thread has started it. */
+
+void waitpage ( CONV *c, int page )
+{
+  LOCK ( c ) ;
+  while ( ! c->job [ page ].done ) {
+    if ( c->next == page ) {
+      c->next++ ;
+      UNLOCK ( c ) ;
+      convertpage ( c, page, c->job + page ) ;
+      LOCK ( c ) ;
+      c->job [ page ].done = 1 ;
+    } else {
+      WAIT ( c ) ;
+    }
+  }
+  UNLOCK ( c ) ;
+}
+
+
+/* Scan input read from a pipe (see scanipage()) up to the next
+   selected page and add a job for it.  Sets c->last instead if
+   there are no more pages.  The job array has room for MAXPAGE
+   pages.  Only called by the main thread.  Returns 0 or 2 on
+   errors. */
+
+int morepages ( CONV *c )
+{
+  int err=0, n ;
+
+  LOCK ( c ) ;
+
+  do {
+    n = c->ifile->lastpage - c->ifile->pages + 1 ;
+    if ( n >= MAXPAGE || ! memchr ( c->sel + n, 1, MAXPAGE - n ) ) {
+      c->last = 1 ;		/* no more pages wanted */
+      break ;
+    }
+    if ( ( err = scanipage ( c->ifile ) ) ) {
+      if ( err == 1 ) c->last = 1 ; else c->stop = 1 ;
+      break ;
+    }
+  } while ( ! c->sel [ n ] ) ;
+
+  if ( ! c->last && ! c->stop ) 
+    c->job [ c->npages++ ].ipage = n ;
+
+  WAKE ( c ) ;
+  UNLOCK ( c ) ;
+
+  return err == 1 ? 0 : err ;
+}
+
+
+/* Write the first h lines of converted page j to o, the output
+   with bit `bit' of j->copy.  If the coded data is to be copied,
+   it is read from the input file.  Returns 0 or 2 on errors. */
+
+int writepage ( CONV *c, PAGEJOB *j, OFILE *o, int bit, int h )
+{
+  int err=0, i, no ;
+  IFILE in ;
+
+  if ( j->copy & bit ) {
+    if ( dupinput ( c, &in, j->ipage ) ) {
+      err = 2 ;
+    } else {
+      if ( nextipage ( &in, 0 ) || copypage ( &in, o ) ) err = 2 ;
+      closeIFILE ( &in ) ;
+    }
+  } else {
+    for ( i=0 ; h > 0 && i < j->out.nlines ; i++ ) {
+      no = j->out.pels [ i ] < h ? j->out.pels [ i ] : h ;
+      writeline ( o, j->out.runs + j->out.start [ i ], 
+		  j->out.start [ i+1 ] - j->out.start [ i ], no ) ;
+      h -= no ;
+    }
+  }
+
+  return err ;
+}
+
+
+/* Write page number `page' to output s, converting it first if
+   no other thread has.  Waits until the page has been added and
+   is within c->ahead pages of the slowest output.  Returns 0, 1
+   if there are no more pages or writing has been stopped, or 2
+   on errors, which stop the other outputs. */
+
+int sinkpage ( CONV *c, SINK *s, int page )
+{
+  int err=0, h ;
+  PAGEJOB *j = c->job + page ;
+
+  LOCK ( c ) ;
+  while ( ! c->stop && ( page >= c->written + c->ahead ||
+			 ( page >= c->npages && ! c->last ) ) )
+    WAIT ( c ) ;
+  if ( c->stop || page >= c->npages ) 
+    err = 1 ;
+  UNLOCK ( c ) ;
+
+  if ( err ) 
+    return err ;
+
+  waitpage ( c, page ) ;
+
+  if ( j->end ) 
+    return 1 ;
+
+  if ( ! ( err = j->err ) ) {
+    h = s->o.format == O_PGM ? j->hpgm : j->h ; /* extra lines for PGM */
+    s->o.w = j->w ; 
+    s->o.h = h ; 
+    s->o.xres = j->xres ; 
+    s->o.yres = j->yres ;
+    if ( nextopage ( &s->o, page ) ) 
+      err = 2 ;
+    else if ( ! ( err = writepage ( c, j, &s->o, 1 << ( s - c->sink ), h ) ) )
+      err = endopage ( &s->o ) ;
+  }
+
+  LOCK ( c ) ;
+  if ( err ) {
+    s->err = err ;
+    c->stop = 1 ;
+  } else {
+    s->pages++ ;
+    if ( ++j->nout >= c->nsink ) {
+      freearena ( &j->out ) ;
+      c->written++ ;
+    }
+  }
+  WAKE ( c ) ;
+  UNLOCK ( c ) ;
+
+  return err ;
+}
+
+
+/* Write all pages to one output.  Runs in the thread of each
+   output other than the first. */
+
+void *sinkworker ( void *arg )
+{
+  SINK *s = arg ;
+  int page ;
+
+  for ( page=0 ; ! sinkpage ( s->c, s, page ) ; page++ ) ;
+
+  return 0 ;
+}
+
+
+/* The overlay (-O) is decoded once into ovcache.lines and
+   OR'ed into every page from there.  In server mode it is kept
+   for later requests while the overlay file is unchanged. */
+
+typedef struct ovcachestruct {
+  RUNARENA lines ;		/* overlay lines, pels is the repeat count */
+  int valid ;			/* lines hold a decoded overlay */
+  char fname [ EFAX_PATH_MAX + 1 ] ; /* its file name and status */
+  dev_t dev ;
+  ino_t ino ;
+  off_t size ;
+  time_t mtime, ctime ;
+} OVCACHE ;
+
+OVCACHE ovcache ;
+
+/* Decode the first page of overlay file fname into ovcache
+   unless it is already there.  Returns 0 or 2 on errors. */
+
+int readoverlay ( char *fname )
+{
+  int err=0, nr, pels, n ;
+  short runs [ MAXRUNS ] ;
+  char *fnames [ 2 ] ;
+  struct stat st ;
+  IFILE f ;
+  OVCACHE *c = &ovcache ;
+  RUNARENA *a = &c->lines ;
+
+  if ( strcmp ( fname, "-" ) && ! stat ( fname, &st ) ) {
+    if ( c->valid && ! strcmp ( c->fname, fname ) && 
+	 c->dev == st.st_dev && c->ino == st.st_ino && 
+	 c->size == st.st_size && c->mtime == st.st_mtime && 
+	 c->ctime == st.st_ctime ) {
+      msg ( "F using decoded overlay %s", fname ) ;
+      return 0 ;
+    }
+  } else {
+    memset ( &st, 0, sizeof(st) ) ;
+  }
+
+  freearena ( a ) ;
+  c->valid = 0 ;
+
+  memset ( &f, 0, sizeof(f) ) ;
+  fnames [ 0 ] = fname ;
+  fnames [ 1 ] = 0 ;
+
+  if ( ! ( err = newIFILE ( &f, fnames ) ) && nextipage ( &f, 0 ) ) 
+    err = 2 ;
+
+  /* store runs of repeated lines once */
+
+  while ( ! err && ( nr = readline ( &f, runs, &pels ) ) >= 0 ) {
+    n = a->nlines - 1 ;
+    if ( n >= 0 && nr == a->start [ n+1 ] - a->start [ n ] && 
+	 ! memcmp ( runs, a->runs + a->start [ n ], nr * sizeof(short) ) )
+      a->pels [ n ]++ ;
+    else if ( arenaline ( a, runs, nr, 1 ) ) 
+      err = msg ( "E2 out of memory reading overlay" ) ;
+  }
+
+  freeIFILE ( &f ) ;
+
+  if ( ! err && strlen ( fname ) <= EFAX_PATH_MAX && st.st_ino ) {
+    strcpy ( c->fname, fname ) ;
+    c->dev = st.st_dev ;
+    c->ino = st.st_ino ;
+    c->size = st.st_size ;
+    c->mtime = st.st_mtime ;
+    c->ctime = st.st_ctime ;
+    c->valid = 1 ;
+  }
+
+  return err ;
+}
+
+
+/* Parse an output format argument, a format name optionally
+   followed by `:' and a file name.  Sets *fname to the file name,
+   or null if there is none.  Returns the format or -1 if the
+   name is not valid. */
+
+int getoformat ( char *arg, char **fname )
+{
+  char name [ 16 ] ;
+  size_t n = strcspn ( arg, ":" ) ;
+
+  *fname = arg [ n ] ? arg + n + 1 : 0 ;
+  if ( n >= sizeof(name) ) 
+    return -1 ;
+  memcpy ( name, arg, n ) ;
+  name [ n ] = 0 ;
+
+  return lookup ( oformatstr, name ) ;
+}
+
+
+/* Open the file of output (-o f:file) s unless its name is a
+   pattern, so that all its pages are written to one file as they
+   would be to a stream.  Returns 0 or 2 on errors. */
+
+int opensink ( SINK *s )
+{
+  char *fname = s->o.fname ;
+
+  if ( strchr ( fname, '%' ) ) 
+    return 0 ;
+  
+  if ( ! ( s->o.out = fopen ( fname, ( s->o.format == O_PS || 
+				      s->o.format == O_PS2 ) ? "w" : "wb+" ) ) )
+    return msg ( "ES2 can't open output file %s:", fname ) ;
+
+  s->o.fname = 0 ;
+
+  return 0 ;
+}
+
+
+/* Returns true if standard input ("-") is one of the null-terminated
+   list of input file names or is the overlay file name ovfname. */
+
+int isstdin ( char **fnames, char *ovfname )
+{
+  if ( ovfname && ! strcmp ( ovfname, "-" ) ) 
+    return 1 ;
+  for ( ; *fnames ; fnames++ )
+    if ( ! strcmp ( *fnames, "-" ) ) 
+      return 1 ;
+  return 0 ;
+}
+
+
+/* Convert the files given by the arguments argv[1] to
+   argv[argc-1] (argv[argc] must be null).  Output goes to `out'
+   unless there is a -n option, and to the file of each -o f:file
+   option.  Sets *pages to the number of pages written to every
+   output.  If sname is not null the -S argument, if any,
+   is returned in *sname and no input files are needed; otherwise
+   -S and -M are not allowed.  Returns the exit status: 0 if OK,
+   2 or 3 on errors. */
+
+int convert ( int argc, char **argv, FILE *out, int *pages, char **sname )
+{
+  int err=0, done=0, i, c, n ;
+  int page, nt=1 ;			/* page & thread counts */
+  CONV conv ;
+#ifdef HAVE_PTHREAD_H
+  pthread_t tid [ MAXPAGETHREADS ] ;
+  long ncpu ;
+#endif
   
   float					 /* defaults: */
     xsc=1.0, ysc=1.0,		         /* scale */
@@ -244,48 +914,69 @@ int main( int argc, char **argv)
   float				/* arguments: */
     axres = 0, ayres = 0, axsz = 0, aysz = 0, ainxres=0, ainyres=0 ;
 
-  float				/* values used: */
-    xres = 0, yres = 0, xsz = 0, ysz = 0 ;
-
-  IFILE ifile, ovfile ;
-  OFILE ofile ;
+  IFILE ifile ;
+  SINK sink [ MAXSINKS + 1 ] ;	/* main output, then -o f:file ones */
+  int nsink=0, mainout=0 ;
 
   char **ifnames,  *ovfnames [ 2 ] = { 0, 0 } ;
 
-  int iformat=I_AUTO, oformat=O_TIFF_FAX, pglines=0 ;
-  char *ofname=0 ;
+  int iformat=I_AUTO, oformat=O_TIFF_FAX, pglines=0, greymode=G_THRESHOLD ;
+  int filter=0 ;
+  char *ofname=0, *fname ;
+  char sel [ MAXPAGE ], *pagelist=0 ;	/* pages selected */
 
   faxfont font, *pfont=0 ;	/* text font */
 
   /* initialize */
 
-  argv0 = argv[0] ;
-
-  setlocale ( LC_ALL, "" ) ;
-  /*
-    efix uses formatted text functions for floating point numbers, so restore
-     the C locale for that
-  */
-  setlocale ( LC_NUMERIC, "C" ) ;
+  memset ( &ifile, 0, sizeof(ifile) ) ;
+  memset ( sink, 0, sizeof(sink) ) ;
+  memset ( sel, 1, sizeof(sel) ) ;
+  conv.job = 0 ;
+  conv.nsink = 0 ;
+  *pages = 0 ;
+  nxtoptind = 1 ;
 
   /* process arguments */
 
-  while ( !err && (c=nextopt(argc,argv,"n:i:o:O:v:l:f:r:s:p:d:R:M") ) != -1) {
+  while ( !err && (c=nextopt(argc,argv,"n:i:o:O:P:c:v:l:g:q:f:r:s:p:d:R:MS:") ) != -1) {
     switch ( c ) {
     case 'n':
       ofname = nxtoptarg ;
+      mainout = 1 ;
       break ;
     case 'i': 
       if ( ( iformat = lookup ( iformatstr, nxtoptarg ) ) < 0 ) 
 	err = msg ( "E2invalid input type (%s)", nxtoptarg ) ;
       break ;
     case 'o': 
-      if ( ( oformat = lookup ( oformatstr, nxtoptarg ) ) < 0 )
+      if ( ( i = getoformat ( nxtoptarg, &fname ) ) < 0 ) {
 	err = msg ( "E2invalid output type (%s)", nxtoptarg ) ;
+      } else if ( ! fname ) {
+	oformat = i ;
+	mainout = 1 ;
+      } else if ( ! *fname ) {
+	err = msg ( "E2 missing output file name in (%s)", nxtoptarg ) ;
+      } else if ( nsink >= MAXSINKS ) {
+	err = msg ( "E2 too many outputs (max is %d)", MAXSINKS ) ;
+      } else {
+	newOFILE ( &sink [ ++nsink ].o, i, fname, 0, 0, 0, 0 ) ;
+	sink [ nsink ].o.out = 0 ;	/* see opensink() */
+      }
       break ;
     case 'O': 
       ovfnames[0] = nxtoptarg ;
       break ;
+    case 'P': 
+      err = getpages ( pagelist = nxtoptarg, sel ) ;
+      break ;
+    case 'c':
+      if ( sscanf ( nxtoptarg , "%d", &ifile.npages ) != 1 || 
+	   ifile.npages <= 0 ) {
+	err = msg ( "E2bad page count (%s)", nxtoptarg ) ;
+	ifile.npages = 0 ;
+      }
+      break ;
     case 'v': 
       verb[0] = nxtoptarg ;
       msg ( "A " Version ) ;
@@ -297,6 +988,14 @@ int main( int argc, char **argv)
 	pglines = 0 ;
       }
       break ;
+    case 'g':
+      if ( ( greymode = lookup ( greystr, nxtoptarg ) ) < 0 )
+	err = msg ( "E2invalid grey-scale conversion (%s)", nxtoptarg ) ;
+      break ;
+    case 'q':
+      if ( ( filter = lookup ( scalestr, nxtoptarg ) ) < 0 )
+	err = msg ( "E2invalid scaling method (%s)", nxtoptarg ) ;
+      break ;
     case 'f' :
       if ( ! ( err = readfont ( nxtoptarg, &font ) ) )
 	pfont = &font ;
@@ -306,7 +1005,19 @@ int main( int argc, char **argv)
     case 'R' : err = getxy ( nxtoptarg, &ainxres, &ainyres, 0 ) ; break ;
     case 'p' : err = getxy ( nxtoptarg, &axsz , &aysz , 1 ) ; break ;
     case 'd' : err = getxy ( nxtoptarg, &xsh , &ysh , 1 ) ; break ;
-    case 'M' : err = base64encode() ; done=1 ; break ;
+    case 'M' : 
+      if ( sname ) 
+	err = base64encode() ; 
+      else
+	err = msg ( "E2 -M not allowed in a request" ) ;
+      done=1 ; 
+      break ;
+    case 'S' :
+      if ( sname ) 
+	*sname = nxtoptarg ;
+      else
+	err = msg ( "E2 -S not allowed in a request" ) ;
+      break ;
     default : fprintf ( stderr, Usage, argv0 ) ; err = 2 ; break ;
     }
   }
@@ -317,150 +1028,405 @@ int main( int argc, char **argv)
 
     if ( pfont ) ifile.font = pfont ;
     if ( pglines ) ifile.pglines = pglines ;
+    ifile.greymode = greymode ;
+    ifile.stream = 1 ;
 
     if ( nxtoptind < argc ) {
       ifnames = argv + nxtoptind ;
       if ( argv [ argc ] ) {
 	err = msg ("E2can't happen(unterminated argv)") ;
+      } else if ( ! sname && isstdin ( ifnames, *ovfnames ) ) {
+	err = msg ( "E2 standard input (-) not allowed in a request" ) ;
       } else {
-	newIFILE ( &ifile, ifnames ) ;
+	err = newIFILE ( &ifile, ifnames ) ;
       }
+    } else if ( sname && *sname ) {
+      done=1 ;
     } else {
       err = msg ( "E3 missing input file name" ) ;
     }
 
-    newIFILE ( &ovfile, ovfnames ) ;
+    if ( nsink && ! mainout )	/* only the -o f:file outputs */
+      mainout = -1 ;
+
+    if ( ! err && mainout >= 0 && ! ofname && ! out )
+      err = msg ( "E3 no output file name (-n) or stream" ) ;
+
+    if ( ! err && *ovfnames ) err = readoverlay ( *ovfnames ) ;
+
+    newOFILE ( &sink [ 0 ].o, oformat, ofname, 0, 0, 0, 0 ) ;
+    sink [ 0 ].o.out = out ;
 
-    newOFILE ( &ofile, oformat, ofname, 0, 0, 0, 0 ) ;
+    if ( ! err && ! done && mainout >= 0 && ! ofname && 
+	 lseek ( fileno ( out ), 0, SEEK_CUR ) < 0 &&
+	 ( oformat == O_TIFF_FAX || oformat == O_TIFF_RAW || 
+	   oformat == O_PCX || oformat == O_PCX_RAW || oformat == O_DCX ) )
+      msg ( "W %s output can't be rewound to update its header:"
+	    " use -n to write a file", oformatname [ oformat ] ) ;
+
+    for ( i=1 ; ! err && ! done && i <= nsink ; i++ )
+      err = opensink ( sink + i ) ;
 
   }
 
-  for ( page = 0 ; ! err && ! done ; page++ ) {
+  /* start the page conversion threads */
 
-    if ( nextipage ( &ifile, page != 0 ) ) { 
-      done=1 ; 
-      continue ; 
+  if ( ! err && ! done ) {
+    conv.ifile = &ifile ;
+    conv.ov = *ovfnames ? &ovcache.lines : 0 ;
+    conv.sink = mainout >= 0 ? sink : sink + 1 ;
+    conv.nsink = mainout >= 0 ? nsink + 1 : nsink ;
+    conv.oformats = 0 ;
+    for ( i=0 ; i < conv.nsink ; i++ ) {
+      conv.sink [ i ].c = &conv ;
+      conv.oformats |= 1 << conv.sink [ i ].o.format ;
     }
+    conv.xsc = xsc ; conv.ysc = ysc ;
+    conv.xsh = xsh ; conv.ysh = ysh ;
+    conv.filter = filter ;
+    conv.axres = axres ; conv.ayres = ayres ;
+    conv.axsz = axsz ; conv.aysz = aysz ;
+    conv.ainxres = ainxres ; conv.ainyres = ainyres ;
+    conv.dxres = dxres ; conv.dyres = dyres ;
+    conv.dxsz = dxsz ; conv.dysz = dysz ;
+    conv.sel = sel ;
+    conv.next = conv.written = conv.stop = conv.npages = 0 ;
+    conv.last = ! ifile.scan ;
+    conv.ahead = 1 ;
+    n = ifile.lastpage - ifile.pages + 1 ;
+    if ( ! ( conv.job = calloc ( ( ifile.scan ? MAXPAGE : n ) + 1, 
+				 sizeof(PAGEJOB) ) ) )
+      err = msg ( "E2 out of memory for %d pages", n ) ;
+    else
+      for ( i=0 ; i < n ; i++ )	/* other pages are never decoded */
+	if ( sel [ i ] ) conv.job [ conv.npages++ ].ipage = i ;
+  }
 
-    /* set output size and resolution equal to input if none specified */
+  if ( ! err && ! done ) {
+#ifdef HAVE_PTHREAD_H
+    ncpu = sysconf ( _SC_NPROCESSORS_ONLN ) ;
+    nt = ncpu < 1 ? 1 : ncpu > MAXPAGETHREADS ? MAXPAGETHREADS : ncpu ;
+    if ( nt > conv.npages ) nt = conv.npages ;
+    if ( nt < 1 ) nt = 1 ;	/* keep ahead > 0 if no page is selected */
+    if ( ifile.scan ) nt = 1 ;	/* pages arrive one at a time */
+    pthread_mutex_init ( &conv.lock, 0 ) ;
+    pthread_cond_init ( &conv.cond, 0 ) ;
+    conv.ahead = 2 * nt ;
+    for ( i=1 ; i < nt ; i++ )
+      if ( pthread_create ( &tid [ i ], 0, pageworker, &conv ) ) 
+	break ;
+    nt = i ;
+    for ( i=1 ; i < conv.nsink ; i++ )
+      conv.sink [ i ].thread = 
+	! pthread_create ( &conv.sink [ i ].tid, 0, sinkworker, conv.sink + i ) ;
+#endif
+    if ( ifile.scan )
+      msg ( "F converting pages as they are read from standard input" ) ;
+    else
+      msg ( "F converting %d pages using %d thread(s)", conv.npages, nt ) ;
+  }
 
-    if ( ainxres > 0 ) ifile.page->xres = ainxres ;
-    if ( ainyres > 0 ) ifile.page->yres = ainyres ;
+  /* write the pages in order as they are converted */
 
-    if ( ifile.page->xres <= 0 ) ifile.page->xres = dxres ;
-    if ( ifile.page->yres <= 0 ) ifile.page->yres = dyres ;
+  for ( page = 0 ; ! err && ! done ; page++ ) {
 
-    xres = axres > 0 ? axres : ifile.page->xres ;
-    yres = ayres > 0 ? ayres : ifile.page->yres ;
+    if ( page >= conv.npages && ! conv.last ) 
+      err = morepages ( &conv ) ;
 
-    xsz = axsz > 0 ? axsz : ( ifile.page->w > 0 ? 
-			      ifile.page->w / ifile.page->xres : dxsz ) ;
-    ysz = aysz > 0 ? aysz : ( ifile.page->h > 0 ? 
-			      ifile.page->h / ifile.page->yres : dysz ) ;
+    for ( i=0 ; ! err && ! done && i < conv.nsink ; i++ )
+      if ( ! conv.sink [ i ].thread && 
+	   ( n = sinkpage ( &conv, conv.sink + i, page ) ) ) {
+	if ( n == 1 ) done = 1 ; else err = n ;
+      }
+  }
 
+  /* wait for the other outputs */
 
-    w = xsz * xres + 0.5 ;	      /* output dimensions in pixels */
-    h = ysz * yres + 0.5 ;
-    
-    ixsh = xsh * xres ;		      /* x/y shifts in pixels/lines */
-    iysh = ysh * yres ;
-    
-    if ( ( w & 7 ) != 0 )	/* just about everything requires... */
-      msg ("Iimage width rounded to %d pixels", 
-	   w = ( w + 7 ) & ~7 ) ;
-    
-    if ( ofile.format == O_PGM && h & 3 ) /* PGM x4 decimation requires... */
-      msg ("I PGM image height rounded up to %d lines", 
-	   h = ( h + 3 ) & ~3 ) ;
-    
-    if ( w <= 0 || h <= 0 || xres < 0 || yres < 0 )
-      err = msg ( "E2negative/zero scaling/size/resolution" ) ;
-    
-    if ( ofile.format == O_PCL &&	/* check for strange PCL resolutions */
-	( xres != yres || ( xres != 300 && xres != 150 && xres != 75 ) ) )
-      msg ( "Wstrange PCL resolution (%.0fx%.0f)", xres, yres ) ;
-    
-    if ( w > MAXBITS*8 )	/* make sure output will fit... */
-      err = msg( "E2requested output width too large (%d pixels)", w ) ;
-    
-    ofile.w = w ; 
-    ofile.h = h ; 
-    ofile.xres = xres ; 
-    ofile.yres = yres ;
+  if ( conv.job && err ) {
+    LOCK ( &conv ) ;
+    conv.stop = 1 ;
+    WAKE ( &conv ) ;
+    UNLOCK ( &conv ) ;
+  }
 
-    /* scale according to input file resolution */
+  for ( i=0 ; i < conv.nsink ; i++ ) {
+#ifdef HAVE_PTHREAD_H
+    if ( conv.sink [ i ].thread ) 
+      pthread_join ( conv.sink [ i ].tid, 0 ) ;
+#endif
+    if ( ! err ) err = conv.sink [ i ].err ;
+    if ( i == 0 || conv.sink [ i ].pages < *pages ) 
+      *pages = conv.sink [ i ].pages ;
+  }
 
-    xs = 256 * xsc * xres / ifile.page->xres + 0.5 ;
-    ys = 256 * ysc * yres / ifile.page->yres + 0.5 ;
+  /* stop the conversion threads and release unwritten pages */
 
-    if ( xs <= 0 || ys <= 0 )
-      err = msg ( "E2negative/zero scaling" ) ;
+  if ( nt > 1 ) {
+    LOCK ( &conv ) ;
+    conv.stop = 1 ;
+    WAKE ( &conv ) ;
+    UNLOCK ( &conv ) ;
+#ifdef HAVE_PTHREAD_H
+    for ( i=1 ; i < nt ; i++ )
+      pthread_join ( tid [ i ], 0 ) ;
+#endif
+  }
 
-    if ( *ovfnames )		      /* [re-]open overlay file */
-      if ( nextipage ( &ovfile , 0 ) ) { 
-	err=2 ; 
-	continue ; 
-      }
+  if ( conv.job ) {
+    for ( page = 0 ; page < conv.npages ; page++ )
+      freearena ( &conv.job [ page ].out ) ;
+    free ( conv.job ) ;
+#ifdef HAVE_PTHREAD_H
+    pthread_cond_destroy ( &conv.cond ) ;
+    pthread_mutex_destroy ( &conv.lock ) ;
+#endif
+  }
+
+  if ( ! err && conv.job && pagelist && ! *pages )
+    msg ( "W no pages in page list (%s)", pagelist ) ;
+
+  for ( i=0 ; i <= nsink ; i++ ) {
+    if ( nextopage ( &sink [ i ].o, EOF ) && ! err ) err = 2 ;
+    if ( closeOFILE ( &sink [ i ].o ) && ! err ) err = 2 ;
+    if ( i && sink [ i ].o.out && fclose ( sink [ i ].o.out ) && ! err ) 
+      err = msg ( "ES2output error:" ) ;
+  }
+
+  freeIFILE ( &ifile ) ;
+
+  return err ;
+}
+
+
+/* Server mode (-S).  efix reads conversion requests from a
+   connected Unix stream socket and converts them one at a time,
+   so a client such as efax-gtk can keep a warm efix process
+   instead of starting one per conversion.
+
+   A request is the argument count as a decimal string followed
+   by that many arguments (the options and input file names that
+   would follow the program name on the command line), each
+   terminated by a NUL.  If a file descriptor is passed with the
+   request (SCM_RIGHTS) output is written to it unless there is
+   a -n option; the server closes its copy when the request is
+   done, so the client sees end of file on a pipe (which must be
+   read while waiting for the reply).  The reply is
+   one line, "<status> <pages>\n": the exit status efix would
+   have returned and the number of pages written.  Requests on a
+   connection are served in turn until the client closes it. */
+
+#define MAXREQ 8192		/* longest request, bytes */
+#define MAXREQARGS 256		/* most arguments in a request */
+
+volatile sig_atomic_t stopserver = 0 ;
+
+void onstopsig ( int sig )
+{
+  stopserver = 1 ;
+}
+
+
+/* Read a request from socket s into buf (MAXREQ bytes) and set
+   args[0] to args[n-1] to its n arguments.  *fd is set to the
+   file descriptor passed with the request or -1.  Returns n, 0
+   at end of file or -1 on errors. */
+
+int getrequest ( int s, char *buf, char **args, int *fd )
+{
+  int i, n=-1, nargs=0, len=0, got ;
+  char *p, *end ;
+  struct msghdr m ;
+  struct iovec v ;
+  struct cmsghdr *cm ;
+  union { struct cmsghdr align ; char b [ CMSG_SPACE(sizeof(int)) ] ; } 
+    cbuf ;
+
+  *fd = -1 ;
+
+  while ( n < 0 || nargs < n ) {
 
-    if ( nextopage ( &ofile, page ) ) { 
-      err=2 ; 
-      continue ; 
+    if ( len >= MAXREQ ) {
+      msg ( "E request too long" ) ;
+      break ;
     }
-    linesout=0 ;
 
-    /* y-shift */
+    memset ( &m, 0, sizeof(m) ) ;
+    v.iov_base = buf + len ;
+    v.iov_len = MAXREQ - len ;
+    m.msg_iov = &v ;
+    m.msg_iovlen = 1 ;
+    m.msg_control = cbuf.b ;
+    m.msg_controllen = sizeof(cbuf.b) ;
+
+    if ( ( got = recvmsg ( s, &m, 0 ) ) < 0 ) {
+      if ( errno == EINTR && ! stopserver ) continue ;
+      if ( ! stopserver ) msg ( "ES can't read request:" ) ;
+      break ;
+    }
 
-    if ( iysh > 0 ) {
-      writeline ( &ofile, ( ( *runs = w ), runs ), 1, iysh ) ;
-      linesout += iysh ;
-    } else {
-      for ( i=0 ; i < -iysh ; i++ ) 
-	readline ( &ifile, runs, 0 ) ;
-    }    
+    for ( cm = CMSG_FIRSTHDR(&m) ; cm ; cm = CMSG_NXTHDR(&m,cm) ) {
+      if ( cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS ) {
+	for ( i=0 ; i < ( cm->cmsg_len - CMSG_LEN(0) ) / sizeof(int) ; i++ ) {
+	  int d ;
+	  memcpy ( &d, CMSG_DATA(cm) + i * sizeof(int), sizeof(int) ) ;
+	  if ( *fd < 0 ) *fd = d ; else close ( d ) ;
+	}
+      }
+    }
 
-    /* copy input to output */
-    
-    olines = ilines = 0 ; 
-    
-    while ( linesout < h ) {
+    if ( got == 0 ) {
+      if ( len ) msg ( "E incomplete request" ) ;
+      else n = nargs = 0 ;
+      break ;
+    }
+
+    /* count the complete strings received so far */
 
-      if ( ! ifile.lines || ( nr = readline ( &ifile, runs, &pels ) ) < 0 ) {
+    end = buf + ( len += got ) ;
+    for ( p = buf, i=0 ; ( p = memchr ( p, 0, end - p ) ) ; p++, i++ ) ;
+
+    if ( n < 0 && i > 0 ) {
+      if ( sscanf ( buf, "%d", &n ) != 1 || n <= 0 || n > MAXREQARGS ) {
+	msg ( "E bad request argument count (%.20s)", buf ) ;
+	n = -1 ;
 	break ;
-      } else {
-	ilines++ ;
       }
+    }
+    nargs = i - 1 ;
+  }
 
-      if ( *ovfnames ) {
-	if ( ( ovnr = readline ( &ovfile, ovruns, &ovpels ) ) >= 0 )
-	  nr = runor ( runs, nr, ovruns, ovnr, 0, &pels ) ; 
-      }
+  if ( n > 0 && nargs >= n ) {
+    for ( p = buf + strlen ( buf ) + 1, i=0 ; i < n ; p += strlen ( p ) + 1 )
+      args [ i++ ] = p ;
+    if ( p != buf + len ) {
+      msg ( "E data after request" ) ;
+      n = -1 ;
+    }
+  } else if ( n != 0 || nargs != 0 ) {
+    n = -1 ;
+  }
 
-      /* x-scale, x-shift & x-pad input line */
-    
-      pels  = ( xs == 256 ) ? pels : xscale ( runs, nr, xs ) ;
-      pels += ( ixsh == 0 ) ?   0  : xshift ( runs, nr, ixsh ) ;
-      nr    = ( pels == w ) ?  nr  : xpad   ( runs, nr, w - pels ) ;
+  if ( n <= 0 && *fd >= 0 ) {
+    close ( *fd ) ;
+    *fd = -1 ;
+  }
 
-      /* y-scale by deleting/duplicating lines. */
+  return n ;
+}
 
-      no = ( ( ilines * ys ) >> 8 ) - olines ;
 
-      if ( linesout + no > h ) no = h - linesout ;
-      olines += no ;
+/* Serve requests on connected socket s until the client closes
+   it.  Returns 0 or 2 on errors. */
 
-      writeline ( &ofile, runs, nr, no ) ;
-      linesout += no ;
+int serveconn ( int s )
+{
+  int err=0, n=0, fd, status, pages ;
+  char buf [ MAXREQ ], *args [ MAXREQARGS + 2 ], reply [ 32 ], *verb0 ;
+  FILE *out ;
+
+  while ( ! stopserver && ( n = getrequest ( s, buf, args+1, &fd ) ) > 0 ) {
+
+    args [ 0 ] = argv0 ;
+    args [ n+1 ] = 0 ;
+    out = 0 ;
+    if ( fd >= 0 && ! ( out = fdopen ( fd, "wb" ) ) ) {
+      msg ( "ES2 can't open output stream:" ) ;
+      close ( fd ) ;
     }
 
-    /* y-pad */
+    verb0 = verb[0] ;
+    status = convert ( n+1, args, out, &pages, 0 ) ;
+    verb[0] = verb0 ;
 
-    if ( linesout < h )
-      writeline ( &ofile, ( ( *runs = w ), runs ), 1, h - linesout ) ;
-    
-    if ( ferror ( ifile.f ) ) err = msg ( "ES2input error:" ) ;
+    if ( out && fclose ( out ) && ! status )
+      status = msg ( "ES2 output error:" ) ;
+
+    sprintf ( reply, "%d %d\n", status, pages ) ;
+    if ( write ( s, reply, strlen ( reply ) ) != strlen ( reply ) ) {
+      err = msg ( "ES2 can't send reply:" ) ;
+      break ;
+    }
+  }
+
+  if ( n < 0 ) err = 2 ;
+
+  return err ;
+}
+
+
+/* Serve conversion requests on Unix socket sname until stopped
+   by a signal or, if sname is "-", on the socket that is the
+   standard input until the client closes it.  Returns 0 or 2 on
+   errors. */
+
+int serve ( char *sname )
+{
+  int err=0, s, c ;
+  struct sockaddr_un a ;
+  struct sigaction sa ;
+
+  signal ( SIGPIPE, SIG_IGN ) ;	/* clients may go away */
+
+  if ( ! strcmp ( sname, "-" ) ) 
+    return serveconn ( 0 ) ;
+
+  memset ( &sa, 0, sizeof(sa) ) ;
+  sa.sa_handler = onstopsig ;	/* no SA_RESTART: interrupt accept() */
+  sigaction ( SIGTERM, &sa, 0 ) ;
+  sigaction ( SIGINT, &sa, 0 ) ;
+  sigaction ( SIGHUP, &sa, 0 ) ;
+
+  memset ( &a, 0, sizeof(a) ) ;
+  a.sun_family = AF_UNIX ;
+  if ( strlen ( sname ) >= sizeof(a.sun_path) )
+    return msg ( "E2 socket name too long (%s)", sname ) ;
+  strcpy ( a.sun_path, sname ) ;
+
+  if ( ( s = socket ( AF_UNIX, SOCK_STREAM, 0 ) ) < 0 )
+    return msg ( "ES2 can't create socket:" ) ;
+
+  unlink ( sname ) ;		/* left by an earlier server */
+
+  if ( bind ( s, (struct sockaddr*) &a, sizeof(a) ) || listen ( s, 5 ) ) {
+    err = msg ( "ES2 can't listen on socket %s:", sname ) ;
+  } else {
+    msg ( "I serving requests on %s", sname ) ;
+    while ( ! stopserver ) {
+      if ( ( c = accept ( s, 0, 0 ) ) < 0 ) {
+	if ( errno != EINTR ) err = msg ( "ES2 can't accept connection:" ) ;
+	if ( err ) break ;
+	continue ;
+      }
+      serveconn ( c ) ;
+      close ( c ) ;
+    }
+    unlink ( sname ) ;
   }
 
-  nextopage ( &ofile, EOF ) ;
+  close ( s ) ;
+
+  return err ;
+}
+
+
+int main( int argc, char **argv)
+{
+  int err=0, pages ;
+  char *sname=0 ;
+
+  argv0 = argv[0] ;
+
+  setlocale ( LC_ALL, "" ) ;
+  /*
+    efix uses formatted text functions for floating point numbers, so restore
+     the C locale for that
+  */
+  setlocale ( LC_NUMERIC, "C" ) ;
+
+  err = convert ( argc, argv, stdout, &pages, &sname ) ;
+
+  if ( ! err && sname ) 
+    err = serve ( sname ) ;
 
   return err ;
 }
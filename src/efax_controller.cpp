@@ -19,18 +19,16 @@ COPYING distributed with the source files.
 
 #include <fstream>
 #include <iomanip>
+#include <algorithm>
 #include <memory>
 #include <ctime>
 #include <cstring>
 #include <cstdlib>
 
-// uncomment for debugging in EfaxController::timer_event()
-//#include <iostream>
-
 #include <glib/gtimer.h>
 
 #include "efax_controller.h"
-#include "fax_list_manager.h"
+#include "efix_server.h"
 #include "utils/thread.h"
 #include "utils/mutex.h"
 #include "utils/shared_handle.h"
@@ -60,9 +58,15 @@ COPYING distributed with the source files.
 extern "C" pid_t getpgid(pid_t);
 
 
-EfaxController::EfaxController(void): state(inactive),
-				      close_down(false),
-                                      received_fax_count(0) {
+EfaxController::EfaxController(const Modem_device& modem_,
+			       bool label_output): state(inactive),
+						   close_down(false),
+						   modem(modem_),
+						   label(label_output ? '[' + modem_.name + "] "
+							 : std::string()),
+						   at_line_start(true),
+						   child_pid(0),
+						   received_fax_count(0) {
   // set up state_messages
 
   state_messages.push_back(gettext("Inactive"));
@@ -85,9 +89,50 @@ void EfaxController::efax_closedown(void) {
   }
 }
 
+std::string EfaxController::receive_dirname(void) const {
+  // the directory in which efax puts the pages of a fax being received
+  std::string dirname(prog_config.working_dir);
+  dirname += "/faxin/";
+  dirname += modem.receive_dir;
+  return dirname;
+}
+
+std::string EfaxController::key_filename(void) const {
+  // the file from which efax reads the encryption password - each
+  // line has its own, as its efax process may be sending or receiving
+  // with a different password from the efax processes on other lines
+  std::string filename(prog_config.working_dir);
+  filename += "/key-";
+  filename += modem.receive_dir;
+  return filename;
+}
+
+bool EfaxController::write_key_file(const std::string& password) const {
+  // write password to key_filename(), readable only by the user, for
+  // the efax process about to be started on this line (efax reads it
+  // once, when it starts).  Returns false if it could not be written
+  int fd = open(key_filename().c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+  if (fd == -1) return false;
+  ssize_t result;
+  do {
+    result = write(fd, password.data(), password.size());
+  } while (result == -1 && errno == EINTR);
+  while (::close(fd) == -1 && errno == EINTR);
+  return result == static_cast<ssize_t>(password.size());
+}
+
+void EfaxController::add_device_parms(std::vector<std::string>& parms) const {
+  // add the serial device, lock file and password file arguments for
+  // this object's modem to the efax arguments in parms
+  parms.push_back("-d" + modem.device_path);
+  parms.push_back("-x" + modem.lock_file);
+  parms.push_back("-K" + key_filename());
+}
+
 void EfaxController::init_sendfax_parms(void) {
 
   sendfax_parms_vec = prog_config.parms;
+  add_device_parms(sendfax_parms_vec);
 
   // now add the first set of arguments to the copy of prog_config.parms
   // in sendfax_parms_vec
@@ -265,13 +310,13 @@ void EfaxController::sendfax_slot(void) {
   // happen with Linux kernel 2.6)
   SyncPipe sync_pipe;
 
-  prog_config.efax_controller_child_pid = fork();
+  child_pid = fork();
 
-  if (prog_config.efax_controller_child_pid == -1) {
+  if (child_pid == -1) {
     write_error("Fork error - exiting\n");
     std::exit(FORK_ERROR);
   }
-  if (!prog_config.efax_controller_child_pid) {  // child process - as soon as everything is set up we are going to do an exec()
+  if (!child_pid) {  // child process - as soon as everything is set up we are going to do an exec()
 
     // now we have forked, we can connect stdout_pipe to stdout
     // and connect MainWindow::error_pipe to stderr
@@ -349,13 +394,380 @@ std::pair<const char*, char* const*> EfaxController::get_gs_parms(const std::str
   return std::pair<const char*, char* const*>(prog_name, exec_parms);
 }
 
+std::pair<const char*, char* const*> EfaxController::get_efix_parms(const std::string& basename,
+								   int page_count) {
+  // page_count is the number of pages in the fax, which a cover page
+  // may show - if it is 0 efix gives the number of pages it reads
+
+  std::vector<std::string> parms;
+
+  { // scope block for mutex lock
+    // lock the Prog_config object to stop it being modified in the intial (GUI) thread
+    // while we are accessing it here
+    Thread::Mutex::Lock lock(*prog_config.mutex_p);
+
+    std::string temp;
+    parms.push_back("efix-0.9a");
+    parms.push_back("-ve");
+    parms.push_back("-otiffg3");
+    temp = "-r";
+    temp += prog_config.resolution;
+    parms.push_back(temp);
+    // scanned images usually have a higher resolution than the fax, and
+    // filtering keeps the thin strokes which sampling would drop
+    parms.push_back("-qfilter");
+    // a fax scan line is always 215mm wide (1728 pels) whatever the paper
+    // size, so only take the page length from Prog_config::page_dim
+    temp = "-p215x";
+    temp += prog_config.page_dim.substr(prog_config.page_dim.find('x') + 1);
+    parms.push_back(temp);
+    temp = "-n";
+    temp += basename + ".%03d";
+    parms.push_back(temp);
+  }
+
+  if (page_count > 0) {
+#ifdef HAVE_STRINGSTREAM
+    std::ostringstream strm;
+
+#  ifdef HAVE_STREAM_IMBUE
+    strm.imbue(std::locale::classic());
+#  endif // HAVE_STREAM_IMBUE
+
+    strm << "-c" << page_count;
+    parms.push_back(strm.str());
+#else
+    std::ostrstream strm;
+
+#  ifdef HAVE_STREAM_IMBUE
+    strm.imbue(std::locale::classic());
+#  endif // HAVE_STREAM_IMBUE
+
+    strm << "-c" << page_count << std::ends;
+    const char* count_parm = strm.str();
+    parms.push_back(count_parm);
+    delete[] count_parm;
+#endif
+  }
+  parms.push_back(basename);
+
+  char** exec_parms = new char*[parms.size() + 1];
+
+  std::vector<std::string>::const_iterator iter;
+  char**  temp_pp = exec_parms;
+  for (iter = parms.begin(); iter != parms.end(); ++iter, ++temp_pp) {
+    *temp_pp = new char[iter->size() + 1];
+    std::strcpy(*temp_pp, iter->c_str());
+  }
+
+  *temp_pp = 0;
+  
+  char* prog_name = new char[std::strlen("efix-0.9a") + 1];
+  std::strcpy(prog_name, "efix-0.9a");
+
+  return std::pair<const char*, char* const*>(prog_name, exec_parms);
+}
+
+bool EfaxController::is_efix_image(const std::string& filename) const {
+
+  // this checks for the image formats which efaxlib can read (it uses the
+  // same tests as getformat() in efax/efaxlib.c): TIFF, raw PBM and PGM,
+  // mono PCX, DCX and PDF.  Files in these formats can be converted to tiffg3
+  // by efix-0.9a, which is much quicker than starting up ghostscript
+  // (which cannot read them anyway)
+  unsigned char buf[128];
+  std::ifstream filein(filename.c_str(), std::ios::in | std::ios::binary);
+  if (!filein) return false;
+  filein.read(reinterpret_cast<char*>(buf), sizeof(buf));
+  std::streamsize n = filein.gcount();
+  if (n < 4) return false;
+
+  if (is_pdf_file(filename)) return true;                                     // PDF
+  if (is_cover_file(filename)) return true;                                   // cover page
+  if ((buf[0] == 'I' || buf[0] == 'M') && buf[1] == buf[0]) return true;      // TIFF
+  if (buf[0] == 'P' && (buf[1] == '4' || buf[1] == '5')) return true;         // PBM/PGM
+  if (buf[0] == 0x3a && buf[1] == 0xde && buf[2] == 0x68 && buf[3] == 0xb1) return true; // DCX
+  if (n == sizeof(buf) && buf[0] == 0x0a
+      && (buf[1] == 2 || buf[1] == 3 || buf[1] == 5)
+      && buf[2] <= 1 && buf[65] == 1) return true;                           // mono PCX
+  return false;
+}
+
+bool EfaxController::is_cover_file(const std::string& filename) const {
+
+  // a cover page file describes a page made by efix-0.9a from a template
+  // image and some lines of text (see the efix man page)
+  char buf[11];
+  std::ifstream filein(filename.c_str(), std::ios::in | std::ios::binary);
+  if (!filein) return false;
+  filein.read(buf, sizeof(buf));
+  return filein.gcount() == sizeof(buf) && !std::strncmp(buf, "%efax-cover", 11);
+}
+
+bool EfaxController::make_cover_pages(const std::string& filename, int page_count) {
+  // have the efix server convert the cover page file filename into
+  // tiffg3 fax files, beginning at [filename].001, with page_count as
+  // the number of pages in the fax.  Returns false if the efix server
+  // could not be used or could not convert the file
+
+  // the efix server does not share our working directory, so pass the
+  // full path name (the output files are named with the -n option, so
+  // nothing is written to the descriptor passed with the request)
+  std::pair<const char*, char* const*> efix_parms(get_efix_parms(filename, page_count));
+  int result = -1;
+  int fd = open("/dev/null", O_WRONLY);
+  if (fd != -1) {
+    result = EfixServer::convert(efix_parms.second, fd);
+    while (::close(fd) == -1 && errno == EINTR);
+  }
+  delete_parms(efix_parms);
+  // efix exits with 0 on success and 1 or 2 on errors
+  return result == 0;
+}
+
+bool EfaxController::is_pdf_file(const std::string& filename) const {
+
+  // efix-0.9a can only read PDF files in which each page is a single
+  // fax or bit-map image (such as those made by scanners and by efix
+  // itself) - make_fax_thread() passes other PDF files to ghostscript
+  char buf[4];
+  std::ifstream filein(filename.c_str(), std::ios::in | std::ios::binary);
+  if (!filein) return false;
+  filein.read(buf, sizeof(buf));
+  return filein.gcount() == sizeof(buf) && !std::strncmp(buf, "%PDF", 4);
+}
+
+bool EfaxController::make_fax_pages(const std::string& filename,
+				    std::string::size_type pos, bool image_file,
+				    int page_count) {
+  // convert filename into tiffg3 fax files, beginning at [filename].001,
+  // with efix (if image_file is true) or ghostscript, and enter their names in
+  // sendfax_parms_vec.  pos is the position of the last '/' character in filename.
+  // page_count is the number of pages in the fax for a cover page, or 0.
+  // Returns true if any fax files were made
+
+  // cover pages are made by the resident efix server, which keeps the
+  // decoded template of a cover page from one fax to the next - if it
+  // cannot be used or fails, fall back to running efix ourselves
+  if (image_file && is_cover_file(filename) && make_cover_pages(filename, page_count))
+    return enter_fax_pages(filename);
+
+  // unfortunately ghostscript does not handle long file names
+  // so we need to separate the file name from the full path (we will chdir() to the directory later)
+  std::string dirname(filename.substr(0, pos));
+  pos++;
+  std::string basename(filename.substr(pos));
+
+  // get the arguments for the exec() call below (because this is a
+  // multi-threaded program, we must do this before fork()ing because
+  // we use functions to get the arguments which are not async-signal-safe)
+  std::pair<const char*, char* const*> gs_parms(image_file ? get_efix_parms(basename, page_count)
+						: get_gs_parms(basename));
+
+  // create a synchronising pipe - we need to wait() on gs (or efix) having completed executing
+  // and then notify the parent process.  To wait() successfully we need to fork() once,
+  // reset the child signal handler, and then fork() again
+  SyncPipe sync_pipe;
+
+  pid_t pid = fork();
+  
+  if (pid == -1) {
+    write_error("Fork error\n");
+    std::exit(FORK_ERROR);
+  }
+  if (!pid) { // child process
+
+    // unblock signals as these are blocked for all worker threads
+    // (the child process inherits the signal mask of the thread
+    // creating it with the fork() call)
+    sigset_t sig_mask;
+    sigemptyset(&sig_mask);
+    sigaddset(&sig_mask, SIGCHLD);
+    sigaddset(&sig_mask, SIGQUIT);
+    sigaddset(&sig_mask, SIGTERM);
+    sigaddset(&sig_mask, SIGINT);
+    sigaddset(&sig_mask, SIGHUP);
+    // this child process is single threaded, so we can use sigprocmask()
+    // rather than pthread_sigmask() (and should do so as sigprocmask()
+    // is guaranteed to be async-signal-safe)
+    // this process will not be receiving interrupts so we do not need
+    // to test for EINTR on the call to sigprocmask()
+    sigprocmask(SIG_UNBLOCK, &sig_mask, 0);
+
+    connect_to_stderr();
+
+    // now fork() again
+    pid_t pid = fork();
+
+    if (pid == -1) {
+      write_error("Fork error\n");
+      _exit(FORK_ERROR); // we have already forked, so use _exit() not exit()
+    }
+    if (!pid) {  // child process - when everything is set up, we are going to do an exec()
+
+      // we don't need sync_pipe in this process - ignore it by calling release()
+      sync_pipe.release();
+
+      // now start up ghostscript
+      // first we need to connect stdin to /dev/null to make ghostscript terminate
+      // this process will not be receiving interrupts so we do not need
+      // to test for EINTR on the calls to open(), dup2() and close() as this
+      // process will not be receiving any signals
+      int fd = open("/dev/null", O_RDWR);
+      if (fd == -1) {
+	write_error("Cannot open /dev/null in EfaxController::make_fax_pages()\n");
+	// in case of error end child process here
+	_exit(FILEOPEN_ERROR);
+      }
+      dup2(fd, 0);
+      // now close stdout
+      dup2(fd, 1);
+      close(fd); // now stdin and stdout read/write to /dev/null, we can close the /dev/null file descriptor
+
+      // unfortunately ghostscript does not handle long file names
+      // so we need to chdir()
+      chdir(dirname.c_str());
+      execvp(gs_parms.first, gs_parms.second);
+
+      // if we reached this point, then the execvp() call must have failed
+      if (image_file) write_error("Can't find the efix-0.9a program - please check your installation\n"
+				  "and the PATH environmental variable\n");
+      else write_error("Can't find the ghostscript program - please check your installation\n"
+		       "and the PATH environmental variable\n");
+      // this child process must end here - use _exit() not exit()
+      _exit(EXEC_ERROR); 
+    } // end of child process
+
+    // this is the parent process
+
+    // wait until ghostscript has produced the fax tiffg3 fax file.
+    // Note that we have already fork()ed so this process will not be
+    // receiving signals so we do not need to test for EINTR on the
+    // call to wait()
+    wait(0);
+
+    // release the waiting parent process
+    sync_pipe.release();
+
+    // now end the process - use _exit() not exit()
+    _exit(0);
+  }
+  // wait on sync_pipe until we know gs has made all the files in tiffg3 format
+  sync_pipe.wait();
+
+  // release the memory allocated on the heap for
+  // the redundant gs_parms
+  // we are in the main parent process here - no worries about
+  // only being able to use async-signal-safe functions
+  delete_parms(gs_parms);
+
+  // now enter the names of the created files in sendfax_parms_vec
+  return enter_fax_pages(filename);
+}
+
+bool EfaxController::enter_fax_pages(const std::string& filename) {
+  // enter the names of the fax files [filename].001 etc. made by
+  // make_fax_pages() in sendfax_parms_vec.  Returns true if there
+  // are any
+
+  bool valid_file = false;
+  int partnumber = 1;
+#ifdef HAVE_STRINGSTREAM
+  std::ostringstream strm;
+
+#  ifdef HAVE_STREAM_IMBUE
+  strm.imbue(std::locale::classic());
+#  endif // HAVE_STREAM_IMBUE
+
+  strm << filename << '.' << std::setfill('0')
+       << std::setw(3) << partnumber;
+  int result = access(strm.str().c_str(), R_OK);
+  
+  while (!result) {  // file OK
+    // valid_file only needs to be set true once, but it is more
+    // convenient to do it in this loop
+    valid_file = true;
+
+    // we do not need a mutex to protect sendfax_parms_vec - until
+    // EfaxController::child_exited() resets state to inactive or
+    // receive_standby, we cannot invoke sendfax() again
+    sendfax_parms_vec.push_back(strm.str());
+
+    partnumber++;
+    strm.str("");
+    strm << filename << '.' << std::setfill('0')
+	 << std::setw(3) << partnumber;
+    result = access(strm.str().c_str(), R_OK);
+  }
+#else
+  std::ostrstream strm;
+
+#  ifdef HAVE_STREAM_IMBUE
+  strm.imbue(std::locale::classic());
+#  endif // HAVE_STREAM_IMBUE
+
+  strm << filename.c_str() << '.' << std::setfill('0')
+       << std::setw(3) << partnumber << std::ends;
+  const char* test_name = strm.str();
+  int result = access(test_name, R_OK);
+  
+  while (!result) {  // file OK
+    // valid_file only needs to be set true once, but it is more
+    // convenient to do it in this loop
+    valid_file = true;
+
+    sendfax_parms_vec.push_back(test_name);
+    delete[] test_name;
+
+    partnumber++;
+    std::ostrstream strm;
+
+#  ifdef HAVE_STREAM_IMBUE
+    strm.imbue(std::locale::classic());
+#  endif // HAVE_STREAM_IMBUE
+
+    strm << filename.c_str() << '.' << std::setfill('0')
+	 << std::setw(3) << partnumber << std::ends;
+    test_name = strm.str();
+    result = access(test_name, R_OK);
+  }
+  delete[] test_name;
+#endif
+  return valid_file;
+}
+
 void EfaxController::make_fax_thread(void) {
   // convert the postscript file(s) into tiffg3 fax files, beginning at [filename].001
-  // we will use ghostscript.  we will also load the results into sendfax_parms_vec
+  // we will use ghostscript, or efix for image files which efix can read directly.
+  // we will also load the results into sendfax_parms_vec
 
   std::vector<std::string>::const_iterator filename_iter;
 
-  // we do not need a mutex to protect last_fax_item_sent - until EfaxController::timer_event()
+  // a cover page may show the number of pages in the fax, which is not
+  // known until the other files have been converted - so cover page files
+  // are converted last, and each is recorded here with the position in
+  // sendfax_parms_vec at which its pages are to go
+  std::vector<std::pair<std::string, std::vector<std::string>::size_type> > cover_files;
+  // sendfax_parms_vec already holds the efax arguments made by init_sendfax_parms()
+  std::vector<std::string>::size_type first_page = sendfax_parms_vec.size();
+
+  // efax will read the password for this fax from the file named by
+  // its -K argument (we do not need a mutex to protect last_fax_item_sent
+  // - see below)
+  if (!write_key_file(last_fax_item_sent.password)) {
+    write_error(gettext("Cannot write the password file for efax\n"));
+
+    // synchronise memory on multi-processor systems before we emit the
+    // Notifier signal - we call fax_made_sem.wait() in
+    // EfaxController::no_fax_made_slot()
+    fax_made_sem.post();
+
+    // clean up and then end this worker thread
+    no_fax_made_notify();
+    return;
+  }
+
+  // we do not need a mutex to protect last_fax_item_sent - until EfaxController::child_exited()
   // resets state to inactive or receive_standby, we cannot invoke sendfax() again
   for (filename_iter = last_fax_item_sent.file_list.begin();
        filename_iter != last_fax_item_sent.file_list.end(); ++filename_iter) {
@@ -401,180 +813,48 @@ void EfaxController::make_fax_thread(void) {
       return;
     }
 
-    // unfortunately ghostscript does not handle long file names
-    // so we need to separate the file name from the full path (we will chdir() to the directory later)
-    // pos is already set to the position of the last '/' character
-    std::string dirname(filename_iter->substr(0, pos));
-    pos++;
-    std::string basename(filename_iter->substr(pos));
-
-    // get the arguments for the exec() call below (because this is a
-    // multi-threaded program, we must do this before fork()ing because
-    // we use functions to get the arguments which are not async-signal-safe)
-    std::pair<const char*, char* const*> gs_parms(get_gs_parms(basename));
-
-    // create a synchronising pipe - we need to wait() on gs having completed executing
-    // and then notify the parent process.  To wait() successfully we need to fork() once,
-    // reset the child signal handler, and then fork() again
-    SyncPipe sync_pipe;
-
-    pid_t pid = fork();
-    
-    if (pid == -1) {
-      write_error("Fork error\n");
-      std::exit(FORK_ERROR);
+    bool image_file = is_efix_image(*filename_iter);
+    if (image_file && is_cover_file(*filename_iter)) {
+      cover_files.push_back(std::make_pair(*filename_iter, sendfax_parms_vec.size()));
+      continue;
     }
-    if (!pid) { // child process
-
-      // unblock signals as these are blocked for all worker threads
-      // (the child process inherits the signal mask of the thread
-      // creating it with the fork() call)
-      sigset_t sig_mask;
-      sigemptyset(&sig_mask);
-      sigaddset(&sig_mask, SIGCHLD);
-      sigaddset(&sig_mask, SIGQUIT);
-      sigaddset(&sig_mask, SIGTERM);
-      sigaddset(&sig_mask, SIGINT);
-      sigaddset(&sig_mask, SIGHUP);
-      // this child process is single threaded, so we can use sigprocmask()
-      // rather than pthread_sigmask() (and should do so as sigprocmask()
-      // is guaranteed to be async-signal-safe)
-      // this process will not be receiving interrupts so we do not need
-      // to test for EINTR on the call to sigprocmask()
-      sigprocmask(SIG_UNBLOCK, &sig_mask, 0);
-
-      connect_to_stderr();
-
-      // now fork() again
-      pid_t pid = fork();
-
-      if (pid == -1) {
-	write_error("Fork error\n");
-	_exit(FORK_ERROR); // we have already forked, so use _exit() not exit()
-      }
-      if (!pid) {  // child process - when everything is set up, we are going to do an exec()
-
-	// we don't need sync_pipe in this process - ignore it by calling release()
-	sync_pipe.release();
-
-	// now start up ghostscript
-	// first we need to connect stdin to /dev/null to make ghostscript terminate
-	// this process will not be receiving interrupts so we do not need
-	// to test for EINTR on the calls to open(), dup2() and close() as this
-	// process will not be receiving any signals
-	int fd = open("/dev/null", O_RDWR);
-	if (fd == -1) {
-	  write_error("Cannot open /dev/null in EfaxController::make_fax_thread()\n");
-	  // in case of error end child process here
-	  _exit(FILEOPEN_ERROR);
-	}
-	dup2(fd, 0);
-	// now close stdout
-	dup2(fd, 1);
-	close(fd); // now stdin and stdout read/write to /dev/null, we can close the /dev/null file descriptor
-
-	// unfortunately ghostscript does not handle long file names
-	// so we need to chdir()
-	chdir(dirname.c_str());
-	execvp(gs_parms.first, gs_parms.second);
-
-	// if we reached this point, then the execvp() call must have failed
-	write_error("Can't find the ghostscript program - please check your installation\n"
-		    "and the PATH environmental variable\n");
-	// this child process must end here - use _exit() not exit()
-	_exit(EXEC_ERROR); 
-      } // end of child process
-
-      // this is the parent process
-
-      // wait until ghostscript has produced the fax tiffg3 fax file.
-      // Note that we have already fork()ed so this process will not be
-      // receiving signals so we do not need to test for EINTR on the
-      // call to wait()
-      wait(0);
-
-      // release the waiting parent process
-      sync_pipe.release();
+    bool valid_file = make_fax_pages(*filename_iter, pos, image_file, 0);
 
-      // now end the process - use _exit() not exit()
-      _exit(0);
+    // efix-0.9a cannot read PDF files with text or vector graphics, or
+    // with images compressed in ways which it cannot decode - ghostscript can
+    if (!valid_file && image_file && is_pdf_file(*filename_iter)) {
+      image_file = false;
+      valid_file = make_fax_pages(*filename_iter, pos, image_file, 0);
     }
-    // wait on sync_pipe until we know gs has made all the files in tiffg3 format
-    sync_pipe.wait();
-
-    // release the memory allocated on the heap for
-    // the redundant gs_parms
-    // we are in the main parent process here - no worries about
-    // only being able to use async-signal-safe functions
-    delete_parms(gs_parms);
-
-    // now enter the names of the created files in sendfax_parms_vec
-    bool valid_file = false;
-    int partnumber = 1;
-#ifdef HAVE_STRINGSTREAM
-    std::ostringstream strm;
-
-#  ifdef HAVE_STREAM_IMBUE
-    strm.imbue(std::locale::classic());
-#  endif // HAVE_STREAM_IMBUE
 
-    strm << *filename_iter << '.' << std::setfill('0')
-	 << std::setw(3) << partnumber;
-    int result = access(strm.str().c_str(), R_OK);
-    
-    while (!result) {  // file OK
-      // valid_file only needs to be set true once, but it is more
-      // convenient to do it in this loop
-      valid_file = true;
+    if (!valid_file) {
+      if (image_file) write_error(gettext("Not valid image file\n"));
+      else write_error(gettext("Not valid postscript file\n"));
 
-      // we do not need a mutex to protect sendfax_parms_vec - until
-      // EfaxController::timer_event() resets state to inactive or
-      // receive_standby, we cannot invoke sendfax() again
-      sendfax_parms_vec.push_back(strm.str());
+      // synchronise memory on multi-processor systems before we emit the
+      // Notifier signal - we call fax_made_sem.wait() in
+      // EfaxController::no_fax_made_slot()
+      fax_made_sem.post();
 
-      partnumber++;
-      strm.str("");
-      strm << *filename_iter << '.' << std::setfill('0')
-	   << std::setw(3) << partnumber;
-      result = access(strm.str().c_str(), R_OK);
+      // clean up and then end this worker thread
+      no_fax_made_notify();
+      return;
     }
-#else
-    std::ostrstream strm;
-
-#  ifdef HAVE_STREAM_IMBUE
-    strm.imbue(std::locale::classic());
-#  endif // HAVE_STREAM_IMBUE
+  }
 
-    strm << filename_iter->c_str() << '.' << std::setfill('0')
-	 << std::setw(3) << partnumber << std::ends;
-    const char* test_name = strm.str();
-    int result = access(test_name, R_OK);
-  
-    while (!result) {  // file OK
-      // valid_file only needs to be set true once, but it is more
-      // convenient to do it in this loop
-      valid_file = true;
+  // a cover page file makes one page
+  int page_count = sendfax_parms_vec.size() - first_page + cover_files.size();
+  // the number of pages of earlier cover page files already moved into
+  // place, which moves the insertion point of later ones along
+  std::vector<std::string>::size_type inserted = 0;
 
-      sendfax_parms_vec.push_back(test_name);
-      delete[] test_name;
+  std::vector<std::pair<std::string, std::vector<std::string>::size_type> >::const_iterator cover_iter;
+  for (cover_iter = cover_files.begin(); cover_iter != cover_files.end(); ++cover_iter) {
 
-      partnumber++;
-      std::ostrstream strm;
-
-#  ifdef HAVE_STREAM_IMBUE
-      strm.imbue(std::locale::classic());
-#  endif // HAVE_STREAM_IMBUE
-
-      strm << filename_iter->c_str() << '.' << std::setfill('0')
-	   << std::setw(3) << partnumber << std::ends;
-      test_name = strm.str();
-      result = access(test_name, R_OK);
-    }
-    delete[] test_name;
-#endif  
-    
-    if (!valid_file) {
-      write_error(gettext("Not valid postscript file\n"));
+    std::vector<std::string>::size_type end = sendfax_parms_vec.size();
+    if (!make_fax_pages(cover_iter->first, cover_iter->first.find_last_of('/'),
+			true, page_count)) {
+      write_error(gettext("Not valid image file\n"));
 
       // synchronise memory on multi-processor systems before we emit the
       // Notifier signal - we call fax_made_sem.wait() in
@@ -585,7 +865,14 @@ void EfaxController::make_fax_thread(void) {
       no_fax_made_notify();
       return;
     }
+    // make_fax_pages() has appended the cover pages to sendfax_parms_vec,
+    // so move them to where the cover page file came in the file list
+    std::rotate(sendfax_parms_vec.begin() + cover_iter->second + inserted,
+		sendfax_parms_vec.begin() + end,
+		sendfax_parms_vec.end());
+    inserted += sendfax_parms_vec.size() - end;
   }
+
   // we have now made the fax pages in tiffg3 format and entered them into sendfax_parms_vec.
   // At the end of this method this worker thread will end, and emitting fax_made_notify
   // will cause sendfax_slot() to be executed in the initial (GUI) thread
@@ -601,6 +888,7 @@ void EfaxController::make_fax_thread(void) {
 std::pair<const char*, char* const*> EfaxController::get_receive_parms(int mode) {
 
   std::vector<std::string> efax_parms(prog_config.parms);
+  add_device_parms(efax_parms);
   std::string temp;
 
   efax_parms.push_back("-rcurrent");
@@ -644,10 +932,14 @@ void EfaxController::receive(State mode) {
     beep();
     return;
   }
+  if (!write_key_file(receive_password)) {
+    write_error(gettext("Cannot write the password file for efax\n"));
+    beep();
+    return;
+  }
 
   // now proceed to put the program in receive mode
-  std::string fax_pathname(prog_config.working_dir);
-  fax_pathname += "/faxin/current";
+  std::string fax_pathname(receive_dirname());
   // we can extract the C string here - we do not do anything below to make it invalid
   const char* fax_pathname_str = fax_pathname.c_str();
 
@@ -674,12 +966,12 @@ void EfaxController::receive(State mode) {
     // happen with Linux kernel 2.6)
     SyncPipe sync_pipe;
 
-    prog_config.efax_controller_child_pid = fork();
-    if (prog_config.efax_controller_child_pid == -1) {
+    child_pid = fork();
+    if (child_pid == -1) {
       write_error("Fork error - exiting\n");
       std::exit(FORK_ERROR);
     }
-    if (!prog_config.efax_controller_child_pid) {  // child process - as soon as everything is set up we are going to do an exec()
+    if (!child_pid) {  // child process - as soon as everything is set up we are going to do an exec()
 
       // now we have forked, we can connect stdout_pipe to stdout
       // and connect MainWindow::error_pipe to stderr
@@ -735,123 +1027,99 @@ void EfaxController::stop(void) {
   else beep();
 }
 
-void EfaxController::timer_event(void) {
+void EfaxController::child_exited(int stat_val) {
 
-  // if a fax list is in the process of being constructed, we need to wait until
-  // construction has completed before reaping efax exit status and acting on it
-  // (we might have reached here through the call to gtk_main_iteration() in
-  // FaxListManager::populate_fax_list())
-  if (FaxListManager::is_fax_received_list_main_iteration()
-      || FaxListManager::is_fax_sent_list_main_iteration()) {
-    return;
-  }
+  // this is called by ModemPool::timer_event() when it has reaped the
+  // exit status of the efax process whose pid is in child_pid
 
-  // preconditions are OK - proceed
+  child_pid = 0;
 
-  int stat_val;
-  pid_t result;
+  int exit_code = -1;
+  if (WIFEXITED(stat_val)) exit_code = WEXITSTATUS(stat_val);
 
-  // reap the status of any exited child processes
-  while ((result = waitpid(-1, &stat_val, WNOHANG)) > 0) {
+  // this won't work if efax is suid root and we are not root
+  unlink(modem.lock_file.c_str());
+  // efax read the password when it started, so it need not be kept
+  unlink(key_filename().c_str());
 
-    if (result && result == prog_config.efax_controller_child_pid) {
+  bool restart_standby = false;
+  bool end_receive = false;
 
-      prog_config.efax_controller_child_pid = 0;
+  switch(state) {
 
-      int exit_code = -1;
-      if (WIFEXITED(stat_val)) exit_code = WEXITSTATUS(stat_val);
+  case EfaxController::sending:
+  case EfaxController::send_on_standby:
+    if (!exit_code) {
+      std::pair<std::string, std::string> fax_info(save_sent_fax());
+      // notify that the fax has been sent
+      if (!fax_info.first.empty()) fax_sent_notify(fax_info);
 
-      // this won't work if efax is suid root and we are not root
-      if (!prog_config.lock_file.empty()) unlink(prog_config.lock_file.c_str());
-    
-      bool restart_standby = false;
-      bool end_receive = false;
-
-      switch(state) {
-
-      case EfaxController::sending:
-      case EfaxController::send_on_standby:
-	if (!exit_code) {
-	  std::pair<std::string, std::string> fax_info(save_sent_fax());
-	  // notify that the fax has been sent
-	  if (!fax_info.first.empty()) fax_sent_notify(fax_info);
-
-	  if (last_fax_item_sent.is_socket_file) {
-	    // if we are sending a print job via the socket server, notify the
-	    // SocketServer object which created the temporary file (the server
-	    // object will clean up by deleting it and also cause the socket
-	    // file list to be updated - we do not need to do that here)
-	    remove_from_socket_server_filelist(last_fax_item_sent.file_list[0]);
-	  }
-	}
-	else cleanup_fax_send_fail();
-	unjoin_child();
-	{
-	  State state_val = state;
-	  state = inactive;
-	  if (state_val == send_on_standby
-	      && !close_down) {
-	    receive(receive_standby);
-	  }
-	  // we do not need to call display_state() if we have called receive(), as
-	  // receive() will call display_state() itself
-	  else display_state();
-	}
-	break;
-      case EfaxController::start_send_on_standby:
-	receive_cleanup();
-	unjoin_child();
-	if (!close_down) sendfax_impl(last_fax_item_sent, true);
-	else {
-	  state = inactive;
-	  display_state();
-	}
-	break;
-      case EfaxController::receive_standby:
-	if ((!exit_code || exit_code == 3)
-	    && !close_down) {
-	  restart_standby = true;
-	}
-	else end_receive = true;
-	break;
-      default:
-	if (!inactive) end_receive = true;
-	break;
+      if (last_fax_item_sent.is_socket_file) {
+	// if we are sending a print job via the socket server, notify the
+	// SocketServer object which created the temporary file (the server
+	// object will clean up by deleting it and also cause the socket
+	// file list to be updated - we do not need to do that here)
+	remove_from_socket_server_filelist(last_fax_item_sent.file_list[0]);
       }
-
-      if (end_receive || restart_standby) {
-	receive_cleanup();
-	unjoin_child();
-	state = inactive; // this is needed even if we are going to call receive()
-	// now restart if in standby mode
-	if (restart_standby) receive(receive_standby);
-	// we do not need to call display_state() if we have called receive(), as
-	// receive() will call display_state() itself (calling display_state() will
-	// also update the received fax count displayed in the tray icon tooltip if we are
-	// in receive_standby mode - this will appear in the tray_item tooltip, because
-	// TrayIcon::set_tooltip_slot() is connected to the write_state signal in the
-	// MainWindow::MainWindow() constructor)
-	else display_state();
-	restart_standby = false;
-	end_receive = false;
+    }
+    else cleanup_fax_send_fail();
+    unjoin_child();
+    {
+      State state_val = state;
+      state = inactive;
+      if (state_val == send_on_standby
+	  && !close_down) {
+	receive(receive_standby);
       }
-
-      if (close_down && state == inactive) ready_to_quit_notify();
+      // we do not need to call display_state() if we have called receive(), as
+      // receive() will call display_state() itself
+      else display_state();
     }
-    /* uncomment for debugging
+    break;
+  case EfaxController::start_send_on_standby:
+    receive_cleanup();
+    unjoin_child();
+    if (!close_down) sendfax_impl(last_fax_item_sent, true);
     else {
-      std::cout << "Not efax_controller child" << std::endl;
-      std::cout << "Child pid is " << result << std::endl;
-      std::cout << "Child exit code is " << exit_code << std::endl;
+      state = inactive;
+      display_state();
+    }
+    break;
+  case EfaxController::receive_standby:
+    if ((!exit_code || exit_code == 3)
+	&& !close_down) {
+      restart_standby = true;
     }
-    */
+    else end_receive = true;
+    break;
+  default:
+    if (!inactive) end_receive = true;
+    break;
   }
+
+  if (end_receive || restart_standby) {
+    receive_cleanup();
+    unjoin_child();
+    state = inactive; // this is needed even if we are going to call receive()
+    // now restart if in standby mode
+    if (restart_standby) receive(receive_standby);
+    // we do not need to call display_state() if we have called receive(), as
+    // receive() will call display_state() itself (calling display_state() will
+    // also update the received fax count displayed in the tray icon tooltip if we are
+    // in receive_standby mode - this will appear in the tray_item tooltip, because
+    // TrayIcon::set_tooltip_slot() is connected to the write_state signal of the
+    // ModemPool object in the MainWindow::MainWindow() constructor)
+    else display_state();
+    restart_standby = false;
+    end_receive = false;
+  }
+
+  if (close_down && state == inactive) ready_to_quit_notify();
 }
 
 void EfaxController::receive_cleanup(void) {
   // delete the "current" receive directory if it is empty
-  std::string full_dirname(prog_config.working_dir);
-  full_dirname += "/faxin/current";
+  std::string full_dirname(receive_dirname());
   int result = rmdir(full_dirname.c_str()); // only deletes the directory if it is empty
 
   if (result == -1 && errno == ENOTEMPTY) {
@@ -919,8 +1187,7 @@ std::pair<std::string, std::string> EfaxController::save_received_fax(void) {
     // that we have just created
     new_dirname += faxname;
 
-    std::string old_dirname(prog_config.working_dir);
-    old_dirname += "/faxin/current";
+    std::string old_dirname(receive_dirname());
 
     std::vector<std::string> filelist;
     struct dirent* direntry;
@@ -1001,16 +1268,35 @@ bool EfaxController::read_pipe_slot(void) {
 
   while ((result = stdout_pipe.read(pipe_buffer, PIPE_BUF)) > 0) {
     SharedHandle<char*> output_h(stdout_pipe_reassembler(pipe_buffer, result));
-    if (output_h.get()) stdout_message(output_h.get());
-    else write_error(gettext("Invalid Utf8 received in EfaxController::read_pipe_slot()\n"));
+    if (!output_h.get())
+      write_error(gettext("Invalid Utf8 received in EfaxController::read_pipe_slot()\n"));
+    else if (label.empty()) stdout_message(output_h.get());
+    else stdout_message(label_lines(output_h.get()).c_str());
   }
   return true; // this is multi-shot
 }
 
+std::string EfaxController::label_lines(const char* text) {
+  // when efax is running on more than one serial device its output is
+  // interleaved in the message window, so begin each line with the
+  // name of the device from which it came
+  std::string output;
+  for (; *text; ++text) {
+    if (at_line_start) {
+      output += label;
+      at_line_start = false;
+    }
+    output += *text;
+    if (*text == '\n') at_line_start = true;
+  }
+  return output;
+}
+
 void EfaxController::join_child(void) {
   // we do not need a mutex for this - join_child() and unjoin_child() are
   // only called in the initial (GUI) thread
 
+  at_line_start = true;
   iowatch_tag = start_iowatch(stdout_pipe.get_read_fd(),
 			      sigc::mem_fun(*this, &EfaxController::read_pipe_slot),
 			      G_IO_IN);
@@ -1028,27 +1314,24 @@ void EfaxController::unjoin_child(void) {
 
 void EfaxController::kill_child(void) {
   // it shouldn't be necessary to check whether the process group id of
-  // the process whose pid is in prog_config.efax_controller_child_pid
-  // is the same as efax-gtk (that is, prog_config.efax_controller_child_pid
-  // is not out of date) because it shouldn't happen - even if efax has ended
-  // we cannot have reaped its exit value yet if prog_config.efax_controller_child_pid
-  // is not 0 so it should still be a zombie in the process table, but for
-  // safety's sake let's just check it
-  if (prog_config.efax_controller_child_pid > 0
-      && getpgid(0) == getpgid(prog_config.efax_controller_child_pid)) {
-    kill(prog_config.efax_controller_child_pid, SIGTERM);
+  // the process whose pid is in child_pid is the same as efax-gtk (that
+  // is, child_pid is not out of date) because it shouldn't happen - even
+  // if efax has ended we cannot have reaped its exit value yet if
+  // child_pid is not 0 so it should still be a zombie in the process
+  // table, but for safety's sake let's just check it
+  if (child_pid > 0
+      && getpgid(0) == getpgid(child_pid)) {
+    kill(child_pid, SIGTERM);
     // one second delay
     g_usleep(1000000);
-    // now really make sure (we don't need to check
-    // prog_config.efax_controller_child_pid again in the
-    // implementation as at version 2.2.12 because the child exit
+    // now really make sure (we don't need to check child_pid again in
+    // the implementation as at version 2.2.12 because the child exit
     // handling is in this thread, via MainWindow::timer_event_handler()
-    // and EfaxController::timer_event() but we would need to check it
+    // and ModemPool::timer_event() but we would need to check it
     // again (and protect it with a mutex) if the program is modified
     // to put child exit handling in a signal handling thread waiting
-    // on sigwait() which resets the value of
-    // prog_config.efax_controller_child_pid)
-    kill(prog_config.efax_controller_child_pid, SIGKILL);
+    // on sigwait() which resets the value of child_pid)
+    kill(child_pid, SIGKILL);
   }
 }
 
@@ -1353,8 +1636,8 @@ bool EfaxController::is_receiving_fax(void) const {
 
   bool return_val = false;
 
-  std::string file_name(prog_config.working_dir);
-  file_name += "/faxin/current/current.001";
+  std::string file_name(receive_dirname());
+  file_name += "/current.001";
 
   struct stat statinfo;
   if (!stat(file_name.c_str(), &statinfo)) return_val = true;
@@ -30,9 +30,14 @@ COPYING distributed with the source files.
 struct Fax_item {
   std::vector<std::string> file_list;
   std::string number;
+  std::string password;
   bool is_socket_file;
 };
 
+// an EfaxController object runs efax on one serial device - the
+// ModemPool object (modem_pool.h) holds one for each device named in
+// efax-gtkrc and reaps the exit status of the efax processes for them
+
 class EfaxController: public sigc::trackable {
 
 public:
@@ -42,6 +47,11 @@ private:
   State state;
   bool close_down;
 
+  const Modem_device modem;
+  const std::string label;
+  bool at_line_start;
+  pid_t child_pid;
+
   int received_fax_count;
 
   SemSync fax_made_sem;
@@ -50,11 +60,18 @@ private:
 
   std::vector<std::string> sendfax_parms_vec;
   Fax_item last_fax_item_sent;
+  std::string receive_password;
 
   PipeFifo stdout_pipe;
   guint iowatch_tag;
   Utf8::Reassembler stdout_pipe_reassembler;
 
+  std::string receive_dirname(void) const;
+  std::string key_filename(void) const;
+  bool write_key_file(const std::string&) const;
+  void add_device_parms(std::vector<std::string>&) const;
+  std::string label_lines(const char*);
+
   void receive_cleanup(void);
   std::pair<std::string, std::string> save_received_fax(void);
   std::pair<std::string, std::string> save_sent_fax(void);
@@ -64,6 +81,9 @@ private:
   void cleanup_fax_send_fail(void);
   std::vector<std::string> state_messages;
   void make_fax_thread(void);
+  bool make_fax_pages(const std::string&, std::string::size_type, bool, int);
+  bool make_cover_pages(const std::string&, int);
+  bool enter_fax_pages(const std::string&);
   void init_sendfax_parms(void);
   std::pair<const char*, char* const*> get_sendfax_parms(void);
   void sendfax_slot(void);
@@ -72,8 +92,13 @@ private:
   void sendfax_impl(const Fax_item&, bool);
 
   std::pair<const char*, char* const*> get_gs_parms(const std::string&);
+  std::pair<const char*, char* const*> get_efix_parms(const std::string&, int);
+  bool is_efix_image(const std::string&) const;
+  bool is_pdf_file(const std::string&) const;
+  bool is_cover_file(const std::string&) const;
   std::pair<const char*, char* const*> get_receive_parms(int);
   void delete_parms(std::pair<const char*, char* const*>);
+  void receive(State);
 
   // we don't want to permit copies of this class
   EfaxController(const EfaxController&);
@@ -87,8 +112,12 @@ public:
   sigc::signal1<void, const char*> write_state;
   sigc::signal1<void, const std::string&> remove_from_socket_server_filelist;
 
-  void timer_event(void);
+  void child_exited(int);
+  pid_t get_child_pid(void) const {return child_pid;}
+  const Modem_device& get_modem(void) const {return modem;}
+  const Fax_item& get_fax_item(void) const {return last_fax_item_sent;}
   void display_state(void) {write_state(state_messages[state].c_str());}
+  const char* get_state_message(void) const {return state_messages[state].c_str();}
   int get_state(void) const {return state;}
   bool is_receiving_fax(void) const;
 
@@ -99,8 +128,13 @@ public:
 
   void efax_closedown(void);
   void sendfax(const Fax_item& fax_item) {sendfax_impl(fax_item, false);}
-  void receive(State);
-  EfaxController(void);
+  // password is the one with which efax decrypts faxes received on
+  // this line, until receive() is next called with another
+  void receive(State mode, const std::string& password) {receive_password = password; receive(mode);}
+
+  // if label_output is true, each line of efax output passed to
+  // stdout_message is preceded by the name of the serial device
+  EfaxController(const Modem_device&, bool label_output);
 };
 
 #endif
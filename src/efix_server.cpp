@@ -0,0 +1,213 @@
+/* Copyright (C) 2007 Chris Vine
+
+This program is distributed under the General Public Licence, version 2.
+For particulars of this and relevant disclaimers see the file
+COPYING distributed with the source files.
+
+*/
+
+#include <string>
+#include <cstring>
+#include <cstdlib>
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+
+#include "efix_server.h"
+
+#ifdef HAVE_STRINGSTREAM
+#include <sstream>
+#else
+#include <strstream>
+#endif
+
+#ifdef HAVE_STREAM_IMBUE
+#include <locale>
+#endif
+
+Thread::Mutex EfixServer::mutex;
+int EfixServer::sock_fd = -1;
+
+bool EfixServer::start(void) {
+  Thread::Mutex::Lock lock(mutex);
+  return start_impl();
+}
+
+// start_impl() must be called with the mutex locked
+bool EfixServer::start_impl(void) {
+
+  if (sock_fd != -1) return true;
+
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == -1) {
+    write_error("Cannot create socket pair for the efix server\n");
+    return false;
+  }
+  // our end must not be inherited by other programs we run, or the efix
+  // server would not see end of file when efax-gtk exits
+  fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+
+  // get the number of file descriptors to close in the child process
+  // before fork()ing, as sysconf() is not async-signal-safe
+  long max_fd = sysconf(_SC_OPEN_MAX);
+  if (max_fd < 0) max_fd = 256;
+
+  pid_t pid = fork();
+
+  if (pid == -1) {
+    write_error("Fork error - exiting\n");
+    std::exit(FORK_ERROR);
+  }
+
+  if (!pid) { // child process which will exec efix in server mode
+
+    // unblock signals as these may be blocked for the thread
+    // creating the child process with the fork() call
+    sigset_t sig_mask;
+    sigemptyset(&sig_mask);
+    sigaddset(&sig_mask, SIGCHLD);
+    sigaddset(&sig_mask, SIGQUIT);
+    sigaddset(&sig_mask, SIGTERM);
+    sigaddset(&sig_mask, SIGINT);
+    sigaddset(&sig_mask, SIGHUP);
+    sigprocmask(SIG_UNBLOCK, &sig_mask, 0);
+
+    connect_to_stderr();
+
+    // the efix server is long lived, so it must not hold open the
+    // pipes and files of other processes started by efax-gtk (a
+    // pipe whose write end it held would never see end of file)
+    dup2(fds[1], 0);
+    for (long fd = 3; fd < max_fd; ++fd) ::close(fd);
+
+    execlp("efix-0.9a", "efix-0.9a", "-v", "", "-S", "-", static_cast<char*>(0));
+
+    // if we reached this point, then the execlp() call must have failed
+    // report error and then end process - use _exit(), not exit()
+    write_error("Can't find the efix-0.9a program - please check your installation\n"
+		"and the PATH environmental variable\n");
+    _exit(0);
+  }
+
+  // this is the parent process
+  while (::close(fds[1]) == -1 && errno == EINTR);
+  sock_fd = fds[0];
+  return true;
+}
+
+// send_request() must be called with the mutex locked.  It returns
+// false if the request could not be sent
+bool EfixServer::send_request(char* const* efix_parms, int out_fd) {
+
+  // a request is the argument count followed by the arguments (not
+  // including the program name), each terminated by a NUL character
+  std::string request;
+  int count = 0;
+  for (char* const* temp_pp = efix_parms + 1; *temp_pp; ++temp_pp, ++count) {
+    request += *temp_pp;
+    request += '\0';
+  }
+
+#ifdef HAVE_STRINGSTREAM
+  std::ostringstream strm;
+#  ifdef HAVE_STREAM_IMBUE
+  strm.imbue(std::locale::classic());
+#  endif // HAVE_STREAM_IMBUE
+  strm << count;
+  request.insert(0, strm.str() + '\0');
+#else
+  std::ostrstream strm;
+#  ifdef HAVE_STREAM_IMBUE
+  strm.imbue(std::locale::classic());
+#  endif // HAVE_STREAM_IMBUE
+  strm << count << std::ends;
+  const char* count_str = strm.str();
+  request.insert(0, count_str, std::strlen(count_str) + 1);
+  delete[] count_str;
+#endif
+
+  // pass out_fd with the first part of the request
+  union {
+    cmsghdr align;
+    char buf[CMSG_SPACE(sizeof(int))];
+  } control;
+  msghdr message;
+  iovec vec;
+  std::memset(&message, 0, sizeof(message));
+  vec.iov_base = const_cast<char*>(request.data());
+  vec.iov_len = request.size();
+  message.msg_iov = &vec;
+  message.msg_iovlen = 1;
+  message.msg_control = control.buf;
+  message.msg_controllen = sizeof(control.buf);
+  cmsghdr* cmsg_p = CMSG_FIRSTHDR(&message);
+  cmsg_p->cmsg_level = SOL_SOCKET;
+  cmsg_p->cmsg_type = SCM_RIGHTS;
+  cmsg_p->cmsg_len = CMSG_LEN(sizeof(int));
+  std::memcpy(CMSG_DATA(cmsg_p), &out_fd, sizeof(int));
+
+  ssize_t result;
+  while ((result = sendmsg(sock_fd, &message, 0)) == -1 && errno == EINTR);
+  if (result == -1) return false;
+
+  // send any remainder without the file descriptor
+  std::string::size_type sent = result;
+  while (sent < request.size()) {
+    result = ::write(sock_fd, request.data() + sent, request.size() - sent);
+    if (result == -1 && errno != EINTR) return false;
+    if (result > 0) sent += result;
+  }
+  return true;
+}
+
+// read_reply() must be called with the mutex locked.  It returns
+// the efix exit status, or -1 if no reply could be read
+int EfixServer::read_reply(void) {
+
+  // the reply is one line, "<status> <pages>\n"
+  std::string reply;
+  char letter;
+  ssize_t result;
+  while ((result = ::read(sock_fd, &letter, 1)) == 1 || (result == -1 && errno == EINTR)) {
+    if (result == 1) {
+      if (letter == '\n') return std::atoi(reply.c_str());
+      reply += letter;
+    }
+  }
+  return -1;
+}
+
+int EfixServer::convert(char* const* efix_parms, int out_fd) {
+
+  Thread::Mutex::Lock lock(mutex);
+
+  if (!start_impl()) return -1;
+
+  bool sent = send_request(efix_parms, out_fd);
+  if (!sent) {
+    // the efix process has probably died - start another one and retry once
+    while (::close(sock_fd) == -1 && errno == EINTR);
+    sock_fd = -1;
+    if (!start_impl()) return -1;
+    sent = send_request(efix_parms, out_fd);
+  }
+
+  int status = -1;
+  if (sent) status = read_reply();
+
+  if (status == -1) {
+    // efix has gone away - output may already have been written to
+    // out_fd, so report the error rather than have the caller retry
+    write_error("The efix server has failed\n");
+    while (::close(sock_fd) == -1 && errno == EINTR);
+    sock_fd = -1;
+    if (!sent) return -1;
+    status = 2;
+  }
+  return status;
+}
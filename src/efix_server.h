@@ -0,0 +1,53 @@
+/* Copyright (C) 2007 Chris Vine
+
+This program is distributed under the General Public Licence, version 2.
+For particulars of this and relevant disclaimers see the file
+COPYING distributed with the source files.
+
+*/
+
+#ifndef EFIX_SERVER_H
+#define EFIX_SERVER_H
+
+#include "prog_defs.h"
+
+#include "utils/mutex.h"
+
+// EfixServer keeps one efix process running in server mode
+// ("efix-0.9a -S -") so that faxes can be converted for viewing and
+// printing without starting a new efix process and rebuilding its
+// tables for every conversion.  The efix process reads requests on a
+// socket pair connected to its standard input, and ends when
+// efax-gtk closes its end of the socket pair (that is, when
+// efax-gtk exits).  All members are static and may be called in any
+// thread - requests are serialised by a mutex, and the efix process
+// is started (or restarted, if it has died) when first needed.
+
+class EfixServer {
+  static Thread::Mutex mutex;
+  static int sock_fd;
+
+  static bool start_impl(void);
+  static bool send_request(char* const*, int);
+  static int read_reply(void);
+
+  // this class is not to be instantiated
+  EfixServer(void);
+public:
+  // start the efix process now, if it is not already running, so that
+  // it is warm when the first fax is viewed or printed.  It returns
+  // false if the process cannot be started
+  static bool start(void);
+
+  // convert with efix: efix_parms is the null terminated argument
+  // vector which would be passed to execvp() to run efix (the program
+  // name in efix_parms[0] is ignored), and the output is written to
+  // out_fd, which remains owned by the caller.  It returns the efix
+  // exit status, or -1 if the request could not be made, in which
+  // case nothing has been written to out_fd and the caller should run
+  // efix itself.  If out_fd is a pipe, something must read from it
+  // while this method is waiting for the conversion to finish
+  static int convert(char* const* efix_parms, int out_fd);
+};
+
+#endif
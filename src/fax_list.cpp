@@ -55,6 +55,7 @@ COPYING distributed with the source files.
 #include <glib/gtimer.h>
 
 #include "fax_list.h"
+#include "efix_server.h"
 #include "dialogs.h"
 #include "fax_list_icons.h"
 #include "utils/thread.h"
@@ -149,6 +150,10 @@ FaxListDialog::FaxListDialog(FaxListEnum::Mode mode_, const int standard_size_):
   if (mode == FaxListEnum::received) is_fax_received_list++;
   else is_fax_sent_list++;
 
+  // start the efix server now (if it is not already running), so that
+  // it is ready when a fax is first viewed or printed
+  EfixServer::start();
+
   close_button_p = gtk_button_new_from_stock(GTK_STOCK_CLOSE);
   print_button_p = gtk_button_new();
   view_button_p = gtk_button_new();
@@ -589,11 +594,9 @@ void FaxListDialog::print_fax_prompt(void) {
 #else
     if (prog_config.print_popup) {
 #endif      
-      std::string msg(gettext("Print selected fax?"));
-      PromptDialog* dialog_p = new PromptDialog(msg.c_str(), gettext("efax-gtk: Print fax"),
-						standard_size, get_win());
-      dialog_p->accepted.connect(sigc::mem_fun(*this, &FaxListDialog::print_fax));
-      // there is no memory leak -- the memory will be deleted when PromptDialog closes
+      PrintPagesDialog* dialog_p = new PrintPagesDialog(standard_size, get_win());
+      dialog_p->accepted.connect(sigc::mem_fun(*this, &FaxListDialog::print_fax_pages));
+      // there is no memory leak -- the memory will be deleted when PrintPagesDialog closes
     }
     else print_fax();
   }
@@ -662,7 +665,8 @@ std::pair<const char*, char* const*> FaxListDialog::get_print_from_stdin_parms(v
 }
 
 std::pair<const char*, char* const*> FaxListDialog::get_fax_to_ps_parms
-                                       (const std::string& basename, bool allow_shrink) {
+                                       (const std::string& basename, bool allow_shrink,
+					const std::string& pages) {
 
   // set up the parms for efix
   std::vector<std::string> efix_parms;
@@ -675,20 +679,33 @@ std::pair<const char*, char* const*> FaxListDialog::get_fax_to_ps_parms
     Thread::Mutex::Lock lock(*prog_config.mutex_p);
 
     efix_parms.push_back("efix-0.9a");
-    // shut up efix (comment out next line and uncomment following one if errors to be reported)
+    // shut up efix with an empty message level (comment out next two lines and
+    // uncomment following one if errors to be reported) - -v always takes an
+    // argument, so it must not be followed directly by another option
     efix_parms.push_back("-v");
+    efix_parms.push_back("");
     //efix_parms.push_back("-ve");
-    efix_parms.push_back("-r300");
-    efix_parms.push_back("-ops");
+    // Level 2 postscript carries the fax data itself and leaves the scaling
+    // to the printer or viewer, so there is no need to resample to 300 dpi
+    efix_parms.push_back("-ops2");
     temp = "-p";
     temp += prog_config.page_dim;
     efix_parms.push_back(temp);
+    // efix locates the other pages from the file headers without
+    // decoding them
+    if (!pages.empty()) {
+      efix_parms.push_back("-P");
+      efix_parms.push_back(pages);
+    }
 
 #ifdef HAVE_STRINGSTREAM
     if (allow_shrink && prog_config.print_shrink.compare("100")) { // if print_shrink is not 100
       temp = "-s0.";
       temp += prog_config.print_shrink;
       efix_parms.push_back(temp);
+      // filter rather than drop pixels and lines, so that thin strokes
+      // in the fax survive the shrinking
+      efix_parms.push_back("-qfilter");
 
       std::ostringstream strm;
 
@@ -756,6 +773,9 @@ std::pair<const char*, char* const*> FaxListDialog::get_fax_to_ps_parms
       temp = "-s0.";
       temp += prog_config.print_shrink;
       efix_parms.push_back(temp);
+      // filter rather than drop pixels and lines, so that thin strokes
+      // in the fax survive the shrinking
+      efix_parms.push_back("-qfilter");
 
       std::ostrstream strm;
 
@@ -872,6 +892,45 @@ void FaxListDialog::write_pipe_to_file(PipeFifo* pipe_p, int file_fd) {
   g_usleep(50000);
 }
 
+void FaxListDialog::write_ps_to_file(std::pair<const char*, char* const*> fax_to_ps_parms,
+				     int file_fd) {
+
+  // have the resident efix server write the postscript straight to the
+  // file - if it cannot be used, fall back to running efix ourselves
+  if (EfixServer::convert(fax_to_ps_parms.second, file_fd) != -1) return;
+
+  // now create a pipe and proceed to fork to write the postscript to file
+  PipeFifo fork_pipe(PipeFifo::block);
+
+  // now fork to create the process which will write postscript to stdout
+  pid_t pid = fork();
+
+  if (pid == -1) {
+    write_error("Fork error - exiting\n");
+    std::exit(FORK_ERROR);
+  }
+    
+  if (!pid) { // child process which will send postscript to stdout
+  
+    // this is the child process to write to stdin
+    // now we have fork()ed we can connect to stderr
+    connect_to_stderr();
+
+    fork_pipe.connect_to_stdout();
+    execvp(fax_to_ps_parms.first, fax_to_ps_parms.second);
+
+    // if we reached this point, then the execvp() call must have failed
+    // report error and then end process - use _exit(), not exit()
+    write_error("Can't find the efix-0.9a program - please check your installation\n"
+		"and the PATH environmental variable\n");
+    _exit(0);
+  }
+
+  // now write from the pipe (containing the generated PS text) to file
+  fork_pipe.make_readonly();
+  write_pipe_to_file(&fork_pipe, file_fd);
+}
+
 std::pair<const char*, char* const*> FaxListDialog::get_ps_viewer_parms(const char* filename) {
 
   std::vector<std::string> view_parms;
@@ -937,12 +996,37 @@ std::pair<const char*, char* const*> FaxListDialog::get_ps_viewer_parms(const ch
 }
 
 void FaxListDialog::print_fax(void) {
+  print_fax_pages("");
+}
+
+void FaxListDialog::print_fax_pages(const std::string& pages) {
+
+  // pages is empty or "all" to print every page, or else a list of
+  // page numbers and ranges such as "1-3,5" which is passed to efix
+  std::string page_list;
+  if (pages.compare("all") && pages.compare(gettext("all"))) {
+    std::string::const_iterator iter;
+    for (iter = pages.begin(); iter != pages.end(); ++iter) {
+      if ((*iter >= '0' && *iter <= '9') || *iter == '-' || *iter == ',') page_list += *iter;
+      else if (*iter != ' ') {
+	new InfoDialog(gettext("Give the pages to print as page numbers or ranges\n"
+			       "separated by commas, for example 1-3,5"),
+		       gettext("efax-gtk: Print fax"),
+		       GTK_MESSAGE_WARNING,
+		       get_win());
+	// there is no memory leak -- the memory will be deleted when InfoDialog closes
+	return;
+      }
+    }
+  }
 
   if (fax_list_manager.is_fax_selected() == 1 && !prog_config.print_cmd.empty()) {
 
-    std::auto_ptr<std::string> fax_basename_a(new std::string(prog_config.working_dir));
-    if (mode == FaxListEnum::received) *fax_basename_a += "/faxin/";
-    else *fax_basename_a += "/faxsent/";
+    std::auto_ptr<std::pair<std::string, std::string> >
+      print_job_a(new std::pair<std::string, std::string>(prog_config.working_dir, page_list));
+    std::string* fax_basename_p = &print_job_a->first;
+    if (mode == FaxListEnum::received) *fax_basename_p += "/faxin/";
+    else *fax_basename_p += "/faxsent/";
 
     // we don't need to use a Glib conversion function here - we know the
     // fax name is just plain ASCII numbers
@@ -951,10 +1035,10 @@ void FaxListDialog::print_fax(void) {
     // as we checked for a fax selection, fax_number_h should not be
     // null, but check it in case
     if (fax_number_h.get()) fax_number = fax_number_h.get();
-    *fax_basename_a += fax_number;
-    *fax_basename_a += '/';
-    *fax_basename_a += fax_number;
-    *fax_basename_a += '.';
+    *fax_basename_p += fax_number;
+    *fax_basename_p += '/';
+    *fax_basename_p += fax_number;
+    *fax_basename_p += '.';
 
     // create the print manager
 #if GTK_CHECK_VERSION(2,10,0)
@@ -976,14 +1060,14 @@ void FaxListDialog::print_fax(void) {
     sigaddset(&sig_mask, SIGHUP);
     pthread_sigmask(SIG_BLOCK, &sig_mask, 0);
 
-    // hand ownership of fax_basename_a to the new thread - Thread::Thread::start()
+    // hand ownership of print_job_a to the new thread - Thread::Thread::start()
     // could throw in the event of memory allocation failure, as could the creation of
     // the Callback2 object on free store, but as a matter of policy we do not deal
     // with that condition in this program so we can pass a raw pointer rather than
     // the std::auto_ptr<> object - anyway passing a std::auto_ptr<> object wouldn't
     // be enough as we would still have to catch the std::bad_alloc exception in
     // order to pop() off the object in async_queue
-    std::string* arg_p = fax_basename_a.release();
+    std::pair<std::string, std::string>* arg_p = print_job_a.release();
     std::auto_ptr<Thread::Thread> res =
       Thread::Thread::start(Callback::make(*this, &FaxListDialog::print_fax_thread,
 					   arg_p, prog_config.gtkprint),
@@ -1013,10 +1097,11 @@ void FaxListDialog::print_fax(void) {
   }
 }
 
-void FaxListDialog::print_fax_thread(std::string* arg_p, bool use_gtkprint) {
+void FaxListDialog::print_fax_thread(std::pair<std::string, std::string>* arg_p,
+				     bool use_gtkprint) {
 
-  // extract the string argument to a std::auto_ptr<> object
-  const std::auto_ptr<std::string> fax_basename_a(arg_p);
+  // extract the fax basename and page list argument to a std::auto_ptr<> object
+  const std::auto_ptr<std::pair<std::string, std::string> > print_job_a(arg_p);
 
   // extract any FilePrintManager object
 #if GTK_CHECK_VERSION(2,10,0)
@@ -1035,7 +1120,8 @@ void FaxListDialog::print_fax_thread(std::string* arg_p, bool use_gtkprint) {
   // get the arguments for the exec() calls below (because this is a
   // multi- threaded program, we must do this before fork()ing because
   // we use functions to get the arguments which are not async-signal-safe)
-  std::pair<const char*, char* const*> fax_to_ps_parms(get_fax_to_ps_parms(*fax_basename_a, true));
+  std::pair<const char*, char* const*> fax_to_ps_parms(get_fax_to_ps_parms(print_job_a->first, true,
+										   print_job_a->second));
 
 #if GTK_CHECK_VERSION(2,10,0)
   if (use_gtkprint) {
@@ -1055,52 +1141,85 @@ void FaxListDialog::print_fax_thread(std::string* arg_p, bool use_gtkprint) {
 
     if (file_fd == -1) {
       write_error("Failed to make temporary file for printing");
+      delete_parms(fax_to_ps_parms);
       return;
     }
 
-    // now create a pipe and proceed to fork to write the postscript to temporary file
+    // write the postscript to the temporary file
+    write_ps_to_file(fax_to_ps_parms, file_fd);
+    while (::close(file_fd) == -1 && errno == EINTR);
+
+    print_manager_i->set_filename(tempfile_h.get());
+    print_manager_i->print(); // this will pass ownership to the FilePrintManager object
+                              // which will control its own destiny now, via the GTK+
+                              // print system
+  }
+  else {
+#endif
+
+  std::pair<const char*, char* const*> print_from_stdin_parms(get_print_from_stdin_parms());
+  if (print_from_stdin_parms.first && EfixServer::start()) {
+
+    // the resident efix server will write the postscript to a pipe
+    // read by the print program
+    bool print_popup;
+    {
+      Thread::Mutex::Lock lock(*prog_config.mutex_p);
+      print_popup = prog_config.print_popup;
+    }
     PipeFifo fork_pipe(PipeFifo::block);
 
-    // now fork to create the process which will write postscript to stdout
     pid_t pid = fork();
 
     if (pid == -1) {
       write_error("Fork error - exiting\n");
       std::exit(FORK_ERROR);
     }
-  
-    if (!pid) { // child process which will send postscript to stdout
-  
-      // this is the child process to write to stdin
-      // now we have fork()ed we can connect to stderr
-      connect_to_stderr();
+    if (!pid) { // process to exec to print_from_stdin()
 
-      fork_pipe.connect_to_stdout();
-      execvp(fax_to_ps_parms.first, fax_to_ps_parms.second);
+      // see the comments on connect_to_stderr() for the child print
+      // process below
+      if (print_popup) connect_to_stderr();
 
+      fork_pipe.connect_to_stdin();
+      execvp(print_from_stdin_parms.first, print_from_stdin_parms.second);
       // if we reached this point, then the execvp() call must have failed
-      // report error and then end process - use _exit(), not exit()
-      write_error("Can't find the efix-0.9a program - please check your installation\n"
+      // write error and then end process - use _exit(), not exit()
+      write_error("Can't find the print program - please check your installation\n"
 		  "and the PATH environmental variable\n");
       _exit(0);
     }
 
-    // write from the pipe (containing the generated PS text) to file
-    fork_pipe.make_readonly();
-    write_pipe_to_file(&fork_pipe, file_fd);
-    while (::close(file_fd) == -1 && errno == EINTR);
+    fork_pipe.make_writeonly();
+    if (EfixServer::convert(fax_to_ps_parms.second, fork_pipe.get_write_fd()) == -1) {
 
-    print_manager_i->set_filename(tempfile_h.get());
-    print_manager_i->print(); // this will pass ownership to the FilePrintManager object
-                              // which will control its own destiny now, via the GTK+
-                              // print system
-  }
-  else {
-#endif
+      // the efix server has failed, so run efix ourselves to write to the pipe
+      pid = fork();
 
-  std::pair<const char*, char* const*> print_from_stdin_parms(get_print_from_stdin_parms());
-  if (print_from_stdin_parms.first) { // this will be 0 if get_print_from_stdin_parms()
-                                      // threw a Utf8::ConversionError)
+      if (pid == -1) {
+	write_error("Fork error - exiting\n");
+	std::exit(FORK_ERROR);
+      }
+      if (!pid) { // process which will send postscript to stdout
+
+	if (print_popup) connect_to_stderr();
+
+	fork_pipe.connect_to_stdout();
+	execvp(fax_to_ps_parms.first, fax_to_ps_parms.second);
+
+	// if we reached this point, then the execvp() call must have failed
+	// report error and then end process - use _exit(), not exit()
+	write_error("Can't find the efix-0.9a program - please check your installation\n"
+		    "and the PATH environmental variable\n");
+	_exit(0);
+      }
+    }
+    // closing the pipe lets the print program see the end of the postscript
+    fork_pipe.close();
+    delete_parms(print_from_stdin_parms);
+  }
+  else if (print_from_stdin_parms.first) { // this will be 0 if get_print_from_stdin_parms()
+                                           // threw a Utf8::ConversionError)
 
     // now launch a new process to control the printing process
     // the main program process needs to continue while the printing
@@ -1261,49 +1380,15 @@ void FaxListDialog::view_fax_thread(std::string* fax_basename_p,
   const std::auto_ptr<std::string> fax_basename_a(fax_basename_p);
   const std::auto_ptr<std::string> filename_a(file_pair.first);
 
-  // now create a pipe and proceed to fork to write the postscript to temporary file
-  PipeFifo fork_pipe(PipeFifo::block);
-
-  // get the arguments for the exec() call to convert the fax files to
-  // PS format following the next fork() call (because this is a multi-
-  // threaded program, we must do this before fork()ing because we use
-  // functions to get the arguments which are not async-signal-safe)
-  std::pair<const char*, char* const*> fax_to_ps_parms(get_fax_to_ps_parms(*fax_basename_a, false));
+  // get the arguments to convert the fax files to PS format (because
+  // this is a multi-threaded program, we must do this before any fork()
+  // because we use functions to get the arguments which are not
+  // async-signal-safe)
+  std::pair<const char*, char* const*> fax_to_ps_parms(get_fax_to_ps_parms(*fax_basename_a, false, ""));
 
-  // now fork to create the process which will write postscript to stdout
-  pid_t pid = fork();
-
-  if (pid == -1) {
-    write_error("Fork error - exiting\n");
-    std::exit(FORK_ERROR);
-  }
-    
-  if (!pid) { // child process which will send postscript to stdout
-  
-    // this is the child process to write to stdin
-    // now we have fork()ed we can connect to stderr
-    connect_to_stderr();
-
-    fork_pipe.connect_to_stdout();
-    execvp(fax_to_ps_parms.first, fax_to_ps_parms.second);
-
-    // if we reached this point, then the execvp() call must have failed
-    // report error and then end process - use _exit(), not exit()
-    write_error("Can't find the efix-0.9a program - please check your installation\n"
-		"and the PATH environmental variable\n");
-    _exit(0);
-  }
-  // this is the parent process,
-
-  // first, release the memory allocated on the heap for
-  // the redundant fax_to_ps_parms
-  // we are in the main parent process here - no worries about
-  // only being able to use async-signal-safe functions
+  // write the postscript to the temporary file
+  write_ps_to_file(fax_to_ps_parms, file_pair.second);
   delete_parms(fax_to_ps_parms);
-    
-  // now write from the pipe (containing the generated PS text) to file
-  fork_pipe.make_readonly();
-  write_pipe_to_file(&fork_pipe, file_pair.second);
   while (::close(file_pair.second) == -1 && errno == EINTR);
 
   // the temporary file to be viewed has now been created
@@ -1320,7 +1405,7 @@ void FaxListDialog::view_fax_thread(std::string* fax_basename_p,
   if (ps_viewer_parms.first) { // this will be 0 if get_ps_viewer_parms()
                                // threw a Utf8::ConversionError)
     
-    pid = fork();
+    pid_t pid = fork();
     
     if (pid == -1) {
       write_error("Fork error\n");
@@ -1536,3 +1621,12 @@ AddFolderDialog::AddFolderDialog(const int standard_size,
 					  "level and can be drag-and-dropped\n"
 					  "into other folders)"),
 				  parent_p) {}
+
+PrintPagesDialog::PrintPagesDialog(const int standard_size,
+				   GtkWindow* parent_p):
+                      EntryDialog(standard_size,
+				  gettext("all"),
+				  gettext("efax-gtk: Print fax"),
+				  gettext("Print which pages of the selected fax?\n"
+					  "(for example 1-3,5 or all)"),
+				  parent_p) {}
@@ -80,12 +80,15 @@ class FaxListDialog: public sigc::trackable, public WinBase {
   void empty_trash_prompt(void);
   void delete_folder_prompt(void);
   void write_pipe_to_file(PipeFifo*, int);
+  void write_ps_to_file(std::pair<const char*, char* const*>, int);
   std::pair<const char*, char* const*> get_print_from_stdin_parms(void);
-  std::pair<const char*, char* const*> get_fax_to_ps_parms(const std::string&, bool);
+  std::pair<const char*, char* const*> get_fax_to_ps_parms(const std::string&, bool,
+							  const std::string&);
   std::pair<const char*, char* const*> get_ps_viewer_parms(const char*);
   void print_fax_prompt(void);
   void print_fax(void);
-  void print_fax_thread(std::string*, bool);
+  void print_fax_pages(const std::string&);
+  void print_fax_thread(std::pair<std::string, std::string>*, bool);
   void view_fax(void);
   void view_fax_thread(std::string*, std::pair<std::string*, int>);
   void delete_parms(std::pair<const char*, char* const*>);
@@ -150,4 +153,10 @@ public:
   AddFolderDialog(const int standard_size, GtkWindow* parent_p);
 };
 
+class PrintPagesDialog: public EntryDialog {
+
+public:
+  PrintPagesDialog(const int standard_size, GtkWindow* parent_p);
+};
+
 #endif
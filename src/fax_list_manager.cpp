@@ -611,16 +611,17 @@ void FaxListManager::populate_fax_list(void) {
 	  && std::strcmp(direntry->d_name, ".")
 	  && std::strcmp(direntry->d_name, "..")
 	  && (mode == FaxListEnum::sent
-	      || std::strcmp(direntry->d_name, "current"))) {
-	// checking for "current" will prevent double entries if completion of a received
+	      || std::strncmp(direntry->d_name, "current", std::strlen("current")))) {
+	// checking for "current" (and "current-2" etc. used for the second and subsequent
+	// serial devices) will prevent double entries if completion of a received
 	// fax occurs while we are scanning the faxin directory - it is transferred to its
-	// own directory in the EfaxController::timer_event() callback and that callback
+	// own directory in the ModemPool::timer_event() callback and that callback
 	// cannot be invoked until this method has returned (note also the checks for
 	// FaxListManager::is_fax_received_list_main_iteration() and
-	// FaxListManager::is_fax_sent_list_main_iteration() in EfaxController::timer_event())
+	// FaxListManager::is_fax_sent_list_main_iteration() in ModemPool::timer_event())
 	// likewise a completed sent fax will not be stored in a directory in the faxsent
 	// directory (if we are scanning that directory) until that is done via
-	// EfaxController::timer_event()
+	// ModemPool::timer_event()
 
 	std::string fax_name(direntry->d_name);
 
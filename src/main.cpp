@@ -133,6 +133,7 @@ int mkdir_with_parent(const std::string&);
 bool is_arg(const char*, int, char*[]);
 extern "C" void atexit_cleanup(void);
 void clean_up_receive_dir(void);
+void clean_up_receive_dir(const std::string&);
 bool is_ascii(const std::string&);
 int is_in_process_table(pid_t);
 char passp[50];
@@ -401,7 +402,7 @@ std::string configure_prog(bool reread) {
 
     // if we are re-reading efax-gtkrc, we need to clear the old settings
     if (reread) {
-      prog_config.lock_file = "";
+      prog_config.modems.clear();
       prog_config.my_name = "";
       prog_config.my_number = "";
       prog_config.parms.clear();
@@ -417,14 +418,13 @@ std::string configure_prog(bool reread) {
       prog_config.logfile_name = "";
       prog_config.permitted_clients_list.clear();
     }
-    // if we are setting up for first time, initialise prog_config.efax_controller_child_pid;
-    else prog_config.efax_controller_child_pid = 0;
 
 // now extract settings from file
 
     std::string file_read;
     std::string device;
     std::string lock_file;
+    std::string standby_lines;
     std::string modem_class;
     std::string rings;
     std::string dialmode;
@@ -463,6 +463,9 @@ std::string configure_prog(bool reread) {
 	else if (get_prog_parm("LOCK:", file_read, lock_file,
 			       Utf8::filename_to_utf8));
 
+	// look for "STANDBY_LINES:"
+	else if (get_prog_parm("STANDBY_LINES:", file_read, standby_lines));
+
 	// look for "CLASS:"
 	else if (get_prog_parm("CLASS:", file_read, modem_class));
 
@@ -650,42 +653,88 @@ std::string configure_prog(bool reread) {
     }
 
     if (!device.empty()) {
-      std::string locale_device;
-      try {
-	locale_device = Utf8::locale_from_utf8(device);
-      }
-      catch (Utf8::ConversionError&) {
-	write_error("UTF-8 conversion error in configure_prog() - device\n");
+      std::string lock_dir;
+      if (lock_file.empty()) lock_dir = "/var/lock";
+      else {
+	try {
+	  lock_dir = Utf8::filename_from_utf8(lock_file);
+	}
+	catch (Utf8::ConversionError&) {
+	  write_error("UTF-8 conversion error in configure_prog() - lock file\n");
+	  write_error("Defaulting to /var/lock\n");
+	  lock_dir = "/var/lock";
+	}
       }
 
-      if (!locale_device.empty()) {
-	if (lock_file.empty()) {
-	  prog_config.lock_file = "/var/lock";
+      // DEVICE: may name more than one serial device, separated by
+      // white space - efax-gtk then runs a separate efax session on each
+      std::string::size_type start = device.find_first_not_of(" \t");
+      std::string::size_type end;
+      while (start != std::string::npos) {
+	Modem_device modem;
+	end = device.find_first_of(" \t", start);
+	if (end != std::string::npos) {
+	  modem.name.assign(device, start, end - start);
+	  start = device.find_first_not_of(" \t", end); // prepare for the next iteration
 	}
 	else {
-	  try {
-	    prog_config.lock_file = Utf8::filename_from_utf8(lock_file);
-	  }
-	  catch (Utf8::ConversionError&) {
-	    write_error("UTF-8 conversion error in configure_prog() - lock file\n");
-	    write_error("Defaulting to /var/lock\n");
-	    prog_config.lock_file = "/var/lock";
+	  modem.name.assign(device, start, device.size() - start);
+	  start = end;
+	}
+
+	std::string locale_device;
+	try {
+	  locale_device = Utf8::locale_from_utf8(modem.name);
+	}
+	catch (Utf8::ConversionError&) {
+	  write_error("UTF-8 conversion error in configure_prog() - device\n");
+	}
+
+	if (!locale_device.empty()) {
+	  modem.device_path = "/dev/";
+	  modem.device_path += locale_device;
+
+	  modem.lock_file = lock_dir;
+	  modem.lock_file += "/LCK..";
+	  temp = modem.name;
+	  // replace any '/' characters with '_' character
+	  std::replace(temp.begin(), temp.end(), '/', '_');
+	  modem.lock_file += temp;
+
+	  // efax puts a fax being received into the faxin/current directory -
+	  // the second and subsequent devices use faxin/current-2 and so on
+	  modem.receive_dir = "current";
+	  if (!prog_config.modems.empty()) {
+#ifdef HAVE_STRINGSTREAM
+	    std::ostringstream strm;
+#  ifdef HAVE_STREAM_IMBUE
+	    strm.imbue(std::locale::classic());
+#  endif // HAVE_STREAM_IMBUE
+	    strm << '-' << prog_config.modems.size() + 1;
+	    modem.receive_dir += strm.str();
+#else
+	    std::ostrstream strm;
+#  ifdef HAVE_STREAM_IMBUE
+	    strm.imbue(std::locale::classic());
+#  endif // HAVE_STREAM_IMBUE
+	    strm << '-' << prog_config.modems.size() + 1 << std::ends;
+	    const char* suffix = strm.str();
+	    modem.receive_dir += suffix;
+	    delete[] suffix;
+#endif
 	  }
+	  prog_config.modems.push_back(modem);
 	}
-	
-	prog_config.lock_file += "/LCK..";
-	temp = device;
-	// replace any '/' characters with '_' character
-	std::replace(temp.begin(), temp.end(), '/', '_');
-	prog_config.lock_file += temp;
-	
-	temp = "-d/dev/";
-	temp += locale_device;
-	prog_config.parms.push_back(temp);
+      }
+    }
 
-	temp = "-x";
-	temp += prog_config.lock_file;
-	prog_config.parms.push_back(temp);
+    if (standby_lines.empty()) prog_config.standby_lines = 1;
+    else {
+      prog_config.standby_lines = std::atoi(standby_lines.c_str());
+      if (prog_config.standby_lines < 1) {
+	return_val += gettext("Invalid number of standby lines specified\n"
+			      "Will keep one line free to receive faxes\n");
+	prog_config.standby_lines = 1;
       }
     }
 
@@ -1257,9 +1306,21 @@ void atexit_cleanup(void) {
 
 void clean_up_receive_dir(void) {
 
+  // there is a receive directory for each serial device - the first is
+  // always faxin/current, so check that even if no device is configured
+  clean_up_receive_dir("current");
+  std::vector<Modem_device>::const_iterator iter;
+  for (iter = prog_config.modems.begin(); iter != prog_config.modems.end(); ++iter) {
+    if (iter->receive_dir.compare("current")) clean_up_receive_dir(iter->receive_dir);
+  }
+}
+
+void clean_up_receive_dir(const std::string& receive_dir) {
+
   if (!prog_config.working_dir.empty()) {
     std::string full_dirname(prog_config.working_dir);
-    full_dirname += "/faxin/current";
+    full_dirname += "/faxin/";
+    full_dirname += receive_dir;
     int result = rmdir(full_dirname.c_str());
     if (result == -1 && errno == ENOTEMPTY) { // we must be in the middle of receiving a fax
                                               // when the program ended - save what we can
@@ -1311,7 +1372,8 @@ void clean_up_receive_dir(void) {
 	new_dirname += faxname;
 
 	std::string old_dirname(prog_config.working_dir);
-	old_dirname += "/faxin/current";
+	old_dirname += "/faxin/";
+	old_dirname += receive_dir;
 
 	std::vector<std::string> filelist;
 	struct dirent* direntry;
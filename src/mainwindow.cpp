@@ -168,7 +168,7 @@ void MainWindowCB::mainwin_button_clicked(GtkWidget* widget_p, void* data) {
     instance_p->receive_impl(EfaxController::receive_standby);
   }
   else if (widget_p == instance_p->stop_button_p) {
-    instance_p->efax_controller.stop();
+    instance_p->modem_pool.stop();
   }
   else {
     write_error("Callback error in MainWindowCB::mainwin_button_clicked()\n");
@@ -271,7 +271,7 @@ gboolean MainWindowCB::mainwin_timer_event(void* data) {
                               // so we need an orderly close down
     close_flag = false;
   }
-  instance_p->efax_controller.timer_event();
+  instance_p->modem_pool.timer_event();
   return true; // we want a multi-shot timer
 }
 
@@ -326,7 +326,7 @@ MainWindow::MainWindow(const std::string& messages,bool start_hidden,
 
   // we don't need to set a child signal handler - the default
   // (SIG_DFL) is fine - we want to ignore it as we will reap
-  // exit status in EfaxController::timer_event(), which calls
+  // exit status in ModemPool::timer_event(), which calls
   // waitpid()
 
   write_error_mutex_p = new Thread::Mutex;
@@ -758,11 +758,11 @@ MainWindow::MainWindow(const std::string& messages,bool start_hidden,
 		   G_CALLBACK(MainWindowCB::mainwin_drawing_area_expose_event),
 		   this);
 
-  efax_controller.ready_to_quit_notify.connect(sigc::mem_fun(*this, &MainWindow::quit_slot));
+  modem_pool.ready_to_quit_notify.connect(sigc::mem_fun(*this, &MainWindow::quit_slot));
 
-  efax_controller.stdout_message.connect(sigc::mem_fun(text_window, &MessageText::write_black_slot));
-  efax_controller.write_state.connect(sigc::mem_fun(status_line, &StatusLine::write_status_slot));
-  efax_controller.remove_from_socket_server_filelist.connect(sigc::mem_fun(*this,
+  modem_pool.stdout_message.connect(sigc::mem_fun(text_window, &MessageText::write_black_slot));
+  modem_pool.write_state.connect(sigc::mem_fun(status_line, &StatusLine::write_status_slot));
+  modem_pool.remove_from_socket_server_filelist.connect(sigc::mem_fun(*this,
 			    &MainWindow::remove_from_socket_server_filelist));
 
   // connect up our end of the error pipe
@@ -850,8 +850,8 @@ MainWindow::MainWindow(const std::string& messages,bool start_hidden,
 					   &MainWindow::fax_to_send_notify_slot));
 
   // this connects the SigC object which indicates that a fax has been received
-  // from the modem by the EfaxController object
-  efax_controller.fax_received_notify.connect(sigc::mem_fun(*this,
+  // from a modem by the ModemPool object
+  modem_pool.fax_received_notify.connect(sigc::mem_fun(*this,
 			                      &MainWindow::fax_received_notify_slot));
 
   // start the socket server
@@ -864,10 +864,10 @@ MainWindow::MainWindow(const std::string& messages,bool start_hidden,
 					  &MainWindow::tray_icon_left_clicked_slot));
   tray_item.menu_item_chosen.connect(sigc::mem_fun(*this,
 					  &MainWindow::tray_icon_menu_slot));
-  tray_item.get_state.connect(sigc::mem_fun(efax_controller, &EfaxController::get_state));
-  tray_item.get_new_fax_count.connect(sigc::mem_fun(efax_controller,
-						    &EfaxController::get_count));
-  efax_controller.write_state.connect(sigc::mem_fun(tray_item, &TrayItem::set_tooltip_slot));
+  tray_item.get_state.connect(sigc::mem_fun(modem_pool, &ModemPool::get_state));
+  tray_item.get_new_fax_count.connect(sigc::mem_fun(modem_pool,
+						    &ModemPool::get_count));
+  modem_pool.write_state.connect(sigc::mem_fun(tray_item, &TrayItem::set_tooltip_slot));
 
   present_window_notify.connect(sigc::mem_fun(*this, &MainWindow::present_window_slot));
   start_pipe_thread();
@@ -969,10 +969,10 @@ void MainWindow::close_impl(void) {
   // close down socket server
   socket_server.stop();
   // make sure we close down efax() if it is active
-  // (the EfaxController::ready_to_quit_notify signal is connected to
+  // (the ModemPool::ready_to_quit_notify signal is connected to
   // quit_slot() below and will end the main program loop once any efax
-  // session running has been dealt with)
-  efax_controller.efax_closedown();
+  // sessions running have been dealt with)
+  modem_pool.efax_closedown();
 }
 
 void MainWindow::quit_slot(void) {
@@ -983,9 +983,6 @@ void MainWindow::sendfax_slot(void) {
 
   std::string number_entry(gtk_entry_get_text(GTK_ENTRY(number_entry_p)));
   std::string passp_entry(gtk_entry_get_text(GTK_ENTRY(pass_entry_p)));
-  char pass_str[50];
-  int len;
-  FILE *fp; 
  // eliminate leading or trailing spaces so that we can check for an empty string
   strip(number_entry);  
   if (number_entry.empty()) {
@@ -1011,14 +1008,10 @@ void MainWindow::sendfax_slot(void) {
     }
     return;
   }
-  std::strcpy (pass_str, passp_entry.c_str());
-   len=strlen(pass_str);
-   fp = fopen( "/home/secfax/Desktop/file.txt" , "w" );
-   fwrite(pass_str , 1 , len , fp );
-
-   fclose(fp);
-  // Fax_item is defined in efax_controller.h
+  // Fax_item is defined in efax_controller.h - the password goes with
+  // the fax, as it may wait in ModemPool's queue for a line to be free
   Fax_item fax_item;
+  fax_item.password = passp_entry;
 
   try {
     fax_item.number = Utf8::locale_from_utf8(prog_config.dial_prefix);
@@ -1082,31 +1075,24 @@ void MainWindow::sendfax_slot(void) {
     beep();
   }
   
-  else if (prog_config.lock_file.empty()) { // if there is no lock file, then it means no
-                                            // serial device has been specified (the lock
-                                            // file dir defaults to /var/lock)
+  else if (prog_config.modems.empty()) {
     text_window.write_red_slot("Can't send fax -- no valid serial device specified\n\n");
     beep();
   }
 
   else if (fax_item.file_list.empty()) beep();
 
-  else efax_controller.sendfax(fax_item);
+  else modem_pool.sendfax(fax_item);
 }
 
 void MainWindow::receive_impl(EfaxController::State mode) {
-FILE *fp;
-int len;
-char pass_str[50];
 std::string passp_entry(gtk_entry_get_text(GTK_ENTRY(pass_entry_p)));
   if (!prog_config.found_rcfile) {
     text_window.write_red_slot("Can't receive fax -- no efax-gtkrc configuration file found\n\n");
     beep();
   }
   
-  else if (prog_config.lock_file.empty()) { // if there is no lock file, then it means no
-                                            // serial device has been specified (the lock
-                                            // file dir defaults to /var/lock)
+  else if (prog_config.modems.empty()) {
     text_window.write_red_slot("Can't receive fax -- no valid serial device specified\n\n");
     beep();
   }
@@ -1119,28 +1105,23 @@ std::string passp_entry(gtk_entry_get_text(GTK_ENTRY(pass_entry_p)));
     if (!dialog.exec()) {
       return;
     }return;
-    efax_controller.stop();
-  }
-  std::strcpy (pass_str, passp_entry.c_str());
-   len=strlen(pass_str);
-   fp = fopen( "/home/secfax/Desktop/file.txt" , "w" );
-   fwrite(pass_str , 1 , len , fp );
-   fclose(fp);
-efax_controller.receive(mode);
+    modem_pool.stop();
+  }
+modem_pool.receive(mode, passp_entry);
 }
 }
 
 void MainWindow::get_file_impl(void) {   
-   char command1[100],command2[100];
+   char command1[100];
    //std::string file_loc;
-   const char* file_loc[] = {"/home/secfax/scan.pdf", "02", "03", "04"};
+   // the grey-scale TIFF is sent as it is - EfaxController::make_fax_thread()
+   // converts it to tiffg3 with efix-0.9a, so it needs no conversion to PDF
+   const char* file_loc[] = {"/home/secfax/scan.tiff", "02", "03", "04"};
  std::vector<std::string> file_result(file_loc, file_loc + 4);
    strcpy(command1,"scanimage --mode Gray --format=tiff> /home/secfax/scan.tiff");
    system(command1);
-   strcpy(command2,"tiff2pdf -o /home/secfax/scan.pdf /home/secfax/scan.tiff");
  // FileReadSelectDialog file_dialog(standard_size, false, get_win());
   //file_dialog.exec();
-  system(command2);
  // file_loc="/home/secfax/scan.pdf";
   //std::vector<std::string> file_result = file_dialog.get_result();
    //std::vector<std::string> file_result;
@@ -1166,12 +1147,12 @@ void MainWindow::fax_list_impl(FaxListEnum::Mode mode) {
 
       if (!FaxListDialog::get_is_fax_received_list()) {
 	received_fax_list_p = new FaxListDialog(mode, standard_size);
-	efax_controller.fax_received_notify.connect(sigc::mem_fun(*received_fax_list_p,
+	modem_pool.fax_received_notify.connect(sigc::mem_fun(*received_fax_list_p,
 						       &FaxListDialog::insert_new_fax_slot));
-	received_fax_list_p->get_new_fax_count_sig.connect(sigc::mem_fun(efax_controller,
-						       &EfaxController::get_count));
-	received_fax_list_p->reset_sig.connect(sigc::mem_fun(efax_controller,
-						       &EfaxController::reset_count));
+	received_fax_list_p->get_new_fax_count_sig.connect(sigc::mem_fun(modem_pool,
+						       &ModemPool::get_count));
+	received_fax_list_p->reset_sig.connect(sigc::mem_fun(modem_pool,
+						       &ModemPool::reset_count));
 	// now display the correct number of new received faxes
 	received_fax_list_p->display_new_fax_count();
       }
@@ -1187,7 +1168,7 @@ void MainWindow::fax_list_impl(FaxListEnum::Mode mode) {
 
       if (!FaxListDialog::get_is_fax_sent_list()) {
 	sent_fax_list_p = new FaxListDialog(mode, standard_size);
-	efax_controller.fax_sent_notify.connect(sigc::mem_fun(*sent_fax_list_p,
+	modem_pool.fax_sent_notify.connect(sigc::mem_fun(*sent_fax_list_p,
 						       &FaxListDialog::insert_new_fax_slot));
       }
       else gtk_window_present(sent_fax_list_p->get_win());
@@ -1245,11 +1226,11 @@ void MainWindow::socket_filelist_changed_notify_slot(void) {
    MainWindow::remove_from_socket_server_filelist()
 
    MainWindow::remove_from_socket_server_filelist() is connected to
-   the EfaxController::remove_from_socket_server_filelist signal and
+   the ModemPool::remove_from_socket_server_filelist signal and
    to the SocketListDialog::remove_from_socket_server_filelist signal
 
-   The EfaxController::remove_from_socket_server_filelist signal is
-   emitted by EfaxController::timer_event() when a fax derived from
+   The ModemPool::remove_from_socket_server_filelist signal is
+   emitted by EfaxController::child_exited() when a fax derived from
    the socket list is successfully sent
 
    The SocketListDialog::remove_from_socket_server_filelist signal is
@@ -1284,9 +1265,9 @@ void MainWindow::fax_to_send_dialog(const std::pair<std::string, unsigned int>&
   if (prog_config.sock_popup) {
 
     if (GTK_WIDGET_SENSITIVE(GTK_WIDGET(get_win()))
-	&& (efax_controller.get_state() == EfaxController::inactive
-	    || (efax_controller.get_state() == EfaxController::receive_standby
-		&& !efax_controller.is_receiving_fax()))) {
+	&& (modem_pool.get_state() == EfaxController::inactive
+	    || (modem_pool.get_state() == EfaxController::receive_standby
+		&& !modem_pool.is_receiving_fax()))) {
       notified_fax = fax_pair;
       SocketNotifyDialog* dialog_p = new SocketNotifyDialog(standard_size, fax_pair);
       dialog_p->fax_name_sig.connect(sigc::mem_fun(*this,
@@ -1475,7 +1456,7 @@ void MainWindow::file_list_impl(void) {
 
 void MainWindow::settings_impl(void) {
 
-  if (efax_controller.get_state() != EfaxController::inactive) {
+  if (modem_pool.get_state() != EfaxController::inactive) {
     InfoDialog* dialog_p;
     std::string message(gettext("Can't change settings unless "
 				"the program is inactive\n"
@@ -1507,6 +1488,9 @@ void MainWindow::settings_changed_slot(const std::string& messages) {
       write_error("UTF-8 conversion error in MainWindow::settings_changed_slot()\n");
     }
   }
+  // the serial devices may have changed
+  modem_pool.configure();
+
   if ((!prog_config.sock_server || prog_config.sock_server_port.empty())
       && socket_server.is_server_running()) {
     socket_server.stop();
@@ -1682,7 +1666,7 @@ void MainWindow::tray_icon_menu_slot(int item) {
     receive_impl(EfaxController::receive_standby);
     break;
   case TrayItem::stop:
-    efax_controller.stop();
+    modem_pool.stop();
     break;
   case TrayItem::quit:
     close_impl();
@@ -1762,12 +1746,12 @@ bool MainWindow::draw_fax_from_socket_notifier(void) {
      MainWindow::remove_from_socket_server_filelist()
 
    - MainWindow::remove_from_socket_server_filelist() is connected to
-     the EfaxController::remove_from_socket_server_filelist signal and
+     the ModemPool::remove_from_socket_server_filelist signal and
      to the SocketListDialog::remove_from_socket_server_filelist
      signal
 
-   - the EfaxController::remove_from_socket_server_filelist signal is
-     emitted by EfaxController::timer_event() when a fax derived from
+   - the ModemPool::remove_from_socket_server_filelist signal is
+     emitted by EfaxController::child_exited() when a fax derived from
      the socket list is successfully sent
 
    - the SocketListDialog::remove_from_socket_server_filelist signal is
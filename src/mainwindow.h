@@ -38,6 +38,7 @@ COPYING distributed with the source files.
 
 
 #include "efax_controller.h"
+#include "modem_pool.h"
 #include "fax_list_manager.h"
 #include "fax_list.h"
 #include "socket_server.h"
@@ -155,7 +156,7 @@ class MainWindow: public sigc::trackable, public WinBase {
   std::string max_text;
   MessageText text_window;
   StatusLine status_line;
-  EfaxController efax_controller;
+  ModemPool modem_pool;
   SocketServer socket_server;
 
   std::pair<std::string, unsigned int> notified_fax;
@@ -0,0 +1,373 @@
+/* Copyright (C) 2007 Chris Vine
+
+This program is distributed under the General Public Licence, version 2.
+For particulars of this and relevant disclaimers see the file
+COPYING distributed with the source files.
+
+*/
+
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <algorithm>
+
+#include "modem_pool.h"
+#include "fax_list_manager.h"
+
+#ifdef HAVE_STRINGSTREAM
+#include <sstream>
+#else
+#include <strstream>
+#endif
+
+#ifdef HAVE_STREAM_IMBUE
+#include <locale>
+#endif
+
+#ifdef ENABLE_NLS
+#include <libintl.h>
+#endif
+
+
+ModemPool::ModemPool(void): standby(false),
+			    close_down(false),
+			    reconfigure_pending(false),
+			    fax_count_base(0) {
+  make_controllers();
+}
+
+void ModemPool::make_controllers(void) {
+
+  // keep the count of new faxes received across a change of devices
+  fax_count_base = get_count();
+  controllers.clear();
+
+  bool label_output = prog_config.modems.size() > 1;
+  std::vector<Modem_device>::const_iterator iter;
+  for (iter = prog_config.modems.begin(); iter != prog_config.modems.end(); ++iter) {
+    ControllerPtr controller(new EfaxController(*iter, label_output));
+
+    controller->fax_received_notify.connect(sigc::mem_fun(*this, &ModemPool::fax_received_slot));
+    controller->fax_sent_notify.connect(sigc::mem_fun(*this, &ModemPool::fax_sent_slot));
+    controller->ready_to_quit_notify.connect(sigc::mem_fun(*this, &ModemPool::controller_quit_slot));
+    controller->stdout_message.connect(sigc::mem_fun(*this, &ModemPool::stdout_message_slot));
+    controller->write_state.connect(sigc::mem_fun(*this, &ModemPool::state_changed_slot));
+    controller->remove_from_socket_server_filelist.connect(sigc::mem_fun(*this,
+							      &ModemPool::remove_from_filelist_slot));
+    controllers.push_back(controller);
+  }
+}
+
+void ModemPool::configure(void) {
+  if (is_inactive()) {
+    make_controllers();
+    display_state();
+  }
+  else reconfigure_pending = true;
+}
+
+bool ModemPool::is_inactive(void) const {
+
+  std::vector<ControllerPtr>::const_iterator iter;
+  for (iter = controllers.begin(); iter != controllers.end(); ++iter) {
+    if ((*iter)->get_state() != EfaxController::inactive) return false;
+  }
+  return true;
+}
+
+int ModemPool::get_state(void) const {
+
+  if (standby) return EfaxController::receive_standby;
+
+  std::vector<ControllerPtr>::const_iterator iter;
+  for (iter = controllers.begin(); iter != controllers.end(); ++iter) {
+    if ((*iter)->get_state() != EfaxController::inactive) return (*iter)->get_state();
+  }
+  return EfaxController::inactive;
+}
+
+bool ModemPool::is_receiving_fax(void) const {
+
+  // if in standby mode a line is receiving a fax, a fax to be sent
+  // can still go out on another line which is inactive or standing by
+  bool receiving = false;
+  std::vector<ControllerPtr>::const_iterator iter;
+  for (iter = controllers.begin(); iter != controllers.end(); ++iter) {
+    if ((*iter)->get_state() == EfaxController::inactive) return false;
+    if ((*iter)->get_state() == EfaxController::receive_standby) {
+      if ((*iter)->is_receiving_fax()) receiving = true;
+      else return false;
+    }
+  }
+  return receiving;
+}
+
+int ModemPool::get_count(void) {
+
+  int count = fax_count_base;
+  std::vector<ControllerPtr>::const_iterator iter;
+  for (iter = controllers.begin(); iter != controllers.end(); ++iter) {
+    count += (*iter)->get_count();
+  }
+  return count;
+}
+
+void ModemPool::reset_count(void) {
+
+  fax_count_base = 0;
+  std::vector<ControllerPtr>::const_iterator iter;
+  for (iter = controllers.begin(); iter != controllers.end(); ++iter) {
+    (*iter)->reset_count();
+  }
+  display_state();
+}
+
+void ModemPool::display_state(void) {
+
+  if (controllers.empty()) {
+    write_state(gettext("Inactive"));
+    return;
+  }
+  if (controllers.size() == 1 && send_queue.empty()) {
+    write_state(controllers.front()->get_state_message());
+    return;
+  }
+
+  // show the state of each line, and the number of faxes waiting for one
+#ifdef HAVE_STRINGSTREAM
+  std::ostringstream strm;
+#  ifdef HAVE_STREAM_IMBUE
+  strm.imbue(std::locale::classic());
+#  endif // HAVE_STREAM_IMBUE
+#else
+  std::ostrstream strm;
+#  ifdef HAVE_STREAM_IMBUE
+  strm.imbue(std::locale::classic());
+#  endif // HAVE_STREAM_IMBUE
+#endif
+
+  std::vector<ControllerPtr>::const_iterator iter;
+  for (iter = controllers.begin(); iter != controllers.end(); ++iter) {
+    if (iter != controllers.begin()) strm << "; ";
+    if (controllers.size() > 1) strm << (*iter)->get_modem().name << ": ";
+    strm << (*iter)->get_state_message();
+  }
+  if (!send_queue.empty()) {
+    strm << " (" << gettext("faxes queued:") << ' ' << send_queue.size() << ')';
+  }
+
+#ifdef HAVE_STRINGSTREAM
+  write_state(strm.str().c_str());
+#else
+  strm << std::ends;
+  const char* text = strm.str();
+  write_state(text);
+  delete[] text;
+#endif
+}
+
+bool ModemPool::is_file_in_use(const Fax_item& fax_item) const {
+
+  // the fax pages for a file are made next to it as [filename].001 etc,
+  // so the same file cannot be sent on two lines at the same time
+  std::vector<ControllerPtr>::const_iterator iter;
+  for (iter = controllers.begin(); iter != controllers.end(); ++iter) {
+    int state = (*iter)->get_state();
+    if (state == EfaxController::sending
+	|| state == EfaxController::start_send_on_standby
+	|| state == EfaxController::send_on_standby) {
+
+      const std::vector<std::string>& in_use = (*iter)->get_fax_item().file_list;
+      std::vector<std::string>::const_iterator file_iter;
+      for (file_iter = fax_item.file_list.begin();
+	   file_iter != fax_item.file_list.end(); ++file_iter) {
+	if (std::find(in_use.begin(), in_use.end(), *file_iter) != in_use.end()) return true;
+      }
+    }
+  }
+  return false;
+}
+
+int ModemPool::free_standby_count(void) const {
+
+  int count = 0;
+  std::vector<ControllerPtr>::const_iterator iter;
+  for (iter = controllers.begin(); iter != controllers.end(); ++iter) {
+    if ((*iter)->get_state() == EfaxController::receive_standby
+	&& !(*iter)->is_receiving_fax()) {
+      ++count;
+    }
+  }
+  return count;
+}
+
+void ModemPool::dispatch(void) {
+
+  // this must not be called from a slot connected to a signal of an
+  // EfaxController object, as the object may be part way through a
+  // change of state - it is called from timer_event(), and from the
+  // methods called by MainWindow
+
+  if (close_down) return;
+
+  // a line standing by can only take a fax if this number of other
+  // lines will still be standing by
+  int reserve = prog_config.standby_lines;
+  if (reserve > static_cast<int>(controllers.size()) - 1) reserve = controllers.size() - 1;
+
+  std::list<Fax_item>::iterator item_iter = send_queue.begin();
+  while (item_iter != send_queue.end()) {
+
+    if (is_file_in_use(*item_iter)) {
+      ++item_iter;
+      continue;
+    }
+
+    EfaxController* controller_p = 0;
+    std::vector<ControllerPtr>::const_iterator iter;
+    for (iter = controllers.begin(); !controller_p && iter != controllers.end(); ++iter) {
+      if ((*iter)->get_state() == EfaxController::inactive) controller_p = iter->get();
+    }
+    if (!controller_p && standby && free_standby_count() > reserve) {
+      for (iter = controllers.begin(); !controller_p && iter != controllers.end(); ++iter) {
+	if ((*iter)->get_state() == EfaxController::receive_standby
+	    && !(*iter)->is_receiving_fax()) {
+	  controller_p = iter->get();
+	}
+      }
+    }
+    if (!controller_p) break;
+
+    // EfaxController::sendfax() will go through the start_send_on_standby
+    // state if the line is standing by
+    controller_p->sendfax(*item_iter);
+    item_iter = send_queue.erase(item_iter);
+  }
+}
+
+void ModemPool::sendfax(const Fax_item& fax_item) {
+
+  send_queue.push_back(fax_item);
+  dispatch();
+  if (!send_queue.empty()) {
+    stdout_message(gettext("\n*** All lines are busy - the fax will be sent "
+			   "when a line is free ***\n\n"));
+  }
+  display_state();
+}
+
+void ModemPool::receive(EfaxController::State mode, const std::string& password) {
+
+  EfaxController* controller_p = 0;
+  std::vector<ControllerPtr>::const_iterator iter;
+  for (iter = controllers.begin(); !controller_p && iter != controllers.end(); ++iter) {
+    if ((*iter)->get_state() == EfaxController::inactive) controller_p = iter->get();
+  }
+
+  if (!controller_p || standby) beep();
+  else if (mode == EfaxController::receive_standby) {
+    standby = true;
+    standby_password = password;
+    // send any faxes waiting for a line, and then stand by on the others
+    dispatch();
+    for (iter = controllers.begin(); iter != controllers.end(); ++iter) {
+      if ((*iter)->get_state() == EfaxController::inactive) {
+	(*iter)->receive(EfaxController::receive_standby, standby_password);
+      }
+    }
+    display_state();
+  }
+  else controller_p->receive(mode, password);
+}
+
+void ModemPool::stop(void) {
+
+  bool active = standby;
+  standby = false;
+
+  if (!send_queue.empty()) {
+    stdout_message(gettext("\n*** Faxes waiting to be sent have been discarded ***\n\n"));
+    send_queue.clear();
+    active = true;
+  }
+
+  std::vector<ControllerPtr>::const_iterator iter;
+  for (iter = controllers.begin(); iter != controllers.end(); ++iter) {
+    if ((*iter)->get_state() != EfaxController::inactive) {
+      (*iter)->stop();
+      active = true;
+    }
+  }
+  if (!active) beep();
+  display_state();
+}
+
+void ModemPool::efax_closedown(void) {
+
+  standby = false;
+  send_queue.clear();
+
+  if (is_inactive()) ready_to_quit_notify();
+  else if (!close_down) {
+    close_down = true;
+    std::vector<ControllerPtr>::const_iterator iter;
+    for (iter = controllers.begin(); iter != controllers.end(); ++iter) {
+      if ((*iter)->get_state() != EfaxController::inactive) (*iter)->efax_closedown();
+    }
+  }
+}
+
+void ModemPool::controller_quit_slot(void) {
+  // each EfaxController object told to close down emits ready_to_quit_notify
+  // when its efax process has ended - we are ready when all have done so
+  if (close_down && is_inactive()) ready_to_quit_notify();
+}
+
+void ModemPool::timer_event(void) {
+
+  // if a fax list is in the process of being constructed, we need to wait until
+  // construction has completed before reaping efax exit status and acting on it
+  // (we might have reached here through the call to gtk_main_iteration() in
+  // FaxListManager::populate_fax_list())
+  if (FaxListManager::is_fax_received_list_main_iteration()
+      || FaxListManager::is_fax_sent_list_main_iteration()) {
+    return;
+  }
+
+  // preconditions are OK - proceed
+
+  int stat_val;
+  pid_t result;
+
+  // reap the status of any exited child processes, and pass the exit status
+  // of an efax process to the EfaxController object which started it
+  while ((result = waitpid(-1, &stat_val, WNOHANG)) > 0) {
+    std::vector<ControllerPtr>::const_iterator iter;
+    for (iter = controllers.begin(); iter != controllers.end(); ++iter) {
+      if ((*iter)->get_child_pid() == result) {
+	int old_state = (*iter)->get_state();
+	(*iter)->child_exited(stat_val);
+
+	// in standby mode a line which has finished sending a fax goes
+	// back to waiting for calls (a line which was standing by before
+	// it sent the fax does this by itself, and a line which has
+	// stopped standing by because of an error is left inactive)
+	if (standby && !close_down
+	    && old_state == EfaxController::sending
+	    && (*iter)->get_state() == EfaxController::inactive) {
+	  (*iter)->receive(EfaxController::receive_standby, standby_password);
+	}
+	break;
+      }
+    }
+  }
+
+  if (reconfigure_pending && is_inactive()) {
+    reconfigure_pending = false;
+    make_controllers();
+    display_state();
+  }
+
+  // lines may have become free
+  dispatch();
+}
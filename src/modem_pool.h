@@ -0,0 +1,108 @@
+/* Copyright (C) 2007 Chris Vine
+
+This program is distributed under the General Public Licence, version 2.
+For particulars of this and relevant disclaimers see the file
+COPYING distributed with the source files.
+
+*/
+
+#ifndef MODEM_POOL_H
+#define MODEM_POOL_H
+
+#include "prog_defs.h"
+
+#include <string>
+#include <vector>
+#include <list>
+#include <utility>
+
+#include <sigc++/sigc++.h>
+
+#include "efax_controller.h"
+#include "utils/shared_ptr.h"
+
+// ModemPool runs an EfaxController object for each serial device
+// named on the DEVICE: line of efax-gtkrc, so that an office with
+// more than one fax line can send and receive on all of them at
+// once.  It presents to MainWindow the same interface that a single
+// EfaxController would.  Faxes to be sent are queued and passed to
+// the first line which is free; in standby mode every line which is
+// not sending waits for calls, and a queued fax will only be sent on
+// a line which is standing by if Prog_config::standby_lines others are
+// left standing by (or all the others, if there are fewer lines than
+// that).  With one serial device ModemPool behaves exactly as the
+// single EfaxController object used to.
+//
+// The efax processes are all children of efax-gtk, so ModemPool (and
+// not the EfaxController objects) reaps their exit status in
+// timer_event(), and passes it on to the EfaxController object
+// concerned.
+
+class ModemPool: public sigc::trackable {
+
+  typedef SharedPtr<EfaxController> ControllerPtr;
+
+  std::vector<ControllerPtr> controllers;
+  std::list<Fax_item> send_queue;
+  std::string standby_password;
+  bool standby;
+  bool close_down;
+  bool reconfigure_pending;
+  int fax_count_base;
+
+  void make_controllers(void);
+  void dispatch(void);
+  bool is_inactive(void) const;
+  bool is_file_in_use(const Fax_item&) const;
+  int free_standby_count(void) const;
+  void state_changed_slot(const char*) {display_state();}
+  void fax_received_slot(const std::pair<std::string, std::string>& info) {fax_received_notify(info);}
+  void fax_sent_slot(const std::pair<std::string, std::string>& info) {fax_sent_notify(info);}
+  void stdout_message_slot(const char* text) {stdout_message(text);}
+  void remove_from_filelist_slot(const std::string& name) {remove_from_socket_server_filelist(name);}
+  void controller_quit_slot(void);
+
+  // we don't want to permit copies of this class
+  ModemPool(const ModemPool&);
+  void operator=(const ModemPool&);
+
+public:
+  sigc::signal1<void, const std::pair<std::string, std::string>&> fax_received_notify;
+  sigc::signal1<void, const std::pair<std::string, std::string>&> fax_sent_notify;
+  sigc::signal0<void> ready_to_quit_notify;
+  sigc::signal1<void, const char*> stdout_message;
+  sigc::signal1<void, const char*> write_state;
+  sigc::signal1<void, const std::string&> remove_from_socket_server_filelist;
+
+  void timer_event(void);
+  void display_state(void);
+
+  // get_state() returns EfaxController::inactive if all lines are
+  // inactive, EfaxController::receive_standby if in standby mode, and
+  // otherwise the state of the first line which is active
+  int get_state(void) const;
+
+  // is_receiving_fax() returns true if no line is free to take a fax
+  // for sending because all lines which could are receiving faxes
+  bool is_receiving_fax(void) const;
+
+  int get_count(void);
+  void reset_count(void);
+
+  void stop(void);
+
+  void efax_closedown(void);
+  void sendfax(const Fax_item&);
+  // password is the one with which faxes received are decrypted - in
+  // standby mode it is kept for lines which go back to standing by
+  void receive(EfaxController::State, const std::string& password);
+
+  // configure() should be called when efax-gtkrc has been reread -
+  // the EfaxController objects are remade for the new list of serial
+  // devices when all lines are next inactive
+  void configure(void);
+
+  ModemPool(void);
+};
+
+#endif
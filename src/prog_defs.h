@@ -149,13 +149,14 @@ using namespace std;    // until I get a Std C++ compliant compiler to test with
    read outside the main (GUI) thread as follows -
 
      - Prog_config::resolution is read by EfaxController::get_gs_parms()
-       (in efax_controller.cpp)
+       and EfaxController::get_efix_parms() (in efax_controller.cpp)
 
      - Prog_config::page_size is read by EfaxController::get_gs_parms()
        (in efax_controller.cpp) and by FaxListDialog::get_fax_to_ps_parms() (in
        fax_list.cpp)
 
-     - Prog_config::page_dim is read by FaxListDialog::get_fax_to_ps_parms() (in
+     - Prog_config::page_dim is read by EfaxController::get_efix_parms() (in
+       efax_controller.cpp) and by FaxListDialog::get_fax_to_ps_parms() (in
        fax_list.cpp)
 
      - Prog_config::print_shrink is read by FaxListDialog::get_fax_to_ps_parms()
@@ -203,13 +204,26 @@ using namespace std;    // until I get a Std C++ compliant compiler to test with
    fork()s will receive SIGCHLD.  Thus SIGCHLD cannot be received in a
    special signal handling thread.  Instead, a timer event handler is
    provided in MainWindow::timer_event() (which also calls
-   EfaxController::timer_event()) which deals with interrupts and
+   ModemPool::timer_event()) which deals with interrupts and
    child exit handling.
 
 *********************************************************************/
 
-struct Prog_config {
+// one of these is held in Prog_config::modems for each serial device
+// named on the DEVICE: line of efax-gtkrc.  name is the device as
+// given there (UTF-8), device_path the full path passed to efax with
+// -d, and receive_dir the sub-directory of faxin in which efax puts
+// the pages of a fax being received on the device
+struct Modem_device {
+  std::string name;
+  std::string device_path;
   std::string lock_file;
+  std::string receive_dir;
+};
+
+struct Prog_config {
+  std::vector<Modem_device> modems;
+  int standby_lines;  // number of modems kept free for receiving in standby mode
   std::string fixed_font;
   std::string homedir;
   std::string working_dir;
@@ -239,7 +253,6 @@ struct Prog_config {
   std::string fax_received_prog;
   std::vector<std::string> parms;
   std::vector<std::string> permitted_clients_list;
-  pid_t efax_controller_child_pid;
   GobjHandle<GdkPixbuf> window_icon_h;
   Thread::Mutex* mutex_p;
 };
@@ -59,7 +59,10 @@ ModemMessages::ModemMessages(void): SettingsMessagesBase(rings + 1) {
 			     "here (if none is given, the program defaults to "
 			     "/dev/modem).  Do not include the `/dev/' part of "
 			     "the device name -- ie state it as `ttyS1' or `cua2', etc.  "
-			     "With Linux, ttyS0 equates to COM 1, ttyS1 to COM 2, and so on");
+			     "With Linux, ttyS0 equates to COM 1, ttyS1 to COM 2, and so on.  "
+			     "If more than one modem is connected, name all of their devices "
+			     "separated by spaces, and faxes will be sent and received on all "
+			     "of them at once");
   captions[device] = gettext("efax-gtk help: Device");
 
   messages[lock] = gettext("Put the lock file directory here.  If none is specified, the program "